@@ -18,7 +18,14 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace core
 {
@@ -28,6 +35,51 @@ Traits for serialization and deserialization of cache custom types.
 To use custom types, specialize this template
 for each custom type (other than string) in the `core` namespace.
 
+Instead of specializing `encode()` and `decode()`, you can specialize the entire
+struct and provide `encode_to()` and `decode_from()`:
+
+\code{.cpp}
+namespace core
+{
+
+template <>
+struct CacheCodec<Person>
+{
+    // Appends the encoded value to buf.
+    static void encode_to(Person const& value, std::string& buf);
+
+    // Decodes a value from size bytes at data.
+    static Person decode_from(char const* data, std::size_t size);
+};
+
+}  // namespace core
+\endcode
+
+PersistentCache detects these methods at compile time and uses them instead of
+`encode()` and `decode()`. `encode_to()` is passed a buffer that the cache reuses across
+calls, and `decode_from()` is passed the data as it is stored in the cache, so
+neither direction needs a temporary string. A specialization must provide both
+methods; otherwise, the cache uses `encode()` and `decode()`.
+
+The library provides built-in codecs for integral types, enumerations, floating-point types,
+and other trivially copyable types without padding bytes (such as a struct of integers), except for
+pointers and arrays. Built-in codecs are the default definitions of `encode()` and `decode()`,
+so a type with a built-in codec needs no specialization. Integral and enumeration values are encoded as
+big-endian binary with the sign bit inverted, so their encodings sort in the same order as the values
+themselves. Other types are encoded as a copy of their bytes, so the encoding is not portable across
+platforms with different byte order. Decoding an empty string yields a value-initialized `T`;
+decoding a string of any other size than `sizeof(T)` throws `std::invalid_argument`.
+
+A specialization of `encode()` and `decode()` (or of the entire struct) for a type takes priority
+over the built-in codec, so caches that were written with your own codec for a type such as `int`
+or `double` continue to work unchanged. The specialization must be declared before the first use of
+the codec, as usual for explicit specializations.
+
+Types with padding bytes (and structs with floating-point members, whose encoding the library
+cannot verify to be free of padding) have no built-in codec: the values of padding bytes are
+unspecified, so equal values could be encoded differently. Specialize `encode()` and `decode()`
+for such types.
+
 \warning Do _not_ specialize this struct for `std::string`!
 Doing so has no effect.
 
@@ -47,4 +99,348 @@ struct CacheCodec
     static T decode(std::string const& s);
 };
 
+// @cond
+
+namespace internal
+{
+
+// Selects the built-in codec, if any, for a type. Only types whose bytes are all part of the value
+// are copied byte for byte, so equal values have equal encodings. Without the compiler builtin that
+// tells us whether a type has padding, only floating-point types are copied byte for byte.
+
+template <typename T>
+struct HasOrderedCodec : std::integral_constant<bool, std::is_integral<T>::value || std::is_enum<T>::value>
+{
+};
+
+#if (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 7) || (defined(__clang__) && __clang_major__ >= 6)
+#define CORE_CACHE_HAS_UNIQUE_OBJECT_REPRESENTATIONS(T) __has_unique_object_representations(T)
+#else
+#define CORE_CACHE_HAS_UNIQUE_OBJECT_REPRESENTATIONS(T) false
+#endif
+
+template <typename T>
+struct HasRawCodec
+    : std::integral_constant<bool,
+                             std::is_trivially_copyable<T>::value && std::is_default_constructible<T>::value &&
+                                 !HasOrderedCodec<T>::value && !std::is_pointer<T>::value &&
+                                 !std::is_member_pointer<T>::value && !std::is_array<T>::value &&
+                                 (std::is_floating_point<T>::value ||
+                                  CORE_CACHE_HAS_UNIQUE_OBJECT_REPRESENTATIONS(T))>
+{
+};
+
+#undef CORE_CACHE_HAS_UNIQUE_OBJECT_REPRESENTATIONS
+
+// The integer type through which an integral or enumeration value is encoded.
+
+template <typename T, typename = void>
+struct IntegerOf
+{
+    typedef T type;
+};
+
+template <typename T>
+struct IntegerOf<T, typename std::enable_if<std::is_enum<T>::value>::type>
+{
+    typedef typename std::underlying_type<T>::type type;
+};
+
+template <>
+struct IntegerOf<bool>
+{
+    typedef unsigned char type;
+};
+
+// Returns true if size is zero, meaning that the decoded value is value-initialized.
+// Throws if size is neither zero nor the size of the value.
+
+inline bool check_decode_size(std::size_t size, std::size_t expected)
+{
+    if (size != 0 && size != expected)
+    {
+        throw std::invalid_argument("CacheCodec: cannot decode " + std::to_string(size) +
+                                    " bytes into a value of size " + std::to_string(expected));
+    }
+    return size == 0;
+}
+
+// Built-in codecs, which provide the default definitions of CacheCodec<T>::encode() and decode().
+// For types without a built-in codec, the functions are declared only, so a missing
+// specialization of CacheCodec is reported by the linker, as it always was.
+
+template <typename T, typename = void>
+struct BuiltinCodec
+{
+    static std::string encode(T const& value);
+    static T decode(std::string const& s);
+};
+
+// Built-in codec for integral and enumeration types. The sign bit is inverted and the value is
+// written in big-endian order, so encoded values sort in the same order as the numbers they represent.
+
+template <typename T>
+struct BuiltinCodec<T, typename std::enable_if<HasOrderedCodec<T>::value>::type>
+{
+    static std::string encode(T const& value)
+    {
+        typedef typename IntegerOf<T>::type I;
+        typedef typename std::make_unsigned<I>::type U;
+
+        U u = static_cast<U>(static_cast<I>(value) ^ sign_bit<I>());
+        char bytes[sizeof(U)];
+        for (std::size_t i = sizeof(U); i-- > 0;)
+        {
+            bytes[i] = static_cast<char>(u & 0xff);
+            u = static_cast<U>(u >> 8);
+        }
+        return std::string(bytes, sizeof(U));
+    }
+
+    static T decode(std::string const& s)
+    {
+        typedef typename IntegerOf<T>::type I;
+        typedef typename std::make_unsigned<I>::type U;
+
+        if (check_decode_size(s.size(), sizeof(U)))
+        {
+            return T();
+        }
+        U u = 0;
+        for (std::size_t i = 0; i < sizeof(U); ++i)
+        {
+            u = static_cast<U>((u << 8) | static_cast<unsigned char>(s[i]));
+        }
+        return static_cast<T>(static_cast<I>(u) ^ sign_bit<I>());
+    }
+
+private:
+    template <typename I>
+    static I sign_bit()
+    {
+        return std::is_signed<I>::value ? std::numeric_limits<I>::min() : I(0);
+    }
+};
+
+// Built-in codec for other trivially copyable types. The value is copied byte for byte.
+
+template <typename T>
+struct BuiltinCodec<T, typename std::enable_if<HasRawCodec<T>::value>::type>
+{
+    static std::string encode(T const& value)
+    {
+        return std::string(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    static T decode(std::string const& s)
+    {
+        T value = T();
+        if (!check_decode_size(s.size(), sizeof(T)))
+        {
+            std::memcpy(&value, s.data(), sizeof(T));
+        }
+        return value;
+    }
+};
+
+}  // namespace internal
+
+template <typename T>
+std::string CacheCodec<T>::encode(T const& value)
+{
+    return internal::BuiltinCodec<T>::encode(value);
+}
+
+template <typename T>
+T CacheCodec<T>::decode(std::string const& s)
+{
+    return internal::BuiltinCodec<T>::decode(s);
+}
+
+namespace internal
+{
+
+// Detects whether CacheCodec<T> provides encode_to() and decode_from().
+
+template <typename T>
+struct BufferCodecCheck
+{
+    template <typename C>
+    static auto check(int) -> decltype(C::encode_to(std::declval<T const&>(), std::declval<std::string&>()),
+                                       std::is_convertible<decltype(C::decode_from(std::declval<char const*>(),
+                                                                                   std::size_t())),
+                                                           T>());
+    template <typename C>
+    static std::false_type check(...);
+
+    typedef decltype(check<CacheCodec<T>>(0)) type;
+};
+
+template <typename T>
+struct HasBufferCodec : BufferCodecCheck<T>::type
+{
+};
+
+// Adapter that provides both the string-based and the buffer-based interface for any codec.
+// The cache calls CacheCodec<T> only through this adapter.
+
+template <typename T, bool = HasBufferCodec<T>::value>
+struct Codec
+{
+    static std::string encode(T const& value)
+    {
+        return CacheCodec<T>::encode(value);
+    }
+
+    static void encode_to(T const& value, std::string& buf)
+    {
+        if (buf.empty())
+        {
+            buf = CacheCodec<T>::encode(value);  // Move instead of copy.
+        }
+        else
+        {
+            buf += CacheCodec<T>::encode(value);
+        }
+    }
+
+    static T decode(std::string const& s)
+    {
+        return CacheCodec<T>::decode(s);
+    }
+
+    static T decode_from(char const* data, std::size_t size)
+    {
+        return CacheCodec<T>::decode(std::string(data, size));
+    }
+};
+
+template <typename T>
+struct Codec<T, true>
+{
+    static std::string encode(T const& value)
+    {
+        std::string s;
+        CacheCodec<T>::encode_to(value, s);
+        return s;
+    }
+
+    static void encode_to(T const& value, std::string& buf)
+    {
+        CacheCodec<T>::encode_to(value, buf);
+    }
+
+    static T decode(std::string const& s)
+    {
+        return CacheCodec<T>::decode_from(s.data(), s.size());
+    }
+
+    static T decode_from(char const* data, std::size_t size)
+    {
+        return CacheCodec<T>::decode_from(data, size);
+    }
+};
+
+// Strings are passed through unchanged.
+
+template <>
+struct Codec<std::string, false>
+{
+    static std::string encode(std::string const& value)
+    {
+        return value;
+    }
+
+    static void encode_to(std::string const& value, std::string& buf)
+    {
+        buf += value;
+    }
+
+    static std::string decode(std::string const& s)
+    {
+        return s;
+    }
+
+    static std::string decode_from(char const* data, std::size_t size)
+    {
+        return std::string(data, size);
+    }
+};
+
+// Encodes a value into a string buffer that is taken from a per-thread pool and returned to
+// the pool by the destructor, so the buffer's memory is reused by later calls on the same thread.
+// Because each instance has its own buffer, nested calls (such as from an event handler) are safe.
+
+template <typename T>
+class Encoded
+{
+public:
+    explicit Encoded(T const& value)
+        : buf_(acquire())
+    {
+        Codec<T>::encode_to(value, buf_);
+    }
+
+    ~Encoded()
+    {
+        release(buf_);
+    }
+
+    Encoded(Encoded const&) = delete;
+    Encoded& operator=(Encoded const&) = delete;
+
+    std::string const& str() const noexcept
+    {
+        return buf_;
+    }
+
+private:
+    static std::size_t const max_pool_size = 8;
+
+    static std::vector<std::string>& pool()
+    {
+        static thread_local std::vector<std::string> buffers;
+        return buffers;
+    }
+
+    static std::string acquire()
+    {
+        auto& buffers = pool();
+        if (buffers.empty())
+        {
+            return std::string();
+        }
+        std::string buf = std::move(buffers.back());
+        buffers.pop_back();
+        return buf;
+    }
+
+    static void release(std::string& buf) noexcept
+    {
+        auto& buffers = pool();
+        if (buffers.capacity() == 0)
+        {
+            try
+            {
+                buffers.reserve(max_pool_size);
+            }
+            catch (...)
+            {
+                return;  // LCOV_EXCL_LINE
+            }
+        }
+        if (buffers.size() < max_pool_size)
+        {
+            buf.clear();
+            buffers.push_back(std::move(buf));  // Can't throw because we reserved enough space.
+        }
+    }
+
+    std::string buf_;
+};
+
+}  // namespace internal
+
+// @endcond
+
 }  // namespace core
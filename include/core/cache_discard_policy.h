@@ -31,11 +31,31 @@ in least-recently-used order until enough space is available.
 
 If the discard policy is set to `lru_only`, entries do not maintain an expiry time and
 are therefore discarded strictly in LRU order.
+
+With `segmented_lru`, entries do not maintain an expiry time either. The cache is divided
+into a probation segment and a protected segment. New entries start out in probation,
+and an entry moves to the protected segment when it is accessed again. Once the protected
+segment exceeds its share of the cache (see `PersistentCacheOptions::protected_fraction`),
+its least recently used entries move back to probation. Entries are discarded in LRU order
+from probation first, and from the protected segment only if probation is empty. This means
+that a burst of entries that are accessed only once, such as a scan over many keys, does not
+displace entries that are accessed repeatedly.
+
+With `gdsf` (GreedyDual-Size-Frequency), entries do not maintain an expiry time either. Each entry
+has a priority of `clock + cost * frequency / size`, where `cost` is the miss cost passed to
+`PersistentStringCache::put()` (1 by default), `frequency` is the number of times the entry
+was added or accessed, and `size` is the size of the entry in bytes. Entries are discarded in order
+of lowest priority first, and each eviction advances the clock to the priority of the evicted entry,
+so entries that are not accessed for a while age out of the cache. This favors small entries that are
+expensive to re-create over large entries that are cheap to re-create, which improves the byte hit
+ratio and lowers the total miss cost.
 */
 enum class CacheDiscardPolicy
 {
-    lru_ttl,  ///< Evict expired entries first, followed by eviction in LRU order
-    lru_only  ///< Evict in LRU order
+    lru_ttl,        ///< Evict expired entries first, followed by eviction in LRU order
+    lru_only,       ///< Evict in LRU order
+    segmented_lru,  ///< Evict in LRU order, entries that were accessed only once first
+    gdsf            ///< Evict in order of lowest cost and frequency per byte
 };
 
 }  // namespace core
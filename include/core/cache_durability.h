@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+namespace core
+{
+
+/**
+\brief Indicates when the writes to a cache are flushed to disk.
+
+With `none`, writes are handed to the operating system, but the cache never waits for them to reach
+the disk. This is the fastest mode. If the process crashes, no data is lost, but if the
+operating system crashes or the machine loses power, the most recent writes may be lost.
+
+With `periodic`, a background thread flushes all writes to disk at a fixed interval
+(see `PersistentCacheOptions::sync_interval`). A machine crash loses at most the writes
+of the most recent interval.
+
+With `sync`, an operation that modifies the cache, such as `put()`, returns only once
+its writes are on disk. Threads that modify the cache concurrently share a single flush
+(group commit), so the cost of a flush is spread over all the writes it covers. Access time
+updates by reads are not flushed.
+*/
+enum class CacheDurability
+{
+    none,      ///< Do not flush writes to disk
+    periodic,  ///< Flush writes to disk at a fixed interval
+    sync       ///< Flush the writes of each modifying operation to disk before it returns
+};
+
+}  // namespace core
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <core/internal/cache_event_indexes.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace core
+{
+
+namespace internal
+{
+
+// Bounded queue of events for asynchronous delivery to the event handlers.
+//
+// The queue is a ring buffer for a single producer and a single consumer. The producer is whichever
+// thread holds the cache lock, so successive pushes are ordered by that lock. The consumer is the
+// dispatch thread. Neither push() nor pop_all() takes a lock, except that push() locks mutex_
+// to wake up the consumer if the consumer is waiting for events.
+
+class EventQueue
+{
+public:
+    struct Event
+    {
+        std::string key;
+        CacheEventIndex index;
+    };
+
+    // The capacity is rounded up to the next power of two.
+    explicit EventQueue(int64_t capacity);
+
+    EventQueue(EventQueue const&) = delete;
+    EventQueue& operator=(EventQueue const&) = delete;
+
+    // Appends an event. Returns false if the queue is full, in which case the event is dropped.
+    bool push(std::string const& key, CacheEventIndex index);
+
+    // Moves all queued events to the end of events and returns the number of events moved.
+    int64_t pop_all(std::vector<Event>& events);
+
+    // Waits until the queue is non-empty or shutdown() was called. Returns false after shutdown()
+    // once the queue is empty.
+    bool wait();
+
+    void shutdown();
+
+private:
+    std::vector<Event> slots_;
+    uint64_t const mask_;
+    std::atomic<uint64_t> head_;  // Next slot to write. Written by the producer only.
+    std::atomic<uint64_t> tail_;  // Next slot to read. Written by the consumer only.
+
+    std::atomic<bool> waiting_;  // True while the consumer is (about to be) blocked in wait().
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool done_;  // Protected by mutex_.
+};
+
+}  // namespace internal
+
+}  // namespace core
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace core
+{
+
+namespace internal
+{
+
+// Count-min sketch that estimates how often each key was accessed recently, for the admission filter.
+//
+// Each key maps to one counter in each of DEPTH rows, and the estimate for a key is the smallest
+// of its counters. Counters saturate at MAX_COUNT. Once the number of increments reaches ten times
+// the width of a row, all counters are halved, so the estimates reflect recent accesses rather than
+// all accesses since the cache was created.
+
+class FrequencySketch
+{
+public:
+    static constexpr unsigned DEPTH = 4;
+    static constexpr unsigned MAX_COUNT = 15;
+
+    // The width is rounded up to the next power of two.
+    explicit FrequencySketch(int64_t width);
+
+    FrequencySketch(FrequencySketch const&) = delete;
+    FrequencySketch& operator=(FrequencySketch const&) = delete;
+
+    void increment(std::string const& key) noexcept;
+    unsigned estimate(std::string const& key) const noexcept;
+
+    int64_t width() const noexcept;
+
+    // The serialized form is the width and the number of increments since the counters
+    // were last halved, followed by the counters.
+    std::string serialize() const;
+
+    // Returns false, leaving the sketch unchanged, if s was written by a sketch with a different width.
+    bool deserialize(std::string const& s) noexcept;
+
+private:
+    void age() noexcept;
+
+    std::vector<uint8_t> counters_;  // DEPTH rows of width counters each.
+    uint64_t const mask_;
+    int64_t additions_;
+    int64_t const sample_size_;
+};
+
+}  // namespace internal
+
+}  // namespace core
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace core
+{
+
+namespace internal
+{
+
+// Fixed-width binary encoding for 64-bit integers. Values are written as
+// eight bytes in big-endian order, with the sign bit inverted. That way,
+// encoded values collate lexicographically in the same order as the
+// numbers they represent, which is what we need for the secondary indexes.
+
+static constexpr unsigned INT64_ENCODED_SIZE = 8;
+
+inline void append_int64(std::string& s, int64_t value)
+{
+    uint64_t u = static_cast<uint64_t>(value) ^ (uint64_t(1) << 63);
+    char buf[INT64_ENCODED_SIZE];
+    for (int i = INT64_ENCODED_SIZE - 1; i >= 0; --i)
+    {
+        buf[i] = static_cast<char>(u & 0xff);
+        u >>= 8;
+    }
+    s.append(buf, INT64_ENCODED_SIZE);
+}
+
+inline std::string encode_int64(int64_t value)
+{
+    std::string s;
+    s.reserve(INT64_ENCODED_SIZE);
+    append_int64(s, value);
+    return s;
+}
+
+// Pre: p points at (at least) INT64_ENCODED_SIZE bytes.
+
+inline int64_t decode_int64(char const* p) noexcept
+{
+    uint64_t u = 0;
+    for (unsigned i = 0; i < INT64_ENCODED_SIZE; ++i)
+    {
+        u = (u << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return static_cast<int64_t>(u ^ (uint64_t(1) << 63));
+}
+
+}  // namespace internal
+
+}  // namespace core
@@ -19,12 +19,20 @@
 #pragma once
 
 #include <core/internal/cache_event_indexes.h>
+#include <core/internal/event_queue.h>
+#include <core/internal/frequency_sketch.h>
+#include <core/persistent_cache_options.h>
 #include <core/persistent_string_cache.h>
 
 #include <leveldb/db.h>
 
+#include <condition_variable>
+#include <future>
+#include <list>
 #include <mutex>
-#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace core
 {
@@ -37,10 +45,24 @@ class PersistentStringCacheStats;
 class PersistentStringCacheImpl
 {
 public:
+    // An entry for put_many(). The pointers refer to the caller's strings.
+    // metadata is nullptr if the entry has no metadata.
+    struct PutEntry
+    {
+        std::string const* key;
+        std::string const* value;
+        std::string const* metadata;
+    };
+
     PersistentStringCacheImpl(std::string const& cache_path,
                               int64_t max_size_in_bytes,
                               core::CacheDiscardPolicy policy,
                               PersistentStringCache* pimpl = nullptr);
+    PersistentStringCacheImpl(std::string const& cache_path,
+                              int64_t max_size_in_bytes,
+                              core::CacheDiscardPolicy policy,
+                              PersistentCacheOptions const& options,
+                              PersistentStringCache* pimpl = nullptr);
     PersistentStringCacheImpl(std::string const& cache_path, PersistentStringCache* pimpl = nullptr);
 
     PersistentStringCacheImpl(PersistentStringCacheImpl const&) = delete;
@@ -53,6 +75,10 @@ public:
 
     bool get(std::string const& key, std::string& value) const;
     bool get(std::string const& key, std::string& value, std::string* metadata) const;
+    bool get_view(std::string const& key, PersistentStringCache::View& view) const;
+    void get_many(std::vector<std::string> const& keys,
+                  std::vector<Optional<std::string>>& values,
+                  std::vector<std::string>* metadata) const;
     bool get_metadata(std::string const& key, std::string& metadata) const;
     bool contains_key(std::string const& key) const;
     int64_t size() const noexcept;
@@ -78,7 +104,10 @@ public:
              int64_t value_size,
              char const* metadata_data,
              int64_t metadata_size,
-             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
+             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point(),
+             double cost = 1.0);
+    bool put_many(std::vector<PutEntry> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time);
     bool get_or_put(std::string const& key, std::string& value, PersistentStringCache::Loader load_func);
     bool get_or_put(std::string const& key,
                     std::string& value,
@@ -102,22 +131,35 @@ public:
     void trim_to(int64_t used_size_in_bytes);
     void compact();
     void set_handler(CacheEvent events, PersistentStringCache::EventCallback cb);
+    void set_batch_handler(CacheEvent events, PersistentStringCache::BatchEventCallback cb);
+
+    // For CacheDurability::sync, waits until the writes of the operations that completed so far are on disk.
+    // The owner of the cache calls this after each modifying operation, once the cache lock is released,
+    // so concurrent operations can share a sync.
+    void commit();
+
+    // Writes the staged entries (only if options_.write_behind is set).
+    void flush();
 
 private:
     // Simple struct to serialize/deserialize a data tuple.
-    // For the stringified representation, fields are separated
-    // by a space.
+    // The serialized representation is the binary encoding
+    // of the three fields (see int64_encoding.h). For segmented_lru,
+    // the size of a protected entry is stored as its one's complement,
+    // so the segment doesn't need a field of its own.
 
     struct DataTuple
     {
-        int64_t atime;  // Last access time, msec since the epoch
-        int64_t etime;  // Expiry time, msec since the epoch
-        int64_t size;   // Size in bytes
+        int64_t atime;      // Last access time, msec since the epoch
+        int64_t etime;      // Expiry time, msec since the epoch
+        int64_t size;       // Size in bytes
+        bool is_protected;  // True if the entry is in the protected segment (segmented_lru only)
 
-        DataTuple(int64_t at, int64_t et, int64_t s) noexcept
+        DataTuple(int64_t at, int64_t et, int64_t s, bool p = false) noexcept
             : atime(at)
             , etime(et)
             , size(s)
+            , is_protected(p)
         {
         }
 
@@ -126,12 +168,7 @@ private:
         {
         }
 
-        DataTuple(std::string const& s) noexcept
-        {
-            std::istringstream is(s);
-            is >> atime >> etime >> size;
-            assert(!is.bad());
-        }
+        DataTuple(leveldb::Slice const& s) noexcept;
 
         DataTuple(DataTuple const&) = default;
         DataTuple(DataTuple&&) = default;
@@ -139,34 +176,130 @@ private:
         DataTuple& operator=(DataTuple const&) = default;
         DataTuple& operator=(DataTuple&&) = default;
 
-        std::string to_string() const
+        std::string to_string() const;
+    };
+
+    // Miss cost and number of accesses of an entry, which determine its priority for gdsf.
+    // (The other policies don't use the weight of an entry.)
+
+    struct Weight
+    {
+        double cost;
+        int64_t frequency;
+
+        Weight(double c = 1.0, int64_t f = 1) noexcept
+            : cost(c)
+            , frequency(f)
         {
-            std::ostringstream os;
-            os << atime << " " << etime << " " << size;
-            return os.str();
         }
     };
 
     void init_stats();
+    void init_options(PersistentCacheOptions const& options);
+    leveldb::Options make_db_options(int64_t max_size_in_bytes);
     void init_db(leveldb::Options options);
     bool cache_is_new() const;
     void write_version();
     void check_version();
+    void upgrade_from_version_3();
+    void upgrade_from_version_4();
+    void upgrade_from_version_5();
+    void upgrade_from_version_6();
+    void upgrade_from_version_7();
     void read_settings();
+    void read_db_settings();
     void write_settings();
     void read_stats();
     void write_stats();
+    void read_sketch();
+    void write_sketch();
+    bool read_checkpoint();
+    void write_checkpoint();
+    void write_checkpoint(leveldb::WriteBatch& batch);
+    void stats_add_entry(int64_t size);
+    void stats_remove_entry(int64_t size);
+    void write_batch(leveldb::WriteBatch& batch, std::string const& msg);
     bool read_dirty_flag() const;
     void write_dirty_flag(bool is_dirty);
+    bool get_entry(std::string const& key,
+                   std::string& value,
+                   std::string* metadata,
+                   leveldb::WriteBatch& batch,
+                   int64_t& num_updates) const;
+    bool get_entry_view(std::string const& key,
+                        PersistentStringCache::View& view,
+                        leveldb::WriteBatch& batch,
+                        int64_t& num_updates) const;
+    bool get_record(std::string const& key, std::string& record) const;
     DataTuple get_data(std::string const& key, bool& found) const;
     bool get_value_and_metadata(std::string const& key,
                                 DataTuple& data,
                                 std::string& value,
                                 std::string* metadata) const;
     void batch_delete(std::string const& key, DataTuple const& data, leveldb::WriteBatch& batch);
+    void batch_put_index(std::string const& key,
+                         DataTuple const& data,
+                         leveldb::WriteBatch& batch,
+                         Weight const& weight = Weight()) const;
+    void batch_delete_index(std::string const& key, DataTuple const& data, leveldb::WriteBatch& batch) const;
+    Weight get_weight(std::string const& key, DataTuple const& data) const;
+    Weight set_access_time(std::string const& key, DataTuple& data, int64_t atime) const;
+    int64_t priority_of(int64_t size, Weight const& weight) const;
+    void init_clock();
+    void demote_protected() const;
+    bool admit(std::string const& key, int64_t bytes_needed) const;
+    int64_t count_protected() const;
     void delete_entry(std::string const& key, DataTuple const& data);
-    void delete_at_least(int64_t bytes_needed, std::string const& skip_key = "");
+    void batch_put(std::string const& key,
+                   DataTuple const& data,
+                   leveldb::Slice const& value,
+                   leveldb::Slice const* metadata,
+                   bool found,
+                   DataTuple const& old_data,
+                   double cost,
+                   leveldb::WriteBatch& batch);
+    void delete_at_least(int64_t bytes_needed,
+                         std::unordered_set<std::string> const& skip_keys = std::unordered_set<std::string>());
+    int64_t delete_expired(int64_t max_entries,
+                           std::unordered_set<std::string> const& skip_keys,
+                           int64_t& deleted_bytes);
+    bool evict_to_low_watermark();
+    void request_eviction() const;
+    void request_drop() const;
+    int64_t drop_old_generations(int64_t max_rows, std::string& from);
+    void run_background();
+    void start_background();
+    void stop_background();
+    void sync_writes();
+    void record_access_time(std::string const& key, int64_t atime) const;
+    void flush_access_times() const;
+    bool memory_get(std::string const& key, std::string& value, std::string* metadata) const;
+    bool memory_get_view(std::string const& key, PersistentStringCache::View& view) const;
+    void memory_put(std::string const& key,
+                    char const* value_data,
+                    int64_t value_size,
+                    char const* metadata_data,
+                    int64_t metadata_size,
+                    int64_t etime) const;
+    void memory_erase(std::string const& key) const;
+    void put_entries(std::vector<PutEntry> const& entries,
+                     std::vector<int64_t> const& etimes,
+                     std::vector<double> const& costs);
+    void stage(std::string const& key,
+               char const* value_data,
+               int64_t value_size,
+               char const* metadata_data,
+               int64_t metadata_size,
+               int64_t etime,
+               double cost,
+               int64_t size);
+    bool unstage(std::string const& key);
+    void flush_staged();
+    uint32_t check_events(CacheEvent events, std::string const& method) const;
     void call_handler(std::string const& key, core::internal::CacheEventIndex event) const;
+    void run_dispatch();
+    void start_dispatch();
+    void stop_dispatch();
 
     std::string make_message(leveldb::Status const& s, std::string const& msg) const;
     std::string make_message(std::string const& msg) const;
@@ -176,12 +309,109 @@ private:
     void throw_corrupt_error(std::string const& msg) const;
 
     PersistentStringCache* pimpl_;                 // Back-pointer to owning pimpl.
-    std::unique_ptr<leveldb::Cache> block_cache_;  // Must be defined *before* db_!
+    std::unique_ptr<leveldb::Cache> block_cache_;                 // Must be defined *before* db_!
+    std::unique_ptr<leveldb::FilterPolicy const> filter_policy_;  // Must be defined *before* db_!
+    std::unique_ptr<leveldb::Env> env_;                           // Must be defined *before* db_!
     std::unique_ptr<leveldb::DB> db_;
     std::shared_ptr<PersistentStringCacheStats> stats_;
+    PersistentCacheOptions options_;
+
+    // Access times of hits that are not written to disk yet (only if options_.defer_access_time_updates is set).
+    mutable std::unordered_map<std::string, int64_t> pending_atimes_;
+    mutable int64_t last_atime_flush_;
+
+    // In-memory tier (only if options_.memory_cache_size > 0). The list is in most-recently-read order,
+    // and memory_index_ maps each key to its position in the list. The value and metadata are shared with
+    // any views of the entry.
+    struct MemoryEntry
+    {
+        std::string key;
+        std::shared_ptr<PersistentStringCache::Data const> data;
+        int64_t etime;
+        int64_t size;
+    };
+    typedef std::list<MemoryEntry> MemoryList;
+    mutable MemoryList memory_lru_;
+    mutable std::unordered_map<std::string, MemoryList::iterator> memory_index_;
+    mutable int64_t memory_size_;
+
+    // Entries that are not written to disk yet (only if options_.write_behind is set), in the order in which
+    // they were put. staged_index_ maps each key to its position in the list. A staged entry supersedes
+    // the entry on disk for the same key.
+    struct StagedEntry
+    {
+        std::string key;
+        std::shared_ptr<PersistentStringCache::Data const> data;
+        bool has_metadata;
+        int64_t etime;
+        double cost;
+        int64_t size;
+    };
+    typedef std::list<StagedEntry> StagedList;
+    StagedList staged_;
+    std::unordered_map<std::string, StagedList::iterator> staged_index_;
+    int64_t staged_size_;
+
+    // Stats journal (only if options_.stats_checkpoint_interval > 0). journal_ accumulates the sizes of entries
+    // added (positive) and removed (negative) until the next write_batch(), which writes them as journal row
+    // journal_seq_. checkpoint_seq_ is the sequence number of the most recent journal row covered by the
+    // stats checkpoint.
+    std::string journal_;
+    int64_t journal_seq_;
+    int64_t checkpoint_seq_;
+
+    // Generation of the entries. Only rows with this generation are visible; rows of older generations
+    // are left over from invalidate() and are deleted by drop_old_generations().
+    int64_t generation_;
+
+    // Loads in progress for get_or_put(). Concurrent misses on a key that is being
+    // loaded wait for the existing load instead of calling the loader again.
+    struct Load
+    {
+        std::shared_future<void> done;
+        std::thread::id loader;
+    };
+    std::unordered_map<std::string, Load> loads_;
+
+    // Background thread that deletes expired entries and, if options_.eviction_high_watermark < 1,
+    // evicts down to the low watermark once a put takes the cache above the high watermark.
+    // If options_.background_invalidate is set, it also deletes the rows of old generations.
+    // It also writes the staged entries if options_.write_behind is set, and syncs if
+    // options_.durability is CacheDurability::periodic.
+    // The thread runs only if there is something to do in the background. background_done_, evict_requested_,
+    // and drop_requested_ are protected by background_mutex_.
+    std::thread background_thread_;
+    mutable std::mutex background_mutex_;
+    mutable std::condition_variable background_cond_;
+    bool background_done_;
+    mutable bool evict_requested_;
+    mutable bool drop_requested_;
 
     std::array<PersistentStringCache::EventCallback, static_cast<unsigned>(CacheEventIndex::END_)>
         handlers_;
+    PersistentStringCache::BatchEventCallback batch_handler_;
+    uint32_t batch_events_;  // Bitwise OR of the CacheEvent values that are passed to batch_handler_.
+
+    // Queue and thread for asynchronous event delivery (only if options_.async_events is set).
+    // call_handler() appends to the queue while it holds mutex_, so there is only one producer at a time.
+    std::unique_ptr<EventQueue> event_queue_;
+    std::thread dispatch_thread_;
+
+    // Access frequencies for the admission filter (only if options_.admission_filter is set).
+    std::unique_ptr<FrequencySketch> sketch_;
+
+    // Inflation value for gdsf. Each eviction advances the clock to the priority of the evicted entry,
+    // and new priorities are relative to the clock, so entries that are not accessed age out eventually.
+    double clock_;
+
+    // Group commit state for sync_writes(), protected by sync_mutex_. Syncs are numbered
+    // in the order in which they start; syncs_done_ is the number of the most recent sync
+    // that completed successfully.
+    std::mutex sync_mutex_;
+    std::condition_variable sync_cond_;
+    int64_t syncs_started_;
+    int64_t syncs_done_;
+    bool sync_in_progress_;
 
     mutable std::recursive_mutex mutex_;
 };
@@ -21,6 +21,9 @@
 #include <core/cache_discard_policy.h>
 #include <core/persistent_cache_stats.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -32,19 +35,336 @@ namespace core
 namespace internal
 {
 
-// Simple stats class to keep track of accesses.
+// A value that can be read without holding the cache lock while another thread updates it.
+// Updates are made only while the cache lock is held, so there is at most one writer, and
+// a relaxed load followed by a relaxed store is sufficient for increments. This is
+// cheaper than an atomic read-modify-write. A reader sees each value as it was at some
+// point in time, but different values are not necessarily consistent with each other.
+
+template <typename T>
+class Relaxed
+{
+public:
+    Relaxed(T v = T()) noexcept
+        : v_(v)
+    {
+    }
+
+    Relaxed(Relaxed const& other) noexcept
+        : v_(other.load())
+    {
+    }
+
+    Relaxed& operator=(Relaxed const& rhs) noexcept
+    {
+        store(rhs.load());
+        return *this;
+    }
+
+    Relaxed& operator=(T v) noexcept
+    {
+        store(v);
+        return *this;
+    }
+
+    operator T() const noexcept
+    {
+        return load();
+    }
+
+    T load() const noexcept
+    {
+        return v_.load(std::memory_order_relaxed);
+    }
+
+    void store(T v) noexcept
+    {
+        v_.store(v, std::memory_order_relaxed);
+    }
+
+    Relaxed& operator++() noexcept
+    {
+        store(load() + 1);
+        return *this;
+    }
+
+    Relaxed& operator--() noexcept
+    {
+        store(load() - 1);
+        return *this;
+    }
+
+    Relaxed& operator+=(T delta) noexcept
+    {
+        store(load() + delta);
+        return *this;
+    }
+
+    Relaxed& operator-=(T delta) noexcept
+    {
+        store(load() - delta);
+        return *this;
+    }
+
+private:
+    std::atomic<T> v_;
+};
+
+// Histogram of entry sizes. The bins are kept twice: as relaxed atomics, so a copy can be made without
+// holding the cache lock, and as the vector that is returned by PersistentCacheStats::histogram().
+// The vector of the cache's own instance is read only while the cache lock is held (by event handlers);
+// a copy rebuilds its vector from the atomic bins.
+
+class SizeHistogram
+{
+public:
+    SizeHistogram()
+        : values_(PersistentCacheStats::NUM_BINS, 0)
+    {
+    }
+
+    SizeHistogram(SizeHistogram const& other)
+        : values_(PersistentCacheStats::NUM_BINS)
+    {
+        copy_from(other);
+    }
+
+    SizeHistogram& operator=(SizeHistogram const& rhs)
+    {
+        if (this != &rhs)
+        {
+            copy_from(rhs);
+        }
+        return *this;
+    }
+
+    uint32_t operator[](unsigned index) const noexcept
+    {
+        return bins_[index];
+    }
+
+    unsigned size() const noexcept
+    {
+        return PersistentCacheStats::NUM_BINS;
+    }
+
+    PersistentCacheStats::Histogram const& values() const noexcept
+    {
+        return values_;
+    }
+
+    void set(unsigned index, uint32_t value) noexcept
+    {
+        bins_[index] = value;
+        values_[index] = value;
+    }
+
+    void increment(unsigned index) noexcept
+    {
+        ++bins_[index];
+        ++values_[index];
+    }
+
+    void decrement(unsigned index) noexcept
+    {
+        --bins_[index];
+        --values_[index];
+    }
+
+    void add(SizeHistogram const& other) noexcept
+    {
+        for (unsigned i = 0; i < size(); ++i)
+        {
+            set(i, bins_[i] + other.bins_[i]);
+        }
+    }
+
+    void clear() noexcept
+    {
+        for (unsigned i = 0; i < size(); ++i)
+        {
+            set(i, 0);
+        }
+    }
+
+private:
+    void copy_from(SizeHistogram const& other) noexcept
+    {
+        for (unsigned i = 0; i < size(); ++i)
+        {
+            set(i, other.bins_[i]);
+        }
+    }
+
+    std::array<Relaxed<uint32_t>, PersistentCacheStats::NUM_BINS> bins_;
+    PersistentCacheStats::Histogram values_;
+};
+
+// Latency histograms, one per type of operation. Latencies are recorded after the cache lock
+// is released, so they include the time spent waiting for the lock. This means that there can be
+// several writers at a time, so the bins are incremented with an atomic read-modify-write.
+
+class LatencyHistograms
+{
+public:
+    typedef PersistentCacheStats::Operation Operation;
+
+    static constexpr unsigned NUM_OPS = static_cast<unsigned>(Operation::END_);
+    static constexpr unsigned NUM_BINS = PersistentCacheStats::NUM_LATENCY_BINS;
+    static constexpr unsigned SUB_BINS = 8;  // Bins per power of two.
+
+    LatencyHistograms() noexcept
+    {
+        clear();
+    }
+
+    LatencyHistograms(LatencyHistograms const& other) noexcept
+    {
+        copy_from(other);
+    }
+
+    LatencyHistograms& operator=(LatencyHistograms const& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            copy_from(rhs);
+        }
+        return *this;
+    }
+
+    void record(Operation op, int64_t nanoseconds) noexcept
+    {
+        bins_[static_cast<unsigned>(op)][bin_of(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t get(Operation op, unsigned bin) const noexcept
+    {
+        return bins_[static_cast<unsigned>(op)][bin].load(std::memory_order_relaxed);
+    }
+
+    void add(LatencyHistograms const& other) noexcept
+    {
+        for (unsigned op = 0; op < NUM_OPS; ++op)
+        {
+            for (unsigned bin = 0; bin < NUM_BINS; ++bin)
+            {
+                bins_[op][bin].fetch_add(other.bins_[op][bin].load(std::memory_order_relaxed),
+                                         std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void clear() noexcept
+    {
+        for (auto& op_bins : bins_)
+        {
+            for (auto& b : op_bins)
+            {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns the bin for a duration. Below SUB_BINS nanoseconds, each bin holds a single value.
+    // Thereafter, we shift the duration right until it is in the range [SUB_BINS..2 * SUB_BINS), which
+    // leaves the leading bit and the three bits after it. The number of shifts selects the power of two,
+    // and the three bits select the bin within that power of two.
+
+    static unsigned bin_of(int64_t nanoseconds) noexcept
+    {
+        if (nanoseconds < int64_t(SUB_BINS))
+        {
+            return nanoseconds < 0 ? 0 : unsigned(nanoseconds);
+        }
+        uint64_t v = nanoseconds;
+        unsigned shifts = 0;
+        while (v >= 2 * SUB_BINS)
+        {
+            v >>= 1;
+            ++shifts;
+        }
+        uint64_t bin = uint64_t(shifts) * SUB_BINS + v;
+        return bin < NUM_BINS ? unsigned(bin) : NUM_BINS - 1;
+    }
+
+    // Writes, for each operation, the number of non-empty bins, followed by the index and count of each
+    // non-empty bin. Most bins are empty, so this is a lot shorter than writing all of them.
+
+    void serialize(std::ostream& os) const
+    {
+        for (unsigned op = 0; op < NUM_OPS; ++op)
+        {
+            unsigned non_empty = 0;
+            for (auto const& b : bins_[op])
+            {
+                non_empty += b.load(std::memory_order_relaxed) != 0;
+            }
+            os << " " << non_empty;
+            for (unsigned bin = 0; bin < NUM_BINS; ++bin)
+            {
+                auto count = bins_[op][bin].load(std::memory_order_relaxed);
+                if (count != 0)
+                {
+                    os << " " << bin << " " << count;
+                }
+            }
+        }
+    }
+
+    // Stops at the first value that can't be read, leaving the remaining bins empty.
+
+    void deserialize(std::istream& is) noexcept
+    {
+        for (unsigned op = 0; op < NUM_OPS; ++op)
+        {
+            unsigned non_empty;
+            if (!(is >> non_empty))
+            {
+                return;
+            }
+            for (unsigned i = 0; i < non_empty; ++i)
+            {
+                unsigned bin;
+                uint64_t count;
+                if (!(is >> bin >> count) || bin >= NUM_BINS)
+                {
+                    return;
+                }
+                bins_[op][bin].store(count, std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    void copy_from(LatencyHistograms const& other) noexcept
+    {
+        for (unsigned op = 0; op < NUM_OPS; ++op)
+        {
+            for (unsigned bin = 0; bin < NUM_BINS; ++bin)
+            {
+                bins_[op][bin].store(other.bins_[op][bin].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::array<std::array<std::atomic<uint64_t>, NUM_BINS>, NUM_OPS> bins_;
+};
+
+// Stats of a cache. The counters can be read without holding the cache lock, so
+// PersistentStringCacheImpl::stats() and size() do not block other operations.
+// All updates must be made while holding the cache lock.
 
 class PersistentStringCacheStats
 {
 public:
-    PersistentStringCacheStats() noexcept
+    PersistentStringCacheStats()
         : policy_(CacheDiscardPolicy::lru_only)
         , max_cache_size_(0)
         , num_entries_(0)
         , cache_size_(0)
+        , protected_size_(0)
     {
         clear();
-        hist_.resize(PersistentCacheStats::NUM_BINS, 0);
     }
 
     PersistentStringCacheStats(PersistentStringCacheStats const&) = default;
@@ -52,29 +372,37 @@ public:
     PersistentStringCacheStats& operator=(PersistentStringCacheStats const&) = default;
     PersistentStringCacheStats& operator=(PersistentStringCacheStats&&) = default;
 
+    typedef std::chrono::system_clock::time_point TimePoint;
+
     std::string cache_path_;           // Immutable
     core::CacheDiscardPolicy policy_;  // Immutable
-    int64_t max_cache_size_;
+    Relaxed<int64_t> max_cache_size_;
 
-    int64_t num_entries_;
-    int64_t cache_size_;
-    PersistentCacheStats::Histogram hist_;
+    Relaxed<int64_t> num_entries_;
+    Relaxed<int64_t> cache_size_;
+    SizeHistogram hist_;
+    Relaxed<int64_t> protected_size_;  // Bytes in the protected segment (segmented_lru only)
 
     // Values below are reset by a call to clear().
-    int64_t hits_;
-    int64_t misses_;
-    int64_t hits_since_last_miss_;
-    int64_t misses_since_last_hit_;
-    int64_t longest_hit_run_;
-    int64_t longest_miss_run_;
-    int64_t num_hit_runs_;
-    int64_t num_miss_runs_;
-    int64_t ttl_evictions_;
-    int64_t lru_evictions_;
-    std::chrono::system_clock::time_point most_recent_hit_time_;
-    std::chrono::system_clock::time_point most_recent_miss_time_;
-    std::chrono::system_clock::time_point longest_hit_run_time_;
-    std::chrono::system_clock::time_point longest_miss_run_time_;
+    Relaxed<int64_t> hits_;
+    Relaxed<int64_t> misses_;
+    Relaxed<int64_t> hits_since_last_miss_;
+    Relaxed<int64_t> misses_since_last_hit_;
+    Relaxed<int64_t> longest_hit_run_;
+    Relaxed<int64_t> longest_miss_run_;
+    Relaxed<int64_t> num_hit_runs_;
+    Relaxed<int64_t> num_miss_runs_;
+    Relaxed<int64_t> ttl_evictions_;
+    Relaxed<int64_t> lru_evictions_;
+    Relaxed<int64_t> memory_hits_;
+    Relaxed<int64_t> memory_misses_;
+    Relaxed<int64_t> dropped_events_;
+    Relaxed<int64_t> rejected_puts_;
+    Relaxed<TimePoint> most_recent_hit_time_;
+    Relaxed<TimePoint> most_recent_miss_time_;
+    Relaxed<TimePoint> longest_hit_run_time_;
+    Relaxed<TimePoint> longest_miss_run_time_;
+    LatencyHistograms latencies_;
 
     enum State
     {
@@ -82,7 +410,7 @@ public:
         LastAccessWasHit,
         LastAccessWasMiss
     };
-    State state_;
+    Relaxed<State> state_;
 
     void inc_hits() noexcept
     {
@@ -123,18 +451,18 @@ public:
     void hist_decrement(int64_t size) noexcept
     {
         assert(size > 0);
-        --hist_[size_to_index(size)];
+        hist_.decrement(size_to_index(size));
     }
 
     void hist_increment(int64_t size) noexcept
     {
         assert(size > 0);
-        ++hist_[size_to_index(size)];
+        hist_.increment(size_to_index(size));
     }
 
     void hist_clear() noexcept
     {
-        memset(&hist_[0], 0, hist_.size() * sizeof(PersistentCacheStats::Histogram::value_type));
+        hist_.clear();
     }
 
     void clear() noexcept
@@ -150,10 +478,62 @@ public:
         num_miss_runs_ = 0;
         ttl_evictions_ = 0;
         lru_evictions_ = 0;
-        most_recent_hit_time_ = std::chrono::system_clock::time_point();
-        most_recent_miss_time_ = std::chrono::system_clock::time_point();
-        longest_hit_run_time_ = std::chrono::system_clock::time_point();
-        longest_miss_run_time_ = std::chrono::system_clock::time_point();
+        memory_hits_ = 0;
+        memory_misses_ = 0;
+        dropped_events_ = 0;
+        rejected_puts_ = 0;
+        most_recent_hit_time_ = TimePoint();
+        most_recent_miss_time_ = TimePoint();
+        longest_hit_run_time_ = TimePoint();
+        longest_miss_run_time_ = TimePoint();
+        latencies_.clear();
+    }
+
+    // Adds the stats of another shard of the same cache. Counts and sizes are summed.
+    // Hit and miss runs are tracked per shard, so the longest runs are the longest
+    // of any shard, and the current run is that of the shard that was accessed last.
+
+    void merge(PersistentStringCacheStats const& other) noexcept
+    {
+        using namespace std;
+
+        bool other_is_newer = max(other.most_recent_hit_time_.load(), other.most_recent_miss_time_.load()) >
+                              max(most_recent_hit_time_.load(), most_recent_miss_time_.load());
+        if (other_is_newer)
+        {
+            state_ = other.state_;
+            hits_since_last_miss_ = other.hits_since_last_miss_;
+            misses_since_last_hit_ = other.misses_since_last_hit_;
+        }
+
+        max_cache_size_ += other.max_cache_size_;
+        num_entries_ += other.num_entries_;
+        cache_size_ += other.cache_size_;
+        hist_.add(other.hist_);
+        protected_size_ += other.protected_size_;
+        hits_ += other.hits_;
+        misses_ += other.misses_;
+        num_hit_runs_ += other.num_hit_runs_;
+        num_miss_runs_ += other.num_miss_runs_;
+        ttl_evictions_ += other.ttl_evictions_;
+        lru_evictions_ += other.lru_evictions_;
+        memory_hits_ += other.memory_hits_;
+        memory_misses_ += other.memory_misses_;
+        dropped_events_ += other.dropped_events_;
+        rejected_puts_ += other.rejected_puts_;
+        latencies_.add(other.latencies_);
+        if (other.longest_hit_run_ > longest_hit_run_)
+        {
+            longest_hit_run_ = other.longest_hit_run_;
+            longest_hit_run_time_ = other.longest_hit_run_time_;
+        }
+        if (other.longest_miss_run_ > longest_miss_run_)
+        {
+            longest_miss_run_ = other.longest_miss_run_;
+            longest_miss_run_time_ = other.longest_miss_run_time_;
+        }
+        most_recent_hit_time_ = max(most_recent_hit_time_.load(), other.most_recent_hit_time_.load());
+        most_recent_miss_time_ = max(most_recent_miss_time_.load(), other.most_recent_miss_time_.load());
     }
 
     // Serialize the stats.
@@ -177,14 +557,19 @@ public:
            << num_miss_runs_ << " "
            << ttl_evictions_ << " "
            << lru_evictions_ << " "
-           << duration_cast<milliseconds>(most_recent_hit_time_.time_since_epoch()).count() << " "
-           << duration_cast<milliseconds>(most_recent_miss_time_.time_since_epoch()).count() << " "
-           << duration_cast<milliseconds>(longest_hit_run_time_.time_since_epoch()).count() << " "
-           << duration_cast<milliseconds>(longest_miss_run_time_.time_since_epoch()).count();
-        for (auto d : hist_)
+           << duration_cast<milliseconds>(most_recent_hit_time_.load().time_since_epoch()).count() << " "
+           << duration_cast<milliseconds>(most_recent_miss_time_.load().time_since_epoch()).count() << " "
+           << duration_cast<milliseconds>(longest_hit_run_time_.load().time_since_epoch()).count() << " "
+           << duration_cast<milliseconds>(longest_miss_run_time_.load().time_since_epoch()).count();
+        for (auto d : hist_.values())
         {
             os << " " << d;
         }
+        os << " " << memory_hits_ << " " << memory_misses_;
+        os << " " << dropped_events_;
+        latencies_.serialize(os);
+        os << " " << protected_size_;
+        os << " " << rejected_puts_;
         return os.str();
     }
 
@@ -196,32 +581,67 @@ public:
         using namespace std::chrono;
 
         istringstream is(s);
-        int64_t state;
-        int64_t mrht;
-        int64_t mrmt;
-        int64_t lhrt;
-        int64_t lmrt;
-        is >> state
-           >> num_entries_
-           >> cache_size_
-           >> hits_
-           >> misses_
-           >> hits_since_last_miss_
-           >> misses_since_last_hit_
-           >> longest_hit_run_
-           >> longest_miss_run_
-           >> num_hit_runs_
-           >> num_miss_runs_
-           >> ttl_evictions_
-           >> lru_evictions_
-           >> mrht
-           >> mrmt
-           >> lhrt
-           >> lmrt;
+        int64_t state = 0;
+        int64_t mrht = 0;
+        int64_t mrmt = 0;
+        int64_t lhrt = 0;
+        int64_t lmrt = 0;
+        array<int64_t, 12> counts;
+        counts.fill(0);
+        is >> state;
+        for (auto& c : counts)
+        {
+            is >> c;
+        }
+        is >> mrht >> mrmt >> lhrt >> lmrt;
+        num_entries_ = counts[0];
+        cache_size_ = counts[1];
+        hits_ = counts[2];
+        misses_ = counts[3];
+        hits_since_last_miss_ = counts[4];
+        misses_since_last_hit_ = counts[5];
+        longest_hit_run_ = counts[6];
+        longest_miss_run_ = counts[7];
+        num_hit_runs_ = counts[8];
+        num_miss_runs_ = counts[9];
+        ttl_evictions_ = counts[10];
+        lru_evictions_ = counts[11];
         for (unsigned i = 0; i < PersistentCacheStats::NUM_BINS; ++i)
         {
-            is >> hist_[i];
+            uint32_t bin = 0;
+            is >> bin;
+            hist_.set(i, bin);
+        }
+        // Added later; stats written by an older version end here.
+        int64_t memory_hits = 0;
+        int64_t memory_misses = 0;
+        int64_t dropped_events = 0;
+        if (!(is >> memory_hits >> memory_misses))
+        {
+            memory_hits = 0;
+            memory_misses = 0;
+        }
+        if (!(is >> dropped_events))
+        {
+            dropped_events = 0;
+        }
+        memory_hits_ = memory_hits;
+        memory_misses_ = memory_misses;
+        dropped_events_ = dropped_events;
+        latencies_.clear();
+        latencies_.deserialize(is);
+        int64_t protected_size = 0;
+        if (!(is >> protected_size))
+        {
+            protected_size = 0;
+        }
+        protected_size_ = protected_size;
+        int64_t rejected_puts = 0;
+        if (!(is >> rejected_puts))
+        {
+            rejected_puts = 0;
         }
+        rejected_puts_ = rejected_puts;
         assert(!is.bad());
         state_ = static_cast<State>(state);
         most_recent_hit_time_ = system_clock::time_point(milliseconds(mrht));
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <core/internal/persistent_string_cache_impl.h>
+#include <core/persistent_string_cache.h>
+
+#include <memory>
+#include <vector>
+
+namespace core
+{
+
+namespace internal
+{
+
+// Partitions the cache into one or more shards. Each shard is a PersistentStringCacheImpl
+// with its own leveldb and its own lock, so operations on keys in different shards
+// proceed in parallel. Operations that are not specific to a key are applied to all shards,
+// and the results are aggregated.
+//
+// With a single shard (the default), the cache lives directly in cache_path, exactly as before.
+// With N > 1 shards, cache_path is a directory that contains the sub-directories shard-0 to shard-<N-1>,
+// one per leveldb. The number of shards is fixed when the cache is created.
+//
+// Modifying operations call commit() on each shard they modified after the shard has released its lock,
+// so concurrent operations on a shard can share a sync for CacheDurability::sync.
+
+class ShardedStringCacheImpl
+{
+public:
+    ShardedStringCacheImpl(std::string const& cache_path,
+                           int64_t max_size_in_bytes,
+                           core::CacheDiscardPolicy policy,
+                           PersistentCacheOptions const& options,
+                           PersistentStringCache* pimpl);
+    ShardedStringCacheImpl(std::string const& cache_path, PersistentStringCache* pimpl);
+
+    ShardedStringCacheImpl(ShardedStringCacheImpl const&) = delete;
+    ShardedStringCacheImpl& operator=(ShardedStringCacheImpl const&) = delete;
+
+    ShardedStringCacheImpl(ShardedStringCacheImpl&&) = delete;
+    ShardedStringCacheImpl& operator=(ShardedStringCacheImpl&&) = delete;
+
+    ~ShardedStringCacheImpl();
+
+    bool get(std::string const& key, std::string& value, std::string* metadata) const;
+    bool get_view(std::string const& key, PersistentStringCache::View& view) const;
+    void get_many(std::vector<std::string> const& keys,
+                  std::vector<Optional<std::string>>& values,
+                  std::vector<std::string>* metadata) const;
+    bool get_metadata(std::string const& key, std::string& metadata) const;
+    bool contains_key(std::string const& key) const;
+    int64_t size() const noexcept;
+    int64_t size_in_bytes() const noexcept;
+    int64_t max_size_in_bytes() const noexcept;
+    int64_t disk_size_in_bytes() const;
+    CacheDiscardPolicy discard_policy() const noexcept;
+    core::PersistentCacheStats stats() const;
+
+    bool put(std::string const& key,
+             char const* value_data,
+             int64_t value_size,
+             char const* metadata_data,
+             int64_t metadata_size,
+             std::chrono::time_point<std::chrono::system_clock> expiry_time,
+             double cost = 1.0);
+    bool put_many(std::vector<PersistentStringCacheImpl::PutEntry> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time);
+    bool get_or_put(std::string const& key,
+                    std::string& value,
+                    std::string* metadata,
+                    PersistentStringCache::Loader load_func);
+    bool put_metadata(std::string const& key, char const* metadata, int64_t metadata_size);
+    bool take(std::string const& key, std::string& value, std::string* metadata);
+    bool invalidate(std::string const& key);
+    void invalidate(std::vector<std::string> const& keys);
+    void invalidate();
+    bool touch(std::string const& key, std::chrono::time_point<std::chrono::system_clock> expiry_time);
+    void clear_stats() noexcept;
+    void resize(int64_t size_in_bytes);
+    void trim_to(int64_t used_size_in_bytes);
+    void compact();
+    void flush();
+    void set_handler(CacheEvent events, PersistentStringCache::EventCallback cb);
+    void set_batch_handler(CacheEvent events, PersistentStringCache::BatchEventCallback cb);
+
+private:
+    PersistentStringCacheImpl& shard(std::string const& key) const noexcept;
+    static std::vector<int64_t> split(int64_t size_in_bytes, int num_shards) noexcept;
+
+    std::string make_message(std::string const& msg) const;
+    void throw_logic_error(std::string const& msg) const;
+    void throw_invalid_argument(std::string const& msg) const;
+
+    std::string cache_path_;
+    std::vector<std::unique_ptr<PersistentStringCacheImpl>> shards_;  // Immutable after construction.
+};
+
+}  // namespace internal
+
+}  // namespace core
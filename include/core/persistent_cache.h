@@ -24,6 +24,67 @@
 namespace core
 {
 
+// @cond
+
+namespace internal
+{
+
+// Lookup helpers for PersistentCache. If V has a buffer codec, we decode the value
+// straight from a view of the entry, without copying it into a string first.
+
+template <typename V>
+Optional<V> get_value(PersistentStringCache const& c, std::string const& skey, std::true_type)
+{
+    auto view = c.get_view(skey);
+    return view ? Optional<V>(Codec<V>::decode_from(view->data(), view->size())) : Optional<V>();
+}
+
+template <typename V>
+Optional<V> get_value(PersistentStringCache const& c, std::string const& skey, std::false_type)
+{
+    auto svalue = c.get(skey);
+    return svalue ? Optional<V>(Codec<V>::decode(*svalue)) : Optional<V>();
+}
+
+template <typename V>
+Optional<V> get_value(PersistentStringCache const& c, std::string const& skey)
+{
+    return get_value<V>(c, skey, HasBufferCodec<V>());
+}
+
+template <typename Data, typename V, typename M>
+Optional<Data> get_data(PersistentStringCache const& c, std::string const& skey, std::true_type)
+{
+    auto view = c.get_view(skey);
+    if (!view)
+    {
+        return Optional<Data>();
+    }
+    return Optional<Data>(Data{Codec<V>::decode_from(view->data(), view->size()),
+                               Codec<M>::decode_from(view->metadata_data(), view->metadata_size())});
+}
+
+template <typename Data, typename V, typename M>
+Optional<Data> get_data(PersistentStringCache const& c, std::string const& skey, std::false_type)
+{
+    auto sdata = c.get_data(skey);
+    if (!sdata)
+    {
+        return Optional<Data>();
+    }
+    return Optional<Data>(Data{Codec<V>::decode(sdata->value), Codec<M>::decode(sdata->metadata)});
+}
+
+template <typename Data, typename V, typename M>
+Optional<Data> get_data(PersistentStringCache const& c, std::string const& skey)
+{
+    return get_data<Data, V, M>(c, skey, HasBufferCodec<V>());
+}
+
+}  // namespace internal
+
+// @endcond
+
 /**
 \brief A persistent cache of key-value pairs and metadata of user-defined type.
 
@@ -110,6 +171,12 @@ Bjarne Stroustrup: C++ inventor
 You can use a custom type for the cache's value and metadata as well by simply providing
 CacheCodec specializations as needed.
 
+Integral types, enumerations, floating-point types, and trivially copyable types
+without padding (such as a struct of integers) do not need a specialization because
+the library provides built-in codecs for them. For example, `PersistentCache<int64_t, double>`
+works without any further code. If you specialize CacheCodec for such a type,
+your specialization is used instead of the built-in codec.
+
 \see core::CacheCodec
 \see core::PersistentStringCache
 */
@@ -188,6 +255,14 @@ public:
     */
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
 
+    /**
+    \brief Creates or opens a PersistentCache with the specified options.
+    */
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
+
     /**
     \brief Opens an existing PersistentCache.
     */
@@ -210,6 +285,16 @@ public:
     */
     OptionalData get_data(K const& key) const;
 
+    /**
+    \brief Returns the values of several entries in the cache.
+    */
+    std::vector<OptionalValue> get_many(std::vector<K> const& keys) const;
+
+    /**
+    \brief Returns the data for several entries in the cache.
+    */
+    std::vector<OptionalData> get_data_many(std::vector<K> const& keys) const;
+
     /**
     \brief Returns the metadata for an entry in the cache, provided the entry has not expired.
     */
@@ -274,6 +359,20 @@ public:
              M const& metadata,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    /**
+    \brief Adds or updates several entries.
+    */
+    bool put_many(std::vector<std::pair<K, V>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+
+    /**
+    \brief Adds or updates several entries and their metadata.
+    */
+    bool put_many(std::vector<std::pair<K, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+
     /**
     \brief Function called by the cache to load an entry after a cache miss.
     */
@@ -358,6 +457,11 @@ public:
     */
     void compact();
 
+    /**
+    \brief Writes the entries that were staged by `put()`.
+    */
+    void flush();
+
     //@}
 
     /** @name Monitoring cache activity
@@ -375,11 +479,30 @@ public:
     */
     void set_handler(CacheEvent events, EventCallback cb);
 
+    /**
+    \brief A batch of events, in the order in which they occurred.
+    */
+    typedef std::vector<std::pair<K, CacheEvent>> EventBatch;
+
+    /**
+    \brief The type of a batch handler function.
+    */
+    typedef std::function<void(EventBatch const& events, PersistentCacheStats const& stats)> BatchEventCallback;
+
+    /**
+    \brief Installs a handler that receives events in batches.
+    */
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
+
     //@}
 
 private:
     // @cond
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -404,6 +527,15 @@ PersistentCache<K, V, M>::PersistentCache(std::string const& cache_path)
 {
 }
 
+template <typename K, typename V, typename M>
+PersistentCache<K, V, M>::PersistentCache(std::string const& cache_path,
+                                          int64_t max_size_in_bytes,
+                                          CacheDiscardPolicy policy,
+                                          PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::UPtr PersistentCache<K, V, M>::open(std::string const& cache_path,
                                                                        int64_t max_size_in_bytes,
@@ -418,35 +550,89 @@ typename PersistentCache<K, V, M>::UPtr PersistentCache<K, V, M>::open(std::stri
     return PersistentCache<K, V, M>::UPtr(new PersistentCache<K, V, M>(cache_path));
 }
 
+template <typename K, typename V, typename M>
+typename PersistentCache<K, V, M>::UPtr PersistentCache<K, V, M>::open(
+    std::string const& cache_path,
+    int64_t max_size_in_bytes,
+    CacheDiscardPolicy policy,
+    PersistentCacheOptions const& options)
+{
+    return PersistentCache<K, V, M>::UPtr(
+        new PersistentCache<K, V, M>(cache_path, max_size_in_bytes, policy, options));
+}
+
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::OptionalValue PersistentCache<K, V, M>::get(K const& key) const
 {
-    auto const& svalue = p_->get(CacheCodec<K>::encode(key));
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return internal::get_value<V>(*p_, internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::OptionalData PersistentCache<K, V, M>::get_data(K const& key) const
 {
-    auto sdata = p_->get_data(CacheCodec<K>::encode(key));
-    if (!sdata)
+    return internal::get_data<Data, V, M>(*p_, internal::Encoded<K>(key).str());
+}
+
+template <typename K, typename V, typename M>
+std::vector<typename PersistentCache<K, V, M>::OptionalValue>
+    PersistentCache<K, V, M>::get_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
     {
-        return OptionalData();
+        skeys.push_back(internal::Codec<K>::encode(key));
+    }
+    auto svalues = p_->get_many(skeys);
+
+    std::vector<OptionalValue> values;
+    values.reserve(svalues.size());
+    for (auto const& svalue : svalues)
+    {
+        values.push_back(svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue());
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), CacheCodec<M>::decode(sdata->metadata)});
+    return values;
+}
+
+template <typename K, typename V, typename M>
+std::vector<typename PersistentCache<K, V, M>::OptionalData>
+    PersistentCache<K, V, M>::get_data_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
+    {
+        skeys.push_back(internal::Codec<K>::encode(key));
+    }
+    auto sdata_many = p_->get_data_many(skeys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({internal::Codec<V>::decode(sdata->value), internal::Codec<M>::decode(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
+    }
+    return data;
 }
 
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::OptionalMetadata PersistentCache<K, V, M>::get_metadata(K const& key) const
 {
-    auto smeta = p_->get_metadata(CacheCodec<K>::encode(key));
-    return smeta ? OptionalMetadata(CacheCodec<M>::decode(*smeta)) : OptionalMetadata();
+    auto smeta = p_->get_metadata(internal::Encoded<K>(key).str());
+    return smeta ? OptionalMetadata(internal::Codec<M>::decode(*smeta)) : OptionalMetadata();
 }
 
 template <typename K, typename V, typename M>
 bool PersistentCache<K, V, M>::contains_key(K const& key) const
 {
-    return p_->contains_key(CacheCodec<K>::encode(key));
+    return p_->contains_key(internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename V, typename M>
@@ -490,7 +676,7 @@ bool PersistentCache<K, V, M>::put(K const& key,
                                    V const& value,
                                    std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), CacheCodec<V>::encode(value), expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), internal::Encoded<V>(value).str(), expiry_time);
 }
 
 template <typename K, typename V, typename M>
@@ -499,28 +685,56 @@ bool PersistentCache<K, V, M>::put(K const& key,
                                    M const& metadata,
                                    std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), CacheCodec<V>::encode(value), CacheCodec<M>::encode(metadata),
+    return p_->put(internal::Encoded<K>(key).str(), internal::Encoded<V>(value).str(), internal::Encoded<M>(metadata).str(),
                    expiry_time);
 }
 
+template <typename K, typename V, typename M>
+bool PersistentCache<K, V, M>::put_many(std::vector<std::pair<K, V>> const& entries,
+                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, std::string>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), internal::Codec<V>::encode(e.second));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
+template <typename K, typename V, typename M>
+bool PersistentCache<K, V, M>::put_many(std::vector<std::pair<K, Data>> const& entries,
+                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{internal::Codec<V>::encode(e.second.value),
+                                         internal::Codec<M>::encode(e.second.metadata)};
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::OptionalValue PersistentCache<K, V, M>::get_or_put(
     K const& key, PersistentCache<K, V, M>::Loader const& load_func)
 {
-    std::string const& skey = CacheCodec<K>::encode(key);
+    std::string const& skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
     };
     auto svalue = p_->get_or_put(skey, sload_func);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::OptionalData PersistentCache<K, V, M>::get_or_put_data(
     K const& key, PersistentCache<K, V, M>::Loader const& load_func)
 {
-    std::string const& skey = CacheCodec<K>::encode(key);
+    std::string const& skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
@@ -530,37 +744,37 @@ typename PersistentCache<K, V, M>::OptionalData PersistentCache<K, V, M>::get_or
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename K, typename V, typename M>
 bool PersistentCache<K, V, M>::put_metadata(K const& key, M const& metadata)
 {
-    return p_->put_metadata(CacheCodec<K>::encode(key), CacheCodec<M>::encode(metadata));
+    return p_->put_metadata(internal::Encoded<K>(key).str(), internal::Encoded<M>(metadata).str());
 }
 
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::OptionalValue PersistentCache<K, V, M>::take(K const& key)
 {
-    auto svalue = p_->take(CacheCodec<K>::encode(key));
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    auto svalue = p_->take(internal::Encoded<K>(key).str());
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename K, typename V, typename M>
 typename PersistentCache<K, V, M>::OptionalData PersistentCache<K, V, M>::take_data(K const& key)
 {
-    auto sdata = p_->take_data(CacheCodec<K>::encode(key));
+    auto sdata = p_->take_data(internal::Encoded<K>(key).str());
     if (!sdata)
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename K, typename V, typename M>
 bool PersistentCache<K, V, M>::invalidate(K const& key)
 {
-    return p_->invalidate(CacheCodec<K>::encode(key));
+    return p_->invalidate(internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename V, typename M>
@@ -576,7 +790,7 @@ void PersistentCache<K, V, M>::invalidate(It begin, It end)
     std::vector<std::string> skeys;
     for (auto&& it = begin; it < end; ++it)
     {
-        skeys.push_back(CacheCodec<K>::encode(*it));
+        skeys.push_back(internal::Codec<K>::encode(*it));
     }
     p_->invalidate(skeys.begin(), skeys.end());
 }
@@ -596,7 +810,7 @@ void PersistentCache<K, V, M>::invalidate()
 template <typename K, typename V, typename M>
 bool PersistentCache<K, V, M>::touch(K const& key, std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->touch(CacheCodec<K>::encode(key), expiry_time);
+    return p_->touch(internal::Encoded<K>(key).str(), expiry_time);
 }
 
 template <typename K, typename V, typename M>
@@ -623,16 +837,43 @@ void PersistentCache<K, V, M>::compact()
     p_->compact();
 }
 
+template <typename K, typename V, typename M>
+void PersistentCache<K, V, M>::flush()
+{
+    p_->flush();
+}
+
 template <typename K, typename V, typename M>
 void PersistentCache<K, V, M>::set_handler(CacheEvent events, EventCallback cb)
 {
     auto scb = [cb](std::string const& key, CacheEvent ev, PersistentCacheStats const& c)
     {
-        cb(CacheCodec<K>::decode(key), ev, c);
+        cb(internal::Codec<K>::decode(key), ev, c);
     };
     p_->set_handler(events, scb);
 }
 
+template <typename K, typename V, typename M>
+void PersistentCache<K, V, M>::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    if (!cb)
+    {
+        p_->set_batch_handler(events, nullptr);
+        return;
+    }
+    auto scb = [cb](PersistentStringCache::EventBatch const& sevents, PersistentCacheStats const& c)
+    {
+        EventBatch batch;
+        batch.reserve(sevents.size());
+        for (auto const& e : sevents)
+        {
+            batch.emplace_back(internal::Codec<K>::decode(e.first), e.second);
+        }
+        cb(batch, c);
+    };
+    p_->set_batch_handler(events, scb);
+}
+
 // Below are specializations for the various combinations of one or more of K, V, and M
 // being of type std::string. Without this, we would end up calling through a string-to-string
 // codec, which would force a copy for everything of type string, which is brutally inefficient.
@@ -671,10 +912,16 @@ public:
     ~PersistentCache() = default;
 
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
     static UPtr open(std::string const& cache_path);
 
     OptionalValue get(std::string const& key) const;
     OptionalData get_data(std::string const& key) const;
+    std::vector<OptionalValue> get_many(std::vector<std::string> const& keys) const;
+    std::vector<OptionalData> get_data_many(std::vector<std::string> const& keys) const;
     OptionalMetadata get_metadata(std::string const& key) const;
     bool contains_key(std::string const& key) const;
     int64_t size() const noexcept;
@@ -692,6 +939,12 @@ public:
              M const& metadata,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    bool put_many(std::vector<std::pair<std::string, V>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+    bool put_many(std::vector<std::pair<std::string, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
     typedef std::function<void(std::string const& key, PersistentCache<std::string, V, M>& cache)> Loader;
 
     OptionalValue get_or_put(std::string const& key, Loader const& load_func);
@@ -713,13 +966,21 @@ public:
     void resize(int64_t size_in_bytes);
     void trim_to(int64_t used_size_in_bytes);
     void compact();
+    void flush();
 
     typedef std::function<void(std::string const& key, CacheEvent ev, PersistentCacheStats const& stats)> EventCallback;
+    typedef PersistentStringCache::EventBatch EventBatch;
+    typedef PersistentStringCache::BatchEventCallback BatchEventCallback;
 
     void set_handler(CacheEvent events, EventCallback cb);
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
 
 private:
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -739,6 +1000,15 @@ PersistentCache<std::string, V, M>::PersistentCache(std::string const& cache_pat
 {
 }
 
+template <typename V, typename M>
+PersistentCache<std::string, V, M>::PersistentCache(std::string const& cache_path,
+                                                    int64_t max_size_in_bytes,
+                                                    CacheDiscardPolicy policy,
+                                                    PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 template <typename V, typename M>
 typename PersistentCache<std::string, V, M>::UPtr PersistentCache<std::string, V, M>::open(
     std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy)
@@ -754,24 +1024,66 @@ typename PersistentCache<std::string, V, M>::UPtr PersistentCache<std::string, V
     return PersistentCache<std::string, V, M>::UPtr(new PersistentCache<std::string, V, M>(cache_path));
 }
 
+template <typename V, typename M>
+typename PersistentCache<std::string, V, M>::UPtr PersistentCache<std::string, V, M>::open(
+    std::string const& cache_path,
+    int64_t max_size_in_bytes,
+    CacheDiscardPolicy policy,
+    PersistentCacheOptions const& options)
+{
+    return PersistentCache<std::string, V, M>::UPtr(
+        new PersistentCache<std::string, V, M>(cache_path, max_size_in_bytes, policy, options));
+}
+
 template <typename V, typename M>
 typename PersistentCache<std::string, V, M>::OptionalValue PersistentCache<std::string, V, M>::get(
     std::string const& key) const
 {
-    auto const& svalue = p_->get(key);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return internal::get_value<V>(*p_, key);
 }
 
 template <typename V, typename M>
 typename PersistentCache<std::string, V, M>::OptionalData PersistentCache<std::string, V, M>::get_data(
     std::string const& key) const
 {
-    auto sdata = p_->get_data(key);
-    if (!sdata)
+    return internal::get_data<Data, V, M>(*p_, key);
+}
+
+template <typename V, typename M>
+std::vector<typename PersistentCache<std::string, V, M>::OptionalValue>
+    PersistentCache<std::string, V, M>::get_many(std::vector<std::string> const& keys) const
+{
+    auto svalues = p_->get_many(keys);
+
+    std::vector<OptionalValue> values;
+    values.reserve(svalues.size());
+    for (auto const& svalue : svalues)
     {
-        return OptionalData();
+        values.push_back(svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue());
+    }
+    return values;
+}
+
+template <typename V, typename M>
+std::vector<typename PersistentCache<std::string, V, M>::OptionalData>
+    PersistentCache<std::string, V, M>::get_data_many(std::vector<std::string> const& keys) const
+{
+    auto sdata_many = p_->get_data_many(keys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({internal::Codec<V>::decode(sdata->value), internal::Codec<M>::decode(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), CacheCodec<M>::decode(sdata->metadata)});
+    return data;
 }
 
 template <typename V, typename M>
@@ -779,7 +1091,7 @@ typename PersistentCache<std::string, V, M>::OptionalMetadata PersistentCache<st
     std::string const& key) const
 {
     auto smeta = p_->get_metadata(key);
-    return smeta ? OptionalMetadata(CacheCodec<M>::decode(*smeta)) : OptionalMetadata();
+    return smeta ? OptionalMetadata(internal::Codec<M>::decode(*smeta)) : OptionalMetadata();
 }
 
 template <typename V, typename M>
@@ -829,7 +1141,7 @@ bool PersistentCache<std::string, V, M>::put(std::string const& key,
                                              V const& value,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(key, CacheCodec<V>::encode(value), expiry_time);
+    return p_->put(key, internal::Encoded<V>(value).str(), expiry_time);
 }
 
 template <typename V, typename M>
@@ -838,7 +1150,35 @@ bool PersistentCache<std::string, V, M>::put(std::string const& key,
                                              M const& metadata,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(key, CacheCodec<V>::encode(value), CacheCodec<M>::encode(metadata), expiry_time);
+    return p_->put(key, internal::Encoded<V>(value).str(), internal::Encoded<M>(metadata).str(), expiry_time);
+}
+
+template <typename V, typename M>
+bool PersistentCache<std::string, V, M>::put_many(std::vector<std::pair<std::string, V>> const& entries,
+                                                  std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, std::string>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        sentries.emplace_back(e.first, internal::Codec<V>::encode(e.second));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
+template <typename V, typename M>
+bool PersistentCache<std::string, V, M>::put_many(std::vector<std::pair<std::string, Data>> const& entries,
+                                                  std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{internal::Codec<V>::encode(e.second.value),
+                                         internal::Codec<M>::encode(e.second.metadata)};
+        sentries.emplace_back(e.first, std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
 }
 
 template <typename V, typename M>
@@ -850,7 +1190,7 @@ typename PersistentCache<std::string, V, M>::OptionalValue PersistentCache<std::
         load_func(key, *this);
     };
     auto svalue = p_->get_or_put(key, sload_func);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename V, typename M>
@@ -866,13 +1206,13 @@ typename PersistentCache<std::string, V, M>::OptionalData PersistentCache<std::s
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename V, typename M>
 bool PersistentCache<std::string, V, M>::put_metadata(std::string const& key, M const& metadata)
 {
-    return p_->put_metadata(key, CacheCodec<M>::encode(metadata));
+    return p_->put_metadata(key, internal::Encoded<M>(metadata).str());
 }
 
 template <typename V, typename M>
@@ -880,7 +1220,7 @@ typename PersistentCache<std::string, V, M>::OptionalValue PersistentCache<std::
     std::string const& key)
 {
     auto svalue = p_->take(key);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename V, typename M>
@@ -892,7 +1232,7 @@ typename PersistentCache<std::string, V, M>::OptionalData PersistentCache<std::s
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename V, typename M>
@@ -962,12 +1302,24 @@ void PersistentCache<std::string, V, M>::compact()
     p_->compact();
 }
 
+template <typename V, typename M>
+void PersistentCache<std::string, V, M>::flush()
+{
+    p_->flush();
+}
+
 template <typename V, typename M>
 void PersistentCache<std::string, V, M>::set_handler(CacheEvent events, EventCallback cb)
 {
     p_->set_handler(events, cb);
 }
 
+template <typename V, typename M>
+void PersistentCache<std::string, V, M>::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    p_->set_batch_handler(events, cb);
+}
+
 // Specialization for V = std::string.
 
 template <typename K, typename M>
@@ -996,10 +1348,16 @@ public:
     ~PersistentCache() = default;
 
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
     static UPtr open(std::string const& cache_path);
 
     OptionalValue get(K const& key) const;
     OptionalData get_data(K const& key) const;
+    std::vector<OptionalValue> get_many(std::vector<K> const& keys) const;
+    std::vector<OptionalData> get_data_many(std::vector<K> const& keys) const;
     OptionalMetadata get_metadata(K const& key) const;
     bool contains_key(K const& key) const;
     int64_t size() const noexcept;
@@ -1026,6 +1384,12 @@ public:
              M const& metadata,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    bool put_many(std::vector<std::pair<K, std::string>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+    bool put_many(std::vector<std::pair<K, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
     typedef std::function<void(K const& key, PersistentCache<K, std::string, M>& cache)> Loader;
 
     OptionalValue get_or_put(K const& key, Loader const& load_func);
@@ -1047,13 +1411,21 @@ public:
     void resize(int64_t size_in_bytes);
     void trim_to(int64_t used_size_in_bytes);
     void compact();
+    void flush();
 
     typedef std::function<void(K const& key, CacheEvent ev, PersistentCacheStats const& stats)> EventCallback;
+    typedef std::vector<std::pair<K, CacheEvent>> EventBatch;
+    typedef std::function<void(EventBatch const& events, PersistentCacheStats const& stats)> BatchEventCallback;
 
     void set_handler(CacheEvent events, EventCallback cb);
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
 
 private:
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -1073,6 +1445,15 @@ PersistentCache<K, std::string, M>::PersistentCache(std::string const& cache_pat
 {
 }
 
+template <typename K, typename M>
+PersistentCache<K, std::string, M>::PersistentCache(std::string const& cache_path,
+                                                    int64_t max_size_in_bytes,
+                                                    CacheDiscardPolicy policy,
+                                                    PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::UPtr PersistentCache<K, std::string, M>::open(
     std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy)
@@ -1088,10 +1469,21 @@ typename PersistentCache<K, std::string, M>::UPtr PersistentCache<K, std::string
     return PersistentCache<K, std::string, M>::UPtr(new PersistentCache<K, std::string, M>(cache_path));
 }
 
+template <typename K, typename M>
+typename PersistentCache<K, std::string, M>::UPtr PersistentCache<K, std::string, M>::open(
+    std::string const& cache_path,
+    int64_t max_size_in_bytes,
+    CacheDiscardPolicy policy,
+    PersistentCacheOptions const& options)
+{
+    return PersistentCache<K, std::string, M>::UPtr(
+        new PersistentCache<K, std::string, M>(cache_path, max_size_in_bytes, policy, options));
+}
+
 template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::OptionalValue PersistentCache<K, std::string, M>::get(K const& key) const
 {
-    auto const& svalue = p_->get(CacheCodec<K>::encode(key));
+    auto const& svalue = p_->get(internal::Encoded<K>(key).str());
     return svalue ? OptionalValue(*svalue) : OptionalValue();
 }
 
@@ -1099,26 +1491,67 @@ template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::OptionalData PersistentCache<K, std::string, M>::get_data(
     K const& key) const
 {
-    auto sdata = p_->get_data(CacheCodec<K>::encode(key));
+    auto sdata = p_->get_data(internal::Encoded<K>(key).str());
     if (!sdata)
     {
         return OptionalData();
     }
-    return OptionalData({sdata->value, CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({sdata->value, internal::Codec<M>::decode(sdata->metadata)});
+}
+
+template <typename K, typename M>
+std::vector<typename PersistentCache<K, std::string, M>::OptionalValue>
+    PersistentCache<K, std::string, M>::get_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
+    {
+        skeys.push_back(internal::Codec<K>::encode(key));
+    }
+    return p_->get_many(skeys);
+}
+
+template <typename K, typename M>
+std::vector<typename PersistentCache<K, std::string, M>::OptionalData>
+    PersistentCache<K, std::string, M>::get_data_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
+    {
+        skeys.push_back(internal::Codec<K>::encode(key));
+    }
+    auto sdata_many = p_->get_data_many(skeys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({std::move(sdata->value), internal::Codec<M>::decode(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
+    }
+    return data;
 }
 
 template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::OptionalMetadata PersistentCache<K, std::string, M>::get_metadata(
     K const& key) const
 {
-    auto smeta = p_->get_metadata(CacheCodec<K>::encode(key));
-    return smeta ? OptionalMetadata(CacheCodec<M>::decode(*smeta)) : OptionalMetadata();
+    auto smeta = p_->get_metadata(internal::Encoded<K>(key).str());
+    return smeta ? OptionalMetadata(internal::Codec<M>::decode(*smeta)) : OptionalMetadata();
 }
 
 template <typename K, typename M>
 bool PersistentCache<K, std::string, M>::contains_key(K const& key) const
 {
-    return p_->contains_key(CacheCodec<K>::encode(key));
+    return p_->contains_key(internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename M>
@@ -1162,7 +1595,7 @@ bool PersistentCache<K, std::string, M>::put(K const& key,
                                              std::string const& value,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), value, expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), value, expiry_time);
 }
 
 template <typename K, typename M>
@@ -1171,7 +1604,7 @@ bool PersistentCache<K, std::string, M>::put(K const& key,
                                              int64_t size,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), value, size, expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), value, size, expiry_time);
 }
 
 template <typename K, typename M>
@@ -1180,7 +1613,7 @@ bool PersistentCache<K, std::string, M>::put(K const& key,
                                              M const& metadata,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), value, CacheCodec<M>::encode(metadata), expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), value, internal::Encoded<M>(metadata).str(), expiry_time);
 }
 
 template <typename K, typename M>
@@ -1190,15 +1623,43 @@ bool PersistentCache<K, std::string, M>::put(K const& key,
                                              M const& metadata,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    std::string md = CacheCodec<M>::encode(metadata);
-    return p_->put(CacheCodec<K>::encode(key), value, size, md.data(), md.size(), expiry_time);
+    std::string md = internal::Codec<M>::encode(metadata);
+    return p_->put(internal::Encoded<K>(key).str(), value, size, md.data(), md.size(), expiry_time);
+}
+
+template <typename K, typename M>
+bool PersistentCache<K, std::string, M>::put_many(std::vector<std::pair<K, std::string>> const& entries,
+                                                  std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, std::string>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), e.second);
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
+template <typename K, typename M>
+bool PersistentCache<K, std::string, M>::put_many(std::vector<std::pair<K, Data>> const& entries,
+                                                  std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{e.second.value,
+                                         internal::Codec<M>::encode(e.second.metadata)};
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
 }
 
 template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::OptionalValue PersistentCache<K, std::string, M>::get_or_put(
     K const& key, PersistentCache<K, std::string, M>::Loader const& load_func)
 {
-    std::string const& skey = CacheCodec<K>::encode(key);
+    std::string const& skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
@@ -1211,7 +1672,7 @@ template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::OptionalData PersistentCache<K, std::string, M>::get_or_put_data(
     K const& key, PersistentCache<K, std::string, M>::Loader const& load_func)
 {
-    std::string const& skey = CacheCodec<K>::encode(key);
+    std::string const& skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
@@ -1221,19 +1682,19 @@ typename PersistentCache<K, std::string, M>::OptionalData PersistentCache<K, std
     {
         return OptionalData();
     }
-    return OptionalData({sdata->value, CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({sdata->value, internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename K, typename M>
 bool PersistentCache<K, std::string, M>::put_metadata(K const& key, M const& metadata)
 {
-    return p_->put_metadata(CacheCodec<K>::encode(key), CacheCodec<M>::encode(metadata));
+    return p_->put_metadata(internal::Encoded<K>(key).str(), internal::Encoded<M>(metadata).str());
 }
 
 template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::OptionalValue PersistentCache<K, std::string, M>::take(K const& key)
 {
-    auto svalue = p_->take(CacheCodec<K>::encode(key));
+    auto svalue = p_->take(internal::Encoded<K>(key).str());
     return svalue ? OptionalValue(*svalue) : OptionalValue();
 }
 
@@ -1241,18 +1702,18 @@ template <typename K, typename M>
 typename PersistentCache<K, std::string, M>::OptionalData PersistentCache<K, std::string, M>::take_data(
     K const& key)
 {
-    auto sdata = p_->take_data(CacheCodec<K>::encode(key));
+    auto sdata = p_->take_data(internal::Encoded<K>(key).str());
     if (!sdata)
     {
         return OptionalData();
     }
-    return OptionalData({sdata->value, CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({sdata->value, internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename K, typename M>
 bool PersistentCache<K, std::string, M>::invalidate(K const& key)
 {
-    return p_->invalidate(CacheCodec<K>::encode(key));
+    return p_->invalidate(internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename M>
@@ -1268,7 +1729,7 @@ void PersistentCache<K, std::string, M>::invalidate(It begin, It end)
     std::vector<std::string> skeys;
     for (auto&& it = begin; it < end; ++it)
     {
-        skeys.push_back(CacheCodec<K>::encode(*it));
+        skeys.push_back(internal::Codec<K>::encode(*it));
     }
     p_->invalidate(skeys.begin(), skeys.end());
 }
@@ -1289,7 +1750,7 @@ template <typename K, typename M>
 bool PersistentCache<K, std::string, M>::touch(K const& key,
                                                std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->touch(CacheCodec<K>::encode(key), expiry_time);
+    return p_->touch(internal::Encoded<K>(key).str(), expiry_time);
 }
 
 template <typename K, typename M>
@@ -1316,16 +1777,43 @@ void PersistentCache<K, std::string, M>::compact()
     p_->compact();
 }
 
+template <typename K, typename M>
+void PersistentCache<K, std::string, M>::flush()
+{
+    p_->flush();
+}
+
 template <typename K, typename M>
 void PersistentCache<K, std::string, M>::set_handler(CacheEvent events, EventCallback cb)
 {
     auto scb = [cb](std::string const& key, CacheEvent ev, PersistentCacheStats const& c)
     {
-        cb(CacheCodec<K>::decode(key), ev, c);
+        cb(internal::Codec<K>::decode(key), ev, c);
     };
     p_->set_handler(events, scb);
 }
 
+template <typename K, typename M>
+void PersistentCache<K, std::string, M>::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    if (!cb)
+    {
+        p_->set_batch_handler(events, nullptr);
+        return;
+    }
+    auto scb = [cb](PersistentStringCache::EventBatch const& sevents, PersistentCacheStats const& c)
+    {
+        EventBatch batch;
+        batch.reserve(sevents.size());
+        for (auto const& e : sevents)
+        {
+            batch.emplace_back(internal::Codec<K>::decode(e.first), e.second);
+        }
+        cb(batch, c);
+    };
+    p_->set_batch_handler(events, scb);
+}
+
 // Specialization for M = std::string.
 
 template <typename K, typename V>
@@ -1354,10 +1842,16 @@ public:
     ~PersistentCache() = default;
 
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
     static UPtr open(std::string const& cache_path);
 
     OptionalValue get(K const& key) const;
     OptionalData get_data(K const& key) const;
+    std::vector<OptionalValue> get_many(std::vector<K> const& keys) const;
+    std::vector<OptionalData> get_data_many(std::vector<K> const& keys) const;
     OptionalMetadata get_metadata(K const& key) const;
     bool contains_key(K const& key) const;
     int64_t size() const noexcept;
@@ -1380,6 +1874,12 @@ public:
              int64_t size,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    bool put_many(std::vector<std::pair<K, V>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+    bool put_many(std::vector<std::pair<K, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
     typedef std::function<void(K const& key, PersistentCache<K, V, std::string>& cache)> Loader;
 
     OptionalValue get_or_put(K const& key, Loader const& load_func);
@@ -1402,13 +1902,21 @@ public:
     void resize(int64_t size_in_bytes);
     void trim_to(int64_t used_size_in_bytes);
     void compact();
+    void flush();
 
     typedef std::function<void(K const& key, CacheEvent ev, PersistentCacheStats const& stats)> EventCallback;
+    typedef std::vector<std::pair<K, CacheEvent>> EventBatch;
+    typedef std::function<void(EventBatch const& events, PersistentCacheStats const& stats)> BatchEventCallback;
 
     void set_handler(CacheEvent events, EventCallback cb);
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
 
 private:
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -1428,6 +1936,15 @@ PersistentCache<K, V, std::string>::PersistentCache(std::string const& cache_pat
 {
 }
 
+template <typename K, typename V>
+PersistentCache<K, V, std::string>::PersistentCache(std::string const& cache_path,
+                                                    int64_t max_size_in_bytes,
+                                                    CacheDiscardPolicy policy,
+                                                    PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::UPtr PersistentCache<K, V, std::string>::open(
     std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy)
@@ -1443,37 +1960,91 @@ typename PersistentCache<K, V, std::string>::UPtr PersistentCache<K, V, std::str
     return PersistentCache<K, V, std::string>::UPtr(new PersistentCache<K, V, std::string>(cache_path));
 }
 
+template <typename K, typename V>
+typename PersistentCache<K, V, std::string>::UPtr PersistentCache<K, V, std::string>::open(
+    std::string const& cache_path,
+    int64_t max_size_in_bytes,
+    CacheDiscardPolicy policy,
+    PersistentCacheOptions const& options)
+{
+    return PersistentCache<K, V, std::string>::UPtr(
+        new PersistentCache<K, V, std::string>(cache_path, max_size_in_bytes, policy, options));
+}
+
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::OptionalValue PersistentCache<K, V, std::string>::get(K const& key) const
 {
-    auto const& svalue = p_->get(CacheCodec<K>::encode(key));
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return internal::get_value<V>(*p_, internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::OptionalData PersistentCache<K, V, std::string>::get_data(
     K const& key) const
 {
-    auto sdata = p_->get_data(CacheCodec<K>::encode(key));
-    if (!sdata)
+    return internal::get_data<Data, V, std::string>(*p_, internal::Encoded<K>(key).str());
+}
+
+template <typename K, typename V>
+std::vector<typename PersistentCache<K, V, std::string>::OptionalValue>
+    PersistentCache<K, V, std::string>::get_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
     {
-        return OptionalData();
+        skeys.push_back(internal::Codec<K>::encode(key));
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), sdata->metadata});
+    auto svalues = p_->get_many(skeys);
+
+    std::vector<OptionalValue> values;
+    values.reserve(svalues.size());
+    for (auto const& svalue : svalues)
+    {
+        values.push_back(svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue());
+    }
+    return values;
+}
+
+template <typename K, typename V>
+std::vector<typename PersistentCache<K, V, std::string>::OptionalData>
+    PersistentCache<K, V, std::string>::get_data_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
+    {
+        skeys.push_back(internal::Codec<K>::encode(key));
+    }
+    auto sdata_many = p_->get_data_many(skeys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({internal::Codec<V>::decode(sdata->value), std::move(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
+    }
+    return data;
 }
 
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::OptionalMetadata PersistentCache<K, V, std::string>::get_metadata(
     K const& key) const
 {
-    auto smeta = p_->get_metadata(CacheCodec<K>::encode(key));
+    auto smeta = p_->get_metadata(internal::Encoded<K>(key).str());
     return smeta ? OptionalMetadata(*smeta) : OptionalMetadata();
 }
 
 template <typename K, typename V>
 bool PersistentCache<K, V, std::string>::contains_key(K const& key) const
 {
-    return p_->contains_key(CacheCodec<K>::encode(key));
+    return p_->contains_key(internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename V>
@@ -1517,7 +2088,7 @@ bool PersistentCache<K, V, std::string>::put(K const& key,
                                              V const& value,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), CacheCodec<V>::encode(value), expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), internal::Encoded<V>(value).str(), expiry_time);
 }
 
 template <typename K, typename V>
@@ -1526,8 +2097,8 @@ bool PersistentCache<K, V, std::string>::put(K const& key,
                                              std::string const& metadata,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    std::string v = CacheCodec<V>::encode(value);
-    return p_->put(CacheCodec<K>::encode(key), v.data(), v.size(), metadata.data(), metadata.size(), expiry_time);
+    std::string v = internal::Codec<V>::encode(value);
+    return p_->put(internal::Encoded<K>(key).str(), v.data(), v.size(), metadata.data(), metadata.size(), expiry_time);
 }
 
 template <typename K, typename V>
@@ -1537,28 +2108,56 @@ bool PersistentCache<K, V, std::string>::put(K const& key,
                                              int64_t size,
                                              std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    std::string v = CacheCodec<V>::encode(value);
-    return p_->put(CacheCodec<K>::encode(key), v.data(), v.size(), metadata, size, expiry_time);
+    std::string v = internal::Codec<V>::encode(value);
+    return p_->put(internal::Encoded<K>(key).str(), v.data(), v.size(), metadata, size, expiry_time);
+}
+
+template <typename K, typename V>
+bool PersistentCache<K, V, std::string>::put_many(std::vector<std::pair<K, V>> const& entries,
+                                                  std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, std::string>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), internal::Codec<V>::encode(e.second));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
+template <typename K, typename V>
+bool PersistentCache<K, V, std::string>::put_many(std::vector<std::pair<K, Data>> const& entries,
+                                                  std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{internal::Codec<V>::encode(e.second.value),
+                                         e.second.metadata};
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
 }
 
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::OptionalValue PersistentCache<K, V, std::string>::get_or_put(
     K const& key, PersistentCache<K, V, std::string>::Loader const& load_func)
 {
-    std::string const& skey = CacheCodec<K>::encode(key);
+    std::string const& skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
     };
     auto svalue = p_->get_or_put(skey, sload_func);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::OptionalData PersistentCache<K, V, std::string>::get_or_put_data(
     K const& key, PersistentCache<K, V, std::string>::Loader const& load_func)
 {
-    std::string const& skey = CacheCodec<K>::encode(key);
+    std::string const& skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
@@ -1568,44 +2167,44 @@ typename PersistentCache<K, V, std::string>::OptionalData PersistentCache<K, V,
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), sdata->metadata});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), sdata->metadata});
 }
 
 template <typename K, typename V>
 bool PersistentCache<K, V, std::string>::put_metadata(K const& key, std::string const& metadata)
 {
-    return p_->put_metadata(CacheCodec<K>::encode(key), metadata);
+    return p_->put_metadata(internal::Encoded<K>(key).str(), metadata);
 }
 
 template <typename K, typename V>
 bool PersistentCache<K, V, std::string>::put_metadata(K const& key, char const* metadata, int64_t size)
 {
-    return p_->put_metadata(CacheCodec<K>::encode(key), metadata, size);
+    return p_->put_metadata(internal::Encoded<K>(key).str(), metadata, size);
 }
 
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::OptionalValue PersistentCache<K, V, std::string>::take(K const& key)
 {
-    auto svalue = p_->take(CacheCodec<K>::encode(key));
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    auto svalue = p_->take(internal::Encoded<K>(key).str());
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename K, typename V>
 typename PersistentCache<K, V, std::string>::OptionalData PersistentCache<K, V, std::string>::take_data(
     K const& key)
 {
-    auto sdata = p_->take_data(CacheCodec<K>::encode(key));
+    auto sdata = p_->take_data(internal::Encoded<K>(key).str());
     if (!sdata)
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), sdata->metadata});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), sdata->metadata});
 }
 
 template <typename K, typename V>
 bool PersistentCache<K, V, std::string>::invalidate(K const& key)
 {
-    return p_->invalidate(CacheCodec<K>::encode(key));
+    return p_->invalidate(internal::Encoded<K>(key).str());
 }
 
 template <typename K, typename V>
@@ -1621,7 +2220,7 @@ void PersistentCache<K, V, std::string>::invalidate(It begin, It end)
     std::vector<std::string> skeys;
     for (auto&& it = begin; it < end; ++it)
     {
-        skeys.push_back(CacheCodec<K>::encode(*it));
+        skeys.push_back(internal::Codec<K>::encode(*it));
     }
     p_->invalidate(skeys.begin(), skeys.end());
 }
@@ -1642,7 +2241,7 @@ template <typename K, typename V>
 bool PersistentCache<K, V, std::string>::touch(K const& key,
                                                std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->touch(CacheCodec<K>::encode(key), expiry_time);
+    return p_->touch(internal::Encoded<K>(key).str(), expiry_time);
 }
 
 template <typename K, typename V>
@@ -1669,16 +2268,43 @@ void PersistentCache<K, V, std::string>::compact()
     p_->compact();
 }
 
+template <typename K, typename V>
+void PersistentCache<K, V, std::string>::flush()
+{
+    p_->flush();
+}
+
 template <typename K, typename V>
 void PersistentCache<K, V, std::string>::set_handler(CacheEvent events, EventCallback cb)
 {
     auto scb = [cb](std::string const& key, CacheEvent ev, PersistentCacheStats const& c)
     {
-        cb(CacheCodec<K>::decode(key), ev, c);
+        cb(internal::Codec<K>::decode(key), ev, c);
     };
     p_->set_handler(events, scb);
 }
 
+template <typename K, typename V>
+void PersistentCache<K, V, std::string>::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    if (!cb)
+    {
+        p_->set_batch_handler(events, nullptr);
+        return;
+    }
+    auto scb = [cb](PersistentStringCache::EventBatch const& sevents, PersistentCacheStats const& c)
+    {
+        EventBatch batch;
+        batch.reserve(sevents.size());
+        for (auto const& e : sevents)
+        {
+            batch.emplace_back(internal::Codec<K>::decode(e.first), e.second);
+        }
+        cb(batch, c);
+    };
+    p_->set_batch_handler(events, scb);
+}
+
 // Specialization for K and V = std::string.
 
 template <typename M>
@@ -1707,10 +2333,16 @@ public:
     ~PersistentCache() = default;
 
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
     static UPtr open(std::string const& cache_path);
 
     OptionalValue get(std::string const& key) const;
     OptionalData get_data(std::string const& key) const;
+    std::vector<OptionalValue> get_many(std::vector<std::string> const& keys) const;
+    std::vector<OptionalData> get_data_many(std::vector<std::string> const& keys) const;
     OptionalMetadata get_metadata(std::string const& key) const;
     bool contains_key(std::string const& key) const;
     int64_t size() const noexcept;
@@ -1737,6 +2369,12 @@ public:
              M const& metadata,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    bool put_many(std::vector<std::pair<std::string, std::string>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+    bool put_many(std::vector<std::pair<std::string, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
     typedef std::function<void(std::string const& key, PersistentCache<std::string, std::string, M>& cache)> Loader;
 
     OptionalValue get_or_put(std::string const& key, Loader const& load_func);
@@ -1758,13 +2396,21 @@ public:
     void resize(int64_t size_in_bytes);
     void trim_to(int64_t used_size_in_bytes);
     void compact();
+    void flush();
 
     typedef std::function<void(std::string const& key, CacheEvent ev, PersistentCacheStats const& stats)> EventCallback;
+    typedef PersistentStringCache::EventBatch EventBatch;
+    typedef PersistentStringCache::BatchEventCallback BatchEventCallback;
 
     void set_handler(CacheEvent events, EventCallback cb);
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
 
 private:
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -1784,6 +2430,15 @@ PersistentCache<std::string, std::string, M>::PersistentCache(std::string const&
 {
 }
 
+template <typename M>
+PersistentCache<std::string, std::string, M>::PersistentCache(std::string const& cache_path,
+                                                              int64_t max_size_in_bytes,
+                                                              CacheDiscardPolicy policy,
+                                                              PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 template <typename M>
 typename PersistentCache<std::string, std::string, M>::UPtr PersistentCache<std::string, std::string, M>::open(
     std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy)
@@ -1800,6 +2455,17 @@ typename PersistentCache<std::string, std::string, M>::UPtr PersistentCache<std:
         new PersistentCache<std::string, std::string, M>(cache_path));
 }
 
+template <typename M>
+typename PersistentCache<std::string, std::string, M>::UPtr PersistentCache<std::string, std::string, M>::open(
+    std::string const& cache_path,
+    int64_t max_size_in_bytes,
+    CacheDiscardPolicy policy,
+    PersistentCacheOptions const& options)
+{
+    return PersistentCache<std::string, std::string, M>::UPtr(
+        new PersistentCache<std::string, std::string, M>(cache_path, max_size_in_bytes, policy, options));
+}
+
 template <typename M>
 typename PersistentCache<std::string, std::string, M>::OptionalValue PersistentCache<std::string, std::string, M>::get(
     std::string const& key) const
@@ -1817,7 +2483,36 @@ typename PersistentCache<std::string, std::string, M>::OptionalData
     {
         return OptionalData();
     }
-    return OptionalData({sdata->value, CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({sdata->value, internal::Codec<M>::decode(sdata->metadata)});
+}
+
+template <typename M>
+std::vector<typename PersistentCache<std::string, std::string, M>::OptionalValue>
+    PersistentCache<std::string, std::string, M>::get_many(std::vector<std::string> const& keys) const
+{
+    return p_->get_many(keys);
+}
+
+template <typename M>
+std::vector<typename PersistentCache<std::string, std::string, M>::OptionalData>
+    PersistentCache<std::string, std::string, M>::get_data_many(std::vector<std::string> const& keys) const
+{
+    auto sdata_many = p_->get_data_many(keys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({std::move(sdata->value), internal::Codec<M>::decode(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
+    }
+    return data;
 }
 
 template <typename M>
@@ -1825,7 +2520,7 @@ typename PersistentCache<std::string, std::string, M>::OptionalMetadata
     PersistentCache<std::string, std::string, M>::get_metadata(std::string const& key) const
 {
     auto smeta = p_->get_metadata(key);
-    return smeta ? OptionalMetadata(CacheCodec<M>::decode(*smeta)) : OptionalMetadata();
+    return smeta ? OptionalMetadata(internal::Codec<M>::decode(*smeta)) : OptionalMetadata();
 }
 
 template <typename M>
@@ -1893,7 +2588,7 @@ bool PersistentCache<std::string, std::string, M>::put(std::string const& key,
                                                        M const& metadata,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(key, value, CacheCodec<M>::encode(metadata), expiry_time);
+    return p_->put(key, value, internal::Encoded<M>(metadata).str(), expiry_time);
 }
 
 template <typename M>
@@ -1903,10 +2598,34 @@ bool PersistentCache<std::string, std::string, M>::put(std::string const& key,
                                                        M const& metadata,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    std::string md = CacheCodec<M>::encode(metadata);
+    std::string md = internal::Codec<M>::encode(metadata);
     return p_->put(key, value, size, md.data(), md.size(), expiry_time);
 }
 
+template <typename M>
+bool PersistentCache<std::string, std::string, M>::put_many(
+    std::vector<std::pair<std::string, std::string>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    return p_->put_many(entries, expiry_time);
+}
+
+template <typename M>
+bool PersistentCache<std::string, std::string, M>::put_many(
+    std::vector<std::pair<std::string, Data>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{e.second.value,
+                                         internal::Codec<M>::encode(e.second.metadata)};
+        sentries.emplace_back(e.first, std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
 template <typename M>
 typename PersistentCache<std::string, std::string, M>::OptionalValue
     PersistentCache<std::string, std::string, M>::get_or_put(
@@ -1934,13 +2653,13 @@ typename PersistentCache<std::string, std::string, M>::OptionalData
     {
         return OptionalData();
     }
-    return OptionalData({sdata->value, CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({sdata->value, internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename M>
 bool PersistentCache<std::string, std::string, M>::put_metadata(std::string const& key, M const& metadata)
 {
-    return p_->put_metadata(key, CacheCodec<M>::encode(metadata));
+    return p_->put_metadata(key, internal::Encoded<M>(metadata).str());
 }
 
 template <typename M>
@@ -1960,7 +2679,7 @@ typename PersistentCache<std::string, std::string, M>::OptionalData
     {
         return OptionalData();
     }
-    return OptionalData({sdata->value, CacheCodec<M>::decode(sdata->metadata)});
+    return OptionalData({sdata->value, internal::Codec<M>::decode(sdata->metadata)});
 }
 
 template <typename M>
@@ -2030,12 +2749,24 @@ void PersistentCache<std::string, std::string, M>::compact()
     p_->compact();
 }
 
+template <typename M>
+void PersistentCache<std::string, std::string, M>::flush()
+{
+    p_->flush();
+}
+
 template <typename M>
 void PersistentCache<std::string, std::string, M>::set_handler(CacheEvent events, EventCallback cb)
 {
     p_->set_handler(events, cb);
 }
 
+template <typename M>
+void PersistentCache<std::string, std::string, M>::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    p_->set_batch_handler(events, cb);
+}
+
 // Specialization for K and M = std::string.
 
 template <typename V>
@@ -2064,10 +2795,16 @@ public:
     ~PersistentCache() = default;
 
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
     static UPtr open(std::string const& cache_path);
 
     OptionalValue get(std::string const& key) const;
     OptionalData get_data(std::string const& key) const;
+    std::vector<OptionalValue> get_many(std::vector<std::string> const& keys) const;
+    std::vector<OptionalData> get_data_many(std::vector<std::string> const& keys) const;
     OptionalMetadata get_metadata(std::string const& key) const;
     bool contains_key(std::string const& key) const;
     int64_t size() const noexcept;
@@ -2090,6 +2827,12 @@ public:
              int64_t size,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    bool put_many(std::vector<std::pair<std::string, V>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+    bool put_many(std::vector<std::pair<std::string, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
     typedef std::function<void(std::string const& key, PersistentCache<std::string, V, std::string>& cache)> Loader;
 
     OptionalValue get_or_put(std::string const& key, Loader const& load_func);
@@ -2112,13 +2855,21 @@ public:
     void resize(int64_t size_in_bytes);
     void trim_to(int64_t used_size_in_bytes);
     void compact();
+    void flush();
 
     typedef std::function<void(std::string const& key, CacheEvent ev, PersistentCacheStats const& stats)> EventCallback;
+    typedef PersistentStringCache::EventBatch EventBatch;
+    typedef PersistentStringCache::BatchEventCallback BatchEventCallback;
 
     void set_handler(CacheEvent events, EventCallback cb);
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
 
 private:
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -2138,6 +2889,15 @@ PersistentCache<std::string, V, std::string>::PersistentCache(std::string const&
 {
 }
 
+template <typename V>
+PersistentCache<std::string, V, std::string>::PersistentCache(std::string const& cache_path,
+                                                              int64_t max_size_in_bytes,
+                                                              CacheDiscardPolicy policy,
+                                                              PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 template <typename V>
 typename PersistentCache<std::string, V, std::string>::UPtr PersistentCache<std::string, V, std::string>::open(
     std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy)
@@ -2154,24 +2914,66 @@ typename PersistentCache<std::string, V, std::string>::UPtr PersistentCache<std:
         new PersistentCache<std::string, V, std::string>(cache_path));
 }
 
+template <typename V>
+typename PersistentCache<std::string, V, std::string>::UPtr PersistentCache<std::string, V, std::string>::open(
+    std::string const& cache_path,
+    int64_t max_size_in_bytes,
+    CacheDiscardPolicy policy,
+    PersistentCacheOptions const& options)
+{
+    return PersistentCache<std::string, V, std::string>::UPtr(
+        new PersistentCache<std::string, V, std::string>(cache_path, max_size_in_bytes, policy, options));
+}
+
 template <typename V>
 typename PersistentCache<std::string, V, std::string>::OptionalValue PersistentCache<std::string, V, std::string>::get(
     std::string const& key) const
 {
-    auto const& svalue = p_->get(key);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return internal::get_value<V>(*p_, key);
 }
 
 template <typename V>
 typename PersistentCache<std::string, V, std::string>::OptionalData
     PersistentCache<std::string, V, std::string>::get_data(std::string const& key) const
 {
-    auto sdata = p_->get_data(key);
-    if (!sdata)
+    return internal::get_data<Data, V, std::string>(*p_, key);
+}
+
+template <typename V>
+std::vector<typename PersistentCache<std::string, V, std::string>::OptionalValue>
+    PersistentCache<std::string, V, std::string>::get_many(std::vector<std::string> const& keys) const
+{
+    auto svalues = p_->get_many(keys);
+
+    std::vector<OptionalValue> values;
+    values.reserve(svalues.size());
+    for (auto const& svalue : svalues)
     {
-        return OptionalData();
+        values.push_back(svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue());
+    }
+    return values;
+}
+
+template <typename V>
+std::vector<typename PersistentCache<std::string, V, std::string>::OptionalData>
+    PersistentCache<std::string, V, std::string>::get_data_many(std::vector<std::string> const& keys) const
+{
+    auto sdata_many = p_->get_data_many(keys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({internal::Codec<V>::decode(sdata->value), std::move(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), sdata->metadata});
+    return data;
 }
 
 template <typename V>
@@ -2229,7 +3031,7 @@ bool PersistentCache<std::string, V, std::string>::put(std::string const& key,
                                                        V const& value,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(key, CacheCodec<V>::encode(value), expiry_time);
+    return p_->put(key, internal::Encoded<V>(value).str(), expiry_time);
 }
 
 template <typename V>
@@ -2238,7 +3040,7 @@ bool PersistentCache<std::string, V, std::string>::put(std::string const& key,
                                                        std::string const& metadata,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    std::string v = CacheCodec<V>::encode(value);
+    std::string v = internal::Codec<V>::encode(value);
     return p_->put(key, v.data(), v.size(), metadata.data(), metadata.size(), expiry_time);
 }
 
@@ -2249,10 +3051,40 @@ bool PersistentCache<std::string, V, std::string>::put(std::string const& key,
                                                        int64_t size,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    std::string v = CacheCodec<V>::encode(value);
+    std::string v = internal::Codec<V>::encode(value);
     return p_->put(key, v.data(), v.size(), metadata, size, expiry_time);
 }
 
+template <typename V>
+bool PersistentCache<std::string, V, std::string>::put_many(
+    std::vector<std::pair<std::string, V>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, std::string>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        sentries.emplace_back(e.first, internal::Codec<V>::encode(e.second));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
+template <typename V>
+bool PersistentCache<std::string, V, std::string>::put_many(
+    std::vector<std::pair<std::string, Data>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{internal::Codec<V>::encode(e.second.value),
+                                         e.second.metadata};
+        sentries.emplace_back(e.first, std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
 template <typename V>
 typename PersistentCache<std::string, V, std::string>::OptionalValue
     PersistentCache<std::string, V, std::string>::get_or_put(
@@ -2263,7 +3095,7 @@ typename PersistentCache<std::string, V, std::string>::OptionalValue
         load_func(key, *this);
     };
     auto svalue = p_->get_or_put(key, sload_func);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename V>
@@ -2280,7 +3112,7 @@ typename PersistentCache<std::string, V, std::string>::OptionalData
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), sdata->metadata});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), sdata->metadata});
 }
 
 template <typename V>
@@ -2302,7 +3134,7 @@ typename PersistentCache<std::string, V, std::string>::OptionalValue PersistentC
     std::string const& key)
 {
     auto svalue = p_->take(key);
-    return svalue ? OptionalValue(CacheCodec<V>::decode(*svalue)) : OptionalValue();
+    return svalue ? OptionalValue(internal::Codec<V>::decode(*svalue)) : OptionalValue();
 }
 
 template <typename V>
@@ -2314,7 +3146,7 @@ typename PersistentCache<std::string, V, std::string>::OptionalData
     {
         return OptionalData();
     }
-    return OptionalData({CacheCodec<V>::decode(sdata->value), sdata->metadata});
+    return OptionalData({internal::Codec<V>::decode(sdata->value), sdata->metadata});
 }
 
 template <typename V>
@@ -2384,12 +3216,24 @@ void PersistentCache<std::string, V, std::string>::compact()
     p_->compact();
 }
 
+template <typename V>
+void PersistentCache<std::string, V, std::string>::flush()
+{
+    p_->flush();
+}
+
 template <typename V>
 void PersistentCache<std::string, V, std::string>::set_handler(CacheEvent events, EventCallback cb)
 {
     p_->set_handler(events, cb);
 }
 
+template <typename V>
+void PersistentCache<std::string, V, std::string>::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    p_->set_batch_handler(events, cb);
+}
+
 // Specialization for V and M = std::string.
 
 template <typename K>
@@ -2418,10 +3262,16 @@ public:
     ~PersistentCache() = default;
 
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
     static UPtr open(std::string const& cache_path);
 
     OptionalValue get(K const& key) const;
     OptionalData get_data(K const& key) const;
+    std::vector<OptionalValue> get_many(std::vector<K> const& keys) const;
+    std::vector<OptionalData> get_data_many(std::vector<K> const& keys) const;
     OptionalMetadata get_metadata(K const& key) const;
     bool contains_key(K const& key) const;
     int64_t size() const noexcept;
@@ -2449,6 +3299,12 @@ public:
              int64_t metadata_size,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    bool put_many(std::vector<std::pair<K, std::string>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+    bool put_many(std::vector<std::pair<K, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
     typedef std::function<void(K const& key, PersistentCache<K, std::string, std::string>& cache)> Loader;
 
     OptionalValue get_or_put(K const& key, Loader const& load_func);
@@ -2471,13 +3327,21 @@ public:
     void resize(int64_t size_in_bytes);
     void trim_to(int64_t used_size_in_bytes);
     void compact();
+    void flush();
 
     typedef std::function<void(K const& key, CacheEvent ev, PersistentCacheStats const& stats)> EventCallback;
+    typedef std::vector<std::pair<K, CacheEvent>> EventBatch;
+    typedef std::function<void(EventBatch const& events, PersistentCacheStats const& stats)> BatchEventCallback;
 
     void set_handler(CacheEvent events, EventCallback cb);
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
 
 private:
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -2497,6 +3361,15 @@ PersistentCache<K, std::string, std::string>::PersistentCache(std::string const&
 {
 }
 
+template <typename K>
+PersistentCache<K, std::string, std::string>::PersistentCache(std::string const& cache_path,
+                                                              int64_t max_size_in_bytes,
+                                                              CacheDiscardPolicy policy,
+                                                              PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 template <typename K>
 typename PersistentCache<K, std::string, std::string>::UPtr PersistentCache<K, std::string, std::string>::open(
     std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy)
@@ -2513,11 +3386,22 @@ typename PersistentCache<K, std::string, std::string>::UPtr PersistentCache<K, s
         new PersistentCache<K, std::string, std::string>(cache_path));
 }
 
+template <typename K>
+typename PersistentCache<K, std::string, std::string>::UPtr PersistentCache<K, std::string, std::string>::open(
+    std::string const& cache_path,
+    int64_t max_size_in_bytes,
+    CacheDiscardPolicy policy,
+    PersistentCacheOptions const& options)
+{
+    return PersistentCache<K, std::string, std::string>::UPtr(
+        new PersistentCache<K, std::string, std::string>(cache_path, max_size_in_bytes, policy, options));
+}
+
 template <typename K>
 typename PersistentCache<K, std::string, std::string>::OptionalValue PersistentCache<K, std::string, std::string>::get(
     K const& key) const
 {
-    auto const& svalue = p_->get(CacheCodec<K>::encode(key));
+    auto const& svalue = p_->get(internal::Encoded<K>(key).str());
     return svalue ? OptionalValue(*svalue) : OptionalValue();
 }
 
@@ -2525,7 +3409,7 @@ template <typename K>
 typename PersistentCache<K, std::string, std::string>::OptionalData
     PersistentCache<K, std::string, std::string>::get_data(K const& key) const
 {
-    auto sdata = p_->get_data(CacheCodec<K>::encode(key));
+    auto sdata = p_->get_data(internal::Encoded<K>(key).str());
     if (!sdata)
     {
         return OptionalData();
@@ -2533,18 +3417,59 @@ typename PersistentCache<K, std::string, std::string>::OptionalData
     return OptionalData({sdata->value, sdata->metadata});
 }
 
+template <typename K>
+std::vector<typename PersistentCache<K, std::string, std::string>::OptionalValue>
+    PersistentCache<K, std::string, std::string>::get_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
+    {
+        skeys.push_back(internal::Codec<K>::encode(key));
+    }
+    return p_->get_many(skeys);
+}
+
+template <typename K>
+std::vector<typename PersistentCache<K, std::string, std::string>::OptionalData>
+    PersistentCache<K, std::string, std::string>::get_data_many(std::vector<K> const& keys) const
+{
+    std::vector<std::string> skeys;
+    skeys.reserve(keys.size());
+    for (auto const& key : keys)
+    {
+        skeys.push_back(internal::Codec<K>::encode(key));
+    }
+    auto sdata_many = p_->get_data_many(skeys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({std::move(sdata->value), std::move(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
+    }
+    return data;
+}
+
 template <typename K>
 typename PersistentCache<K, std::string, std::string>::OptionalMetadata
     PersistentCache<K, std::string, std::string>::get_metadata(K const& key) const
 {
-    auto smeta = p_->get_metadata(CacheCodec<K>::encode(key));
+    auto smeta = p_->get_metadata(internal::Encoded<K>(key).str());
     return smeta ? OptionalMetadata(*smeta) : OptionalMetadata();
 }
 
 template <typename K>
 bool PersistentCache<K, std::string, std::string>::contains_key(K const& key) const
 {
-    return p_->contains_key(CacheCodec<K>::encode(key));
+    return p_->contains_key(internal::Encoded<K>(key).str());
 }
 
 template <typename K>
@@ -2588,7 +3513,7 @@ bool PersistentCache<K, std::string, std::string>::put(K const& key,
                                                        std::string const& value,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), value, expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), value, expiry_time);
 }
 
 template <typename K>
@@ -2597,7 +3522,7 @@ bool PersistentCache<K, std::string, std::string>::put(K const& key,
                                                        int64_t size,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), value, size, expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), value, size, expiry_time);
 }
 
 template <typename K>
@@ -2606,7 +3531,7 @@ bool PersistentCache<K, std::string, std::string>::put(K const& key,
                                                        std::string const& metadata,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), value, metadata, expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), value, metadata, expiry_time);
 }
 
 template <typename K>
@@ -2617,7 +3542,37 @@ bool PersistentCache<K, std::string, std::string>::put(K const& key,
                                                        int64_t metadata_size,
                                                        std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->put(CacheCodec<K>::encode(key), value, value_size, metadata, metadata_size, expiry_time);
+    return p_->put(internal::Encoded<K>(key).str(), value, value_size, metadata, metadata_size, expiry_time);
+}
+
+template <typename K>
+bool PersistentCache<K, std::string, std::string>::put_many(
+    std::vector<std::pair<K, std::string>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, std::string>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), e.second);
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
+template <typename K>
+bool PersistentCache<K, std::string, std::string>::put_many(
+    std::vector<std::pair<K, Data>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{e.second.value,
+                                         e.second.metadata};
+        sentries.emplace_back(internal::Codec<K>::encode(e.first), std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
 }
 
 template <typename K>
@@ -2625,7 +3580,7 @@ typename PersistentCache<K, std::string, std::string>::OptionalValue
     PersistentCache<K, std::string, std::string>::get_or_put(
         K const& key, PersistentCache<K, std::string, std::string>::Loader const& load_func)
 {
-    auto skey = CacheCodec<K>::encode(key);
+    auto skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
@@ -2639,7 +3594,7 @@ typename PersistentCache<K, std::string, std::string>::OptionalData
     PersistentCache<K, std::string, std::string>::get_or_put_data(
         K const& key, PersistentCache<K, std::string, std::string>::Loader const& load_func)
 {
-    auto skey = CacheCodec<K>::encode(key);
+    auto skey = internal::Codec<K>::encode(key);
     auto sload_func = [&](std::string const&, PersistentStringCache const&)
     {
         load_func(key, *this);
@@ -2655,20 +3610,20 @@ typename PersistentCache<K, std::string, std::string>::OptionalData
 template <typename K>
 bool PersistentCache<K, std::string, std::string>::put_metadata(K const& key, std::string const& metadata)
 {
-    return p_->put_metadata(CacheCodec<K>::encode(key), metadata);
+    return p_->put_metadata(internal::Encoded<K>(key).str(), metadata);
 }
 
 template <typename K>
 bool PersistentCache<K, std::string, std::string>::put_metadata(K const& key, char const* metadata, int64_t size)
 {
-    return p_->put_metadata(CacheCodec<K>::encode(key), metadata, size);
+    return p_->put_metadata(internal::Encoded<K>(key).str(), metadata, size);
 }
 
 template <typename K>
 typename PersistentCache<K, std::string, std::string>::OptionalValue PersistentCache<K, std::string, std::string>::take(
     K const& key)
 {
-    auto svalue = p_->take(CacheCodec<K>::encode(key));
+    auto svalue = p_->take(internal::Encoded<K>(key).str());
     return svalue ? OptionalValue(*svalue) : OptionalValue();
 }
 
@@ -2676,7 +3631,7 @@ template <typename K>
 typename PersistentCache<K, std::string, std::string>::OptionalData
     PersistentCache<K, std::string, std::string>::take_data(K const& key)
 {
-    auto sdata = p_->take_data(CacheCodec<K>::encode(key));
+    auto sdata = p_->take_data(internal::Encoded<K>(key).str());
     if (!sdata)
     {
         return OptionalData();
@@ -2687,7 +3642,7 @@ typename PersistentCache<K, std::string, std::string>::OptionalData
 template <typename K>
 bool PersistentCache<K, std::string, std::string>::invalidate(K const& key)
 {
-    return p_->invalidate(CacheCodec<K>::encode(key));
+    return p_->invalidate(internal::Encoded<K>(key).str());
 }
 
 template <typename K>
@@ -2703,7 +3658,7 @@ void PersistentCache<K, std::string, std::string>::invalidate(It begin, It end)
     std::vector<std::string> skeys;
     for (auto&& it = begin; it < end; ++it)
     {
-        skeys.push_back(CacheCodec<K>::encode(*it));
+        skeys.push_back(internal::Codec<K>::encode(*it));
     }
     p_->invalidate(skeys.begin(), skeys.end());
 }
@@ -2724,7 +3679,7 @@ template <typename K>
 bool PersistentCache<K, std::string, std::string>::touch(K const& key,
                                                          std::chrono::time_point<std::chrono::system_clock> expiry_time)
 {
-    return p_->touch(CacheCodec<K>::encode(key), expiry_time);
+    return p_->touch(internal::Encoded<K>(key).str(), expiry_time);
 }
 
 template <typename K>
@@ -2751,16 +3706,43 @@ void PersistentCache<K, std::string, std::string>::compact()
     p_->compact();
 }
 
+template <typename K>
+void PersistentCache<K, std::string, std::string>::flush()
+{
+    p_->flush();
+}
+
 template <typename K>
 void PersistentCache<K, std::string, std::string>::set_handler(CacheEvent events, EventCallback cb)
 {
     auto scb = [cb](std::string const& key, CacheEvent ev, PersistentCacheStats const& c)
     {
-        cb(CacheCodec<K>::decode(key), ev, c);
+        cb(internal::Codec<K>::decode(key), ev, c);
     };
     p_->set_handler(events, scb);
 }
 
+template <typename K>
+void PersistentCache<K, std::string, std::string>::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    if (!cb)
+    {
+        p_->set_batch_handler(events, nullptr);
+        return;
+    }
+    auto scb = [cb](PersistentStringCache::EventBatch const& sevents, PersistentCacheStats const& c)
+    {
+        EventBatch batch;
+        batch.reserve(sevents.size());
+        for (auto const& e : sevents)
+        {
+            batch.emplace_back(internal::Codec<K>::decode(e.first), e.second);
+        }
+        cb(batch, c);
+    };
+    p_->set_batch_handler(events, scb);
+}
+
 // Specialization for K, V, and M = std::string.
 
 template <>
@@ -2789,10 +3771,16 @@ public:
     ~PersistentCache() = default;
 
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
     static UPtr open(std::string const& cache_path);
 
     OptionalValue get(std::string const& key) const;
     OptionalData get_data(std::string const& key) const;
+    std::vector<OptionalValue> get_many(std::vector<std::string> const& keys) const;
+    std::vector<OptionalData> get_data_many(std::vector<std::string> const& keys) const;
     OptionalMetadata get_metadata(std::string const& key) const;
     bool contains_key(std::string const& key) const;
     int64_t size() const noexcept;
@@ -2820,6 +3808,12 @@ public:
              int64_t metadata_size,
              std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
 
+    bool put_many(std::vector<std::pair<std::string, std::string>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+    bool put_many(std::vector<std::pair<std::string, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
     typedef std::function<void(std::string const& key, PersistentCache<std::string, std::string, std::string>& cache)>
         Loader;
 
@@ -2843,13 +3837,21 @@ public:
     void resize(int64_t size_in_bytes);
     void trim_to(int64_t used_size_in_bytes);
     void compact();
+    void flush();
 
     typedef std::function<void(std::string const& key, CacheEvent ev, PersistentCacheStats const& stats)> EventCallback;
+    typedef PersistentStringCache::EventBatch EventBatch;
+    typedef PersistentStringCache::BatchEventCallback BatchEventCallback;
 
     void set_handler(CacheEvent events, EventCallback cb);
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
 
 private:
     PersistentCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentCache(std::string const& cache_path,
+                    int64_t max_size_in_bytes,
+                    CacheDiscardPolicy policy,
+                    PersistentCacheOptions const& options);
     PersistentCache(std::string const& cache_path);
 
     std::unique_ptr<PersistentStringCache> p_;
@@ -2867,6 +3869,14 @@ PersistentCache<std::string, std::string, std::string>::PersistentCache(std::str
 {
 }
 
+PersistentCache<std::string, std::string, std::string>::PersistentCache(std::string const& cache_path,
+                                                                        int64_t max_size_in_bytes,
+                                                                        CacheDiscardPolicy policy,
+                                                                        PersistentCacheOptions const& options)
+    : p_(PersistentStringCache::open(cache_path, max_size_in_bytes, policy, options))
+{
+}
+
 typename PersistentCache<std::string, std::string, std::string>::UPtr
     PersistentCache<std::string, std::string, std::string>::open(std::string const& cache_path,
                                                                  int64_t max_size_in_bytes,
@@ -2883,6 +3893,16 @@ typename PersistentCache<std::string, std::string, std::string>::UPtr
         new PersistentCache<std::string, std::string, std::string>(cache_path));
 }
 
+typename PersistentCache<std::string, std::string, std::string>::UPtr
+    PersistentCache<std::string, std::string, std::string>::open(std::string const& cache_path,
+                                                                 int64_t max_size_in_bytes,
+                                                                 CacheDiscardPolicy policy,
+                                                                 PersistentCacheOptions const& options)
+{
+    return PersistentCache<std::string, std::string, std::string>::UPtr(
+        new PersistentCache<std::string, std::string, std::string>(cache_path, max_size_in_bytes, policy, options));
+}
+
 typename PersistentCache<std::string, std::string, std::string>::OptionalValue
     PersistentCache<std::string, std::string, std::string>::get(std::string const& key) const
 {
@@ -2901,6 +3921,33 @@ typename PersistentCache<std::string, std::string, std::string>::OptionalData
     return OptionalData({sdata->value, sdata->metadata});
 }
 
+std::vector<typename PersistentCache<std::string, std::string, std::string>::OptionalValue>
+    PersistentCache<std::string, std::string, std::string>::get_many(std::vector<std::string> const& keys) const
+{
+    return p_->get_many(keys);
+}
+
+std::vector<typename PersistentCache<std::string, std::string, std::string>::OptionalData>
+    PersistentCache<std::string, std::string, std::string>::get_data_many(std::vector<std::string> const& keys) const
+{
+    auto sdata_many = p_->get_data_many(keys);
+
+    std::vector<OptionalData> data;
+    data.reserve(sdata_many.size());
+    for (auto& sdata : sdata_many)
+    {
+        if (sdata)
+        {
+            data.push_back(OptionalData({std::move(sdata->value), std::move(sdata->metadata)}));
+        }
+        else
+        {
+            data.push_back(OptionalData());
+        }
+    }
+    return data;
+}
+
 typename PersistentCache<std::string, std::string, std::string>::OptionalMetadata
     PersistentCache<std::string, std::string, std::string>::get_metadata(std::string const& key) const
 {
@@ -2978,6 +4025,28 @@ bool PersistentCache<std::string, std::string, std::string>::put(
     return p_->put(key, value, value_size, metadata, metadata_size, expiry_time);
 }
 
+bool PersistentCache<std::string, std::string, std::string>::put_many(
+    std::vector<std::pair<std::string, std::string>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    return p_->put_many(entries, expiry_time);
+}
+
+bool PersistentCache<std::string, std::string, std::string>::put_many(
+    std::vector<std::pair<std::string, Data>> const& entries,
+    std::chrono::time_point<std::chrono::system_clock> expiry_time)
+{
+    std::vector<std::pair<std::string, PersistentStringCache::Data>> sentries;
+    sentries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        PersistentStringCache::Data data{e.second.value,
+                                         e.second.metadata};
+        sentries.emplace_back(e.first, std::move(data));
+    }
+    return p_->put_many(sentries, expiry_time);
+}
+
 typename PersistentCache<std::string, std::string, std::string>::OptionalValue
     PersistentCache<std::string, std::string, std::string>::get_or_put(
         std::string const& key, PersistentCache<std::string, std::string, std::string>::Loader const& load_func)
@@ -3094,11 +4163,22 @@ void PersistentCache<std::string, std::string, std::string>::compact()
     p_->compact();
 }
 
+void PersistentCache<std::string, std::string, std::string>::flush()
+{
+    p_->flush();
+}
+
 void PersistentCache<std::string, std::string, std::string>::set_handler(CacheEvent events, EventCallback cb)
 {
     p_->set_handler(events, cb);
 }
 
+void PersistentCache<std::string, std::string, std::string>::set_batch_handler(CacheEvent events,
+                                                                              BatchEventCallback cb)
+{
+    p_->set_batch_handler(events, cb);
+}
+
 // @endcond
 
 }  // namespace core
@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <core/cache_durability.h>
+
+#include <chrono>
+#include <cstdint>
+
+namespace core
+{
+
+/**
+\brief Tuning options for a cache.
+
+A default-constructed instance provides the same behavior as a cache that
+is opened without options. To change a setting, modify the corresponding
+data member before passing the options to `open()`.
+
+\see PersistentStringCache::open()
+*/
+
+struct PersistentCacheOptions
+{
+    /** @name Access time updates
+    */
+
+    //{@
+
+    /**
+    \brief Defers updates of the access time on a cache hit.
+
+    By default, every hit writes the new access time of the entry to disk.
+    If `defer_access_time_updates` is `true`, a hit records the new access time
+    in memory only. Recorded access times are written to disk in a single batch
+    once `access_time_flush_interval` has elapsed since the previous write, once
+    `max_pending_access_times` entries are pending, before the cache evicts entries,
+    and when the cache is closed.
+
+    Because the access time is stored together with the value of an entry, each
+    access time update rewrites the entry. Deferring the updates is therefore
+    most effective for caches with large values.
+
+    \note If the process terminates without closing the cache, access times that
+    were recorded since the previous write are lost. This affects only the LRU order
+    of the affected entries, not their contents.
+    */
+    bool defer_access_time_updates = false;
+
+    /**
+    \brief The maximum time for which a deferred access time update remains in memory.
+    */
+    std::chrono::milliseconds access_time_flush_interval = std::chrono::milliseconds(1000);
+
+    /**
+    \brief The maximum number of entries with a deferred access time update.
+    */
+    int64_t max_pending_access_times = 10000;
+
+    //@}
+
+    /** @name In-memory tier
+    */
+
+    //{@
+
+    /**
+    \brief The size in bytes of an in-memory tier for frequently accessed entries.
+
+    If `memory_cache_size` is greater than zero, the cache keeps copies of recently
+    read entries in memory, up to a total size (key, value, and metadata) of
+    `memory_cache_size` bytes. A hit on an entry in memory is served without accessing
+    the database. Entries are added to the in-memory tier when they are read, and the least
+    recently read entries are dropped from memory once the tier is full. The in-memory tier
+    is kept consistent with the database by all operations that update or remove entries.
+
+    The access time of a hit that is served from memory is written to disk in the same
+    way as for deferred access time updates (see `access_time_flush_interval` and
+    `max_pending_access_times`).
+
+    For a sharded cache, the size is divided evenly among the shards.
+
+    \see PersistentCacheStats::memory_hits()
+    */
+    int64_t memory_cache_size = 0;
+
+    //@}
+
+    /** @name Expiry
+    */
+
+    //{@
+
+    /**
+    \brief The interval at which expired entries are removed in the background, or zero for no background removal.
+
+    By default, expired entries remain in the cache until a `put()` needs the space they
+    occupy. Until then, they take up disk space and count towards `size_in_bytes()`, and
+    the `put()` that eventually removes them must do so before it can proceed.
+
+    If `expiry_reap_interval` is greater than zero and the policy is `lru_ttl`, a background
+    thread removes expired entries at the given interval. The thread locks the cache only while it
+    removes at most `expiry_reap_batch_size` entries, so other operations can proceed in between.
+    The `evict_ttl` event handler is called on the background thread.
+
+    For a sharded cache, each partition has its own background thread.
+    */
+    std::chrono::milliseconds expiry_reap_interval = std::chrono::milliseconds(0);
+
+    /**
+    \brief The maximum number of expired entries that the background thread removes at a time.
+    */
+    int64_t expiry_reap_batch_size = 1000;
+
+    //@}
+
+    /** @name Background eviction
+    */
+
+    //{@
+
+    /**
+    \brief The fraction of the maximum cache size above which entries are evicted in the background.
+
+    By default, a `put()` that does not fit into the cache evicts entries in LRU order before
+    it writes the new entry. Once the cache is full, this means that nearly every `put()` also
+    pays for an eviction.
+
+    If `eviction_high_watermark` is less than 1, a background thread evicts entries once a
+    put takes the size of the cache above `eviction_high_watermark * max_size_in_bytes`,
+    until the size drops to `eviction_low_watermark * max_size_in_bytes` or below. The space
+    between the high watermark and the maximum size absorbs puts while the background
+    thread catches up. A `put()` evicts entries itself only if the entry does not fit into
+    the remaining space. The `evict_lru` event handler is called on the background thread
+    for entries that it evicts.
+
+    The background thread holds the cache lock while it evicts at most `write_buffer_size`
+    bytes at a time.
+    */
+    double eviction_high_watermark = 1.0;
+
+    /**
+    \brief The fraction of the maximum cache size down to which entries are evicted in the background.
+
+    The value must not be greater than `eviction_high_watermark`.
+    */
+    double eviction_low_watermark = 1.0;
+
+    //@}
+
+    /** @name Segmented LRU
+    */
+
+    //{@
+
+    /**
+    \brief The fraction of the maximum cache size that the protected segment may occupy.
+
+    This setting applies only to caches with the `segmented_lru` policy. Entries that are
+    accessed more than once are kept in the protected segment, up to
+    `protected_fraction * max_size_in_bytes` bytes. The remainder of the cache holds
+    entries that were accessed only once. A larger fraction protects more of the working set
+    from scans, but leaves less room for new entries to prove themselves before they are evicted.
+
+    \see CacheDiscardPolicy
+    */
+    double protected_fraction = 0.8;
+
+    //@}
+
+    /** @name Admission filter
+    */
+
+    //{@
+
+    /**
+    \brief Rejects new entries that are accessed less often than the entries they would displace.
+
+    By default, a `put()` that does not fit into the cache always evicts entries to make room, even if the
+    new entry is less likely to be accessed again than the entries it evicts.
+
+    If `admission_filter` is `true`, the cache estimates how often each key is accessed with a compact
+    frequency sketch. Every `get()` (hit or miss) and every `put()` counts as an access. Once the cache is full,
+    a `put()` that adds a new entry compares the estimated frequency of its key with the frequencies
+    of the entries that it would evict in LRU order. If any of these entries was accessed at least as often
+    as the new key, the `put()` does not add the entry and returns `false`. Updates of existing entries
+    and `put_many()` are not filtered, and neither are puts that fit into the cache without evicting entries.
+    For `get_or_put()`, a rejected put means that no value is returned.
+    The frequencies decay over time, so keys that were popular in the past but are no longer
+    accessed do not keep out new entries indefinitely.
+
+    The sketch is saved when the cache is closed and restored when it is next opened, so the
+    frequencies are not lost across restarts. It is also saved at each `admission_sketch_save_interval`,
+    so a crash loses only the accesses since the most recent save.
+
+    \see PersistentCacheStats::rejected_puts()
+    */
+    bool admission_filter = false;
+
+    /**
+    \brief The number of counters per row of the frequency sketch.
+
+    The value should be about the number of entries that the cache holds. It is rounded up to the
+    next power of two. The sketch occupies four bytes per counter. For a sharded cache, the counters are
+    divided evenly among the shards.
+    */
+    int64_t admission_sketch_size = 64 * 1024;
+
+    /**
+    \brief The interval at which a background thread saves the frequency sketch, or zero to save it only
+    when the cache is closed.
+
+    Saving the sketch writes all of its counters, and the cache is locked while they are copied,
+    so the interval should not be too short.
+    */
+    std::chrono::milliseconds admission_sketch_save_interval = std::chrono::milliseconds(60 * 1000);
+
+    //@}
+
+    /** @name Invalidation
+    */
+
+    //{@
+
+    /**
+    \brief Deletes the entries of the cache in the background after a call to `invalidate()`.
+
+    A call to `invalidate()` without arguments makes all entries inaccessible immediately, regardless
+    of the number of entries. By default, `invalidate()` then deletes the entries from disk before
+    it returns, which takes a long time for a large cache.
+
+    If `background_invalidate` is `true`, `invalidate()` returns immediately, and a background thread
+    deletes the entries. The thread holds the cache lock only while it deletes a small batch of entries,
+    and compacts the database once all entries are deleted. The `invalidate` event handler is called on
+    the background thread. Until then, `disk_size_in_bytes()` includes the deleted entries.
+
+    If the cache is closed before all entries are deleted, the remainder is deleted once the cache is
+    next opened.
+    */
+    bool background_invalidate = false;
+
+    //@}
+
+    /** @name Recovery
+    */
+
+    //{@
+
+    /**
+    \brief The number of writes after which the cache statistics are saved to disk, or zero to save
+    them only when the cache is closed.
+
+    If a cache is not closed cleanly (for example, because the process crashed), the number of entries
+    and their sizes must be recovered when the cache is next opened. Without saved statistics, this
+    requires a scan over all entries, which can take a long time for a large cache.
+
+    If `stats_checkpoint_interval` is greater than zero, each write that adds or removes entries also records
+    the change to the statistics, and the statistics are saved every `stats_checkpoint_interval` writes.
+    After a crash, the cache applies the changes recorded since the most recently saved statistics
+    instead of scanning all entries. This adds a small row to every such write, so it is off by default.
+    An interval of 1000 keeps the cost of the checkpoints low while bounding the number of changes
+    that must be applied after a crash.
+    */
+    int64_t stats_checkpoint_interval = 0;
+
+    //@}
+
+    /** @name Durability
+    */
+
+    //{@
+
+    /**
+    \brief Determines when writes are flushed to disk.
+
+    The default of `CacheDurability::none` never waits for the disk. Use `CacheDurability::sync`
+    if the cache holds data that must survive a machine crash, and `CacheDurability::periodic` to bound
+    the amount of data that a machine crash can lose without paying for a flush on every write.
+
+    The setting applies only while the cache is open.
+
+    \see CacheDurability
+    \see PersistentCacheStats::Operation::sync
+    */
+    CacheDurability durability = CacheDurability::none;
+
+    /**
+    \brief The interval at which writes are flushed to disk with `CacheDurability::periodic`.
+    */
+    std::chrono::milliseconds sync_interval = std::chrono::milliseconds(1000);
+
+    //@}
+
+    /** @name Write-behind
+    */
+
+    //{@
+
+    /**
+    \brief Buffers puts in memory and writes them to disk in batches.
+
+    By default, each `put()` writes its entry to disk (and evicts entries as needed) before it returns.
+    If `write_behind` is `true`, `put()` stages the entry in memory and returns `true` immediately.
+    A background thread writes the staged entries every `write_behind_interval`, with a single write
+    and a single eviction pass for all of them. A `put()` that takes the staged entries to
+    `write_behind_max_bytes` or more writes them before it returns, so the buffer cannot
+    grow without bound.
+
+    Staged entries are visible to `get()`, `get_view()`, `get_metadata()`, `contains_key()`, and `get_or_put()`.
+    `take()`, `touch()`, `put_metadata()`, and `put_many()` write the staged entries first, and
+    `invalidate()` discards the staged entries it applies to. `size()`, `size_in_bytes()`, and the
+    statistics do not include staged entries until they are written.
+
+    Staged entries are not subject to the admission filter, and the `put` event handler is called when an
+    entry is written rather than when it is staged. Staged entries are written when the cache is closed,
+    or when `flush()` is called. Staged entries that expire before they are written are discarded. If the
+    process crashes, the staged entries are lost.
+
+    \see PersistentStringCache::flush()
+    */
+    bool write_behind = false;
+
+    /**
+    \brief The interval at which staged entries are written with `write_behind`.
+    */
+    std::chrono::milliseconds write_behind_interval = std::chrono::milliseconds(100);
+
+    /**
+    \brief The total size of staged entries at which `put()` writes them before it returns.
+
+    If the maximum size of the cache is smaller, it is the limit instead. Staged entries count towards
+    the size of the cache for evictions and the admission filter. For a sharded cache, the limit applies to each shard.
+    */
+    int64_t write_behind_max_bytes = 4 * 1024 * 1024;
+
+    //@}
+
+    /** @name Event dispatch
+    */
+
+    //{@
+
+    /**
+    \brief Delivers events to the event handlers on a separate thread.
+
+    By default, event handlers are called by the thread that causes an event, while that thread
+    holds the cache lock. A slow handler therefore delays the operation that caused the event, as
+    well as all other operations on the cache. For example, a `put()` that evicts many entries
+    calls the `evict_lru` handler for each evicted entry before it returns.
+
+    If `async_events` is `true`, events are appended to a queue with room for `event_queue_size`
+    events, and a dispatch thread delivers them to the handlers in the order in which they occurred.
+    Appending an event to the queue does not block. If the handlers do not keep up and the queue is
+    full, further events are dropped until there is room again.
+    The `stats` parameter of a handler reflects the state of the cache when the event is delivered,
+    which can be later than when the event occurred. Events that are queued when the cache is closed
+    are delivered before the cache is closed.
+
+    For a sharded cache, each partition has its own queue and dispatch thread.
+
+    \see PersistentStringCache::set_batch_handler()
+    \see PersistentCacheStats::dropped_events()
+    */
+    bool async_events = false;
+
+    /**
+    \brief The maximum number of events in the queue of the dispatch thread.
+
+    The value is rounded up to the next power of two.
+    */
+    int64_t event_queue_size = 8192;
+
+    //@}
+
+    /** @name Database tuning
+
+    These settings are passed to the underlying leveldb database.
+
+    `bloom_filter_bits_per_key`, `block_size`, and `compression` determine how
+    data is written to disk. They are recorded in the cache: if an existing cache is
+    opened with `open(cache_path)`, the recorded values are used; if it is opened with
+    another overload, the values passed to `open()` replace the recorded ones.
+    The remaining settings apply only while the cache is open.
+    */
+
+    //{@
+
+    /**
+    \brief The number of bits per key for the bloom filter, or zero for no bloom filter.
+
+    A bloom filter allows most lookups of non-existent keys to complete without
+    reading from disk. The default of 10 bits per key yields a false positive rate
+    of about 1%.
+    */
+    int bloom_filter_bits_per_key = 10;
+
+    /**
+    \brief The approximate size of the data that is packed into a block on disk.
+    */
+    int64_t block_size = 4 * 1024;
+
+    /**
+    \brief Whether blocks are compressed on disk.
+    */
+    bool compression = true;
+
+    /**
+    \brief The size of the in-memory block cache of the database, or zero for automatic sizing.
+
+    With automatic sizing, the block cache is 10% of the maximum cache size, but at least
+    512 kB and at most 8 MB. For a sharded cache, the size is divided evenly among the shards.
+    */
+    int64_t block_cache_size = 0;
+
+    /**
+    \brief The amount of data that is accumulated in memory before it is written to disk.
+    */
+    int64_t write_buffer_size = 4 * 1024 * 1024;
+
+    /**
+    \brief The maximum number of files that the database keeps open.
+    */
+    int max_open_files = 1000;
+
+    /**
+    \brief Enables aggressive consistency checks in the database.
+
+    With paranoid checks, the database refuses to open if it detects internal
+    corruption, instead of attempting to recover as much data as possible.
+    */
+    bool paranoid_checks = false;
+
+    //@}
+
+    /** @name Sharding
+    */
+
+    //{@
+
+    /**
+    \brief The number of independently locked partitions of the cache.
+
+    By default, all operations on a cache are serialized. If `num_shards` is
+    greater than one, keys are distributed over `num_shards` partitions by hash
+    value, and each partition is stored in a separate database with its own lock.
+    Operations on keys in different partitions can proceed concurrently.
+    Operations that are not specific to a key, such as `size()`, `stats()`,
+    `invalidate()`, or `resize()`, apply to all partitions.
+
+    The maximum size of the cache is divided evenly among the partitions, and each
+    partition discards entries independently of the others once it is full.
+    This means that the cache can hold no entry that is larger than
+    `max_size_in_bytes / num_shards`, and that the discard order is only
+    approximately LRU across the cache as a whole. Invalidating several keys
+    at once is atomic per partition only.
+
+    A sharded cache is stored in sub-directories of the cache path. The number
+    of partitions is fixed when the cache is created; opening an existing cache
+    with a different value throws `logic_error`.
+    */
+    int num_shards = 1;
+
+    //@}
+};
+
+}  // namespace core
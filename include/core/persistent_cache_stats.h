@@ -31,6 +31,7 @@ namespace internal
 {
 
 class PersistentStringCacheImpl;
+class ShardedStringCacheImpl;
 class PersistentStringCacheStats;
 
 }  // namespace internal
@@ -67,7 +68,7 @@ public:
     std::string cache_path() const;
 
     /**
-    \brief Returns the discard policy (`lru_only` or `lru_ttl`).
+    \brief Returns the discard policy (`lru_only`, `lru_ttl`, `segmented_lru`, or `gdsf`).
     */
     CacheDiscardPolicy policy() const noexcept;
 
@@ -147,6 +148,45 @@ public:
     */
     int64_t lru_evictions() const noexcept;
 
+    /**
+    \brief Returns the number of hits that were served by the in-memory tier.
+
+    Hits served by the in-memory tier are included in the count returned by hits().
+    If the cache has no in-memory tier, the return value is always zero.
+
+    \see PersistentCacheOptions::memory_cache_size
+    */
+    int64_t memory_hits() const noexcept;
+
+    /**
+    \brief Returns the number of lookups that were not served by the in-memory tier.
+
+    Each of these lookups went to the database and counts as a hit or miss there.
+    If the cache has no in-memory tier, the return value is always zero.
+
+    \see PersistentCacheOptions::memory_cache_size
+    */
+    int64_t memory_misses() const noexcept;
+
+    /**
+    \brief Returns the number of events that were not delivered to the event handlers
+    because the event queue was full.
+
+    If events are not delivered asynchronously, the return value is always zero.
+
+    \see PersistentCacheOptions::async_events
+    */
+    int64_t dropped_events() const noexcept;
+
+    /**
+    \brief Returns the number of puts that the admission filter rejected.
+
+    If the cache has no admission filter, the return value is always zero.
+
+    \see PersistentCacheOptions::admission_filter
+    */
+    int64_t rejected_puts() const noexcept;
+
     /**
     \brief Returns the timestamp of the most recent hit.
     */
@@ -230,6 +270,101 @@ public:
 
     //@}
 
+    /** @name Latency statistics
+
+    The cache records the duration of each operation in a histogram per type of operation.
+    The duration includes the time an operation waits for other operations on the cache
+    to complete. Like the other statistics, the latency histograms are persistent and
+    are reset by `clear_stats()`.
+    */
+
+    //{@
+
+    /**
+    \brief The types of operation for which the cache records latencies.
+    */
+    enum class Operation : uint32_t
+    {
+        get,         ///< `get()`, `get_data()`, and `get_view()`
+        put,         ///< `put()`
+        take,        ///< `take()` and `take_data()`
+        invalidate,  ///< `invalidate()` of a single key, a list of keys, or all keys
+        touch,       ///< `touch()`
+        eviction,    ///< A pass that evicts entries to make room for new ones
+        compaction,  ///< `compact()`
+        sync,        ///< A flush of writes to disk (see `PersistentCacheOptions::durability`)
+        END_         ///< Not a valid operation (marks the end of the range)
+    };
+
+    /**
+    \brief Histogram of the durations of an operation.
+
+    The histogram contains the number of operations, grouped by duration in nanoseconds
+    into bins on a logarithmic scale. Index 0 to 7 contain the number of operations that took
+    0 to 7 nanoseconds. Thereafter, each power of two is divided into 8 bins of equal size,
+    so the upper bound of each bin is at most 12.5% larger than its lower bound. The final
+    bin also contains the number of operations that took 2<sup>40</sup> nanoseconds (about 18 minutes)
+    or longer.
+    */
+    typedef std::vector<uint64_t> LatencyHistogram;
+
+    /**
+    \brief Lower and upper (inclusive) bounds in nanoseconds for the bins in a latency histogram.
+    */
+    typedef std::vector<std::pair<int64_t, int64_t>> LatencyHistogramBounds;
+
+    /**
+    \brief The number of bins in a latency histogram.
+    */
+    static constexpr unsigned NUM_LATENCY_BINS = 304;
+
+    /**
+    \brief Returns the number of operations of the given type that were recorded.
+    */
+    int64_t num_operations(Operation op) const noexcept;
+
+    /**
+    \brief Returns the latency histogram for the given type of operation.
+    */
+    LatencyHistogram latency_histogram(Operation op) const;
+
+    /**
+    \brief Returns the bounds for each bin of a latency histogram.
+    */
+    static LatencyHistogramBounds const& latency_histogram_bounds() noexcept;
+
+    /**
+    \brief Returns the given percentile of the durations of an operation.
+
+    \param op The type of operation.
+    \param percentile The percentile in the range [0..100], such as 99.9.
+    \return The upper bound of the histogram bin that contains the percentile (the lower bound for
+    the final bin), or zero if no operations were recorded. Values outside the range [0..100] are clamped.
+    */
+    std::chrono::nanoseconds latency_percentile(Operation op, double percentile) const noexcept;
+
+    /**
+    \brief Returns the median duration of an operation.
+    */
+    std::chrono::nanoseconds latency_p50(Operation op) const noexcept;
+
+    /**
+    \brief Returns the 90th percentile of the duration of an operation.
+    */
+    std::chrono::nanoseconds latency_p90(Operation op) const noexcept;
+
+    /**
+    \brief Returns the 99th percentile of the duration of an operation.
+    */
+    std::chrono::nanoseconds latency_p99(Operation op) const noexcept;
+
+    /**
+    \brief Returns the 99.9th percentile of the duration of an operation.
+    */
+    std::chrono::nanoseconds latency_p999(Operation op) const noexcept;
+
+    //@}
+
 private:
     PersistentCacheStats(std::shared_ptr<core::internal::PersistentStringCacheStats> const& p) noexcept;
 
@@ -244,6 +379,7 @@ private:
 
     // @cond
     friend class internal::PersistentStringCacheImpl;  // For access to constructor
+    friend class internal::ShardedStringCacheImpl;     // For access to constructor and p_
     // @endcond
 };
 
@@ -21,6 +21,7 @@
 #include <core/cache_discard_policy.h>
 #include <core/cache_events.h>
 #include <core/optional.h>
+#include <core/persistent_cache_options.h>
 #include <core/persistent_cache_stats.h>
 
 namespace core
@@ -30,6 +31,7 @@ namespace internal
 {
 
 class PersistentStringCacheImpl;
+class ShardedStringCacheImpl;
 
 }  // namespace internal
 
@@ -90,6 +92,77 @@ public:
         std::string metadata;
     };
 
+    /**
+    \brief Read-only view of the value and metadata of an entry.
+
+    A view refers to the value and metadata as they are stored by the cache, without copying them.
+    The data remains valid and unchanged for as long as the view (or a copy of it) exists, even if
+    the entry is updated or removed in the meantime.
+
+    \warning A view keeps the database state from which it was obtained alive. While a view exists,
+    the database cannot release that state, so a view should be destroyed as soon as it is no longer
+    needed. All views must be destroyed before the cache from which they were obtained.
+    \see get_view()
+    */
+    class View
+    {
+    public:
+        /**
+        \brief Constructs an empty view.
+        */
+        View() noexcept
+            : value_data_(nullptr)
+            , value_size_(0)
+            , metadata_data_(nullptr)
+            , metadata_size_(0)
+        {
+        }
+
+        /**
+        \brief Returns a pointer to the value of the entry.
+        */
+        char const* data() const noexcept
+        {
+            return value_data_;
+        }
+
+        /**
+        \brief Returns the size of the value of the entry.
+        */
+        int64_t size() const noexcept
+        {
+            return value_size_;
+        }
+
+        /**
+        \brief Returns a pointer to the metadata of the entry.
+        */
+        char const* metadata_data() const noexcept
+        {
+            return metadata_data_;
+        }
+
+        /**
+        \brief Returns the size of the metadata of the entry. If no metadata exists
+        for the entry, the size is zero.
+        */
+        int64_t metadata_size() const noexcept
+        {
+            return metadata_size_;
+        }
+
+    private:
+        // @cond
+        std::shared_ptr<void const> pin_;  // Keeps the storage for the data alive.
+        char const* value_data_;
+        int64_t value_size_;
+        char const* metadata_data_;
+        int64_t metadata_size_;
+
+        friend class internal::PersistentStringCacheImpl;
+        // @endcond
+    };
+
     /** @name Copy and Assignment
     Cache instances are not copyable, but can be moved.
     \note The constructors are private. Use one of the open()
@@ -127,7 +200,7 @@ public:
     of this directory are exlusively owned by the cache; do not create additional files
     or directories there. The directory need not exist when creating a new cache.
     \param max_size_in_bytes The maximum size in bytes for the cache.
-    \param policy The discard policy for the cache (`lru_only` or `lru_ttl`). The discard
+    \param policy The discard policy for the cache (`lru_only`, `lru_ttl`, `segmented_lru`, or `gdsf`). The discard
     policy cannot be changed once a cache has been created.
 
     The size of an entry is the sum of the sizes of its key, value, and metadata.
@@ -139,6 +212,27 @@ public:
     */
     static UPtr open(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
 
+    /**
+    \brief Creates or opens a PersistentStringCache with the specified options.
+
+    This overload behaves like open(std::string const&, int64_t, CacheDiscardPolicy), but
+    allows you to tune the behavior of the cache.
+
+    \param cache_path The path to a directory in which to store the cache.
+    \param max_size_in_bytes The maximum size in bytes for the cache.
+    \param policy The discard policy for the cache (`lru_only`, `lru_ttl`, `segmented_lru`, or `gdsf`).
+    \param options The options for the cache.
+
+    \return A <code>unique_ptr</code> to the instance.
+    \throws invalid_argument `max_size_in_bytes` is &lt; 1 or `options` contains an invalid setting.
+    \throws logic_error `max_size_in_bytes` or `policy` do not match the settings of a pre-existing cache.
+    \see PersistentCacheOptions
+    */
+    static UPtr open(std::string const& cache_path,
+                     int64_t max_size_in_bytes,
+                     CacheDiscardPolicy policy,
+                     PersistentCacheOptions const& options);
+
     /**
     \brief Opens an existing PersistentStringCache.
     \param cache_path The path to a directory containing the existing cache.
@@ -172,6 +266,48 @@ public:
     */
     Optional<Data> get_data(std::string const& key) const;
 
+    /**
+    \brief Returns a view of the data for an entry in the cache, provided the entry has not expired.
+
+    Unlike get() and get_data(), this method does not copy the value. This is useful for large values
+    that are passed on without modification, for example, by writing them to a socket.
+    \param key The key for the entry.
+    \return A null value if the entry could not be retrieved; a view of the data of the entry, otherwise.
+    \throws invalid_argument `key` is the empty string.
+    \note This operation updates the access time of the entry. Unless access time updates are deferred
+    (see PersistentCacheOptions::defer_access_time_updates), this requires the entry to be written
+    back to disk, which copies the value.
+    \see View
+    */
+    Optional<View> get_view(std::string const& key) const;
+
+    /**
+    \brief Returns the values of several entries in the cache.
+
+    Looking up several entries with a single call is more efficient than
+    calling get() for each key, because the cache is locked only once and the
+    access times of all entries that are found are written to disk together.
+    \param keys The keys for the entries.
+    \return A vector with one element per key, in the same order as `keys`.
+    Each element is null if the corresponding entry could not be retrieved, and
+    holds the value of the entry otherwise.
+    \throws invalid_argument One or more of the keys is the empty string.
+    \note This operation updates the access time of the entries that are found.
+    */
+    std::vector<Optional<std::string>> get_many(std::vector<std::string> const& keys) const;
+
+    /**
+    \brief Returns the data for several entries in the cache.
+
+    This method behaves like get_many(), but returns the metadata along with the value
+    of each entry. If no metadata exists for an entry, `Data::metadata` is set to the empty string.
+    \param keys The keys for the entries.
+    \return A vector with one element per key, in the same order as `keys`.
+    \throws invalid_argument One or more of the keys is the empty string.
+    \note This operation updates the access time of the entries that are found.
+    */
+    std::vector<Optional<Data>> get_data_many(std::vector<std::string> const& keys) const;
+
     /**
     \brief Returns the metadata for an entry in the cache, provided the entry has not expired.
     \param key The key for the entry.
@@ -223,7 +359,7 @@ public:
 
     /**
     \brief Returns the discard policy of the cache.
-    \return The discard policy (`lru_only` or `lru_ttl`).
+    \return The discard policy (`lru_only`, `lru_ttl`, `segmented_lru`, or `gdsf`).
     */
     CacheDiscardPolicy discard_policy() const noexcept;
 
@@ -233,6 +369,12 @@ public:
     The returned statistics are persistent and are restored the next
     time an existing cache is opened. Call clear_stats() to explicitly
     reset the statistics counters and time stamps to zero.
+
+    This method does not wait for other operations on the cache to complete,
+    so it is cheap to call periodically, for example, from a monitoring thread.
+    If other operations are in progress, each value is up to date, but values
+    may not be consistent with each other (for example, `size()` may already
+    include an entry that `size_in_bytes()` does not include yet).
     \return An object that provides accessors to statistics and settings.
     \see clear_stats()
     */
@@ -255,16 +397,24 @@ public:
 
     This operation deletes any metadata associated with the entry.
 
+    The optional `cost` indicates how expensive it is to re-create the entry if it
+    is not in the cache, for example, the time in milliseconds it takes to compute the
+    value. With the `gdsf` policy, entries with a higher cost per byte are kept in
+    preference to entries with a lower cost per byte. The other policies ignore the cost.
+
     \return `true` if the entry was added or updated. `false` if the policy
-    is `lru_ttl` and `expiry_time` is in the past.
+    is `lru_ttl` and `expiry_time` is in the past, or if the admission filter
+    rejected the entry (see `PersistentCacheOptions::admission_filter`).
 
     \throws invalid_argument `key` is the empty string.
+    \throws invalid_argument `cost` is not a finite value &gt; 0.
     \throws logic_error The size of the entry exceeds the maximum cache size.
-    \throws logic_error The cache policy is `lru_only` and a non-infinite expiry time was provided.
+    \throws logic_error The cache policy is not `lru_ttl` and a non-infinite expiry time was provided.
     */
     bool put(std::string const& key,
              std::string const& value,
-             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
+             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point(),
+             double cost = 1.0);
 
     /**
     \brief Adds or updates an entry.
@@ -279,23 +429,27 @@ public:
     This operation deletes any metadata associated with the entry.
 
     \return `true` if the entry was added or updated. `false` if the policy
-    is `lru_ttl` and `expiry_time` is in the past.
+    is `lru_ttl` and `expiry_time` is in the past, or if the admission filter
+    rejected the entry (see `PersistentCacheOptions::admission_filter`).
 
     \param key The key of the entry.
     \param value A pointer to the first byte of the value.
     \param size The size of the value in bytes.
     \param expiry_time The time at which the entry expires.
+    \param cost The miss cost of the entry (used only by `gdsf`).
 
     \throws invalid_argument `key` is the empty string.
     \throws invalid_argument `value` is `nullptr`.
     \throws invalid_argument `size` is negative.
+    \throws invalid_argument `cost` is not a finite value &gt; 0.
     \throws logic_error The size of the entry exceeds the maximum cache size.
-    \throws logic_error The cache policy is `lru_only` and a non-infinite expiry time was provided.
+    \throws logic_error The cache policy is not `lru_ttl` and a non-infinite expiry time was provided.
     */
     bool put(std::string const& key,
              char const* value,
              int64_t size,
-             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
+             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point(),
+             double cost = 1.0);
 
     /**
     \brief Adds or updates an entry and its metadata.
@@ -306,16 +460,19 @@ public:
     and metadata (and possibly expiry time).
 
     \return `true` if the entry was added or updated. `false` if the policy
-    is `lru_ttl` and `expiry_time` is in the past.
+    is `lru_ttl` and `expiry_time` is in the past, or if the admission filter
+    rejected the entry (see `PersistentCacheOptions::admission_filter`).
 
     \throws invalid_argument `key` is the empty string.
+    \throws invalid_argument `cost` is not a finite value &gt; 0.
     \throws logic_error The sum of sizes of the entry and metadata exceeds the maximum cache size.
-    \throws logic_error The cache policy is `lru_only` and a non-infinite expiry time was provided.
+    \throws logic_error The cache policy is not `lru_ttl` and a non-infinite expiry time was provided.
     */
     bool put(std::string const& key,
              std::string const& value,
              std::string const& metadata,
-             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
+             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point(),
+             double cost = 1.0);
 
     /**
     \brief Adds or updates an entry and its metadata.
@@ -329,7 +486,8 @@ public:
     and metadata (and possibly expiry time).
 
     \return `true` if the entry was added or updated. `false` if the policy
-    is `lru_ttl` and `expiry_time` is in the past.
+    is `lru_ttl` and `expiry_time` is in the past, or if the admission filter
+    rejected the entry (see `PersistentCacheOptions::admission_filter`).
 
     \param key The key of the entry.
     \param value A pointer to the first byte of the value.
@@ -337,17 +495,60 @@ public:
     \param metadata A pointer to the first byte of the metadata.
     \param metadata_size The size of the metadata in bytes.
     \param expiry_time The time at which the entry expires.
+    \param cost The miss cost of the entry (used only by `gdsf`).
 
     \throws invalid_argument `key` is the empty string.
+    \throws invalid_argument `cost` is not a finite value &gt; 0.
     \throws logic_error The sum of sizes of the entry and metadata exceeds the maximum cache size.
-    \throws logic_error The cache policy is `lru_only` and a non-infinite expiry time was provided.
+    \throws logic_error The cache policy is not `lru_ttl` and a non-infinite expiry time was provided.
     */
     bool put(std::string const& key,
              char const* value,
              int64_t value_size,
              char const* metadata,
              int64_t metadata_size,
-             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point());
+             std::chrono::time_point<std::chrono::system_clock> expiry_time = std::chrono::system_clock::time_point(),
+             double cost = 1.0);
+
+    /**
+    \brief Adds or updates several entries.
+
+    Adding several entries with a single call is more efficient than calling put()
+    for each entry: the cache is locked only once, room for all entries is made with a
+    single pass over the expired and least recently used entries, and the entries are
+    written to disk in a small number of batches.
+
+    The effect is the same as calling put() for each entry in order, except that all
+    entries receive the same access time. If several entries have the same key, the
+    last one wins. If the entries do not fit into the cache together, the entries at
+    the front of `entries` are discarded (together with any existing entries for their
+    keys), as they would be evicted by the later ones.
+
+    This operation deletes any metadata associated with the entries.
+
+    \param entries The keys and values of the entries.
+    \param expiry_time The time at which the entries expire.
+
+    \return `true` if the entries were added or updated. `false` if the policy
+    is `lru_ttl` and `expiry_time` is in the past.
+
+    \throws invalid_argument A key is the empty string.
+    \throws logic_error The size of an entry exceeds the maximum cache size.
+    \throws logic_error The cache policy is not `lru_ttl` and a non-infinite expiry time was provided.
+    */
+    bool put_many(std::vector<std::pair<std::string, std::string>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
+
+    /**
+    \brief Adds or updates several entries with metadata.
+
+    This method behaves like put_many() for key-value pairs, but sets the
+    metadata of each entry to `Data::metadata`.
+    */
+    bool put_many(std::vector<std::pair<std::string, Data>> const& entries,
+                  std::chrono::time_point<std::chrono::system_clock> expiry_time =
+                      std::chrono::system_clock::time_point());
 
     /**
     \brief Function called by the cache to load an entry after a cache miss.
@@ -363,16 +564,21 @@ public:
     load function succeeds in adding the entry, the value added by the load
     function is returned. The load function is called by the application thread.
 
+    The load function runs without a lock on the cache, so other threads can use the
+    cache while an entry is being loaded. If several threads call `get_or_put` for the
+    same key concurrently, only the first one calls its load function; the others wait
+    for that load to complete and return the loaded entry. If the load function throws,
+    all of the waiting threads throw the same exception.
+
     \return A null value if the entry could not be retrieved or loaded; the value of the entry, otherwise.
     \throws runtime_error The load function threw an exception.
+    \throws logic_error `get_or_put` was called from an event handler that is not called asynchronously.
+    (Such a handler runs while the calling thread holds the cache lock, so it cannot wait for a load.)
 
     \note The load function must (synchronously) call one of the overloaded `put` methods to add a
-    new entry for the provided key. Calling any other method on the cache from within the load
+    new entry for the provided key. Calling `get_or_put` for the same key from within the load
+    function throws `logic_error`. Calling any other method on the cache from within the load
     function causes undefined behavior.
-
-    \warning This operation holds a lock on the cache while the load function runs.
-    This means that, if multiple threads call into the cache, they will be blocked
-    for the duration of the load function.
     */
     Optional<std::string> get_or_put(std::string const& key, Loader const& load_func);
 
@@ -385,16 +591,21 @@ public:
     load function succeeds in adding the entry, the data added by the load
     function is returned. The load function is called by the application thread.
 
+    The load function runs without a lock on the cache, so other threads can use the
+    cache while an entry is being loaded. If several threads call `get_or_put` for the
+    same key concurrently, only the first one calls its load function; the others wait
+    for that load to complete and return the loaded entry. If the load function throws,
+    all of the waiting threads throw the same exception.
+
     \return A null value if the entry could not be retrieved or loaded; the value and metadata of the entry, otherwise.
     \throws runtime_error The load function threw an exception.
+    \throws logic_error `get_or_put` was called from an event handler that is not called asynchronously.
+    (Such a handler runs while the calling thread holds the cache lock, so it cannot wait for a load.)
 
     \note The load function must (synchronously) call one of the overloaded `put` methods to add a
-    new entry for the provided key. Calling any other method on the cache from within the load
+    new entry for the provided key. Calling `get_or_put` for the same key from within the load
+    function throws `logic_error`. Calling any other method on the cache from within the load
     function causes undefined behavior.
-
-    \warning This operation holds a lock on the cache while the load function runs.
-    This means that, if multiple threads call into the cache, they will be blocked
-    for the duration of the load function.
     */
     Optional<Data> get_or_put_data(std::string const& key, Loader const& load_func);
 
@@ -516,7 +727,7 @@ public:
 
     This operation completely empties the cache.
     \note Clearing the cache also resets the statistics counters.
-    \see clear_stats()
+    \see clear_stats(), PersistentCacheOptions::background_invalidate
     */
     void invalidate();
 
@@ -531,7 +742,7 @@ public:
     `expiry_time` is in the past.
     \throws invalid_argument `key` is the empty string.
     \throws logic_error `key` is the empty string.
-    \throws logic_error The cache policy is `lru_only` and a non-infinite expiry time was provided.
+    \throws logic_error The cache policy is not `lru_ttl` and a non-infinite expiry time was provided.
     */
     bool touch(
         std::string const& key,
@@ -578,6 +789,17 @@ public:
     */
     void compact();
 
+    /**
+    \brief Writes the entries that were staged by `put()`.
+
+    If the cache was opened with `PersistentCacheOptions::write_behind`, `put()` stages entries
+    in memory, and a background thread writes them periodically. `flush()` writes the staged
+    entries before it returns. Otherwise, this operation is a no-op.
+
+    \see PersistentCacheOptions::write_behind
+    */
+    void flush();
+
     //@}
 
     /** @name Monitoring cache activity
@@ -586,7 +808,7 @@ public:
     the cache contents change.
 
     \note Callback functions are called by the application thread that triggered the
-    corresponding event.
+    corresponding event, unless PersistentCacheOptions::async_events is set.
 
     \warning Do not invoke operations on the cache from within a callback function. Doing
     so has undefined behavior.
@@ -598,7 +820,7 @@ public:
     \brief The type of a handler function.
 
     \note Callback functions are called by the application thread that triggered the
-    corresponding event.
+    corresponding event, unless PersistentCacheOptions::async_events is set.
 
     \warning Do not invoke operations on the cache from within a callback function. Doing
     so has undefined behavior.
@@ -635,14 +857,48 @@ public:
     */
     void set_handler(CacheEvent events, EventCallback cb);
 
+    /**
+    \brief A batch of events, in the order in which they occurred.
+    */
+    typedef std::vector<std::pair<std::string, CacheEvent>> EventBatch;
+
+    /**
+    \brief The type of a batch handler function.
+
+    \param events The key and type of each event.
+    \param stats The cache statistics after the most recent event in the batch.
+    */
+    typedef std::function<void(EventBatch const& events, PersistentCacheStats const& stats)> BatchEventCallback;
+
+    /**
+    \brief Installs a handler that receives events in batches.
+
+    \param events A bitwise OR of the event types that are passed to the handler.
+    \param cb The handler to install. To cancel the batch handler, pass `nullptr`.
+
+    There is at most one batch handler; installing a handler replaces the previous one.
+    The batch handler is called in addition to any handlers installed with set_handler().
+
+    If PersistentCacheOptions::async_events is set, the batch handler receives all events that
+    were queued since the previous call. Otherwise, it is called synchronously for each event,
+    with a batch that contains only that event.
+
+    For a sharded cache, each partition delivers its own batches.
+    */
+    void set_batch_handler(CacheEvent events, BatchEventCallback cb);
+
     //@}
 
 private:
     // @cond
     PersistentStringCache(std::string const& cache_path, int64_t max_size_in_bytes, CacheDiscardPolicy policy);
+    PersistentStringCache(std::string const& cache_path,
+                          int64_t max_size_in_bytes,
+                          CacheDiscardPolicy policy,
+                          PersistentCacheOptions const& options);
     PersistentStringCache(std::string const& cache_path);
 
-    std::unique_ptr<internal::PersistentStringCacheImpl> p_;
+    std::unique_ptr<internal::ShardedStringCacheImpl> p_;
     // @endcond
 };
 
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <core/internal/event_queue.h>
+
+using namespace std;
+
+namespace core
+{
+
+namespace internal
+{
+
+namespace
+{
+
+uint64_t round_up_to_power_of_two(int64_t n)
+{
+    uint64_t p = 1;
+    while (p < uint64_t(n))
+    {
+        p <<= 1;
+    }
+    return p;
+}
+
+}  // namespace
+
+EventQueue::EventQueue(int64_t capacity)
+    : slots_(round_up_to_power_of_two(capacity))
+    , mask_(slots_.size() - 1)
+    , head_(0)
+    , tail_(0)
+    , waiting_(false)
+    , done_(false)
+{
+}
+
+bool EventQueue::push(string const& key, CacheEventIndex index)
+{
+    uint64_t const head = head_.load(memory_order_relaxed);
+    if (head - tail_.load(memory_order_acquire) == slots_.size())
+    {
+        return false;
+    }
+    auto& slot = slots_[head & mask_];
+    slot.key.assign(key);  // Reuses the slot's memory if possible.
+    slot.index = index;
+
+    // The store to head_ and the load of waiting_ must not be re-ordered. Otherwise, the consumer
+    // could see an empty queue and go to sleep after we've seen waiting_ as false.
+    head_.store(head + 1, memory_order_seq_cst);
+    if (waiting_.load(memory_order_seq_cst))
+    {
+        lock_guard<mutex> lock(mutex_);
+        cond_.notify_one();
+    }
+    return true;
+}
+
+int64_t EventQueue::pop_all(vector<Event>& events)
+{
+    uint64_t const tail = tail_.load(memory_order_relaxed);
+    uint64_t const head = head_.load(memory_order_acquire);
+    for (uint64_t i = tail; i != head; ++i)
+    {
+        auto& slot = slots_[i & mask_];
+        events.emplace_back();
+        events.back().key.swap(slot.key);
+        events.back().index = slot.index;
+    }
+    tail_.store(head, memory_order_release);
+    return head - tail;
+}
+
+bool EventQueue::wait()
+{
+    unique_lock<mutex> lock(mutex_);
+    waiting_.store(true, memory_order_seq_cst);
+    auto ready = [this]
+    {
+        return done_ || head_.load(memory_order_seq_cst) != tail_.load(memory_order_relaxed);
+    };
+    cond_.wait(lock, ready);
+    waiting_.store(false, memory_order_relaxed);
+    return head_.load(memory_order_acquire) != tail_.load(memory_order_relaxed);
+}
+
+void EventQueue::shutdown()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        done_ = true;
+    }
+    cond_.notify_one();
+}
+
+}  // namespace internal
+
+}  // namespace core
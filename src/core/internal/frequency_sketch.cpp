@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <core/internal/frequency_sketch.h>
+
+#include <core/internal/int64_encoding.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace core
+{
+
+namespace internal
+{
+
+namespace
+{
+
+uint64_t round_up_to_power_of_two(int64_t n)
+{
+    uint64_t p = 1;
+    while (p < uint64_t(n))
+    {
+        p <<= 1;
+    }
+    return p;
+}
+
+// The sketch is saved with the cache, so we can't use std::hash, which is allowed to change
+// between implementations and releases. FNV-1a on its own has poorly distributed low bits,
+// and a sharded cache assigns keys to shards by their FNV-1a hash, so we mix the result.
+
+uint64_t hash_key(string const& key) noexcept
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+}  // namespace
+
+constexpr unsigned FrequencySketch::DEPTH;
+constexpr unsigned FrequencySketch::MAX_COUNT;
+
+FrequencySketch::FrequencySketch(int64_t width)
+    : counters_(DEPTH * round_up_to_power_of_two(width))
+    , mask_(counters_.size() / DEPTH - 1)
+    , additions_(0)
+    , sample_size_(10 * int64_t(counters_.size() / DEPTH))
+{
+}
+
+// The counter for row i is at position (h + i * step) in the row. The step is odd,
+// so the positions of two keys that collide in one row are unlikely to collide in another.
+
+void FrequencySketch::increment(string const& key) noexcept
+{
+    uint64_t const h = hash_key(key);
+    uint64_t const step = (h >> 32) | 1;
+    uint64_t const width = mask_ + 1;
+    bool incremented = false;
+    for (unsigned i = 0; i < DEPTH; ++i)
+    {
+        auto& c = counters_[i * width + ((h + i * step) & mask_)];
+        if (c < MAX_COUNT)
+        {
+            ++c;
+            incremented = true;
+        }
+    }
+    if (incremented && ++additions_ >= sample_size_)
+    {
+        age();
+    }
+}
+
+unsigned FrequencySketch::estimate(string const& key) const noexcept
+{
+    uint64_t const h = hash_key(key);
+    uint64_t const step = (h >> 32) | 1;
+    uint64_t const width = mask_ + 1;
+    unsigned count = MAX_COUNT;
+    for (unsigned i = 0; i < DEPTH; ++i)
+    {
+        count = min(count, unsigned(counters_[i * width + ((h + i * step) & mask_)]));
+    }
+    return count;
+}
+
+int64_t FrequencySketch::width() const noexcept
+{
+    return mask_ + 1;
+}
+
+string FrequencySketch::serialize() const
+{
+    string s;
+    s.reserve(2 * INT64_ENCODED_SIZE + counters_.size());
+    append_int64(s, width());
+    append_int64(s, additions_);
+    s.append(reinterpret_cast<char const*>(counters_.data()), counters_.size());
+    return s;
+}
+
+bool FrequencySketch::deserialize(string const& s) noexcept
+{
+    if (s.size() != 2 * INT64_ENCODED_SIZE + counters_.size() || decode_int64(s.data()) != width())
+    {
+        return false;
+    }
+    additions_ = decode_int64(s.data() + INT64_ENCODED_SIZE);
+    memcpy(counters_.data(), s.data() + 2 * INT64_ENCODED_SIZE, counters_.size());
+    return true;
+}
+
+void FrequencySketch::age() noexcept
+{
+    for (auto& c : counters_)
+    {
+        c >>= 1;
+    }
+    additions_ /= 2;
+}
+
+}  // namespace internal
+
+}  // namespace core
@@ -18,99 +18,138 @@
 
 #include <core/internal/persistent_string_cache_impl.h>
 
+#include <core/internal/int64_encoding.h>
 #include <core/internal/persistent_string_cache_stats.h>
 
 #include <leveldb/cache.h>
+#include <leveldb/env.h>
+#include <leveldb/filter_policy.h>
 #include <leveldb/write_batch.h>
 
-#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <sstream>
 #include <system_error>
 
 /*
-    We have three tables and two secondary indexes in the DB:
+    We have one table and three secondary indexes in the DB:
 
-    - Key -> Value
-      The Values table maps keys to values.
+    - Key -> <Access time, Expiry time, Size, Metadata size, Metadata, Value>
+      The Entries table maps keys to a record that holds everything we know about
+      an entry: the access time, expiry time, and entry size (the data tuple), followed
+      by the metadata and the value. (Size is the sum of key, value, and metadata sizes.)
+      The metadata size is -1 if the entry has no metadata. Because the record contains
+      the data tuple, a hit rewrites the record with the new access time.
 
-    - Key -> <Access time, Expiry time, Size>
-      The Data table maps keys to the access time, expire time,
-      and entry size. (Size is the sum of key, value, and metadata sizes.)
-
-    - Key -> Metadata
-      The Metadata table maps keys to metadata for the entry.
-      If no metadata exists for an entry, there is no row
-      in the table.
-
-    - <Access time, Key> -> Size
+    - <Access time, Key> -> <Size, Expiry time>
       The Atime index provides access in order of oldest-to-newest access time.
       This allows efficient trimming based on LRU order.
 
-    - <Expiry time, Key> -> Size
+    - <Expiry time, Key> -> <Size, Access time>
       The Etime index provides access in order of soonest-to-latest expiry time.
       This allows efficient trimming of expired entries. For lru_only,
       no entry is added to this index, and the corresponding expiry time in the
-      Data table is 0. For lru_ttl, only entries that actually
+      record is 0. For lru_ttl, only entries that actually
       do have an expiry time are added.
 
-    The tables and indexes each map to a different region of the leveldb based on a prefix.
-    Tuple entries are separated by spaces. Entries are sorted in lexicographical order
-    by the DB; to ensure correct numerical comparison for the secondary indexes,
-    times are in milliseconds since the epoch, with fixed-width width zero padding
-    and 13 decimal digits. (That works out to more than 316 years past the epoch.)
+    - <Access time, Key> -> <Size, Expiry time>
+      The Protected index is used only by the segmented_lru policy. It has the same layout as the Atime
+      index, but its own prefix (J, see below). It holds the rows of the entries in the protected segment,
+      that is, entries that were accessed again after they were added. For segmented_lru, the Atime index
+      holds the probation segment, so each entry has a row in exactly one of the two indexes. The data tuple
+      of a protected entry stores the one's complement of its size, so the record tells which of the two
+      indexes holds the row of the entry. Moving an entry between the segments moves its index row and
+      rewrites the data tuple.
+
+    For gdsf, the Atime index is the priority index: the access time of the data tuple and the Atime index
+    hold the priority of the entry instead, so the index is sorted in lowest-to-highest order of priority.
+    The value of an Atime index row also holds the miss cost of the entry and the number of accesses,
+    which are needed to compute the new priority when the entry is accessed again. (Etime rows are not
+    used for gdsf because entries cannot expire.)
+
+    Each index row holds both times of the entry (one in the key, the other in the value),
+    so trimming can delete all rows of an entry while it iterates over an index, without
+    reading the entry's record. In turn, a hit on an entry that expires rewrites its Etime
+    index row with the new access time.
+
+    Keeping everything for an entry in a single record means that a lookup takes a single
+    read, and that each entry costs two rows (three if it expires), each with its own copy
+    of the key.
+
+    The table and indexes each map to a different region of the leveldb based on a prefix
+    (G for Entries, H for Atime, I for Etime, and J for Protected). The prefix is followed by the generation of
+    the cache (see below), and then by the key of the entry (for Entries) or by the time and the key
+    (for the indexes). Times are in milliseconds since the epoch. Times and sizes are stored in a fixed-width
+    binary encoding (eight bytes, big-endian, with the sign bit inverted; see int64_encoding.h).
+    Entries are sorted in lexicographical order by the DB; the encoding ensures that this order
+    is the same as numerical order for the secondary indexes. Because the encoded generation and times
+    have fixed width, no separator is needed between them and the key.
+    (The examples below show generations, times, and sizes in decimal, separated by spaces, for readability.)
 
     Some examples to illustrate how it hangs together with lru_ttl. (Note that,
-    in reality, all four tables really sit inside the single leveldb table, separated
-    by the prefixes of their keys. They are shown as separate tables below to
+    in reality, the table and both indexes really sit inside the single leveldb table, separated
+    by the prefixes of their keys. They are shown separately below to
     make things easier to read.)
 
     At time 0010, insert Bjarne -> Stroustrup, expires 1010,
-    at time 0020, insert Andy   -> Koenig,     expires 2020,
+    at time 0020, insert Andy   -> Koenig,     expires 2020, metadata "C++"
     at time 0030, insert Scott  -> Meyers,     does not expire
     at time 0040, insert Stan   -> Lippman,    expires 1040
 
-    Values:                         Data:
+    Entries:
 
-    Key     | Value                 Key     | Access time | Expiry time | Size
-    --------+-----------            --------+---------------------------------
-    AAndy   | Koenig                BAndy   |      20     |    2020     |  10
-    ABjarne | Stroustrup            BBjarne |      10     |    1010     |  16
-    AScott  | Meyers                BScott  |      30     |       0     |  11
-    AStan   | Lippman               BStan   |      40     |    1040     |  11
+    Key        | Access time | Expiry time | Size | Metadata size | Metadata | Value
+    -----------+-------------+-------------+------+---------------+----------+-----------
+    G 0 Andy   |      20     |    2020     |  13  |       3       |   C++    | Koenig
+    G 0 Bjarne |      10     |    1010     |  16  |      -1       |          | Stroustrup
+    G 0 Scott  |      30     |       0     |  11  |      -1       |          | Meyers
+    G 0 Stan   |      40     |    1040     |  11  |      -1       |          | Lippman
 
 
-    Atime index:                    Etime index:
+    Atime index:                                  Etime index:
 
-    Key                   | Size    Key                   | Size
-    ----------------------+-----    ----------------------+-----
-    D0000000000010 Bjarne |  16     E0000000001010 Bjarne |  16
-    D0000000000020 Andy   |  10     E0000000001040 Stan   |  11
-    D0000000000030 Scott  |  11     E0000000002020 Andy   |  10
-    D0000000000040 Stan   |  11
+    Key                     | Size | Expiry time    Key                     | Size | Access time
+    ------------------------+------+------------    ------------------------+------+------------
+    H 0 0000000010 Bjarne   |  16  |    1010        I 0 0000001010 Bjarne   |  16  |      10
+    H 0 0000000020 Andy     |  13  |    2020        I 0 0000001040 Stan     |  11  |      40
+    H 0 0000000030 Scott    |  11  |       0        I 0 0000002020 Andy     |  13  |      20
+    H 0 0000000040 Stan     |  11  |    1040
 
     Note that, because the expiry time for Scott is infinite, no entry appears in the Etime index.
 
-    At time 100, we call get("Bjarne"). This updates the Data table and Atime index with the new access time.
-    (The Values table and Etime index are unchanged.)
+    At time 100, we call get("Bjarne"). This updates the record and both indexes with the new access time.
+    (The order of the Etime index is unchanged.)
+
+    Entries:
+
+    Key        | Access time | Expiry time | Size | Metadata size | Metadata | Value
+    -----------+-------------+-------------+------+---------------+----------+-----------
+    G 0 Andy   |      20     |    2020     |  13  |       3       |   C++    | Koenig
+    G 0 Bjarne |     100     |    1010     |  16  |      -1       |          | Stroustrup
+    G 0 Scott  |      30     |       0     |  11  |      -1       |          | Meyers
+    G 0 Stan   |      40     |    1040     |  11  |      -1       |          | Lippman
 
-    Values:                         Data:
 
-    Key     | Value                 Key     | Access time | Expiry time | Size
-    --------+-----------            --------+---------------------------------
-    AAndy   | Koenig                BAndy   |      20     |    2020     |  10
-    ABjarne | Stroustrup            BBjarne |     100     |    1010     |  16
-    AScott  | Meyers                BScott  |      30     |       0     |  11
-    AStan   | Lippman               BStan   |      40     |    1040     |  11
+    Atime index:                                  Etime index:
 
+    Key                     | Size | Expiry time    Key                     | Size | Access time
+    ------------------------+------+------------    ------------------------+------+------------
+    H 0 0000000020 Andy     |  13  |    2020        I 0 0000001010 Bjarne   |  16  |     100
+    H 0 0000000030 Scott    |  11  |       0        I 0 0000001040 Stan     |  11  |      40
+    H 0 0000000040 Stan     |  11  |    1040        I 0 0000002020 Andy     |  13  |      20
+    H 0 0000000100 Bjarne   |  16  |    1010
 
-    Atime index:                    Etime index:
+    If deferred access time updates are enabled, the hit at time 100 leaves the record and index unchanged
+    and only records the new access time in memory. The record and indexes are updated
+    later, together with the access times of other hits, in a single batch. For large values,
+    this avoids rewriting the record on every hit.
 
-    Key                   | Size    Key                   | Size
-    ----------------------+-----    ----------------------+-----
-    D0000000000020 Andy   |  10     E0000000001010 Bjarne |  16
-    D0000000000030 Scott  |  11     E0000000001040 Stan   |  11
-    D0000000000040 Stan   |  11     E0000000002020 Andy   |  10
-    D0000000000100 Bjarne |  16
+    If the cache has an in-memory tier, a hit on an entry that is held in memory does not read the DB
+    at all. The new access time is recorded in memory as for deferred access time updates. Operations
+    that modify or remove an entry update or drop its in-memory copy, so the in-memory tier never
+    contains an entry that differs from the DB.
 
     In other words, the Atime and Etime indexes are always sorted in earliest-to-latest order
     of expiry; this allows us to efficiently trim the cache once it is full. The sizes are
@@ -118,19 +157,22 @@
     enough entries in order to make room for a new one.
 
     If this example were to use lru_only, the Etime index would remain empty, and the expiry times
-    in the Data table would all be chrono::duration_cast<chrono::milliseconds>(chrono::time_point()).count().
+    in the records would all be chrono::duration_cast<chrono::milliseconds>(chrono::time_point()).count().
     That value typically is zero (but this is not guaranteed by the standard).
 
-    The Metadata table simply maps each key to its metadata. If no metadata exists
-    for an entry, there is no corresponding row in the table. For example, if Andy
-    and Scott had metadata, but Stan and Bjarne didn't, we'd have:
-
-    Metadata table:
-
-    Key     | Metadata
-    --------+----------
-    CAndy   |  <data>
-    CScott  |  <data>
+    Generations: the current generation is stored in the settings under YGENERATION, and starts at 0.
+    Lookups and updates use only the rows of the current generation. invalidate() without arguments
+    either deletes all rows of the current generation immediately, or, with background_invalidate,
+    increments the generation in the same batch as the reset stats. That hides all existing entries at once.
+    The background thread then deletes the rows of the older generations in small batches
+    (drop_old_generations()) and compacts their key ranges. Rows of older generations that are left over
+    when the cache is closed are deleted when it is next opened.
+
+    Versions 3 to 6 of the schema used the prefixes A to E and had no generation in the keys.
+    Versions 3 and 4 stored the value (prefix A), the data tuple (prefix B), and the
+    metadata (prefix C) in separate tables. Versions 3 to 5 stored only the size in the index rows.
+    Caches with these versions are converted when they are opened. For other versions, all rows
+    (including those with the old prefixes) are deleted.
 */
 
 using namespace std;
@@ -146,6 +188,26 @@ namespace
 
 static string const class_name = "PersistentStringCache";  // For exception messages
 
+// Number of calls to a synchronous event handler that are in progress on this thread. Such a handler
+// runs while the thread holds the lock of the cache that raised the event (see get_or_put()).
+
+static thread_local int handler_depth = 0;
+
+struct HandlerScope
+{
+    HandlerScope() noexcept
+    {
+        ++handler_depth;
+    }
+    ~HandlerScope()
+    {
+        --handler_depth;
+    }
+};
+
+// Writes are never synced individually. For CacheDurability::periodic and CacheDurability::sync,
+// sync_writes() flushes all writes so far with a single sync.
+
 static leveldb::WriteOptions write_options;
 static leveldb::ReadOptions read_options;
 
@@ -154,7 +216,7 @@ static leveldb::ReadOptions read_options;
 // with a different schema version, the cache is simply thrown away, so
 // it will automatically be re-created using the latest schema.
 
-static int const SCHEMA_VERSION = 3;  // Increment whenever schema changes!
+static int const SCHEMA_VERSION = 8;  // Increment whenever schema changes!
 
 // Prefixes to divide the key space into logical tables/indexes.
 // All prefixes must have length 1. The end prefix must be
@@ -163,21 +225,38 @@ static int const SCHEMA_VERSION = 3;  // Increment whenever schema changes!
 //
 // Do not change the prefix without also checking that ALL_BEGIN and
 // ALL_END are still correct!
+//
+// Versions 3 to 6 of the schema used the prefixes "A" to "E" for the tables and indexes.
+// These prefixes are used only to upgrade an older cache; they are unused in the current schema.
+// Versions 3 and 4 stored the data tuple and the metadata of an entry in separate tables.
+
+static string const V6_ENTRIES_BEGIN = "A";
+static string const V4_DATA_BEGIN = "B";
+static string const V4_METADATA_BEGIN = "C";
+static string const V6_ATIME_BEGIN = "D";
+static string const V6_ETIME_BEGIN = "E";
+
+// Each key in the Entries table and the Atime, Etime, and Protected indexes starts with the table prefix,
+// followed by the encoded generation of the cache. A full invalidate() starts a new generation,
+// so the rows of older generations are no longer visible and can be dropped at leisure.
+
+static string const ENTRIES_BEGIN = "G";
+static string const ENTRIES_END = "H";
 
-static string const VALUES_BEGIN = "A";
-static string const VALUES_END = "B";
+static string const ATIME_BEGIN = "H";
+static string const ATIME_END = "I";
 
-static string const DATA_BEGIN = "B";
-static string const DATA_END = "C";
+static string const ETIME_BEGIN = "I";
+static string const ETIME_END = "J";
 
-static string const METADATA_BEGIN = "C";
-static string const METADATA_END = "D";
+static string const PROTECTED_BEGIN = "J";
+static string const PROTECTED_END = "K";
 
-static string const ATIME_BEGIN = "D";
-static string const ATIME_END = "E";
+// The stats journal records the changes to the number and sizes of entries since the most recent
+// stats checkpoint, so we can bring the stats up to date without a full scan after a crash.
 
-static string const ETIME_BEGIN = "E";
-static string const ETIME_END = "F";
+static string const JOURNAL_BEGIN = "W";
+static string const JOURNAL_END = "X";
 
 // We store the stats so they are not lost across process re-starts.
 
@@ -185,7 +264,8 @@ static string const STATS_BEGIN = "X";
 static string const STATS_END = "Y";
 
 // The settings range stores data about the cache itself, such as
-// max size and expiration policy. The prefix for this
+// max size, expiration policy, and the leveldb settings that determine how
+// data is written to disk (bloom filter, block size, compression). The prefix for this
 // range must be outside the range [ALL_BEGIN..ALL_END).
 // The schema version is there so we can change the way things are written into leveldb
 // and detect when an old cache is opened with a newer version.
@@ -200,19 +280,29 @@ static string const SETTINGS_END = "Z";
 static string const DIRTY_FLAG = "!DIRTY";
 
 // These span the entire range of keys in all tables and stats (except settings and dirty flag).
+// The range includes the prefixes of older schema versions, so a version mismatch wipes their rows, too.
 
-static string const ALL_BEGIN = VALUES_BEGIN;  // Must be lowest prefix for all tables and indexes, incl stats.
+static string const ALL_BEGIN = V6_ENTRIES_BEGIN;  // Must be lowest prefix for all tables and indexes, incl stats.
 static string const ALL_END = SETTINGS_BEGIN;  // Must be highest prefix for all tables and indexes, incl stats.
 
 static string const SETTINGS_MAX_SIZE = SETTINGS_BEGIN + "MAX_SIZE";
 static string const SETTINGS_POLICY = SETTINGS_BEGIN + "POLICY";
 static string const SETTINGS_SCHEMA_VERSION = SETTINGS_BEGIN + "SCHEMA_VERSION";
+static string const SETTINGS_BLOOM_BITS_PER_KEY = SETTINGS_BEGIN + "BLOOM_BITS_PER_KEY";
+static string const SETTINGS_BLOCK_SIZE = SETTINGS_BEGIN + "BLOCK_SIZE";
+static string const SETTINGS_COMPRESSION = SETTINGS_BEGIN + "COMPRESSION";
+static string const SETTINGS_GENERATION = SETTINGS_BEGIN + "GENERATION";
 
 static string const STATS_VALUES = STATS_BEGIN + "VALUES";
+static string const STATS_CHECKPOINT = STATS_BEGIN + "CHECKPOINT";  // Journal sequence number of STATS_VALUES.
+static string const STATS_SKETCH = STATS_BEGIN + "SKETCH";  // Frequency sketch of the admission filter.
+
+// The number of rows that invalidate() and drop_old_generations() delete in a single batch.
+
+static int64_t const DROP_BATCH_SIZE = 1000;
 
 // Simple struct to serialize/deserialize a time-key tuple.
-// For the stringified representation, time and key are
-// separated by a space.
+// The serialized representation is the encoded time, followed by the key.
 
 struct TimeKeyTuple
 {
@@ -225,15 +315,13 @@ struct TimeKeyTuple
     {
     }
 
-    TimeKeyTuple(string const& s)
+    // Pre: s does not include the table prefix.
+
+    TimeKeyTuple(leveldb::Slice const& s)
     {
-        auto pos = s.find(' ');
-        assert(pos != string::npos);
-        string t(s.substr(0, pos));
-        istringstream is(t);
-        is >> time;
-        assert(!is.bad());
-        key = s.substr(pos + 1);
+        assert(s.size() > INT64_ENCODED_SIZE);
+        time = decode_int64(s.data());
+        key.assign(s.data() + INT64_ENCODED_SIZE, s.size() - INT64_ENCODED_SIZE);
     }
 
     TimeKeyTuple(TimeKeyTuple const&) = default;
@@ -241,38 +329,234 @@ struct TimeKeyTuple
 
     TimeKeyTuple& operator=(TimeKeyTuple const&) = default;
     TimeKeyTuple& operator=(TimeKeyTuple&&) = default;
+};
+
+// Key creation methods. These methods return the key into the corresponding
+// table or index with the correct prefix and with tuple keys concatenated.
+
+// Returns the prefix for the rows of the given generation in a table or index.
+
+string k_generation(string const& prefix, int64_t generation)
+{
+    string k;
+    k.reserve(prefix.size() + INT64_ENCODED_SIZE);
+    k.append(prefix);
+    append_int64(k, generation);
+    return k;
+}
+
+string k_entry(int64_t generation, string const& key)
+{
+    string k;
+    k.reserve(ENTRIES_BEGIN.size() + INT64_ENCODED_SIZE + key.size());
+    k.append(ENTRIES_BEGIN);
+    append_int64(k, generation);
+    k.append(key);
+    return k;
+}
+
+string k_time_index(string const& prefix, int64_t time, string const& key)
+{
+    string k;
+    k.reserve(prefix.size() + INT64_ENCODED_SIZE + key.size());
+    k.append(prefix);
+    append_int64(k, time);
+    k.append(key);
+    return k;
+}
+
+string k_atime_index(int64_t generation, int64_t atime, string const& key)
+{
+    return k_time_index(k_generation(ATIME_BEGIN, generation), atime, key);
+}
+
+string k_etime_index(int64_t generation, int64_t etime, string const& key)
+{
+    return k_time_index(k_generation(ETIME_BEGIN, generation), etime, key);
+}
+
+string k_protected_index(int64_t generation, int64_t atime, string const& key)
+{
+    return k_time_index(k_generation(PROTECTED_BEGIN, generation), atime, key);
+}
+
+string k_journal(int64_t seq)
+{
+    return JOURNAL_BEGIN + encode_int64(seq);
+}
 
-    string to_string() const
+// An entry record is the encoded data tuple, followed by the encoded metadata size,
+// the metadata, and the value. If the entry has no metadata, the metadata size is -1.
+
+static constexpr unsigned DATA_TUPLE_SIZE = 3 * INT64_ENCODED_SIZE;
+static constexpr unsigned RECORD_HEADER_SIZE = DATA_TUPLE_SIZE + INT64_ENCODED_SIZE;
+
+string v_entry(string const& data, leveldb::Slice const& value, leveldb::Slice const* metadata)
+{
+    assert(data.size() == DATA_TUPLE_SIZE);
+
+    string r;
+    r.reserve(RECORD_HEADER_SIZE + (metadata ? metadata->size() : 0) + value.size());
+    r.append(data);
+    append_int64(r, metadata ? int64_t(metadata->size()) : -1);
+    if (metadata)
     {
-        // We zero-fill the time, so entries collate lexicographically in old-to-new order.
-        ostringstream os;
-        os << setfill('0') << setw(13) << time << " " << key;
-        return os.str();
+        r.append(metadata->data(), metadata->size());
     }
-};
+    r.append(value.data(), value.size());
+    return r;
+}
 
-// Key creation methods. These methods return the key into the corresponding
-// table or index with the correct prefix and with tuple keys concatenated
-// with a space separator.
+bool has_metadata(leveldb::Slice const& record)
+{
+    assert(record.size() >= RECORD_HEADER_SIZE);
+    return decode_int64(record.data() + DATA_TUPLE_SIZE) >= 0;
+}
+
+leveldb::Slice metadata_of(leveldb::Slice const& record)
+{
+    assert(record.size() >= RECORD_HEADER_SIZE);
+    int64_t size = max(decode_int64(record.data() + DATA_TUPLE_SIZE), int64_t(0));
+    return leveldb::Slice(record.data() + RECORD_HEADER_SIZE, size);
+}
+
+leveldb::Slice value_of(leveldb::Slice const& record)
+{
+    auto metadata = metadata_of(record);
+    size_t offset = RECORD_HEADER_SIZE + metadata.size();
+    return leveldb::Slice(record.data() + offset, record.size() - offset);
+}
 
-string k_data(string const& key)
+// Overwrites the data tuple at the start of a record, leaving metadata and value alone.
+
+void set_data(string& record, string const& data)
+{
+    assert(record.size() >= RECORD_HEADER_SIZE);
+    assert(data.size() == DATA_TUPLE_SIZE);
+    record.replace(0, DATA_TUPLE_SIZE, data);
+}
+
+// The value of a row in the Atime and Etime indexes is the size of the entry, followed by the other time
+// of the entry: the expiry time for the Atime index, and the access time for the Etime index.
+
+static constexpr unsigned INDEX_VALUE_SIZE = 2 * INT64_ENCODED_SIZE;
+
+string v_index(int64_t size, int64_t time)
+{
+    string v;
+    v.reserve(INDEX_VALUE_SIZE);
+    append_int64(v, size);
+    append_int64(v, time);
+    return v;
+}
+
+int64_t size_of(leveldb::Slice const& v)
+{
+    assert(v.size() >= INDEX_VALUE_SIZE);
+    return decode_int64(v.data());
+}
+
+int64_t time_of(leveldb::Slice const& v)
+{
+    assert(v.size() >= INDEX_VALUE_SIZE);
+    return decode_int64(v.data() + INT64_ENCODED_SIZE);
+}
+
+// For gdsf, priorities and costs are non-negative doubles. We store the bit pattern of a double as an int64;
+// for non-negative doubles, the bit patterns sort in the same order as the numbers they represent.
+
+static_assert(sizeof(double) == sizeof(int64_t), "unexpected size of double");
+
+int64_t double_bits(double d) noexcept
+{
+    int64_t i;
+    memcpy(&i, &d, sizeof(i));
+    return i;
+}
+
+double double_of(int64_t i) noexcept
+{
+    double d;
+    memcpy(&d, &i, sizeof(d));
+    return d;
+}
+
+// For gdsf, an Atime index row holds the miss cost and the access count of the entry after the size
+// and expiry time.
+
+static constexpr unsigned WEIGHTED_INDEX_VALUE_SIZE = INDEX_VALUE_SIZE + 2 * INT64_ENCODED_SIZE;
+
+string v_weighted_index(int64_t size, int64_t time, double cost, int64_t frequency)
+{
+    string v;
+    v.reserve(WEIGHTED_INDEX_VALUE_SIZE);
+    append_int64(v, size);
+    append_int64(v, time);
+    append_int64(v, double_bits(cost));
+    append_int64(v, frequency);
+    return v;
+}
+
+double cost_of(leveldb::Slice const& v)
+{
+    assert(v.size() == WEIGHTED_INDEX_VALUE_SIZE);
+    return double_of(decode_int64(v.data() + INDEX_VALUE_SIZE));
+}
+
+int64_t frequency_of(leveldb::Slice const& v)
+{
+    assert(v.size() == WEIGHTED_INDEX_VALUE_SIZE);
+    return decode_int64(v.data() + INDEX_VALUE_SIZE + INT64_ENCODED_SIZE);
+}
+
+// Version 4 and 5 index values hold only the size. This is used only to upgrade a version 3 cache.
+
+string v5_size(int64_t size)
+{
+    return encode_int64(size);
+}
+
+// Returns the time-key tuple for a key in the Atime or Etime index.
+
+TimeKeyTuple time_key_of(leveldb::Slice k)
 {
-    return DATA_BEGIN + key;
+    k.remove_prefix(1 + INT64_ENCODED_SIZE);  // Strip table prefix and generation.
+    return TimeKeyTuple(k);
 }
 
-string k_metadata(string const& key)
+// Version 3 of the schema stored times and sizes as decimal strings, and times
+// in the indexes as 13-digit zero-padded decimal strings separated from the key by a space.
+// These helpers are used only to upgrade a version 3 cache.
+
+bool is_decimal(leveldb::Slice const& s)
 {
-    return METADATA_BEGIN + key;
+    return !s.empty() && (isdigit(s[0]) || s[0] == '-');
 }
 
-string k_atime_index(int64_t atime, string const& key)
+// Converts a version 3 index key (without prefix) to a time-key tuple.
+
+TimeKeyTuple v3_time_key_of(leveldb::Slice const& s)
 {
-    return ATIME_BEGIN + TimeKeyTuple(atime, key).to_string();
+    string str = s.ToString();
+    auto pos = str.find(' ');
+    assert(pos != string::npos);
+    return TimeKeyTuple(stoll(str.substr(0, pos)), str.substr(pos + 1));
 }
 
-string k_etime_index(int64_t etime, string const& key)
+
+char const* policy_name(CacheDiscardPolicy policy) noexcept
 {
-    return ETIME_BEGIN + TimeKeyTuple(etime, key).to_string();
+    switch (policy)
+    {
+        case CacheDiscardPolicy::lru_ttl:
+            return "lru_ttl";
+        case CacheDiscardPolicy::lru_only:
+            return "lru_only";
+        case CacheDiscardPolicy::segmented_lru:
+            return "segmented_lru";
+        default:
+            return "gdsf";
+    }
 }
 
 // Little helpers to get milliseconds since the epoch.
@@ -296,8 +580,108 @@ int64_t epoch_ticks() noexcept
     return clock_origin;
 }
 
+// Records the duration of an operation in the latency histograms when it goes out of scope.
+// For the public operations, the timer must be created before the cache lock is acquired,
+// so the recorded latency includes the time spent waiting for the lock.
+
+class LatencyTimer
+{
+public:
+    LatencyTimer(PersistentStringCacheStats& stats, PersistentCacheStats::Operation op) noexcept
+        : latencies_(stats.latencies_)
+        , op_(op)
+        , start_(chrono::steady_clock::now())
+    {
+    }
+
+    ~LatencyTimer()
+    {
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_);
+        latencies_.record(op_, elapsed.count());
+    }
+
+    LatencyTimer(LatencyTimer const&) = delete;
+    LatencyTimer& operator=(LatencyTimer const&) = delete;
+
+private:
+    LatencyHistograms& latencies_;
+    PersistentCacheStats::Operation op_;
+    chrono::steady_clock::time_point start_;
+};
+
 typedef std::unique_ptr<leveldb::Iterator> IteratorUPtr;
 
+// A leveldb log file that is synced when it is closed. When leveldb switches to a new memtable,
+// it closes the old log without syncing it, and a sync of the new log doesn't cover the old one.
+// With this, a sync covers all writes so far, even if leveldb switched logs since then.
+
+class SyncOnCloseFile : public leveldb::WritableFile
+{
+public:
+    explicit SyncOnCloseFile(leveldb::WritableFile* file) noexcept
+        : file_(file)
+        , closed_(false)
+    {
+    }
+
+    ~SyncOnCloseFile()
+    {
+        Close();  // Older versions of leveldb delete the log without closing it first.
+    }
+
+    leveldb::Status Append(leveldb::Slice const& data) override
+    {
+        return file_->Append(data);
+    }
+
+    leveldb::Status Flush() override
+    {
+        return file_->Flush();
+    }
+
+    leveldb::Status Sync() override
+    {
+        return file_->Sync();
+    }
+
+    leveldb::Status Close() override
+    {
+        if (closed_)
+        {
+            return leveldb::Status::OK();
+        }
+        closed_ = true;
+        auto s = file_->Sync();
+        auto c = file_->Close();
+        return s.ok() ? c : s;
+    }
+
+private:
+    unique_ptr<leveldb::WritableFile> file_;
+    bool closed_;
+};
+
+class SyncLogsEnv : public leveldb::EnvWrapper
+{
+public:
+    SyncLogsEnv()
+        : leveldb::EnvWrapper(leveldb::Env::Default())
+    {
+    }
+
+    leveldb::Status NewWritableFile(string const& fname, leveldb::WritableFile** result) override
+    {
+        auto s = target()->NewWritableFile(fname, result);
+        string const suffix = ".log";
+        if (s.ok() && fname.size() >= suffix.size() &&
+            fname.compare(fname.size() - suffix.size(), suffix.size(), suffix) == 0)
+        {
+            *result = new SyncOnCloseFile(*result);
+        }
+        return s;
+    }
+};
+
 #ifndef NDEBUG
 
 // For assertions, so we can verify that num_entries_ matches the sum of entries in the histogram.
@@ -316,11 +700,33 @@ int64_t hist_sum(PersistentCacheStats::Histogram const& h) noexcept
 
 }  // namespace
 
-void PersistentStringCacheImpl::init_stats()
+// The slice is either a version 4 Data table value or an entry record, which starts with the data tuple.
+
+PersistentStringCacheImpl::DataTuple::DataTuple(leveldb::Slice const& s) noexcept
 {
-    int64_t num = 0;
-    int64_t size = 0;
+    assert(s.size() >= DATA_TUPLE_SIZE);
+    atime = decode_int64(s.data());
+    etime = decode_int64(s.data() + INT64_ENCODED_SIZE);
+    size = decode_int64(s.data() + 2 * INT64_ENCODED_SIZE);
+    is_protected = size < 0;
+    if (is_protected)
+    {
+        size = ~size;
+    }
+}
+
+string PersistentStringCacheImpl::DataTuple::to_string() const
+{
+    string s;
+    s.reserve(DATA_TUPLE_SIZE);
+    append_int64(s, atime);
+    append_int64(s, etime);
+    append_int64(s, is_protected ? ~size : size);
+    return s;
+}
 
+void PersistentStringCacheImpl::init_stats()
+{
     // If we shut down cleanly last time, read the saved stats values.
     bool is_dirty = read_dirty_flag();
     if (!is_dirty)
@@ -329,26 +735,102 @@ void PersistentStringCacheImpl::init_stats()
     }
     else
     {
-        // We didn't shut down cleanly or the cache is new.
-        // Run over the Atime index (it's smaller than the Data table)
-        // and count the number of entries and bytes, and initialize
-        // the histogram.
-        IteratorUPtr it(db_->NewIterator(read_options));
-        leveldb::Slice const atime_prefix(ATIME_BEGIN);
-        it->Seek(atime_prefix);
-        while (it->Valid() && it->key().starts_with(atime_prefix))
-        {
-            ++num;
-            auto bytes = stoll(it->value().ToString());
-            size += bytes;
-            stats_->hist_increment(bytes);
-            it->Next();
+        if (!read_checkpoint())
+        {
+            // We didn't shut down cleanly and have no checkpoint, or the cache is new.
+            // Run over the Atime and Protected indexes (they are smaller than the Entries table)
+            // and count the number of entries and bytes, and initialize
+            // the histogram.
+            int64_t num = 0;
+            int64_t size = 0;
+            IteratorUPtr it(db_->NewIterator(read_options));
+            for (auto const& index : {ATIME_BEGIN, PROTECTED_BEGIN})
+            {
+                string const prefix = k_generation(index, generation_);
+                it->Seek(prefix);
+                while (it->Valid() && it->key().starts_with(prefix))
+                {
+                    ++num;
+                    auto bytes = size_of(it->value());
+                    size += bytes;
+                    stats_->hist_increment(bytes);
+                    it->Next();
+                }
+            }
+            throw_if_error(it->status(), "cannot initialize cache");
+            stats_->num_entries_ = num;
+            stats_->cache_size_ = size;
+        }
+        // The journal doesn't record moves between segments, so we recount the protected segment.
+        stats_->protected_size_ = count_protected();
+    }
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
+
+    // Start a new journal. Without journaling, we remove the checkpoint, so
+    // the next dirty open falls back to a full scan.
+    leveldb::WriteBatch batch;
+    IteratorUPtr it(db_->NewIterator(read_options));
+    leveldb::Slice const journal_prefix(JOURNAL_BEGIN);
+    for (it->Seek(journal_prefix); it->Valid() && it->key().starts_with(journal_prefix); it->Next())
+    {
+        batch.Delete(it->key());
+    }
+    throw_if_error(it->status(), "cannot initialize cache");
+    journal_seq_ = 0;
+    checkpoint_seq_ = 0;
+    if (options_.stats_checkpoint_interval > 0)
+    {
+        batch.Put(STATS_VALUES, stats_->serialize());
+        batch.Put(STATS_CHECKPOINT, encode_int64(checkpoint_seq_));
+    }
+    else
+    {
+        batch.Delete(STATS_CHECKPOINT);
+    }
+    auto s = db_->Write(write_options, &batch);
+    throw_if_error(s, "cannot initialize cache");
+}
+
+// Reads the most recent stats checkpoint and applies the changes recorded in the journal since then.
+// Returns false if there is no checkpoint.
+
+bool PersistentStringCacheImpl::read_checkpoint()
+{
+    string val;
+    auto s = db_->Get(read_options, STATS_CHECKPOINT, &val);
+    throw_if_error(s, "read_checkpoint()");
+    if (s.IsNotFound() || val.size() != INT64_ENCODED_SIZE)
+    {
+        return false;
+    }
+    int64_t seq = decode_int64(val.data());
+    read_stats();
+    stats_->clear();  // As after a full scan, the hit and miss counters start from zero.
+
+    IteratorUPtr it(db_->NewIterator(read_options));
+    leveldb::Slice const journal_prefix(JOURNAL_BEGIN);
+    for (it->Seek(k_journal(seq + 1)); it->Valid() && it->key().starts_with(journal_prefix); it->Next())
+    {
+        auto v = it->value();
+        for (size_t i = 0; i + INT64_ENCODED_SIZE <= v.size(); i += INT64_ENCODED_SIZE)
+        {
+            int64_t size = decode_int64(v.data() + i);
+            if (size > 0)
+            {
+                ++stats_->num_entries_;
+                stats_->cache_size_ += size;
+                stats_->hist_increment(size);
+            }
+            else
+            {
+                --stats_->num_entries_;
+                stats_->cache_size_ += size;
+                stats_->hist_decrement(-size);
+            }
         }
-        throw_if_error(it->status(), "cannot initialize cache");
-        stats_->num_entries_ = num;
-        stats_->cache_size_ = size;
     }
-    assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+    throw_if_error(it->status(), "read_checkpoint()");
+    return true;
 }
 
 // Open existing database or create an empty one.
@@ -357,35 +839,52 @@ PersistentStringCacheImpl::PersistentStringCacheImpl(string const& cache_path,
                                                      int64_t max_size_in_bytes,
                                                      CacheDiscardPolicy policy,
                                                      PersistentStringCache* pimpl)
+    : PersistentStringCacheImpl(cache_path, max_size_in_bytes, policy, PersistentCacheOptions(), pimpl)
+{
+}
+
+PersistentStringCacheImpl::PersistentStringCacheImpl(string const& cache_path,
+                                                     int64_t max_size_in_bytes,
+                                                     CacheDiscardPolicy policy,
+                                                     PersistentCacheOptions const& options,
+                                                     PersistentStringCache* pimpl)
     : pimpl_(pimpl)
     , stats_(make_shared<PersistentStringCacheStats>())
+    , last_atime_flush_(now_ticks())
+    , memory_size_(0)
+    , staged_size_(0)
+    , journal_seq_(0)
+    , checkpoint_seq_(0)
+    , generation_(0)
+    , background_done_(false)
+    , evict_requested_(false)
+    , drop_requested_(false)
+    , batch_events_(0)
+    , clock_(0)
+    , syncs_started_(0)
+    , syncs_done_(0)
+    , sync_in_progress_(false)
 {
     stats_->cache_path_ = cache_path;
     if (max_size_in_bytes < 1)
     {
         throw_invalid_argument("invalid max_size_in_bytes (" + to_string(max_size_in_bytes) + "): value must be > 0");
     }
-    stats_->max_cache_size_ = max_size_in_bytes;
-    stats_->policy_ = policy;
-
-    leveldb::Options options;
-    options.create_if_missing = true;
-
-    // For small caches, reduce memory consumption by reducing the size of the internal block cache.
-    // The block cache size is at least 512 kB. For caches 5-80 MB, it is 10% of the nominal cache size.
-    // For caches > 80 MB, the block cache is left at the default of 8 MB.
-    size_t block_cache_size = max_size_in_bytes / 10;
-    if (block_cache_size < 512 * 1024)
+    init_options(options);
+    if (options_.async_events)
     {
-        block_cache_size = 512 * 1024;
+        event_queue_.reset(new EventQueue(options_.event_queue_size));
     }
-    if (block_cache_size < 8 * 1024 * 1024)
+    if (options_.admission_filter)
     {
-        block_cache_.reset(leveldb::NewLRUCache(block_cache_size));
-        options.block_cache = block_cache_.get();
+        sketch_.reset(new FrequencySketch(options_.admission_sketch_size));
     }
+    stats_->max_cache_size_ = max_size_in_bytes;
+    stats_->policy_ = policy;
 
-    init_db(options);
+    auto db_options = make_db_options(max_size_in_bytes);
+    db_options.create_if_missing = true;
+    init_db(db_options);
 
     if (cache_is_new())
     {
@@ -407,18 +906,19 @@ PersistentStringCacheImpl::PersistentStringCacheImpl(string const& cache_path,
         }
         if (stats_->policy_ != policy)
         {
-            auto to_string = [](CacheDiscardPolicy p)
-            {
-                return p == core::CacheDiscardPolicy::lru_only ? "lru_only" : "lru_ttl";
-            };
-            string msg = string("existing cache opened with different policy (") + to_string(policy) +
-                         "), existing policy = " + to_string(stats_->policy_);
+            string msg = string("existing cache opened with different policy (") + policy_name(policy) +
+                         "), existing policy = " + policy_name(stats_->policy_);
             throw_logic_error(msg);
         }
+        write_settings();  // Record the database settings we were opened with.
     }
 
     init_stats();
+    read_sketch();
+    init_clock();
     write_dirty_flag(true);
+    start_background();
+    start_dispatch();
 }
 
 // Open existing database.
@@ -426,6 +926,20 @@ PersistentStringCacheImpl::PersistentStringCacheImpl(string const& cache_path,
 PersistentStringCacheImpl::PersistentStringCacheImpl(string const& cache_path, PersistentStringCache* pimpl)
     : pimpl_(pimpl)
     , stats_(make_shared<PersistentStringCacheStats>())
+    , last_atime_flush_(now_ticks())
+    , memory_size_(0)
+    , staged_size_(0)
+    , journal_seq_(0)
+    , checkpoint_seq_(0)
+    , generation_(0)
+    , background_done_(false)
+    , evict_requested_(false)
+    , drop_requested_(false)
+    , batch_events_(0)
+    , clock_(0)
+    , syncs_started_(0)
+    , syncs_done_(0)
+    , sync_in_progress_(false)
 {
     stats_->cache_path_ = cache_path;
 
@@ -433,17 +947,34 @@ PersistentStringCacheImpl::PersistentStringCacheImpl(string const& cache_path, P
 
     check_version();  // Wipes DB if version doesn't match.
     read_settings();
+    read_db_settings();
+
+    // Re-open with the recorded database settings and a block cache that suits the size of the cache.
+    db_.reset();
+    init_db(make_db_options(stats_->max_cache_size_));
 
     init_stats();
+    read_sketch();
+    init_clock();
     write_dirty_flag(true);
+    start_background();
+    start_dispatch();
 }
 
 PersistentStringCacheImpl::~PersistentStringCacheImpl()
 {
+    stop_background();
     try
     {
-        write_stats();
+        flush_staged();
+        flush_access_times();
+        write_checkpoint();
+        write_sketch();
         write_dirty_flag(false);
+        if (options_.durability != CacheDurability::none)
+        {
+            sync_writes();
+        }
     }
     // LCOV_EXCL_START
     catch (std::exception const& e)
@@ -455,6 +986,7 @@ PersistentStringCacheImpl::~PersistentStringCacheImpl()
         cerr << make_message("~PersistentStringCacheImpl(): unknown exception") << endl;
     }
     // LCOV_EXCL_STOP
+    stop_dispatch();  // Delivers any events that are still queued.
 }
 
 bool PersistentStringCacheImpl::get(string const& key, string& value) const
@@ -469,115 +1001,232 @@ bool PersistentStringCacheImpl::get(string const& key, string& value, string* me
         throw_invalid_argument("get(): key must be non-empty");
     }
 
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::get);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
-    string data_key = k_data(key);
-    DataTuple dt;
-    bool found = get_value_and_metadata(key, dt, value, metadata);
-    if (!found)
+    leveldb::WriteBatch batch;
+    int64_t num_updates = 0;
+    if (!get_entry(key, value, metadata, batch, num_updates))
     {
         stats_->inc_misses();
         call_handler(key, CacheEventIndex::miss);
         return false;
     }
 
-    // Don't return expired entry.
-    int64_t new_atime = now_ticks();
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks() && dt.etime <= new_atime)
-    {
-        call_handler(key, CacheEventIndex::miss);
-        stats_->inc_misses();
-        return false;
-    }
-
-    leveldb::WriteBatch batch;
-
-    batch.Delete(k_atime_index(dt.atime, key));  // Delete old atime entry
-    dt.atime = new_atime;
-    dt.size = key.size() + value.size();
-    if (metadata)
+    if (num_updates != 0)
     {
-        dt.size += metadata->size();
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "get()");
+        demote_protected();
     }
-    batch.Put(data_key, dt.to_string());
-    batch.Put(k_atime_index(dt.atime, key), to_string(dt.size));
-
-    auto s = db_->Write(write_options, &batch);
-    throw_if_error(s, "put()");
 
     stats_->inc_hits();
     call_handler(key, CacheEventIndex::get);
     return true;
 }
 
-bool PersistentStringCacheImpl::get_metadata(string const& key, string& metadata) const
+bool PersistentStringCacheImpl::get_view(string const& key, PersistentStringCache::View& view) const
 {
     if (key.empty())
     {
-        throw_invalid_argument("get_metadata(): key must be non-empty");
+        throw_invalid_argument("get_view(): key must be non-empty");
     }
 
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::get);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
-    string data_key = k_data(key);
-    bool found;
-    auto dt = get_data(data_key, found);
-    if (!found)
+    leveldb::WriteBatch batch;
+    int64_t num_updates = 0;
+    if (!get_entry_view(key, view, batch, num_updates))
     {
+        stats_->inc_misses();
+        call_handler(key, CacheEventIndex::miss);
         return false;
     }
 
-    // Don't return expired entry.
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks() && dt.etime <= now_ticks())
+    if (num_updates != 0)
     {
-        return false;
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "get_view()");
+        demote_protected();
     }
-    auto s = db_->Get(read_options, k_metadata(key), &metadata);
-    throw_if_error(s, "get_metadata()");
-    return !s.IsNotFound();
+
+    stats_->inc_hits();
+    call_handler(key, CacheEventIndex::get);
+    return true;
 }
 
-bool PersistentStringCacheImpl::contains_key(string const& key) const
+// Looks up all keys while holding the lock once. The access times of all hits are written
+// in a single batch. We use a point lookup for each key instead of sharing an iterator
+// because the point lookup consults the bloom filter, so misses are cheap. A shared iterator
+// would also not see access times that are flushed by record_access_time() part-way through.
+
+void PersistentStringCacheImpl::get_many(vector<string> const& keys,
+                                         vector<Optional<string>>& values,
+                                         vector<string>* metadata) const
 {
-    if (key.empty())
+    for (auto const& key : keys)
     {
-        throw_invalid_argument("contains_key(): key must be non-empty");
+        if (key.empty())
+        {
+            throw_invalid_argument("get_many(): key must be non-empty");
+        }
     }
 
     lock_guard<decltype(mutex_)> lock(mutex_);
 
-    string data_key = k_data(key);
-    bool found;
-    auto dt = get_data(data_key, found);
-    if (!found)
+    values.assign(keys.size(), Optional<string>());
+    if (metadata)
+    {
+        metadata->assign(keys.size(), string());
+    }
+
+    leveldb::WriteBatch batch;
+    int64_t num_updates = 0;
+    unordered_map<string, size_t> first_index;  // Index of first occurrence of each key
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        auto it = first_index.find(keys[i]);
+        if (it != first_index.end())
+        {
+            // Duplicate key. We must not look it up again because the batch
+            // already contains the access time update for the first occurrence.
+            values[i] = values[it->second];
+            if (metadata)
+            {
+                (*metadata)[i] = (*metadata)[it->second];
+            }
+            continue;
+        }
+        first_index.emplace(keys[i], i);
+
+        string value;
+        if (get_entry(keys[i], value, metadata ? &(*metadata)[i] : nullptr, batch, num_updates))
+        {
+            values[i] = move(value);
+        }
+    }
+
+    if (num_updates != 0)
+    {
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "get_many()");
+        demote_protected();
+    }
+
+    // Hits and misses are counted in the order of the keys, so the run-length stats come out the same
+    // as for a sequence of calls to get().
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (values[i])
+        {
+            stats_->inc_hits();
+            call_handler(keys[i], CacheEventIndex::get);
+        }
+        else
+        {
+            stats_->inc_misses();
+            call_handler(keys[i], CacheEventIndex::miss);
+        }
+    }
+}
+
+bool PersistentStringCacheImpl::get_metadata(string const& key, string& metadata) const
+{
+    if (key.empty())
+    {
+        throw_invalid_argument("get_metadata(): key must be non-empty");
+    }
+
+    lock_guard<decltype(mutex_)> lock(mutex_);
+
+    auto sit = staged_index_.find(key);
+    if (sit != staged_index_.end())
+    {
+        auto const& e = *sit->second;
+        if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && e.etime != epoch_ticks() && e.etime <= now_ticks())
+        {
+            return false;
+        }
+        if (!e.has_metadata)
+        {
+            return false;
+        }
+        metadata = e.data->metadata;
+        return true;
+    }
+
+    string record;
+    if (!get_record(key, record))
     {
         return false;
     }
+
+    // Don't return expired entry.
+    DataTuple dt(record);
     if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks() && dt.etime <= now_ticks())
     {
-        return false;  // Expired entries are not returned.
+        return false;
+    }
+    if (!has_metadata(record))
+    {
+        return false;
     }
+    metadata = metadata_of(record).ToString();
     return true;
 }
 
-int64_t PersistentStringCacheImpl::size() const noexcept
+bool PersistentStringCacheImpl::contains_key(string const& key) const
 {
+    if (key.empty())
+    {
+        throw_invalid_argument("contains_key(): key must be non-empty");
+    }
+
     lock_guard<decltype(mutex_)> lock(mutex_);
 
+    int64_t etime;
+    auto sit = staged_index_.find(key);
+    auto mit = memory_index_.find(key);
+    if (sit != staged_index_.end())
+    {
+        etime = sit->second->etime;
+    }
+    else if (mit != memory_index_.end())
+    {
+        etime = mit->second->etime;
+    }
+    else
+    {
+        bool found;
+        auto dt = get_data(key, found);
+        if (!found)
+        {
+            return false;
+        }
+        etime = dt.etime;
+    }
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && etime != epoch_ticks() && etime <= now_ticks())
+    {
+        return false;  // Expired entries are not returned.
+    }
+    return true;
+}
+
+// The stats counters can be read without the lock (see PersistentStringCacheStats).
+
+int64_t PersistentStringCacheImpl::size() const noexcept
+{
     return stats_->num_entries_;
 }
 
 int64_t PersistentStringCacheImpl::size_in_bytes() const noexcept
 {
-    lock_guard<decltype(mutex_)> lock(mutex_);
-
     return stats_->cache_size_;
 }
 
 int64_t PersistentStringCacheImpl::max_size_in_bytes() const noexcept
 {
-    lock_guard<decltype(mutex_)> lock(mutex_);
-
     return stats_->max_cache_size_;
 }
 
@@ -598,9 +1247,8 @@ CacheDiscardPolicy PersistentStringCacheImpl::discard_policy() const noexcept
 
 PersistentCacheStats PersistentStringCacheImpl::stats() const
 {
-    lock_guard<decltype(mutex_)> lock(mutex_);
-
-    // We make a copy here so values can't change underneath the caller.
+    // We make a copy here so values can't change underneath the caller. The copy doesn't need the lock,
+    // so monitoring the stats doesn't hold up other operations.
     return PersistentCacheStats(make_shared<PersistentStringCacheStats>(*stats_));
 }
 
@@ -636,7 +1284,8 @@ bool PersistentStringCacheImpl::put(string const& key,
                                     int64_t value_size,
                                     char const* metadata_data,
                                     int64_t metadata_size,
-                                    chrono::time_point<chrono::system_clock> expiry_time)
+                                    chrono::time_point<chrono::system_clock> expiry_time,
+                                    double cost)
 {
     if (key.empty())
     {
@@ -654,6 +1303,10 @@ bool PersistentStringCacheImpl::put(string const& key,
     {
         throw_invalid_argument("put(): invalid negative metadata size: " + to_string(metadata_size));
     }
+    if (!(cost > 0) || isinf(cost))
+    {
+        throw_invalid_argument("put(): invalid cost (" + to_string(cost) + "): value must be > 0 and finite");
+    }
 
     int64_t new_size = key.size() + value_size;
     if (metadata_data)
@@ -667,12 +1320,13 @@ bool PersistentStringCacheImpl::put(string const& key,
     }
 
     auto etime = ticks(expiry_time);
-    if (stats_->policy_ == CacheDiscardPolicy::lru_only && etime != epoch_ticks())
+    if (stats_->policy_ != CacheDiscardPolicy::lru_ttl && etime != epoch_ticks())
     {
-        throw_logic_error(string("put(): policy is lru_only, but expiry_time (") + to_string(etime) +
-                          ") is not infinite");
+        throw_logic_error(string("put(): policy is ") + policy_name(stats_->policy_) + ", but expiry_time (" +
+                          to_string(etime) + ") is not infinite");
     }
 
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::put);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
     auto atime = now_ticks();
@@ -680,91 +1334,289 @@ bool PersistentStringCacheImpl::put(string const& key,
     {
         return false;  // Already expired, so don't add it.
     }
+    if (sketch_)
+    {
+        sketch_->increment(key);
+    }
+    if (options_.write_behind)
+    {
+        // Staged entries take up space, too. A new entry that does not fit must get past the admission
+        // filter now, so we don't stage an entry that would be rejected when it is written.
+        auto avail_bytes = stats_->max_cache_size_ - stats_->cache_size_ - staged_size_;
+        if (sketch_ && new_size > avail_bytes && staged_index_.find(key) == staged_index_.end())
+        {
+            bool found;
+            get_data(key, found);
+            if (!found && !admit(key, new_size - avail_bytes))
+            {
+                ++stats_->rejected_puts_;
+                return false;
+            }
+        }
+        stage(key, value_data, value_size, metadata_data, metadata_size, etime, cost, new_size);
+        request_eviction();  // Makes room for the staged entries before they are written.
+        return true;
+    }
 
     // The entry may or may not exist already.
     // Work out how many bytes of space we need.
     int64_t bytes_needed = new_size;
 
-    string prefixed_key = k_data(key);
     bool found;
-    auto old_data = get_data(prefixed_key, found);
+    auto old_data = get_data(key, found);
     if (found)
     {
         bytes_needed = max(new_size - old_data.size, int64_t(0));  // new_size could be < old size
     }
-    auto avail_bytes = stats_->max_cache_size_ - stats_->cache_size_;
+    auto avail_bytes = stats_->max_cache_size_ - stats_->cache_size_ - staged_size_;
 
-    // Make room to add or replace the entry.
+    // Make room to add or replace the entry. A new entry must first get past the admission filter.
     if (bytes_needed > avail_bytes)
     {
-        delete_at_least(bytes_needed - avail_bytes, key);  // Don't delete the entry about to be updated!
+        if (!found && sketch_ && !admit(key, bytes_needed - avail_bytes))
+        {
+            ++stats_->rejected_puts_;
+            return false;
+        }
+        delete_at_least(bytes_needed - avail_bytes, {key});  // Don't delete the entry about to be updated!
     }
 
     leveldb::WriteBatch batch;
+    leveldb::Slice metadata(metadata_data, metadata_data ? metadata_size : 0);
+    batch_put(key,
+              DataTuple(atime, etime, new_size),
+              leveldb::Slice(value_data, value_size),
+              metadata_data ? &metadata : nullptr,
+              found,
+              old_data,
+              cost,
+              batch);
+
+    // Update cache size and number of entries, and write the batch.
+    if (found)
+    {
+        stats_remove_entry(old_data.size);
+    }
+    stats_add_entry(new_size);
+    write_batch(batch, "put()");
+    demote_protected();
+
+    // Refresh the in-memory copy, if any. (New entries are added to memory only once they are read.)
+    if (memory_index_.find(key) != memory_index_.end())
+    {
+        memory_put(key, value_data, value_size, metadata_data, metadata_data ? metadata_size : 0, etime);
+    }
+
+    assert(stats_->num_entries_ >= 0);
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
+    assert(stats_->cache_size_ >= 0);
+    assert(stats_->cache_size_ <= stats_->max_cache_size_);
+    assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
+    assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
+
+    call_handler(key, CacheEventIndex::put);
+    request_eviction();
+
+    return true;
+}
 
-    // Update the Data table.
-    DataTuple new_meta(atime, etime, new_size);
-    batch.Put(prefixed_key, new_meta.to_string());
+// Adds the entries with a single eviction pass and as few batches as possible. The effect is
+// the same as calling put() for each entry in order, except that all entries get the same access time.
 
-    // Add or replace the entry in the Values table.
-    prefixed_key[0] = VALUES_BEGIN[0];  // Avoid string copy.
-    batch.Put(prefixed_key, leveldb::Slice(value_data, value_size));
+bool PersistentStringCacheImpl::put_many(vector<PutEntry> const& entries,
+                                         chrono::time_point<chrono::system_clock> expiry_time)
+{
+    auto entry_size = [](PutEntry const& e)
+    {
+        return int64_t(e.key->size() + e.value->size() + (e.metadata ? e.metadata->size() : 0));
+    };
 
-    // Update metadata.
-    prefixed_key[0] = METADATA_BEGIN[0];  // Avoid string copy.
-    batch.Delete(prefixed_key);           // In case there was metadata previously.
-    if (metadata_data)
+    // Check everything before we change anything.
+    for (auto const& e : entries)
+    {
+        if (e.key->empty())
+        {
+            throw_invalid_argument("put_many(): key must be non-empty");
+        }
+        auto size = entry_size(e);
+        if (size > stats_->max_cache_size_)
+        {
+            throw_logic_error(string("put_many(): cannot add ") + to_string(size) +
+                              "-byte record to cache with maximum size of " + to_string(stats_->max_cache_size_));
+        }
+    }
+
+    auto etime = ticks(expiry_time);
+    if (stats_->policy_ != CacheDiscardPolicy::lru_ttl && etime != epoch_ticks())
     {
-        batch.Put(prefixed_key, leveldb::Slice(metadata_data, metadata_size));
+        throw_logic_error(string("put_many(): policy is ") + policy_name(stats_->policy_) + ", but expiry_time (" +
+                          to_string(etime) + ") is not infinite");
     }
 
-    // Update the Atime index.
-    string atime_key = k_atime_index(atime, key);
-    if (found)
+    lock_guard<decltype(mutex_)> lock(mutex_);
+
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && etime != epoch_ticks() && etime <= now_ticks())
+    {
+        return false;  // Already expired, so don't add anything.
+    }
+
+    flush_staged();  // Staged entries were put earlier, so they must not overwrite these ones.
+    put_entries(entries, vector<int64_t>(entries.size(), etime), vector<double>(entries.size(), 1.0));
+    return true;
+}
+
+// Writes the entries for put_many() and flush_staged(). etimes and costs are parallel to entries.
+// Pre: the entries are valid and not expired.
+
+void PersistentStringCacheImpl::put_entries(vector<PutEntry> const& entries,
+                                            vector<int64_t> const& etimes,
+                                            vector<double> const& costs)
+{
+    // mutex_ must be locked here!
+
+    auto entry_size = [](PutEntry const& e)
+    {
+        return int64_t(e.key->size() + e.value->size() + (e.metadata ? e.metadata->size() : 0));
+    };
+
+    auto atime = now_ticks();
+
+    // If a key appears more than once, the last entry for the key wins.
+    unordered_map<string, size_t> last_index;
+    for (size_t i = 0; i < entries.size(); ++i)
     {
-        batch.Delete(k_atime_index(old_data.atime, key));
+        last_index[*entries[i].key] = i;
     }
-    batch.Put(atime_key, to_string(new_size));
 
-    // Update the Etime index.
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl)
+    // If the entries don't fit into the cache together, putting them one at a time would
+    // evict the earlier ones to make room for the later ones. We don't write entries that
+    // would be evicted anyway; instead, we write the longest tail of the entries that fits
+    // and discard any existing entries for the keys at the front.
+    vector<size_t> todo;       // Indexes of entries to write, last to first.
+    vector<size_t> discarded;  // Indexes of entries that don't fit.
+    int64_t total_size = 0;
+    for (size_t i = entries.size(); i-- > 0;)
     {
-        if (found && old_data.etime != epoch_ticks())
+        if (last_index[*entries[i].key] != i)
+        {
+            continue;  // Superseded by a later entry.
+        }
+        auto size = entry_size(entries[i]);
+        if (discarded.empty() && total_size + size <= stats_->max_cache_size_)
         {
-            batch.Delete(k_etime_index(old_data.etime, key));
+            total_size += size;
+            todo.push_back(i);
         }
-        // Etime index is not written to for non-expiring entries.
-        if (etime != epoch_ticks())
+        else
         {
-            batch.Put(k_etime_index(etime, key), to_string(new_size));
+            discarded.push_back(i);
         }
     }
+    reverse(todo.begin(), todo.end());
 
-    // Write the batch.
-    auto s = db_->Write(write_options, &batch);
-    throw_if_error(s, "put()");
+    // Each discarded entry counts as an eviction, just as if it had been added and evicted again.
+    for (auto i : discarded)
+    {
+        bool found;
+        auto dt = get_data(*entries[i].key, found);
+        if (found)
+        {
+            delete_entry(*entries[i].key, dt);
+        }
+        ++stats_->lru_evictions_;
+    }
 
-    // Update cache size and number of entries;
-    stats_->cache_size_ = stats_->cache_size_ - old_data.size + new_size;
-    stats_->hist_increment(new_size);
-    if (!found)
+    // Work out how many bytes of space we need and make room in a single pass.
+    vector<DataTuple> old_data(todo.size());
+    vector<char> found(todo.size());
+    unordered_set<string> keys;
+    int64_t bytes_needed = 0;
+    for (size_t j = 0; j < todo.size(); ++j)
     {
-        ++stats_->num_entries_;
+        auto const& key = *entries[todo[j]].key;
+        bool f;
+        old_data[j] = get_data(key, f);
+        found[j] = f;
+        bytes_needed += entry_size(entries[todo[j]]) - old_data[j].size;
+        keys.insert(key);
     }
-    else
+    auto avail_bytes = stats_->max_cache_size_ - stats_->cache_size_ - staged_size_;
+    if (bytes_needed > avail_bytes)
+    {
+        delete_at_least(bytes_needed - avail_bytes, keys);  // Don't delete the entries about to be updated!
+    }
+
+    // We write in batches of bounded size, so we don't build a huge batch in memory.
+    // Sizes and counts are updated as each batch is written.
+    leveldb::WriteBatch batch;
+    int64_t batch_bytes = 0;
+    size_t batch_start = 0;
+    auto flush_batch = [&](size_t batch_end)
+    {
+        for (size_t j = batch_start; j < batch_end; ++j)
+        {
+            if (found[j])
+            {
+                stats_remove_entry(old_data[j].size);
+            }
+            stats_add_entry(entry_size(entries[todo[j]]));
+        }
+        write_batch(batch, "put_many()");
+        demote_protected();
+        batch.Clear();
+        batch_bytes = 0;
+        batch_start = batch_end;
+    };
+
+    for (size_t j = 0; j < todo.size(); ++j)
+    {
+        auto const& e = entries[todo[j]];
+        auto new_size = entry_size(e);
+        leveldb::Slice metadata = e.metadata ? leveldb::Slice(*e.metadata) : leveldb::Slice();
+        batch_put(*e.key,
+                  DataTuple(atime, etimes[todo[j]], new_size),
+                  *e.value,
+                  e.metadata ? &metadata : nullptr,
+                  found[j],
+                  old_data[j],
+                  costs[todo[j]],
+                  batch);
+        batch_bytes += RECORD_HEADER_SIZE + new_size;
+        if (batch_bytes >= options_.write_buffer_size)
+        {
+            flush_batch(j + 1);
+        }
+
+        // Refresh the in-memory copy, if any. (New entries are added to memory only once they are read.)
+        if (memory_index_.find(*e.key) != memory_index_.end())
+        {
+            memory_put(*e.key,
+                       e.value->data(), e.value->size(),
+                       e.metadata ? e.metadata->data() : nullptr, e.metadata ? e.metadata->size() : 0,
+                       etimes[todo[j]]);
+        }
+    }
+    if (batch_start < todo.size())
     {
-        stats_->hist_decrement(old_data.size);
+        flush_batch(todo.size());
     }
+
     assert(stats_->num_entries_ >= 0);
-    assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
     assert(stats_->cache_size_ >= 0);
     assert(stats_->cache_size_ <= stats_->max_cache_size_);
     assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
     assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
 
-    call_handler(key, CacheEventIndex::put);
-
-    return true;
+    for (auto const& e : entries)
+    {
+        call_handler(*e.key, CacheEventIndex::put);
+    }
+    for (auto i : discarded)
+    {
+        call_handler(*entries[i].key, CacheEventIndex::evict_lru);
+    }
+    request_eviction();
 }
 
 bool PersistentStringCacheImpl::get_or_put(string const& key, string& value, PersistentStringCache::Loader load_func)
@@ -781,8 +1633,14 @@ bool PersistentStringCacheImpl::get_or_put(string const& key,
     {
         throw_invalid_argument("get_or_put(): key must be non-empty");
     }
+    if (handler_depth != 0)
+    {
+        // unlock() below would release only one level of the lock, so we could neither wait for another
+        // thread's load (which needs the lock to put the entry) nor run our own loader without the lock.
+        throw_logic_error("get_or_put(): cannot be called from a synchronous event handler");
+    }
 
-    lock_guard<decltype(mutex_)> lock(mutex_);
+    unique_lock<decltype(mutex_)> lock(mutex_);
 
     // Call the normal get() here, so the hit/miss counters and callbacks are correct.
     if (get(key, value, metadata))
@@ -790,18 +1648,52 @@ bool PersistentStringCacheImpl::get_or_put(string const& key,
         return true;
     }
 
+    // If another thread is loading the same key already, we wait for it to finish
+    // instead of calling the loader a second time.
+    auto it = loads_.find(key);
+    if (it != loads_.end())
+    {
+        if (it->second.loader == this_thread::get_id())
+        {
+            throw_logic_error("get_or_put(): recursive call from load_func for key \"" + key + "\"");
+        }
+        auto done = it->second.done;
+        lock.unlock();
+        done.get();  // Throws if the loader threw.
+        lock.lock();
+
+        // We go for the raw DB here, to avoid counting an extra hit or miss.
+        DataTuple dt;
+        return get_value_and_metadata(key, dt, value, metadata);
+    }
+
+    // The loader runs without the lock held, so a slow loader does not block other threads.
+    promise<void> load_done;
+    loads_.emplace(key, Load{load_done.get_future().share(), this_thread::get_id()});
+    lock.unlock();
+
+    exception_ptr ep;
     try
     {
         load_func(key, *pimpl_);  // Expected to put the value.
     }
     catch (std::exception const& e)
     {
-        throw runtime_error(make_message(string("get_or_put(): load_func exception: ") + e.what()));
+        ep = make_exception_ptr(runtime_error(make_message(string("get_or_put(): load_func exception: ") + e.what())));
     }
     catch (...)
     {
-        throw runtime_error(make_message("get_or_put(): load_func: unknown exception"));
+        ep = make_exception_ptr(runtime_error(make_message("get_or_put(): load_func: unknown exception")));
+    }
+
+    lock.lock();
+    loads_.erase(key);
+    if (ep)
+    {
+        load_done.set_exception(ep);
+        rethrow_exception(ep);
     }
+    load_done.set_value();
 
     // We go for the raw DB here, to avoid counting an extra hit or miss.
     DataTuple dt;
@@ -831,22 +1723,19 @@ bool PersistentStringCacheImpl::put_metadata(std::string const& key, const char*
 
     lock_guard<decltype(mutex_)> lock(mutex_);
 
-    string data_key = k_data(key);
-    bool found;
-    auto dt = get_data(data_key, found);
-    if (!found)
+    if (staged_index_.find(key) != staged_index_.end())
     {
-        return false;
+        flush_staged();
     }
 
-    int64_t old_meta_size = 0;
-    IteratorUPtr it(db_->NewIterator(read_options));
-    string metadata_key = k_metadata(key);
-    it->Seek(metadata_key);
-    if (it->Valid() && it->key().ToString() == metadata_key)
+    string record;
+    if (!get_record(key, record))
     {
-        old_meta_size = it->value().size();
+        return false;
     }
+    DataTuple dt(record);
+
+    int64_t old_meta_size = metadata_of(record).size();
     int64_t new_meta_size = metadata_size;
     if (dt.size - old_meta_size + new_meta_size > stats_->max_cache_size_)
     {
@@ -868,47 +1757,41 @@ bool PersistentStringCacheImpl::put_metadata(std::string const& key, const char*
     // that's about to be modified.
     if (new_meta_size > old_meta_size)
     {
-        auto avail_bytes = stats_->max_cache_size_ - stats_->cache_size_;
-        int64_t bytes_needed = new_meta_size - old_meta_size;
-        if (bytes_needed > avail_bytes)
+        // Staged entries count towards the size, but only the other entries on disk can be evicted.
+        auto avail_bytes = stats_->max_cache_size_ - stats_->cache_size_ - staged_size_;
+        int64_t bytes_needed = min(new_meta_size - old_meta_size - avail_bytes, stats_->cache_size_ - original_size);
+        if (bytes_needed > 0)
         {
-            bytes_needed = min(bytes_needed, avail_bytes);
-            delete_at_least(bytes_needed, key);  // Don't delete the entry about to be updated!
+            delete_at_least(bytes_needed, {key});  // Don't delete the entry about to be updated!
         }
     }
 
     leveldb::WriteBatch batch;
 
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks())
-    {
-        it->Seek(k_etime_index(dt.etime, key));
-        assert(it->Valid());
-        assert(it->key().ToString() == k_etime_index(dt.etime, key));
-        batch.Put(it->key(), to_string(dt.size));  // Update Etime index with new size (expiry time is not modified).
-    }
-
-    batch.Put(data_key, dt.to_string());                               // Update data.
-    batch.Put(metadata_key, leveldb::Slice(metadata, metadata_size));  // Update metadata.
-
-    it->Seek(k_atime_index(dt.atime, key));
-    assert(it->Valid());
-    assert(it->key().ToString() == k_atime_index(dt.atime, key));
-    batch.Put(it->key(), to_string(dt.size));  // Update Atime index with new size (access time is not modified).
-
-    auto s = db_->Write(write_options, &batch);
-    throw_if_error(s, "put_metadata(): batch write error");
-
-    stats_->cache_size_ = stats_->cache_size_ - old_meta_size + new_meta_size;
-    stats_->hist_increment(dt.size);
-    stats_->hist_decrement(original_size);
+    leveldb::Slice new_metadata(metadata, metadata_size);
+    // Update data and metadata.
+    batch.Put(k_entry(generation_, key), v_entry(dt.to_string(), value_of(record), &new_metadata));
+    // Update indexes with new size (access and expiry time are not modified, and the entry stays in its segment).
+    // For gdsf, the entry keeps its priority and weight.
+    DataTuple original_dt(dt.atime, dt.etime, original_size, dt.is_protected);
+    auto weight = get_weight(key, original_dt);
+    batch_delete_index(key, original_dt, batch);
+    batch_put_index(key, dt, batch, weight);
+
+    stats_remove_entry(original_size);
+    stats_add_entry(dt.size);
+    write_batch(batch, "put_metadata(): batch write error");
+    memory_erase(key);
 
     assert(stats_->num_entries_ >= 0);
-    assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
     assert(stats_->cache_size_ >= 0);
     assert(stats_->cache_size_ <= stats_->max_cache_size_);
     assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
     assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
 
+    request_eviction();
+
     return true;
 }
 
@@ -924,9 +1807,14 @@ bool PersistentStringCacheImpl::take(string const& key, string& value, string* m
         throw_invalid_argument("take(): key must be non-empty");
     }
 
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::take);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
-    string data_key = k_data(key);
+    if (staged_index_.find(key) != staged_index_.end())
+    {
+        flush_staged();
+    }
+
     DataTuple dt;
     string val;
     bool found = get_value_and_metadata(key, dt, val, metadata);
@@ -952,7 +1840,7 @@ bool PersistentStringCacheImpl::take(string const& key, string& value, string* m
     value = move(val);
     call_handler(key, CacheEventIndex::get);
     call_handler(key, CacheEventIndex::invalidate);
-    assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
     return true;
 }
 
@@ -963,14 +1851,17 @@ bool PersistentStringCacheImpl::invalidate(string const& key)
         throw_invalid_argument("invalidate(): key must be non-empty");
     }
 
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::invalidate);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
-    string prefixed_key = k_data(key);
+    // A staged entry supersedes the entry on disk, so the result depends on the staged entry.
+    bool const was_staged = unstage(key);
+
     bool found;
-    auto dt = get_data(prefixed_key, found);
+    auto dt = get_data(key, found);
     if (!found)
     {
-        return false;
+        return was_staged;
     }
 
     // Delete the entry whether it expired or not. Seeing that we have just done
@@ -978,11 +1869,12 @@ bool PersistentStringCacheImpl::invalidate(string const& key)
     delete_entry(key, dt);
 
     call_handler(key, CacheEventIndex::invalidate);
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks() && dt.etime < now_ticks())
+    if (!was_staged && stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks() &&
+        dt.etime < now_ticks())
     {
         return false;  // Expired entries are hidden.
     }
-    assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
     return true;
 }
 
@@ -994,6 +1886,7 @@ void PersistentStringCacheImpl::invalidate(vector<string> const& keys)
 template<typename It>
 void PersistentStringCacheImpl::invalidate(It begin, It end)
 {
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::invalidate);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
     leveldb::WriteBatch batch;
@@ -1004,8 +1897,9 @@ void PersistentStringCacheImpl::invalidate(It begin, It end)
         {
             continue;
         }
+        unstage(*it);
         bool found;
-        auto dt = get_data(k_data(*it), found);
+        auto dt = get_data(*it, found);
         if (!found)
         {
             continue;
@@ -1013,21 +1907,18 @@ void PersistentStringCacheImpl::invalidate(It begin, It end)
         batch_delete(*it, dt, batch);
 
         // Update cache size and entries.
-        stats_->hist_decrement(dt.size);
-        stats_->cache_size_ -= dt.size;
+        stats_remove_entry(dt.size);
         assert(stats_->cache_size_ >= 0);
         assert(stats_->cache_size_ <= stats_->max_cache_size_);
-        --stats_->num_entries_;
         assert(stats_->num_entries_ >= 0);
-        assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+        assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
         assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
         assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
 
         call_handler(*it, CacheEventIndex::invalidate);
     }
 
-    auto s = db_->Write(write_options, &batch);
-    throw_if_error(s, "invalidate(): batch write error");
+    write_batch(batch, "invalidate(): batch write error");
 }
 
 void PersistentStringCacheImpl::invalidate(initializer_list<std::string> const& keys)
@@ -1037,57 +1928,81 @@ void PersistentStringCacheImpl::invalidate(initializer_list<std::string> const&
 
 void PersistentStringCacheImpl::invalidate()
 {
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::invalidate);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
+    staged_.clear();
+    staged_index_.clear();
+    staged_size_ = 0;
+
+    if (options_.background_invalidate)
     {
-        int64_t count = 0;
+        // Starting a new generation hides all existing entries, and the background thread deletes
+        // them. The stats are reset in the same batch, so a crash can't leave us with stats that
+        // count the entries of the old generation.
+        ++generation_;
+        pending_atimes_.clear();
+        memory_lru_.clear();
+        memory_index_.clear();
+        memory_size_ = 0;
+        stats_->num_entries_ = 0;
+        stats_->hist_clear();
+        stats_->cache_size_ = 0;
+        stats_->protected_size_ = 0;
+        stats_->clear();
+        clock_ = 0;
 
         leveldb::WriteBatch batch;
-        int64_t const batch_size = 1000;
+        batch.Put(SETTINGS_GENERATION, to_string(generation_));
+        write_checkpoint(batch);
+        request_drop();
+        return;
+    }
 
-        PersistentStringCache::EventCallback cb =
-            handlers_[static_cast<underlying_type<CacheEventIndex>::type>(CacheEventIndex::invalidate)];
+    {
+        int64_t count = 0;
+        leveldb::WriteBatch batch;
 
         IteratorUPtr it(db_->NewIterator(read_options));
-        it->Seek(ALL_BEGIN);
-        leveldb::Slice const atime_prefix = ATIME_BEGIN;
-        leveldb::Slice const all_end = ALL_END;
-        while (it->Valid() && it->key().compare(all_end) < 0)
+        for (auto const& table : {ENTRIES_BEGIN, ATIME_BEGIN, ETIME_BEGIN, PROTECTED_BEGIN})
         {
-            auto key = it->key();
-            batch.Delete(key);
-            if (cb && key.starts_with(atime_prefix))
-            {
-                TimeKeyTuple atk(key.ToString().substr(1));
-                --stats_->num_entries_;
-                auto size = stoll(it->value().ToString());
-                stats_->cache_size_ -= size;
-                call_handler(atk.key, CacheEventIndex::invalidate);
-            }
-            if (++count == batch_size)
+            string const prefix = k_generation(table, generation_);
+            for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next())
             {
-                auto s = db_->Write(write_options, &batch);
-                throw_if_error(s, "invalidate(): batch write error");
-                batch.Clear();
-                count = 0;
+                auto key = it->key();
+                batch.Delete(key);
+                if (table == ATIME_BEGIN || table == PROTECTED_BEGIN)
+                {
+                    stats_remove_entry(size_of(it->value()));
+                    call_handler(time_key_of(key).key, CacheEventIndex::invalidate);
+                }
+                if (++count == DROP_BATCH_SIZE)
+                {
+                    write_batch(batch, "invalidate(): batch write error");
+                    batch.Clear();
+                    count = 0;
+                }
             }
-            it->Next();
         }
         throw_if_error(it->status(), "invalidate(): iterator error");
 
         if (count != 0)
         {
-            auto s = db_->Write(write_options, &batch);
-            throw_if_error(s, "invalidate(): final batch write error");
+            write_batch(batch, "invalidate(): final batch write error");
         }
     }  // Close batch
 
-    stats_->num_entries_ = 0;
-    stats_->hist_clear();
-    stats_->cache_size_ = 0;
+    pending_atimes_.clear();
+    memory_lru_.clear();
+    memory_index_.clear();
+    memory_size_ = 0;
+    stats_->protected_size_ = 0;
+    clock_ = 0;
+    assert(stats_->num_entries_ == 0);
+    assert(stats_->cache_size_ == 0);
     // Clear ephemeral stats too.
     stats_->clear();
-    write_stats();
+    write_checkpoint();
 }
 
 bool PersistentStringCacheImpl::touch(string const& key, chrono::time_point<chrono::system_clock> expiry_time)
@@ -1099,21 +2014,26 @@ bool PersistentStringCacheImpl::touch(string const& key, chrono::time_point<chro
 
     int64_t new_etime = ticks(expiry_time);
 
-    if (stats_->policy_ == CacheDiscardPolicy::lru_only && new_etime != epoch_ticks())
+    if (stats_->policy_ != CacheDiscardPolicy::lru_ttl && new_etime != epoch_ticks())
     {
-        throw_logic_error(string("touch(): policy is lru_only, but expiry_time (") + to_string(new_etime) +
-                          ") is not infinite");
+        throw_logic_error(string("touch(): policy is ") + policy_name(stats_->policy_) + ", but expiry_time (" +
+                          to_string(new_etime) + ") is not infinite");
     }
 
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::touch);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
-    string data_key = k_data(key);
-    bool found;
-    auto dt = get_data(data_key, found);
-    if (!found)
+    if (staged_index_.find(key) != staged_index_.end())
+    {
+        flush_staged();
+    }
+
+    string record;
+    if (!get_record(key, record))
     {
         return false;
     }
+    DataTuple dt(record);
 
     int64_t now = now_ticks();
     if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && new_etime != epoch_ticks() && new_etime <= now)
@@ -1123,25 +2043,22 @@ bool PersistentStringCacheImpl::touch(string const& key, chrono::time_point<chro
 
     leveldb::WriteBatch batch;
 
-    string size = to_string(dt.size);
-    batch.Delete(k_atime_index(dt.atime, key));  // Delete old Atime index entry.
-    batch.Put(k_atime_index(now, key), size);    // Write new Atime index entry.
-
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl)
-    {
-        batch.Delete(k_etime_index(dt.etime, key));  // Delete old Etime index entry.
-        if (new_etime != epoch_ticks())
-        {
-            batch.Put(k_etime_index(new_etime, key), size);  // Write new Etime index entry.
-        }
-    }
-    dt.atime = now;
+    batch_delete_index(key, dt, batch);  // Delete old index entries.
+    auto weight = set_access_time(key, dt, now);
     dt.etime = new_etime;
-    batch.Put(data_key, dt.to_string());  // Write new data.
+    set_data(record, dt.to_string());
+    batch.Put(k_entry(generation_, key), record);  // Write new data.
+    batch_put_index(key, dt, batch, weight);  // Write new index entries.
 
     auto s = db_->Write(write_options, &batch);
     throw_if_error(s, "touch(): batch write error");
 
+    auto mit = memory_index_.find(key);
+    if (mit != memory_index_.end())
+    {
+        mit->second->etime = new_etime;
+    }
+
     call_handler(key, CacheEventIndex::touch);
 
     return true;
@@ -1173,7 +2090,7 @@ void PersistentStringCacheImpl::resize(int64_t size_in_bytes)
     auto s = db_->Put(write_options, SETTINGS_MAX_SIZE, to_string(size_in_bytes));
     throw_if_error(s, "resize(): cannot write max size");
     stats_->max_cache_size_ = size_in_bytes;
-    assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
 }
 
 void PersistentStringCacheImpl::trim_to(int64_t used_size_in_bytes)
@@ -1195,11 +2112,12 @@ void PersistentStringCacheImpl::trim_to(int64_t used_size_in_bytes)
     {
         delete_at_least(stats_->cache_size_ - used_size_in_bytes);
     }
-    assert(stats_->num_entries_ == hist_sum(stats_->hist_));
+    assert(stats_->num_entries_ == hist_sum(stats_->hist_.values()));
 }
 
 void PersistentStringCacheImpl::compact()
 {
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::compaction);
     lock_guard<decltype(mutex_)> lock(mutex_);
 
     db_->CompactRange(nullptr, nullptr);
@@ -1207,14 +2125,7 @@ void PersistentStringCacheImpl::compact()
 
 void PersistentStringCacheImpl::set_handler(CacheEvent events, PersistentStringCache::EventCallback cb)
 {
-    static constexpr auto limit = underlying_type<CacheEvent>::type(CacheEvent::END_);
-
-    auto evs = underlying_type<CacheEvent>::type(events);
-    if (evs == 0 || evs > limit - 1)
-    {
-        throw_invalid_argument("set_handler(): invalid events (" + to_string(evs) +
-                               "): value must be in the range [1.." + to_string(limit - 1) + "]");
-    }
+    auto evs = check_events(events, "set_handler()");
 
     lock_guard<decltype(mutex_)> lock(mutex_);
 
@@ -1228,7 +2139,184 @@ void PersistentStringCacheImpl::set_handler(CacheEvent events, PersistentStringC
     }
 }
 
-void PersistentStringCacheImpl::init_db(leveldb::Options options)
+void PersistentStringCacheImpl::set_batch_handler(CacheEvent events, PersistentStringCache::BatchEventCallback cb)
+{
+    auto evs = check_events(events, "set_batch_handler()");
+
+    lock_guard<decltype(mutex_)> lock(mutex_);
+
+    batch_handler_ = cb;
+    batch_events_ = cb ? evs : 0;
+}
+
+uint32_t PersistentStringCacheImpl::check_events(CacheEvent events, string const& method) const
+{
+    static constexpr auto limit = underlying_type<CacheEvent>::type(CacheEvent::END_);
+
+    auto evs = underlying_type<CacheEvent>::type(events);
+    if (evs == 0 || evs > limit - 1)
+    {
+        throw_invalid_argument(method + ": invalid events (" + to_string(evs) + "): value must be in the range [1.." +
+                               to_string(limit - 1) + "]");
+    }
+    return evs;
+}
+
+void PersistentStringCacheImpl::init_options(PersistentCacheOptions const& options)
+{
+    if (options.access_time_flush_interval.count() < 0)
+    {
+        throw_invalid_argument("invalid access_time_flush_interval (" +
+                               to_string(options.access_time_flush_interval.count()) + "): value must be >= 0");
+    }
+    if (options.max_pending_access_times < 1)
+    {
+        throw_invalid_argument("invalid max_pending_access_times (" + to_string(options.max_pending_access_times) +
+                               "): value must be > 0");
+    }
+    if (options.memory_cache_size < 0)
+    {
+        throw_invalid_argument("invalid memory_cache_size (" + to_string(options.memory_cache_size) +
+                               "): value must be >= 0");
+    }
+    if (options.expiry_reap_interval.count() < 0)
+    {
+        throw_invalid_argument("invalid expiry_reap_interval (" + to_string(options.expiry_reap_interval.count()) +
+                               "): value must be >= 0");
+    }
+    if (options.expiry_reap_batch_size < 1)
+    {
+        throw_invalid_argument("invalid expiry_reap_batch_size (" + to_string(options.expiry_reap_batch_size) +
+                               "): value must be > 0");
+    }
+    if (options.eviction_high_watermark <= 0.0 || options.eviction_high_watermark > 1.0)
+    {
+        throw_invalid_argument("invalid eviction_high_watermark (" + to_string(options.eviction_high_watermark) +
+                               "): value must be > 0 and <= 1");
+    }
+    if (options.eviction_low_watermark <= 0.0 || options.eviction_low_watermark > options.eviction_high_watermark)
+    {
+        throw_invalid_argument("invalid eviction_low_watermark (" + to_string(options.eviction_low_watermark) +
+                               "): value must be > 0 and <= eviction_high_watermark");
+    }
+    if (options.admission_sketch_size < 1)
+    {
+        throw_invalid_argument("invalid admission_sketch_size (" + to_string(options.admission_sketch_size) +
+                               "): value must be > 0");
+    }
+    if (options.admission_sketch_save_interval.count() < 0)
+    {
+        throw_invalid_argument("invalid admission_sketch_save_interval (" +
+                               to_string(options.admission_sketch_save_interval.count()) + "): value must be >= 0");
+    }
+    if (options.protected_fraction <= 0.0 || options.protected_fraction > 1.0)
+    {
+        throw_invalid_argument("invalid protected_fraction (" + to_string(options.protected_fraction) +
+                               "): value must be > 0 and <= 1");
+    }
+    if (options.stats_checkpoint_interval < 0)
+    {
+        throw_invalid_argument("invalid stats_checkpoint_interval (" + to_string(options.stats_checkpoint_interval) +
+                               "): value must be >= 0");
+    }
+    if (options.event_queue_size < 1)
+    {
+        throw_invalid_argument("invalid event_queue_size (" + to_string(options.event_queue_size) +
+                               "): value must be > 0");
+    }
+    if (options.durability == CacheDurability::periodic && options.sync_interval.count() < 1)
+    {
+        throw_invalid_argument("invalid sync_interval (" + to_string(options.sync_interval.count()) +
+                               "): value must be > 0");
+    }
+    if (options.write_behind && options.write_behind_interval.count() < 1)
+    {
+        throw_invalid_argument("invalid write_behind_interval (" + to_string(options.write_behind_interval.count()) +
+                               "): value must be > 0");
+    }
+    if (options.write_behind && options.write_behind_max_bytes < 1)
+    {
+        throw_invalid_argument("invalid write_behind_max_bytes (" + to_string(options.write_behind_max_bytes) +
+                               "): value must be > 0");
+    }
+    if (options.bloom_filter_bits_per_key < 0)
+    {
+        throw_invalid_argument("invalid bloom_filter_bits_per_key (" + to_string(options.bloom_filter_bits_per_key) +
+                               "): value must be >= 0");
+    }
+    if (options.block_size < 1)
+    {
+        throw_invalid_argument("invalid block_size (" + to_string(options.block_size) + "): value must be > 0");
+    }
+    if (options.block_cache_size < 0)
+    {
+        throw_invalid_argument("invalid block_cache_size (" + to_string(options.block_cache_size) +
+                               "): value must be >= 0");
+    }
+    if (options.write_buffer_size < 1)
+    {
+        throw_invalid_argument("invalid write_buffer_size (" + to_string(options.write_buffer_size) +
+                               "): value must be > 0");
+    }
+    if (options.max_open_files < 1)
+    {
+        throw_invalid_argument("invalid max_open_files (" + to_string(options.max_open_files) +
+                               "): value must be > 0");
+    }
+    options_ = options;
+}
+
+leveldb::Options PersistentStringCacheImpl::make_db_options(int64_t max_size_in_bytes)
+{
+    assert(!db_);  // The block cache and filter policy must outlive the DB.
+
+    leveldb::Options db_options;
+
+    // Unless the caller asks for a specific size, reduce memory consumption for small caches
+    // by reducing the size of the internal block cache. The block cache size is at least 512 kB.
+    // For caches 5-80 MB, it is 10% of the nominal cache size. For caches > 80 MB, the block cache
+    // is left at the default of 8 MB.
+    size_t block_cache_size = options_.block_cache_size;
+    if (block_cache_size == 0)
+    {
+        block_cache_size = max_size_in_bytes / 10;
+        if (block_cache_size < 512 * 1024)
+        {
+            block_cache_size = 512 * 1024;
+        }
+    }
+    block_cache_.reset();
+    if (options_.block_cache_size != 0 || block_cache_size < 8 * 1024 * 1024)
+    {
+        block_cache_.reset(leveldb::NewLRUCache(block_cache_size));
+        db_options.block_cache = block_cache_.get();
+    }
+
+    filter_policy_.reset();
+    if (options_.bloom_filter_bits_per_key > 0)
+    {
+        filter_policy_.reset(leveldb::NewBloomFilterPolicy(options_.bloom_filter_bits_per_key));
+        db_options.filter_policy = filter_policy_.get();
+    }
+
+    db_options.block_size = options_.block_size;
+    db_options.compression = options_.compression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    db_options.write_buffer_size = options_.write_buffer_size;
+    db_options.max_open_files = options_.max_open_files;
+    db_options.paranoid_checks = options_.paranoid_checks;
+
+    // With durability, a sync must also cover the writes in logs that leveldb closed since the previous sync.
+    env_.reset();
+    if (options_.durability != CacheDurability::none)
+    {
+        env_.reset(new SyncLogsEnv);
+        db_options.env = env_.get();
+    }
+
+    return db_options;
+}
+
+void PersistentStringCacheImpl::init_db(leveldb::Options options)
 {
 #ifndef NDEBUG
     options.paranoid_checks = true;
@@ -1257,8 +2345,9 @@ void PersistentStringCacheImpl::write_version()
 
 // Check if the version of the DB matches the expected version.
 // Pre: Version exists in the DB.
+// If the version is 3 to 7, convert the data to the current version.
 // If the version can be read and make sense as a number, but
-// differs from the expected version, wipe the data (but
+// otherwise differs from the expected version, wipe the data (but
 // not the settings).
 // If the version can be read, but doesn't parse as a number, throw.
 // If the version matches the expected version, do nothing.
@@ -1280,7 +2369,31 @@ void PersistentStringCacheImpl::check_version()
     {
         throw_corrupt_error("check_version(): bad version: \"" + val + "\"");
     }
-    if (old_version != SCHEMA_VERSION)
+    if (old_version == 3)
+    {
+        upgrade_from_version_3();
+        old_version = 4;
+    }
+    if (old_version == 4)
+    {
+        upgrade_from_version_4();
+        old_version = 5;
+    }
+    if (old_version == 5)
+    {
+        upgrade_from_version_5();
+        old_version = 6;
+    }
+    if (old_version == 6)
+    {
+        upgrade_from_version_6();
+        old_version = 7;
+    }
+    if (old_version == 7)
+    {
+        upgrade_from_version_7();
+    }
+    else if (old_version != SCHEMA_VERSION)
     {
         // Wipe all tables and stats (but not settings).
         leveldb::WriteBatch batch;
@@ -1305,6 +2418,7 @@ void PersistentStringCacheImpl::check_version()
         stats_->num_entries_ = 0;
         stats_->hist_clear();
         stats_->cache_size_ = 0;
+        stats_->protected_size_ = 0;
 
         // init_stats() (called later) calls deserialize() on the stats,
         // so we need to create a proper stats record here.
@@ -1312,6 +2426,272 @@ void PersistentStringCacheImpl::check_version()
     }
 }
 
+// Version 3 differs from version 4 only in the encoding of times and sizes
+// in the Data table and the Atime and Etime indexes, so we convert these in place.
+// The conversion skips rows that are already in the new format. That way,
+// if we are interrupted part-way through, the next open picks up where we left off.
+// (The version is written only once everything has been converted.)
+
+void PersistentStringCacheImpl::upgrade_from_version_3()
+{
+    int64_t count = 0;
+    int64_t const batch_size = 1000;
+
+    leveldb::WriteBatch batch;
+    auto write_batch = [&]()
+    {
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "upgrade_from_version_3(): batch write error");
+        batch.Clear();
+        count = 0;
+    };
+
+    IteratorUPtr it(db_->NewIterator(read_options));
+
+    // Data table
+    leveldb::Slice const data_prefix(V4_DATA_BEGIN);
+    it->Seek(data_prefix);
+    while (it->Valid() && it->key().starts_with(data_prefix))
+    {
+        if (is_decimal(it->value()))
+        {
+            DataTuple dt;
+            istringstream is(it->value().ToString());
+            is >> dt.atime >> dt.etime >> dt.size;
+            batch.Put(it->key(), dt.to_string());
+            if (++count == batch_size)
+            {
+                write_batch();
+            }
+        }
+        it->Next();
+    }
+
+    // Atime and Etime indexes
+    for (auto const& prefix : {V6_ATIME_BEGIN, V6_ETIME_BEGIN})
+    {
+        leveldb::Slice const index_prefix(prefix);
+        it->Seek(index_prefix);
+        while (it->Valid() && it->key().starts_with(index_prefix))
+        {
+            leveldb::Slice k = it->key();
+            k.remove_prefix(1);
+            if (is_decimal(k))
+            {
+                auto tk = v3_time_key_of(k);
+                batch.Delete(it->key());
+                batch.Put(k_time_index(prefix, tk.time, tk.key), v5_size(stoll(it->value().ToString())));
+                if (++count == batch_size)
+                {
+                    write_batch();
+                }
+            }
+            it->Next();
+        }
+    }
+    throw_if_error(it->status(), "upgrade_from_version_3(): iterator error");
+
+    batch.Put(SETTINGS_SCHEMA_VERSION, "4");  // check_version() continues with the upgrade from version 4.
+    write_batch();
+}
+
+// Version 4 stored the value, the data tuple, and the metadata of an entry in separate
+// rows of the Values, Data, and Metadata tables. We combine these into a single record
+// that replaces the row in the Values table. (The Values table used the same prefix
+// as the Entries table.) Each entry is converted in the same batch that deletes its
+// Data and Metadata rows, so, if we are interrupted part-way through, the next open
+// picks up with the entries that still have a row in the Data table.
+
+void PersistentStringCacheImpl::upgrade_from_version_4()
+{
+    int64_t count = 0;
+    int64_t const batch_size = 1000;
+
+    leveldb::WriteBatch batch;
+    auto write_batch = [&]()
+    {
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "upgrade_from_version_4(): batch write error");
+        batch.Clear();
+        count = 0;
+    };
+
+    IteratorUPtr it(db_->NewIterator(read_options));
+    leveldb::Slice const data_prefix(V4_DATA_BEGIN);
+    it->Seek(data_prefix);
+    while (it->Valid() && it->key().starts_with(data_prefix))
+    {
+        string key = it->key().ToString().substr(1);
+
+        string value;
+        auto s = db_->Get(read_options, V6_ENTRIES_BEGIN + key, &value);
+        throw_if_error(s, "upgrade_from_version_4(): cannot read value");
+        if (s.IsNotFound())
+        {
+            throw_corrupt_error("upgrade_from_version_4(): missing value for key \"" + key + "\"");  // LCOV_EXCL_LINE
+        }
+
+        string metadata;
+        string metadata_key = V4_METADATA_BEGIN + key;
+        s = db_->Get(read_options, metadata_key, &metadata);
+        throw_if_error(s, "upgrade_from_version_4(): cannot read metadata");
+        leveldb::Slice metadata_slice(metadata);
+
+        batch.Put(V6_ENTRIES_BEGIN + key,
+                  v_entry(it->value().ToString(), value, s.IsNotFound() ? nullptr : &metadata_slice));
+        batch.Delete(it->key());
+        batch.Delete(metadata_key);
+        if (++count == batch_size)
+        {
+            write_batch();
+        }
+        it->Next();
+    }
+    throw_if_error(it->status(), "upgrade_from_version_4(): iterator error");
+
+    batch.Put(SETTINGS_SCHEMA_VERSION, "5");  // check_version() continues with the upgrade from version 5.
+    write_batch();
+}
+
+// Version 5 stored only the size as the value of the Atime and Etime index rows. We rewrite
+// the index rows from the records, which doesn't change their keys. Because rewriting a row
+// that is already in the new format has no effect, an interrupted upgrade simply starts over
+// on the next open.
+
+void PersistentStringCacheImpl::upgrade_from_version_5()
+{
+    int64_t count = 0;
+    int64_t const batch_size = 1000;
+
+    leveldb::WriteBatch batch;
+    auto write_batch = [&]()
+    {
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "upgrade_from_version_5(): batch write error");
+        batch.Clear();
+        count = 0;
+    };
+
+    IteratorUPtr it(db_->NewIterator(read_options));
+    leveldb::Slice const entries_prefix(V6_ENTRIES_BEGIN);
+    it->Seek(entries_prefix);
+    while (it->Valid() && it->key().starts_with(entries_prefix))
+    {
+        string key = it->key().ToString().substr(1);
+        DataTuple dt(it->value());
+        batch.Put(k_time_index(V6_ATIME_BEGIN, dt.atime, key), v_index(dt.size, dt.etime));
+        if (dt.etime != epoch_ticks())  // We don't know the policy yet, but only lru_ttl has expiry times.
+        {
+            batch.Put(k_time_index(V6_ETIME_BEGIN, dt.etime, key), v_index(dt.size, dt.atime));
+        }
+        if (++count == batch_size)
+        {
+            write_batch();
+        }
+        it->Next();
+    }
+    throw_if_error(it->status(), "upgrade_from_version_5(): iterator error");
+
+    batch.Put(SETTINGS_SCHEMA_VERSION, "6");  // check_version() continues with the upgrade from version 6.
+    write_batch();
+}
+
+// Version 6 had no generations, and the Entries table and the Atime and Etime indexes used different
+// prefixes. We move each row to the same key with the new prefix and generation 0. Each row is
+// moved in the same batch that deletes the old one, so an interrupted upgrade picks up with the
+// rows that still have the old prefix.
+
+void PersistentStringCacheImpl::upgrade_from_version_6()
+{
+    int64_t count = 0;
+    int64_t const batch_size = 1000;
+
+    leveldb::WriteBatch batch;
+    auto write_batch = [&]()
+    {
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "upgrade_from_version_6(): batch write error");
+        batch.Clear();
+        count = 0;
+    };
+
+    IteratorUPtr it(db_->NewIterator(read_options));
+    vector<pair<string, string>> const tables = {{V6_ENTRIES_BEGIN, ENTRIES_BEGIN},
+                                                 {V6_ATIME_BEGIN, ATIME_BEGIN},
+                                                 {V6_ETIME_BEGIN, ETIME_BEGIN}};
+    for (auto const& t : tables)
+    {
+        leveldb::Slice const old_prefix(t.first);
+        string const new_prefix = k_generation(t.second, 0);
+        it->Seek(old_prefix);
+        while (it->Valid() && it->key().starts_with(old_prefix))
+        {
+            leveldb::Slice k = it->key();
+            k.remove_prefix(old_prefix.size());
+            batch.Put(new_prefix + k.ToString(), it->value());
+            batch.Delete(it->key());
+            if (++count == batch_size)
+            {
+                write_batch();
+            }
+            it->Next();
+        }
+    }
+    throw_if_error(it->status(), "upgrade_from_version_6(): iterator error");
+
+    batch.Put(SETTINGS_SCHEMA_VERSION, "7");  // check_version() continues with the upgrade from version 7.
+    write_batch();
+}
+
+// Version 7 didn't record the segment of an entry in its data tuple. We set the flag in the record
+// of each entry in the Protected index. Setting the flag again is harmless, so an interrupted
+// upgrade simply starts over.
+
+void PersistentStringCacheImpl::upgrade_from_version_7()
+{
+    int64_t count = 0;
+    int64_t const batch_size = 1000;
+
+    leveldb::WriteBatch batch;
+    auto write_batch = [&]()
+    {
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "upgrade_from_version_7(): batch write error");
+        batch.Clear();
+        count = 0;
+    };
+
+    IteratorUPtr it(db_->NewIterator(read_options));
+    leveldb::Slice const protected_prefix(PROTECTED_BEGIN);
+    it->Seek(protected_prefix);
+    while (it->Valid() && it->key().starts_with(protected_prefix))
+    {
+        // The key is the prefix, generation, access time, and the key of the entry.
+        string const k = it->key().ToString();
+        string const entry_key = ENTRIES_BEGIN + k.substr(PROTECTED_BEGIN.size(), INT64_ENCODED_SIZE) +
+                                 k.substr(PROTECTED_BEGIN.size() + 2 * INT64_ENCODED_SIZE);
+        string record;
+        auto s = db_->Get(read_options, entry_key, &record);
+        throw_if_error(s, "upgrade_from_version_7(): cannot read entry");
+        if (!s.IsNotFound())
+        {
+            DataTuple dt(record);
+            dt.is_protected = true;
+            set_data(record, dt.to_string());
+            batch.Put(entry_key, record);
+            if (++count == batch_size)
+            {
+                write_batch();
+            }
+        }
+        it->Next();
+    }
+    throw_if_error(it->status(), "upgrade_from_version_7(): iterator error");
+
+    batch.Put(SETTINGS_SCHEMA_VERSION, to_string(SCHEMA_VERSION));
+    write_batch();
+}
+
 void PersistentStringCacheImpl::read_settings()
 {
     // Note: Loose error checking here. If someone deliberately
@@ -1327,6 +2707,32 @@ void PersistentStringCacheImpl::read_settings()
     s = db_->Get(read_options, SETTINGS_POLICY, &val);
     throw_if_error(s, "read_settings(): cannot read policy");
     stats_->policy_ = static_cast<CacheDiscardPolicy>(stoi(val));
+
+    // Caches that were never invalidated don't have a generation.
+    s = db_->Get(read_options, SETTINGS_GENERATION, &val);
+    throw_if_error(s, "read_settings(): cannot read generation");
+    generation_ = s.IsNotFound() ? 0 : stoll(val);
+}
+
+// Reads the database settings that determine how data is written to disk.
+// Caches created by older versions don't have these settings; we use the
+// leveldb defaults for those, which is what older versions used.
+
+void PersistentStringCacheImpl::read_db_settings()
+{
+    string val;
+
+    auto s = db_->Get(read_options, SETTINGS_BLOOM_BITS_PER_KEY, &val);
+    throw_if_error(s, "read_db_settings(): cannot read bloom filter bits per key");
+    options_.bloom_filter_bits_per_key = s.IsNotFound() ? 0 : stoi(val);
+
+    s = db_->Get(read_options, SETTINGS_BLOCK_SIZE, &val);
+    throw_if_error(s, "read_db_settings(): cannot read block size");
+    options_.block_size = s.IsNotFound() ? leveldb::Options().block_size : stoll(val);
+
+    s = db_->Get(read_options, SETTINGS_COMPRESSION, &val);
+    throw_if_error(s, "read_db_settings(): cannot read compression");
+    options_.compression = s.IsNotFound() || val == "1";
 }
 
 void PersistentStringCacheImpl::write_settings()
@@ -1335,6 +2741,9 @@ void PersistentStringCacheImpl::write_settings()
 
     batch.Put(SETTINGS_MAX_SIZE, to_string(stats_->max_cache_size_));
     batch.Put(SETTINGS_POLICY, to_string(static_cast<int>(stats_->policy_)));
+    batch.Put(SETTINGS_BLOOM_BITS_PER_KEY, to_string(options_.bloom_filter_bits_per_key));
+    batch.Put(SETTINGS_BLOCK_SIZE, to_string(options_.block_size));
+    batch.Put(SETTINGS_COMPRESSION, options_.compression ? "1" : "0");
 
     auto s = db_->Write(write_options, &batch);
     throw_if_error(s, "write_settings()");
@@ -1354,241 +2763,1435 @@ void PersistentStringCacheImpl::write_stats()
     throw_if_error(s, "write_stats()");
 }
 
-bool PersistentStringCacheImpl::read_dirty_flag() const
+// Restores the frequency sketch that was saved most recently (see run_background()). If there is none,
+// or it was saved with a different sketch size, the sketch starts out empty.
+
+void PersistentStringCacheImpl::read_sketch()
 {
-    string dirty;
-    auto s = db_->Get(read_options, DIRTY_FLAG, &dirty);
-    if (s.IsNotFound())
+    if (!sketch_)
     {
-        return true;
+        return;
+    }
+    string val;
+    auto s = db_->Get(read_options, STATS_SKETCH, &val);
+    throw_if_error(s, "read_sketch()");
+    if (!s.IsNotFound())
+    {
+        sketch_->deserialize(val);
     }
-    return dirty != "0";
 }
 
-void PersistentStringCacheImpl::write_dirty_flag(bool is_dirty)
+void PersistentStringCacheImpl::write_sketch()
 {
-    auto s = db_->Put(write_options, DIRTY_FLAG, is_dirty ? "1" : "0");
-    throw_if_error(s, "write_dirty_flag()");
+    if (!sketch_)
+    {
+        return;
+    }
+    auto s = db_->Put(write_options, STATS_SKETCH, sketch_->serialize());
+    throw_if_error(s, "write_sketch()");
 }
 
-PersistentStringCacheImpl::DataTuple PersistentStringCacheImpl::get_data(string const& key, bool& found) const
+// Writes the stats, together with the sequence number of the most recent journal row,
+// and removes the journal rows that are covered by the new checkpoint.
+
+void PersistentStringCacheImpl::write_checkpoint()
 {
     // mutex_ must be locked here!
 
-    assert(key[0] == DATA_BEGIN[0]);
-
-    string val;
-    auto s = db_->Get(read_options, key, &val);
-    throw_if_error(s, "get_data(): cannot read data");
-    if (!s.IsNotFound())
-    {
-        found = true;
-        return DataTuple(val);
-    }
-    found = false;
-    return DataTuple();
+    leveldb::WriteBatch batch;
+    write_checkpoint(batch);
 }
 
-bool PersistentStringCacheImpl::get_value_and_metadata(string const& key,
-                                                       DataTuple& data,
-                                                       string& value,
-                                                       string* metadata) const
+// Same as write_checkpoint(), but the checkpoint is written together with the contents of batch.
+
+void PersistentStringCacheImpl::write_checkpoint(leveldb::WriteBatch& batch)
 {
     // mutex_ must be locked here!
 
-    // Note: key is the un-prefixed key!
-    string prefixed_key = k_data(key);
-
-    IteratorUPtr it(db_->NewIterator(read_options));
-    it->Seek(prefixed_key);
-    throw_if_error(it->status(), "get_value_and_metadata(): iterator error");
-    assert(it->Valid());
-    if (it->key() != leveldb::Slice(prefixed_key))
-    {
-        return false;
-    }
-
-    data = DataTuple(it->value().ToString());
-    prefixed_key[0] = VALUES_BEGIN[0];  // Avoid string copy.
-    it->Seek(prefixed_key);
-    assert(it->Valid() && it->key().compare(prefixed_key) == 0);
-    value = it->value().ToString();
-    if (metadata)
+    batch.Put(STATS_VALUES, stats_->serialize());
+    if (options_.stats_checkpoint_interval > 0)
     {
-        prefixed_key[0] = METADATA_BEGIN[0];  // Avoid string copy.
-        it->Seek(prefixed_key);
-        if (it->key().compare(prefixed_key) == 0)
-        {
-            *metadata = it->value().ToString();
-        }
-        else
+        batch.Put(STATS_CHECKPOINT, encode_int64(journal_seq_));
+        for (int64_t seq = checkpoint_seq_ + 1; seq <= journal_seq_; ++seq)
         {
-            metadata->clear();  // Metadata may have been there previously, but isn't now.
+            batch.Delete(k_journal(seq));
         }
     }
-    return true;
+    auto s = db_->Write(write_options, &batch);
+    throw_if_error(s, "write_checkpoint()");
+    checkpoint_seq_ = journal_seq_;
 }
 
-void PersistentStringCacheImpl::batch_delete(string const& key, DataTuple const& data, leveldb::WriteBatch& batch)
+// Adds an entry of the given size to the stats, and records the change in the journal.
+
+void PersistentStringCacheImpl::stats_add_entry(int64_t size)
 {
     // mutex_ must be locked here!
 
-    string prefixed_key = k_data(key);
-    batch.Delete(prefixed_key);                    // Delete data.
-    prefixed_key[0] = VALUES_BEGIN[0];             // Avoid string copy.
-    batch.Delete(prefixed_key);                    // Delete value.
-    prefixed_key[0] = METADATA_BEGIN[0];           // Avoid string copy.
-    batch.Delete(prefixed_key);                    // Delete metadata
-    batch.Delete(k_atime_index(data.atime, key));  // Delete atime index
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl)
+    ++stats_->num_entries_;
+    stats_->cache_size_ += size;
+    stats_->hist_increment(size);
+    if (options_.stats_checkpoint_interval > 0)
     {
-        string etime_key = k_etime_index(data.etime, key);
-        batch.Delete(etime_key);
+        append_int64(journal_, size);
     }
 }
 
-void PersistentStringCacheImpl::delete_entry(string const& key, DataTuple const& data)
+// Removes an entry of the given size from the stats, and records the change in the journal.
+
+void PersistentStringCacheImpl::stats_remove_entry(int64_t size)
 {
     // mutex_ must be locked here!
 
-    leveldb::WriteBatch batch;
-    batch_delete(key, data, batch);
+    --stats_->num_entries_;
+    stats_->cache_size_ -= size;
+    stats_->hist_decrement(size);
+    if (options_.stats_checkpoint_interval > 0)
+    {
+        append_int64(journal_, -size);
+    }
+}
+
+// Writes a batch that adds or removes entries. The stats changes that were made for the
+// batch are recorded in a journal row that is written with the batch. Every
+// stats_checkpoint_interval journal rows, we write a new checkpoint.
+
+void PersistentStringCacheImpl::write_batch(leveldb::WriteBatch& batch, string const& msg)
+{
+    // mutex_ must be locked here!
+
+    if (!journal_.empty())
+    {
+        batch.Put(k_journal(++journal_seq_), journal_);
+        journal_.clear();
+    }
+    auto s = db_->Write(write_options, &batch);
+    throw_if_error(s, msg);
+
+    if (options_.stats_checkpoint_interval > 0 &&
+        journal_seq_ - checkpoint_seq_ >= options_.stats_checkpoint_interval)
+    {
+        write_checkpoint();
+    }
+}
+
+bool PersistentStringCacheImpl::read_dirty_flag() const
+{
+    string dirty;
+    auto s = db_->Get(read_options, DIRTY_FLAG, &dirty);
+    if (s.IsNotFound())
+    {
+        return true;
+    }
+    return dirty != "0";
+}
+
+void PersistentStringCacheImpl::write_dirty_flag(bool is_dirty)
+{
+    auto s = db_->Put(write_options, DIRTY_FLAG, is_dirty ? "1" : "0");
+    throw_if_error(s, "write_dirty_flag()");
+}
+
+// Looks up an entry for get() and get_many(). For a hit in the DB, the new access time is added
+// to batch and num_updates is incremented, unless the update is deferred. The caller writes
+// the batch and updates the hit and miss counters.
+
+bool PersistentStringCacheImpl::get_entry(string const& key,
+                                          string& value,
+                                          string* metadata,
+                                          leveldb::WriteBatch& batch,
+                                          int64_t& num_updates) const
+{
+    // mutex_ must be locked here!
+
+    if (sketch_)
+    {
+        sketch_->increment(key);  // Hit or miss, this is an access.
+    }
+
+    // A staged entry supersedes the entry on disk. Its access time is the time it is written.
+    auto sit = staged_index_.find(key);
+    if (sit != staged_index_.end())
+    {
+        auto const& e = *sit->second;
+        if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && e.etime != epoch_ticks() && e.etime <= now_ticks())
+        {
+            return false;
+        }
+        value = e.data->value;
+        if (metadata)
+        {
+            *metadata = e.data->metadata;
+        }
+        return true;
+    }
+
+    if (options_.memory_cache_size > 0)
+    {
+        if (memory_get(key, value, metadata))
+        {
+            // The access time is written to disk later, as for deferred access time updates.
+            record_access_time(key, now_ticks());
+            ++stats_->memory_hits_;
+            return true;
+        }
+        ++stats_->memory_misses_;
+    }
+
+    // If we have an in-memory tier, we always read the metadata, so the entry can be added to memory.
+    string memory_metadata;
+    if (!metadata && options_.memory_cache_size > 0)
+    {
+        metadata = &memory_metadata;
+    }
+
+    // We read the record rather than just the value, so we can write it back with the new access time.
+    string record;
+    if (!get_record(key, record))
+    {
+        return false;
+    }
+    DataTuple dt(record);
+
+    // Don't return expired entry.
+    int64_t new_atime = now_ticks();
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks() && dt.etime <= new_atime)
+    {
+        return false;
+    }
+    value = value_of(record).ToString();
+    if (metadata)
+    {
+        *metadata = metadata_of(record).ToString();
+    }
+
+    if (options_.memory_cache_size > 0)
+    {
+        memory_put(key, value.data(), value.size(), metadata->data(), metadata->size(), dt.etime);
+    }
+
+    if (options_.defer_access_time_updates)
+    {
+        // No write here; the new access time is written later by flush_access_times().
+        record_access_time(key, new_atime);
+        return true;
+    }
+
+    // A pending access time from an earlier hit in memory is superseded by this update.
+    // If we left it, a flush before the batch is written would leave a stale Atime index entry.
+    pending_atimes_.erase(key);
+
+    batch_delete_index(key, dt, batch);
+    auto weight = set_access_time(key, dt, new_atime);
+    dt.is_protected = stats_->policy_ == CacheDiscardPolicy::segmented_lru;  // A hit promotes the entry.
+    set_data(record, dt.to_string());
+    batch.Put(k_entry(generation_, key), record);
+    batch_put_index(key, dt, batch, weight);
+    ++num_updates;
+    return true;
+}
+
+// Same as get_entry(), but sets view to refer to the value and metadata without copying them. For an entry
+// that is not in memory, the view holds on to the iterator that we use to read the entry.
+
+bool PersistentStringCacheImpl::get_entry_view(string const& key,
+                                               PersistentStringCache::View& view,
+                                               leveldb::WriteBatch& batch,
+                                               int64_t& num_updates) const
+{
+    // mutex_ must be locked here!
+
+    if (sketch_)
+    {
+        sketch_->increment(key);
+    }
+
+    // See get_entry(). The view shares the data with the staged entry.
+    auto sit = staged_index_.find(key);
+    if (sit != staged_index_.end())
+    {
+        auto const& e = *sit->second;
+        if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && e.etime != epoch_ticks() && e.etime <= now_ticks())
+        {
+            return false;
+        }
+        view.pin_ = e.data;
+        view.value_data_ = e.data->value.data();
+        view.value_size_ = e.data->value.size();
+        view.metadata_data_ = e.data->metadata.data();
+        view.metadata_size_ = e.data->metadata.size();
+        return true;
+    }
+
+    if (options_.memory_cache_size > 0)
+    {
+        if (memory_get_view(key, view))
+        {
+            // The access time is written to disk later, as for deferred access time updates.
+            record_access_time(key, now_ticks());
+            ++stats_->memory_hits_;
+            return true;
+        }
+        ++stats_->memory_misses_;
+    }
+
+    string const entry_key = k_entry(generation_, key);
+    shared_ptr<leveldb::Iterator> it(db_->NewIterator(read_options));
+    it->Seek(entry_key);
+    throw_if_error(it->status(), "get_view(): cannot read entry");
+    if (!it->Valid() || it->key() != entry_key)
+    {
+        return false;
+    }
+    auto record = it->value();
+    DataTuple dt(record);
+
+    // Don't return expired entry.
+    int64_t new_atime = now_ticks();
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && dt.etime != epoch_ticks() && dt.etime <= new_atime)
+    {
+        return false;
+    }
+    auto value = value_of(record);
+    auto metadata = metadata_of(record);
+
+    if (options_.memory_cache_size > 0)
+    {
+        memory_put(key, value.data(), value.size(), metadata.data(), metadata.size(), dt.etime);
+    }
+
+    view.pin_ = it;
+    view.value_data_ = value.data();
+    view.value_size_ = value.size();
+    view.metadata_data_ = metadata.data();
+    view.metadata_size_ = metadata.size();
+
+    if (options_.defer_access_time_updates)
+    {
+        // No write here; the new access time is written later by flush_access_times().
+        record_access_time(key, new_atime);
+        return true;
+    }
+
+    // See get_entry().
+    pending_atimes_.erase(key);
+
+    batch_delete_index(key, dt, batch);
+    auto weight = set_access_time(key, dt, new_atime);
+    dt.is_protected = stats_->policy_ == CacheDiscardPolicy::segmented_lru;
+    string new_record(record.data(), record.size());
+    set_data(new_record, dt.to_string());
+    batch.Put(entry_key, new_record);
+    batch_put_index(key, dt, batch, weight);
+    ++num_updates;
+    return true;
+}
+
+bool PersistentStringCacheImpl::get_record(string const& key, string& record) const
+{
+    // mutex_ must be locked here!
+
+    // Note: key is the un-prefixed key!
+    auto s = db_->Get(read_options, k_entry(generation_, key), &record);
+    throw_if_error(s, "get_record(): cannot read entry");
+    return !s.IsNotFound();
+}
+
+PersistentStringCacheImpl::DataTuple PersistentStringCacheImpl::get_data(string const& key, bool& found) const
+{
+    // mutex_ must be locked here!
+
+    // Note: key is the un-prefixed key!
+    string record;
+    found = get_record(key, record);
+    return found ? DataTuple(record) : DataTuple();
+}
+
+bool PersistentStringCacheImpl::get_value_and_metadata(string const& key,
+                                                       DataTuple& data,
+                                                       string& value,
+                                                       string* metadata) const
+{
+    // mutex_ must be locked here!
+
+    // Note: key is the un-prefixed key!
+    auto sit = staged_index_.find(key);
+    if (sit != staged_index_.end())
+    {
+        auto const& e = *sit->second;
+        data = DataTuple(0, e.etime, e.size);
+        value = e.data->value;
+        if (metadata)
+        {
+            *metadata = e.data->metadata;
+        }
+        return true;
+    }
+
+    string record;
+    if (!get_record(key, record))
+    {
+        return false;
+    }
+
+    data = DataTuple(record);
+    value = value_of(record).ToString();
+    if (metadata)
+    {
+        *metadata = metadata_of(record).ToString();
+    }
+    return true;
+}
+
+void PersistentStringCacheImpl::batch_delete(string const& key, DataTuple const& data, leveldb::WriteBatch& batch)
+{
+    // mutex_ must be locked here!
+
+    batch.Delete(k_entry(generation_, key));
+    batch_delete_index(key, data, batch);
+    memory_erase(key);
+}
+
+// Adds the Atime and Etime index rows for an entry to batch. For segmented_lru, if data.is_protected
+// is true, the entry goes into the protected segment instead of the Atime index. (data.is_protected
+// is ignored for the other policies.) For gdsf, the Atime index row holds the weight of the entry.
+
+void PersistentStringCacheImpl::batch_put_index(string const& key,
+                                                DataTuple const& data,
+                                                leveldb::WriteBatch& batch,
+                                                Weight const& weight) const
+{
+    // mutex_ must be locked here!
+
+    if (stats_->policy_ == CacheDiscardPolicy::segmented_lru && data.is_protected)
+    {
+        batch.Put(k_protected_index(generation_, data.atime, key), v_index(data.size, data.etime));
+        stats_->protected_size_ += data.size;
+        return;
+    }
+    if (stats_->policy_ == CacheDiscardPolicy::gdsf)
+    {
+        batch.Put(k_atime_index(generation_, data.atime, key),
+                  v_weighted_index(data.size, data.etime, weight.cost, weight.frequency));
+        return;
+    }
+
+    batch.Put(k_atime_index(generation_, data.atime, key), v_index(data.size, data.etime));
+
+    // Etime index is not written to for non-expiring entries.
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && data.etime != epoch_ticks())
+    {
+        batch.Put(k_etime_index(generation_, data.etime, key), v_index(data.size, data.atime));
+    }
+}
+
+// Adds deletions of the Atime and Etime index rows for an entry to batch.
+// For a protected entry, this deletes its Protected index row instead.
+
+void PersistentStringCacheImpl::batch_delete_index(string const& key,
+                                                   DataTuple const& data,
+                                                   leveldb::WriteBatch& batch) const
+{
+    // mutex_ must be locked here!
+
+    if (stats_->policy_ == CacheDiscardPolicy::segmented_lru && data.is_protected)
+    {
+        batch.Delete(k_protected_index(generation_, data.atime, key));
+        stats_->protected_size_ -= data.size;
+        return;
+    }
+
+    batch.Delete(k_atime_index(generation_, data.atime, key));
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && data.etime != epoch_ticks())
+    {
+        batch.Delete(k_etime_index(generation_, data.etime, key));
+    }
+}
+
+// Returns the weight of an entry from its Atime index row. For the other policies, or if
+// the entry doesn't exist, this returns the default weight.
+
+PersistentStringCacheImpl::Weight PersistentStringCacheImpl::get_weight(string const& key,
+                                                                        DataTuple const& data) const
+{
+    // mutex_ must be locked here!
+
+    if (stats_->policy_ != CacheDiscardPolicy::gdsf)
+    {
+        return Weight();
+    }
+    string val;
+    auto s = db_->Get(read_options, k_atime_index(generation_, data.atime, key), &val);
+    throw_if_error(s, "get_weight()");
+    if (s.IsNotFound())
+    {
+        return Weight();  // LCOV_EXCL_LINE
+    }
+    return Weight(cost_of(val), frequency_of(val));
+}
+
+// Updates data for an access to the entry at time atime and returns the weight of the entry.
+// For gdsf, the access increments the frequency, and the access time slot receives the new priority.
+// This must be called before the index rows of the entry are replaced in the DB.
+
+PersistentStringCacheImpl::Weight PersistentStringCacheImpl::set_access_time(string const& key,
+                                                                             DataTuple& data,
+                                                                             int64_t atime) const
+{
+    // mutex_ must be locked here!
+
+    if (stats_->policy_ != CacheDiscardPolicy::gdsf)
+    {
+        data.atime = atime;
+        return Weight();
+    }
+    auto weight = get_weight(key, data);
+    ++weight.frequency;
+    data.atime = priority_of(data.size, weight);
+    return weight;
+}
+
+// Returns the gdsf priority of an entry, encoded so it can take the place of the access time.
+
+int64_t PersistentStringCacheImpl::priority_of(int64_t size, Weight const& weight) const
+{
+    assert(size > 0);
+    return double_bits(clock_ + weight.cost * weight.frequency / size);
+}
+
+// For gdsf, sets the clock to the lowest priority in the cache. We don't store the clock; it is
+// no larger than the lowest priority when the cache is closed, so the clock can only move forward
+// when the cache is opened again.
+
+void PersistentStringCacheImpl::init_clock()
+{
+    clock_ = 0;
+    if (stats_->policy_ != CacheDiscardPolicy::gdsf)
+    {
+        return;
+    }
+    IteratorUPtr it(db_->NewIterator(read_options));
+    string const atime_prefix = k_generation(ATIME_BEGIN, generation_);
+    it->Seek(atime_prefix);
+    if (it->Valid() && it->key().starts_with(atime_prefix))
+    {
+        clock_ = double_of(time_key_of(it->key()).time);
+    }
+    throw_if_error(it->status(), "init_clock(): iterator error");
+}
+
+// Moves the least recently used entries of the protected segment back to probation until the
+// protected segment fits into its share of the cache. The index rows move, and the record of
+// each demoted entry is rewritten to clear its segment flag. Because an entry keeps its access
+// time, it joins probation at the position of its most recent access.
+// This is called after the batch that moved entries into the protected segment is written,
+// so the Protected index we iterate over is up to date.
+
+void PersistentStringCacheImpl::demote_protected() const
+{
+    // mutex_ must be locked here!
+
+    if (stats_->policy_ != CacheDiscardPolicy::segmented_lru)
+    {
+        return;
+    }
+    int64_t const max_protected = stats_->max_cache_size_ * options_.protected_fraction;
+    if (stats_->protected_size_ <= max_protected)
+    {
+        return;
+    }
+
+    leveldb::WriteBatch batch;
+    string record;
+    IteratorUPtr it(db_->NewIterator(read_options));
+    string const protected_prefix = k_generation(PROTECTED_BEGIN, generation_);
+    it->Seek(protected_prefix);
+    while (it->Valid() && it->key().starts_with(protected_prefix) && stats_->protected_size_ > max_protected)
+    {
+        auto atk = time_key_of(it->key());
+        if (get_record(atk.key, record))
+        {
+            DataTuple dt(record);
+            dt.is_protected = false;
+            set_data(record, dt.to_string());
+            batch.Put(k_entry(generation_, atk.key), record);
+        }
+        batch.Delete(it->key());
+        batch.Put(k_atime_index(generation_, atk.time, atk.key), it->value());
+        stats_->protected_size_ -= size_of(it->value());
+        it->Next();
+    }
+    throw_if_error(it->status(), "demote_protected(): iterator error");
+
     auto s = db_->Write(write_options, &batch);
-    throw_if_error(s, "delete_entry()");
+    throw_if_error(s, "demote_protected()");
+}
+
+// Returns true if the admission filter lets a new entry into the cache. The candidate is admitted if its
+// key was accessed more often than each of the entries that delete_at_least() would evict in LRU
+// order to make bytes_needed bytes of room. Expired entries cost nothing to evict, so they don't count
+// against the candidate. (delete_at_least() evicts all expired entries first, so it may evict fewer
+// unexpired entries than we look at here.)
+
+bool PersistentStringCacheImpl::admit(string const& key, int64_t bytes_needed) const
+{
+    // mutex_ must be locked here!
+
+    assert(sketch_);
+    assert(bytes_needed > 0);
+
+    flush_access_times();  // As for delete_at_least(), the Atime index must reflect all hits.
+
+    auto const frequency = sketch_->estimate(key);
+    auto const now = now_ticks();
+    IteratorUPtr it(db_->NewIterator(read_options));
+    for (auto const& index : {ATIME_BEGIN, PROTECTED_BEGIN})
+    {
+        if (index == PROTECTED_BEGIN && stats_->policy_ != CacheDiscardPolicy::segmented_lru)
+        {
+            break;
+        }
+        string const index_prefix = k_generation(index, generation_);
+        for (it->Seek(index_prefix); it->Valid() && it->key().starts_with(index_prefix); it->Next())
+        {
+            int64_t etime = time_of(it->value());
+            bool expired = stats_->policy_ == CacheDiscardPolicy::lru_ttl && etime != epoch_ticks() && etime <= now;
+            if (!expired && sketch_->estimate(time_key_of(it->key()).key) >= frequency)
+            {
+                return false;
+            }
+            bytes_needed -= size_of(it->value());
+            if (bytes_needed <= 0)
+            {
+                return true;
+            }
+        }
+    }
+    throw_if_error(it->status(), "admit(): iterator error");
+    return true;
+}
+
+// Returns the total size of the entries in the protected segment.
+
+int64_t PersistentStringCacheImpl::count_protected() const
+{
+    int64_t size = 0;
+    IteratorUPtr it(db_->NewIterator(read_options));
+    string const protected_prefix = k_generation(PROTECTED_BEGIN, generation_);
+    for (it->Seek(protected_prefix); it->Valid() && it->key().starts_with(protected_prefix); it->Next())
+    {
+        size += size_of(it->value());
+    }
+    throw_if_error(it->status(), "count_protected(): iterator error");
+    return size;
+}
+
+// Adds the rows for a new or updated entry to batch. If found is true, old_data
+// is the data tuple of the existing entry, whose index entries are replaced.
+// For gdsf, cost is the miss cost of the entry, and the access time of data
+// is replaced with the priority of the entry.
+
+void PersistentStringCacheImpl::batch_put(string const& key,
+                                          DataTuple const& data,
+                                          leveldb::Slice const& value,
+                                          leveldb::Slice const* metadata,
+                                          bool found,
+                                          DataTuple const& old_data,
+                                          double cost,
+                                          leveldb::WriteBatch& batch)
+{
+    // mutex_ must be locked here!
+
+    // Replacing an existing entry counts as another access, which moves it into the protected segment.
+    DataTuple new_data(data);
+    new_data.is_protected = found && stats_->policy_ == CacheDiscardPolicy::segmented_lru;
+    Weight weight(cost, found ? get_weight(key, old_data).frequency + 1 : 1);
+    if (stats_->policy_ == CacheDiscardPolicy::gdsf)
+    {
+        new_data.atime = priority_of(new_data.size, weight);
+    }
+
+    // Add or replace the entry in the Entries table. This replaces any previous metadata.
+    batch.Put(k_entry(generation_, key), v_entry(new_data.to_string(), value, metadata));
+
+    // Replace the index rows.
+    if (found)
+    {
+        batch_delete_index(key, old_data, batch);
+    }
+    batch_put_index(key, new_data, batch, weight);
+}
+
+void PersistentStringCacheImpl::delete_entry(string const& key, DataTuple const& data)
+{
+    // mutex_ must be locked here!
+
+    leveldb::WriteBatch batch;
+    batch_delete(key, data, batch);
+    stats_remove_entry(data.size);
+    write_batch(batch, "delete_entry()");
+
+    assert(stats_->cache_size_ >= 0);
+    assert(stats_->cache_size_ <= stats_->max_cache_size_);
+    assert(stats_->num_entries_ >= 0);
+    assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
+    assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
+}
+
+void PersistentStringCacheImpl::delete_at_least(int64_t bytes_needed, unordered_set<string> const& skip_keys)
+{
+    // mutex_ must be locked here!
+
+    assert(bytes_needed > 0);
+    assert(bytes_needed <= stats_->cache_size_);
+
+    LatencyTimer timer(*stats_, PersistentCacheStats::Operation::eviction);
+
+    // The Atime index must reflect all hits, otherwise we would evict in the wrong order.
+    flush_access_times();
+
+    // Step 1: Delete all expired entries.
+    int64_t deleted_bytes;
+    delete_expired(0, skip_keys, deleted_bytes);
+    bytes_needed -= deleted_bytes;
+
+    leveldb::WriteBatch batch;
+
+    // Step 2: If we still need more room, delete entries in LRU order until we have enough room.
+    // For segmented_lru, the Atime index holds only the probation segment, and we continue with
+    // the protected segment if evicting all of probation isn't enough. For gdsf, the Atime index
+    // is in order of priority, so we delete the entries with the lowest priority first.
+    for (auto const& index : {ATIME_BEGIN, PROTECTED_BEGIN})
+    {
+        if (bytes_needed <= 0 || (index == PROTECTED_BEGIN && stats_->policy_ != CacheDiscardPolicy::segmented_lru))
+        {
+            break;
+        }
+
+        // Run over the index and delete in old-to-new order.
+        IteratorUPtr it(db_->NewIterator(read_options));
+        string const index_prefix = k_generation(index, generation_);
+        it->Seek(index_prefix);
+        while (it->Valid() && bytes_needed > 0 && it->key().starts_with(index_prefix))
+        {
+            auto atk = time_key_of(it->key());
+            if (!skip_keys.empty() && skip_keys.count(atk.key) != 0)
+            {
+                it->Next();
+                continue;  // This entry must not be deleted (see put_metadata()).
+            }
+
+            // The index row tells us everything we need to delete the entry, so we don't read the record.
+            int64_t size = size_of(it->value());
+            deleted_bytes += size;
+            bytes_needed -= size;
+            batch_delete(atk.key, DataTuple(atk.time, time_of(it->value()), size, index == PROTECTED_BEGIN), batch);
+            if (stats_->policy_ == CacheDiscardPolicy::gdsf)
+            {
+                clock_ = double_of(atk.time);  // The index is in order of priority, so the clock only moves forward.
+            }
+
+            stats_remove_entry(size);
+            ++stats_->lru_evictions_;
+            call_handler(atk.key, CacheEventIndex::evict_lru);
+
+            it->Next();
+        }
+        throw_if_error(it->status(), "delete_at_least(): LRU iterator error");
+    }
+    assert(bytes_needed <= 0);
+
+    write_batch(batch, "delete_at_least(): LRU write error");
+
+    assert(stats_->cache_size_ >= 0);
+    assert(stats_->num_entries_ >= 0);
+    assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
+    assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
+}
+
+// Deletes expired entries in order of expiry time, up to max_entries of them, or all of them
+// if max_entries is zero. Returns the number of entries deleted and sets deleted_bytes
+// to their total size.
+
+int64_t PersistentStringCacheImpl::delete_expired(int64_t max_entries,
+                                                  unordered_set<string> const& skip_keys,
+                                                  int64_t& deleted_bytes)
+{
+    // mutex_ must be locked here!
+
+    deleted_bytes = 0;
+    int64_t deleted_entries = 0;
+
+    if (stats_->policy_ != CacheDiscardPolicy::lru_ttl)
+    {
+        return 0;
+    }
+
+    leveldb::WriteBatch batch;
+    {
+        auto now_time = now_ticks();
+        IteratorUPtr it(db_->NewIterator(read_options));
+        string const etime_prefix = k_generation(ETIME_BEGIN, generation_);
+        it->Seek(etime_prefix);
+        while (it->Valid() && (max_entries == 0 || deleted_entries < max_entries))
+        {
+            if (!it->key().starts_with(etime_prefix))
+            {
+                break;
+            }
+            auto ek = time_key_of(it->key());
+            if (!skip_keys.empty() && skip_keys.count(ek.key) != 0)
+            {
+                // Too hard to hit with a test because the entry must expire
+                // in between put_metadata() having decided that it's still
+                // unexpired and now_time taken above.
+                // LCOV_EXCL_START
+                it->Next();
+                continue;  // This entry must not be deleted (see put_metadata()).
+                // LCOV_EXCL_STOP
+            }
+            if (ek.time > now_time)
+            {
+                break;  // Anything past this point has not expired yet.
+            }
+
+            int64_t size = size_of(it->value());
+            deleted_bytes += size;
+            ++deleted_entries;
+            batch_delete(ek.key, DataTuple(time_of(it->value()), ek.time, size), batch);
+
+            stats_remove_entry(size);
+            ++stats_->ttl_evictions_;
+            call_handler(ek.key, CacheEventIndex::evict_ttl);
+
+            it->Next();
+        }
+        throw_if_error(it->status(), "delete_expired(): expiry iterator error");
+    }  // Close iterator.
+
+    if (deleted_entries)
+    {
+        write_batch(batch, "delete_expired(): expiry write error");
+    }
+
+    assert(stats_->cache_size_ >= 0);
+    assert(stats_->num_entries_ >= 0);
+    return deleted_entries;
+}
+
+// Evicts entries in LRU order until the cache is at or below the low watermark. To avoid holding
+// the lock for a long time, at most write_buffer_size bytes are evicted per call.
+// Returns true if there is more to evict.
+
+bool PersistentStringCacheImpl::evict_to_low_watermark()
+{
+    lock_guard<decltype(mutex_)> lock(mutex_);
+
+    // Staged entries count towards the size, so there is room for them when they are written.
+    int64_t low_watermark = int64_t(stats_->max_cache_size_ * options_.eviction_low_watermark);
+    int64_t excess = min(stats_->cache_size_ + staged_size_ - low_watermark, int64_t(stats_->cache_size_));
+    if (excess <= 0)
+    {
+        return false;
+    }
+    delete_at_least(min(excess, options_.write_buffer_size));
+    return stats_->cache_size_ > 0 && stats_->cache_size_ + staged_size_ > low_watermark;
+}
+
+void PersistentStringCacheImpl::request_eviction() const
+{
+    // mutex_ must be locked here!
+
+    if (options_.eviction_high_watermark >= 1.0 ||
+        stats_->cache_size_ + staged_size_ <= int64_t(stats_->max_cache_size_ * options_.eviction_high_watermark))
+    {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(background_mutex_);
+        evict_requested_ = true;
+    }
+    background_cond_.notify_one();
+}
+
+void PersistentStringCacheImpl::request_drop() const
+{
+    {
+        lock_guard<mutex> lock(background_mutex_);
+        drop_requested_ = true;
+    }
+    background_cond_.notify_one();
+}
+
+// Deletes up to max_rows rows of generations older than generation_, in key order, starting at from
+// (or at the beginning if from is empty), and calls the invalidate handler for each deleted entry.
+// Sets from to the key at which to continue, or clears it once no rows of old generations remain.
+// Returns the number of rows deleted.
+
+int64_t PersistentStringCacheImpl::drop_old_generations(int64_t max_rows, string& from)
+{
+    // mutex_ must be locked here!
+
+    int64_t count = 0;
+    leveldb::WriteBatch batch;
+
+    IteratorUPtr it(db_->NewIterator(read_options));
+    it->Seek(from.empty() ? ENTRIES_BEGIN : from);
+    from.clear();
+    leveldb::Slice const tables_end(PROTECTED_END);
+    while (it->Valid() && it->key().compare(tables_end) < 0)
+    {
+        auto key = it->key();
+        string const prefix(key.data(), 1);
+        if (key.compare(k_generation(prefix, generation_)) >= 0)
+        {
+            // Rows of the current generation sort last in each table, so we continue with the next table.
+            it->Seek(string(1, prefix[0] + 1));
+            continue;
+        }
+        if (count == max_rows)
+        {
+            from = key.ToString();
+            break;
+        }
+        batch.Delete(key);
+        ++count;
+        if (prefix == ATIME_BEGIN || prefix == PROTECTED_BEGIN)
+        {
+            call_handler(time_key_of(key).key, CacheEventIndex::invalidate);
+        }
+        it->Next();
+    }
+    throw_if_error(it->status(), "drop_old_generations(): iterator error");
+
+    if (count != 0)
+    {
+        auto s = db_->Write(write_options, &batch);
+        throw_if_error(s, "drop_old_generations(): batch write error");
+    }
+    return count;
+}
+
+// Body of the background thread. It deletes expired entries at each expiry_reap_interval,
+// evicts down to the low watermark whenever a put pushes the cache above the high watermark,
+// deletes the rows of old generations after invalidate(), writes the staged entries at each
+// write_behind_interval, syncs at each sync_interval, and saves the frequency sketch at each
+// admission_sketch_save_interval.
+
+void PersistentStringCacheImpl::run_background()
+{
+    bool const reap = stats_->policy_ == CacheDiscardPolicy::lru_ttl && options_.expiry_reap_interval.count() > 0;
+    bool const periodic_sync = options_.durability == CacheDurability::periodic;
+    bool const write_behind = options_.write_behind;
+    bool const save_sketch = sketch_ && options_.admission_sketch_save_interval.count() > 0;
+    auto const batch_size = options_.expiry_reap_batch_size;
+    auto next_reap = chrono::steady_clock::now() + options_.expiry_reap_interval;
+    auto next_sync = chrono::steady_clock::now() + options_.sync_interval;
+    auto next_flush = chrono::steady_clock::now() + options_.write_behind_interval;
+    auto next_sketch_save = chrono::steady_clock::now() + options_.admission_sketch_save_interval;
+    string drop_from;          // Where to continue deleting rows of old generations.
+    int64_t dropped_rows = 0;  // Rows of old generations deleted since the last compaction.
+
+    unique_lock<mutex> lock(background_mutex_);
+    for (;;)
+    {
+        auto ready = [this] { return background_done_ || evict_requested_ || drop_requested_; };
+        auto const never = chrono::steady_clock::time_point::max();
+        auto deadline = never;
+        if (reap)
+        {
+            deadline = min(deadline, next_reap);
+        }
+        if (periodic_sync)
+        {
+            deadline = min(deadline, next_sync);
+        }
+        if (write_behind)
+        {
+            deadline = min(deadline, next_flush);
+        }
+        if (save_sketch)
+        {
+            deadline = min(deadline, next_sketch_save);
+        }
+        if (deadline != never)
+        {
+            background_cond_.wait_until(lock, deadline, ready);
+        }
+        else
+        {
+            background_cond_.wait(lock, ready);
+        }
+        if (background_done_)
+        {
+            break;
+        }
+        bool evict = evict_requested_;
+        evict_requested_ = false;
+        bool drop = drop_requested_;
+        drop_requested_ = false;
+        bool reap_now = reap && chrono::steady_clock::now() >= next_reap;
+        bool sync_now = periodic_sync && chrono::steady_clock::now() >= next_sync;
+        bool flush_now = write_behind && chrono::steady_clock::now() >= next_flush;
+        bool save_sketch_now = save_sketch && chrono::steady_clock::now() >= next_sketch_save;
+        lock.unlock();
+
+        bool more_to_evict = false;
+        bool more_to_drop = false;
+        try
+        {
+            if (flush_now)
+            {
+                {
+                    lock_guard<decltype(mutex_)> cache_lock(mutex_);
+                    flush_staged();
+                }
+                next_flush = chrono::steady_clock::now() + options_.write_behind_interval;
+            }
+            if (reap_now)
+            {
+                // We hold the cache lock for at most batch_size deletions at a time. If we deleted
+                // a full batch, there may be more expired entries, so we carry on right away.
+                int64_t deleted_entries;
+                {
+                    lock_guard<decltype(mutex_)> cache_lock(mutex_);
+                    int64_t deleted_bytes;
+                    deleted_entries = delete_expired(batch_size, unordered_set<string>(), deleted_bytes);
+                }
+                next_reap = chrono::steady_clock::now();
+                if (deleted_entries < batch_size)
+                {
+                    next_reap += options_.expiry_reap_interval;
+                }
+            }
+            if (evict)
+            {
+                more_to_evict = evict_to_low_watermark();
+            }
+            if (drop)
+            {
+                // As for expired entries, we hold the cache lock for one batch at a time. Once the old
+                // generations are gone, we compact their key ranges to get rid of the deletion markers.
+                int64_t generation;
+                {
+                    lock_guard<decltype(mutex_)> cache_lock(mutex_);
+                    dropped_rows += drop_old_generations(DROP_BATCH_SIZE, drop_from);
+                    generation = generation_;
+                }
+                more_to_drop = !drop_from.empty();
+                if (!more_to_drop && dropped_rows != 0)
+                {
+                    for (auto const& prefix : {ENTRIES_BEGIN, ATIME_BEGIN, ETIME_BEGIN, PROTECTED_BEGIN})
+                    {
+                        leveldb::Slice const begin(prefix);
+                        string const end = k_generation(prefix, generation);
+                        leveldb::Slice const end_slice(end);
+                        db_->CompactRange(&begin, &end_slice);
+                    }
+                    dropped_rows = 0;
+                }
+            }
+            if (sync_now)
+            {
+                sync_writes();
+                next_sync = chrono::steady_clock::now() + options_.sync_interval;
+            }
+            if (save_sketch_now)
+            {
+                // We hold the cache lock only while we copy the counters.
+                string sketch;
+                {
+                    lock_guard<decltype(mutex_)> cache_lock(mutex_);
+                    sketch = sketch_->serialize();
+                }
+                auto s = db_->Put(write_options, STATS_SKETCH, sketch);
+                throw_if_error(s, "run_background(): cannot write sketch");
+                next_sketch_save = chrono::steady_clock::now() + options_.admission_sketch_save_interval;
+            }
+        }
+        // LCOV_EXCL_START
+        catch (std::exception const& e)
+        {
+            cerr << make_message(string("run_background(): ") + e.what()) << endl;
+        }
+        catch (...)
+        {
+            cerr << make_message("run_background(): unknown exception") << endl;
+        }
+        // LCOV_EXCL_STOP
 
-    // Update cache size and entries.
-    stats_->hist_decrement(data.size);
-    stats_->cache_size_ -= data.size;
-    assert(stats_->cache_size_ >= 0);
-    assert(stats_->cache_size_ <= stats_->max_cache_size_);
-    --stats_->num_entries_;
-    assert(stats_->num_entries_ >= 0);
-    assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
-    assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
+        lock.lock();
+        evict_requested_ = evict_requested_ || more_to_evict;
+        drop_requested_ = drop_requested_ || more_to_drop;
+    }
+}
+
+void PersistentStringCacheImpl::start_background()
+{
+    if (!options_.background_invalidate)
+    {
+        // Delete any rows of old generations that are left over because the cache
+        // was closed before a background invalidate() finished, or because of a crash.
+        lock_guard<decltype(mutex_)> lock(mutex_);
+        string from;
+        do
+        {
+            drop_old_generations(DROP_BATCH_SIZE, from);
+        }
+        while (!from.empty());
+    }
+
+    bool const reap = stats_->policy_ == CacheDiscardPolicy::lru_ttl && options_.expiry_reap_interval.count() > 0;
+    bool const periodic_sync = options_.durability == CacheDurability::periodic;
+    bool const save_sketch = sketch_ && options_.admission_sketch_save_interval.count() > 0;
+    if (!reap && !periodic_sync && !options_.write_behind && options_.eviction_high_watermark >= 1.0 &&
+        !options_.background_invalidate && !save_sketch)
+    {
+        return;  // Nothing to do in the background.
+    }
+    background_done_ = false;
+    evict_requested_ = false;
+    drop_requested_ = options_.background_invalidate;  // In case rows of old generations are left over.
+    background_thread_ = thread(&PersistentStringCacheImpl::run_background, this);
+
+    lock_guard<decltype(mutex_)> lock(mutex_);
+    request_eviction();  // In case the cache is already above the high watermark.
+}
+
+void PersistentStringCacheImpl::stop_background()
+{
+    if (!background_thread_.joinable())
+    {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(background_mutex_);
+        background_done_ = true;
+    }
+    background_cond_.notify_one();
+    background_thread_.join();
+}
+
+// Flushes all writes so far to disk. Concurrent callers are coalesced into a group commit: while one
+// thread syncs, the others wait, and the next sync covers the writes of all of them. Every caller waits
+// for a sync that starts after it arrives, because a sync that is already in progress may have started
+// before the caller's writes.
+
+void PersistentStringCacheImpl::sync_writes()
+{
+    // mutex_ should not be locked here, so other threads can write while we wait for the disk.
+
+    unique_lock<mutex> lock(sync_mutex_);
+    int64_t const needed = syncs_started_ + 1;
+    while (syncs_done_ < needed)
+    {
+        if (sync_in_progress_)
+        {
+            sync_cond_.wait(lock);
+            continue;
+        }
+
+        // We lead the next sync. An empty batch written with the sync option flushes the current log.
+        // Earlier logs were synced when leveldb closed them (see SyncLogsEnv).
+        sync_in_progress_ = true;
+        ++syncs_started_;
+        lock.unlock();
+        leveldb::Status s;
+        {
+            LatencyTimer timer(*stats_, PersistentCacheStats::Operation::sync);
+            leveldb::WriteOptions sync_options;
+            sync_options.sync = true;
+            leveldb::WriteBatch batch;
+            s = db_->Write(sync_options, &batch);
+        }
+        lock.lock();
+        sync_in_progress_ = false;
+        if (s.ok())
+        {
+            syncs_done_ = syncs_started_;
+        }
+        sync_cond_.notify_all();
+        throw_if_error(s, "sync_writes()");  // Another waiter, if any, tries again.
+    }
+}
+
+void PersistentStringCacheImpl::commit()
+{
+    if (options_.durability == CacheDurability::sync)
+    {
+        sync_writes();
+    }
 }
 
-void PersistentStringCacheImpl::delete_at_least(int64_t bytes_needed, string const& skip_key)
+void PersistentStringCacheImpl::flush()
+{
+    lock_guard<decltype(mutex_)> lock(mutex_);
+
+    flush_staged();
+}
+
+void PersistentStringCacheImpl::record_access_time(string const& key, int64_t atime) const
 {
     // mutex_ must be locked here!
 
-    assert(bytes_needed > 0);
-    assert(bytes_needed <= stats_->cache_size_);
+    pending_atimes_[key] = atime;
+    if (int64_t(pending_atimes_.size()) >= options_.max_pending_access_times ||
+        atime - last_atime_flush_ >= options_.access_time_flush_interval.count())
+    {
+        flush_access_times();
+    }
+}
 
-    int64_t deleted_bytes = 0;
-    int64_t deleted_entries = 0;
+void PersistentStringCacheImpl::flush_access_times() const
+{
+    // mutex_ must be locked here!
 
-    leveldb::WriteBatch batch;
+    last_atime_flush_ = now_ticks();
+    if (pending_atimes_.empty())
+    {
+        return;
+    }
 
-    // Step 1: Delete all expired entries.
-    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl)
+    // We re-read the data for each entry because the entry may have been
+    // updated or removed since the hit. Only entries whose access time on disk
+    // is older than the recorded one are updated. For segmented_lru, a hit
+    // within the same tick as the put must still promote the entry. For gdsf,
+    // the hits on an entry since the previous flush count as a single access.
+    leveldb::WriteBatch batch;
+    string record;
+    for (auto const& p : pending_atimes_)
     {
-        auto now_time = now_ticks();
-        IteratorUPtr it(db_->NewIterator(read_options));
-        leveldb::Slice const etime_prefix(ETIME_BEGIN);
-        it->Seek(etime_prefix);
-        while (it->Valid())
+        if (!get_record(p.first, record))
         {
-            if (!it->key().starts_with(etime_prefix))
-            {
-                break;
-            }
-            string etime_key = it->key().ToString();
-            TimeKeyTuple ek(etime_key.substr(1));  // Strip prefix to create the etime/key tuple.
-            if (!skip_key.empty() && ek.key == skip_key)
+            continue;
+        }
+        DataTuple dt(record);
+        if (stats_->policy_ != CacheDiscardPolicy::gdsf)  // For gdsf, the access time slot holds the priority.
+        {
+            if (dt.atime > p.second)
             {
-                // Too hard to hit with a test because the entry must expire
-                // in between put_metadata() having decided that it's still
-                // unexpired and now_time taken above.
-                // LCOV_EXCL_START
-                it->Next();
-                continue;  // This entry must not be deleted (see put_metadata()).
-                // LCOV_EXCL_STOP
+                continue;
             }
-            if (ek.time > now_time)
+            if (dt.atime == p.second && (stats_->policy_ != CacheDiscardPolicy::segmented_lru || dt.is_protected))
             {
-                break;  // Anything past this point has not expired yet.
+                continue;
             }
+        }
+        batch_delete_index(p.first, dt, batch);
+        auto weight = set_access_time(p.first, dt, p.second);
+        dt.is_protected = stats_->policy_ == CacheDiscardPolicy::segmented_lru;
+        set_data(record, dt.to_string());
+        batch.Put(k_entry(generation_, p.first), record);
+        batch_put_index(p.first, dt, batch, weight);
+    }
+    pending_atimes_.clear();
 
-            string prefixed_key = k_data(ek.key);
-            string val;
-            auto s = db_->Get(read_options, prefixed_key, &val);
-            throw_if_error(s, "delete_at_least: cannot read data");
-            DataTuple dt(move(val));
+    auto s = db_->Write(write_options, &batch);
+    throw_if_error(s, "flush_access_times()");
+    demote_protected();
+}
 
-            int64_t size = stoll(it->value().ToString());
-            deleted_bytes += size;
-            bytes_needed -= size;
-            ++deleted_entries;
-            batch_delete(ek.key, dt, batch);
+bool PersistentStringCacheImpl::memory_get(string const& key, string& value, string* metadata) const
+{
+    // mutex_ must be locked here!
 
-            --stats_->num_entries_;
-            ++stats_->ttl_evictions_;
-            stats_->hist_decrement(size);
-            stats_->cache_size_ -= size;
-            call_handler(ek.key, CacheEventIndex::evict_ttl);
+    auto it = memory_index_.find(key);
+    if (it == memory_index_.end())
+    {
+        return false;
+    }
+    auto const& e = *it->second;
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && e.etime != epoch_ticks() && e.etime <= now_ticks())
+    {
+        // Let the caller deal with the expired entry via the DB.
+        memory_erase(key);
+        return false;
+    }
+    value = e.data->value;
+    if (metadata)
+    {
+        *metadata = e.data->metadata;
+    }
+    memory_lru_.splice(memory_lru_.begin(), memory_lru_, it->second);  // Most recently read entry goes first.
+    return true;
+}
 
-            it->Next();
-        }
-        throw_if_error(it->status(), "delete_at_least(): expiry iterator error");
-    }  // Close iterator.
+// Same as memory_get(), but sets view to refer to the data in memory.
 
-    if (deleted_entries)
+bool PersistentStringCacheImpl::memory_get_view(string const& key, PersistentStringCache::View& view) const
+{
+    // mutex_ must be locked here!
+
+    auto it = memory_index_.find(key);
+    if (it == memory_index_.end())
     {
-        // Need to commit the batch here, otherwise what follows will not see the changes made above.
-        auto s = db_->Write(write_options, &batch);
-        throw_if_error(s, "delete_at_least(): expiry write error");
-        batch.Clear();
+        return false;
+    }
+    auto const& e = *it->second;
+    if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && e.etime != epoch_ticks() && e.etime <= now_ticks())
+    {
+        // Let the caller deal with the expired entry via the DB.
+        memory_erase(key);
+        return false;
     }
+    view.pin_ = e.data;
+    view.value_data_ = e.data->value.data();
+    view.value_size_ = e.data->value.size();
+    view.metadata_data_ = e.data->metadata.data();
+    view.metadata_size_ = e.data->metadata.size();
+    memory_lru_.splice(memory_lru_.begin(), memory_lru_, it->second);  // Most recently read entry goes first.
+    return true;
+}
 
-    // Step 2: If we still need more room, delete entries in LRU order until we have enough room.
-    if (bytes_needed > 0)
+void PersistentStringCacheImpl::memory_put(string const& key,
+                                           char const* value_data,
+                                           int64_t value_size,
+                                           char const* metadata_data,
+                                           int64_t metadata_size,
+                                           int64_t etime) const
+{
+    // mutex_ must be locked here!
+
+    memory_erase(key);
+
+    int64_t size = key.size() + value_size + metadata_size;
+    if (size > options_.memory_cache_size)
     {
-        // Run over the Atime index and delete in old-to-new order.
-        IteratorUPtr it(db_->NewIterator(read_options));
-        leveldb::Slice const atime_prefix(ATIME_BEGIN);
-        it->Seek(atime_prefix);
-        while (it->Valid() && bytes_needed > 0 && it->key().starts_with(atime_prefix))
-        {
-            TimeKeyTuple atk(it->key().ToString().substr(1));  // Strip prefix to create the atime/key tuple.
-            if (!skip_key.empty() && atk.key == skip_key)
-            {
-                it->Next();
-                continue;  // This entry must not be deleted (see put_metadata()).
-            }
+        return;  // Too large to ever fit.
+    }
 
-            int64_t size = stoll(it->value().ToString());
-            deleted_bytes += size;
-            bytes_needed -= size;
-            ++deleted_entries;
+    // Drop least recently read entries until the new one fits.
+    while (memory_size_ + size > options_.memory_cache_size)
+    {
+        auto const& last = memory_lru_.back();
+        memory_size_ -= last.size;
+        memory_index_.erase(last.key);
+        memory_lru_.pop_back();
+    }
 
-            string data_string;
-            string prefixed_key = k_data(atk.key);
-            auto s = db_->Get(read_options, prefixed_key, &data_string);
-            assert(!s.IsNotFound());
-            throw_if_error(s, "delete_at_least()");
-            DataTuple dt(move(data_string));
-            batch_delete(atk.key, dt, batch);
+    string metadata = metadata_data ? string(metadata_data, metadata_size) : string();
+    auto data = make_shared<PersistentStringCache::Data const>(
+        PersistentStringCache::Data{string(value_data, value_size), move(metadata)});
+    memory_lru_.push_front(MemoryEntry{key, move(data), etime, size});
+    memory_index_[key] = memory_lru_.begin();
+    memory_size_ += size;
+}
 
-            --stats_->num_entries_;
-            ++stats_->lru_evictions_;
-            stats_->hist_decrement(size);
-            stats_->cache_size_ -= size;
-            call_handler(atk.key, CacheEventIndex::evict_lru);
+void PersistentStringCacheImpl::memory_erase(string const& key) const
+{
+    // mutex_ must be locked here!
 
-            it->Next();
-        }
-        throw_if_error(it->status(), "delete_at_least(): LRU iterator error");
-        assert(deleted_bytes > 0);
-        assert(bytes_needed <= 0);
+    auto it = memory_index_.find(key);
+    if (it != memory_index_.end())
+    {
+        memory_size_ -= it->second->size;
+        memory_lru_.erase(it->second);
+        memory_index_.erase(it);
     }
+}
 
-    auto s = db_->Write(write_options, &batch);
-    throw_if_error(s, "delete_at_least(): LRU write error");
+// Adds an entry to the staged entries, replacing any staged entry for the same key. If that takes the staged
+// entries to write_behind_max_bytes or more, they are written immediately.
+
+void PersistentStringCacheImpl::stage(string const& key,
+                                      char const* value_data,
+                                      int64_t value_size,
+                                      char const* metadata_data,
+                                      int64_t metadata_size,
+                                      int64_t etime,
+                                      double cost,
+                                      int64_t size)
+{
+    // mutex_ must be locked here!
 
-    assert(stats_->cache_size_ >= 0);
-    assert(stats_->num_entries_ >= 0);
-    assert(stats_->cache_size_ == 0 || stats_->num_entries_ != 0);
-    assert(stats_->num_entries_ == 0 || stats_->cache_size_ != 0);
+    unstage(key);
+
+    string metadata = metadata_data ? string(metadata_data, metadata_size) : string();
+    auto data = make_shared<PersistentStringCache::Data const>(
+        PersistentStringCache::Data{string(value_data, value_size), move(metadata)});
+    staged_.push_back(StagedEntry{key, move(data), metadata_data != nullptr, etime, cost, size});
+    staged_index_[key] = prev(staged_.end());
+    staged_size_ += size;
+
+    // The staged entries must fit into the cache together, even if the cache is smaller than the limit.
+    if (staged_size_ >= min(options_.write_behind_max_bytes, int64_t(stats_->max_cache_size_)))
+    {
+        flush_staged();
+    }
+}
+
+// Discards the staged entry for key, if any. Returns true if the entry was staged and has not expired.
+
+bool PersistentStringCacheImpl::unstage(string const& key)
+{
+    // mutex_ must be locked here!
+
+    auto it = staged_index_.find(key);
+    if (it == staged_index_.end())
+    {
+        return false;
+    }
+    auto etime = it->second->etime;
+    staged_size_ -= it->second->size;
+    staged_.erase(it->second);
+    staged_index_.erase(it);
+    return stats_->policy_ != CacheDiscardPolicy::lru_ttl || etime == epoch_ticks() || etime > now_ticks();
+}
+
+// Writes the staged entries with a single eviction pass. Entries that expired while they were
+// staged are discarded, together with the entries on disk that they replace. We take the entries
+// off the list before writing them, so an event handler that puts another entry while we write
+// stages it for the next flush.
+
+void PersistentStringCacheImpl::flush_staged()
+{
+    // mutex_ must be locked here!
+
+    if (staged_.empty())
+    {
+        return;
+    }
+
+    StagedList staged;
+    staged.swap(staged_);
+    staged_index_.clear();
+    staged_size_ = 0;
+
+    vector<PutEntry> entries;
+    vector<int64_t> etimes;
+    vector<double> costs;
+    entries.reserve(staged.size());
+    etimes.reserve(staged.size());
+    costs.reserve(staged.size());
+    leveldb::WriteBatch batch;  // Deletes the entries replaced by expired ones.
+    bool have_deletes = false;
+    auto now = now_ticks();
+    for (auto const& e : staged)
+    {
+        if (stats_->policy_ == CacheDiscardPolicy::lru_ttl && e.etime != epoch_ticks() && e.etime <= now)
+        {
+            bool found;
+            auto dt = get_data(e.key, found);
+            if (found)
+            {
+                batch_delete(e.key, dt, batch);
+                stats_remove_entry(dt.size);
+                have_deletes = true;
+            }
+            continue;
+        }
+        entries.push_back({&e.key, &e.data->value, e.has_metadata ? &e.data->metadata : nullptr});
+        etimes.push_back(e.etime);
+        costs.push_back(e.cost);
+    }
+    if (have_deletes)
+    {
+        write_batch(batch, "flush_staged()");
+    }
+    if (!entries.empty())
+    {
+        put_entries(entries, etimes, costs);
+    }
 }
 
 void PersistentStringCacheImpl::call_handler(string const& key, CacheEventIndex event_index) const
@@ -1596,13 +4199,41 @@ void PersistentStringCacheImpl::call_handler(string const& key, CacheEventIndex
     // mutex_ must be locked here!
 
     typedef underlying_type<CacheEventIndex>::type IndexType;
-    auto handler = handlers_[static_cast<IndexType>(event_index)];
+    IndexType index = static_cast<IndexType>(event_index);
+    auto handler = handlers_[index];
+    bool const batched = (batch_events_ >> index) & 1;
+    if (!handler && !batched)
+    {
+        return;
+    }
+
+    if (event_queue_)
+    {
+        if (!event_queue_->push(key, event_index))
+        {
+            ++stats_->dropped_events_;
+        }
+        return;
+    }
+
+    HandlerScope scope;
+    auto const event = static_cast<CacheEvent>(1 << index);
     if (handler)
     {
         try
         {
-            IndexType index = static_cast<IndexType>(event_index);
-            handler(key, static_cast<CacheEvent>(1 << index), stats_);
+            handler(key, event, stats_);
+        }
+        catch (...)
+        {
+            // Ignored
+        }
+    }
+    if (batched)
+    {
+        try
+        {
+            batch_handler_(PersistentStringCache::EventBatch{{key, event}}, stats_);
         }
         catch (...)
         {
@@ -1611,6 +4242,86 @@ void PersistentStringCacheImpl::call_handler(string const& key, CacheEventIndex
     }
 }
 
+// Delivers the events in the queue until stop_dispatch() is called. For each batch of events, we take
+// a copy of the handlers and the stats while we hold the cache lock, and then call the handlers without
+// the lock, so slow handlers don't hold up other operations on the cache.
+
+void PersistentStringCacheImpl::run_dispatch()
+{
+    typedef underlying_type<CacheEventIndex>::type IndexType;
+
+    vector<EventQueue::Event> events;
+    PersistentStringCache::EventBatch batch;
+    while (event_queue_->wait())
+    {
+        events.clear();
+        event_queue_->pop_all(events);
+
+        decltype(handlers_) handlers;
+        PersistentStringCache::BatchEventCallback batch_handler;
+        uint32_t batch_events;
+        shared_ptr<PersistentStringCacheStats> stats;
+        {
+            lock_guard<decltype(mutex_)> lock(mutex_);
+            handlers = handlers_;
+            batch_handler = batch_handler_;
+            batch_events = batch_events_;
+            stats = make_shared<PersistentStringCacheStats>(*stats_);
+        }
+        PersistentCacheStats const cache_stats(stats);
+
+        batch.clear();
+        for (auto& e : events)
+        {
+            IndexType index = static_cast<IndexType>(e.index);
+            auto const event = static_cast<CacheEvent>(1 << index);
+            if (handlers[index])
+            {
+                try
+                {
+                    handlers[index](e.key, event, cache_stats);
+                }
+                catch (...)
+                {
+                    // Ignored
+                }
+            }
+            if ((batch_events >> index) & 1)
+            {
+                batch.emplace_back(move(e.key), event);
+            }
+        }
+        if (!batch.empty())
+        {
+            try
+            {
+                batch_handler(batch, cache_stats);
+            }
+            catch (...)
+            {
+                // Ignored
+            }
+        }
+    }
+}
+
+void PersistentStringCacheImpl::start_dispatch()
+{
+    if (event_queue_)
+    {
+        dispatch_thread_ = thread(&PersistentStringCacheImpl::run_dispatch, this);
+    }
+}
+
+void PersistentStringCacheImpl::stop_dispatch()
+{
+    if (dispatch_thread_.joinable())
+    {
+        event_queue_->shutdown();
+        dispatch_thread_.join();
+    }
+}
+
 string PersistentStringCacheImpl::make_message(leveldb::Status const& s, string const& msg) const
 {
     return class_name + ": " + msg + ": " + s.ToString() + " (cache_path: " + stats_->cache_path_ + ")";
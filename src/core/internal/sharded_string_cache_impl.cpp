@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2015 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <core/internal/sharded_string_cache_impl.h>
+
+#include <core/internal/persistent_string_cache_stats.h>
+
+#include <leveldb/env.h>
+
+#include <algorithm>
+
+using namespace std;
+
+namespace core
+{
+
+namespace internal
+{
+
+namespace
+{
+
+static string const class_name = "PersistentStringCache";  // For exception messages
+
+static string const SHARD_PREFIX = "shard-";
+
+string shard_path(string const& cache_path, int shard)
+{
+    return cache_path + "/" + SHARD_PREFIX + to_string(shard);
+}
+
+// Returns the number of shard directories in cache_path, or 0 if the cache isn't sharded
+// (or doesn't exist yet).
+
+int count_shards(string const& cache_path)
+{
+    vector<string> children;
+    auto s = leveldb::Env::Default()->GetChildren(cache_path, &children);
+    if (!s.ok())
+    {
+        return 0;
+    }
+    int count = 0;
+    for (auto const& c : children)
+    {
+        if (c.size() > SHARD_PREFIX.size() && c.compare(0, SHARD_PREFIX.size(), SHARD_PREFIX) == 0 &&
+            all_of(c.begin() + SHARD_PREFIX.size(), c.end(), [](char ch){ return ch >= '0' && ch <= '9'; }))
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// FNV-1a. The shard of a key is persistent, so we can't use std::hash,
+// which is allowed to change between implementations and releases.
+
+uint64_t hash_key(string const& key) noexcept
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+}  // namespace
+
+ShardedStringCacheImpl::ShardedStringCacheImpl(string const& cache_path,
+                                               int64_t max_size_in_bytes,
+                                               CacheDiscardPolicy policy,
+                                               PersistentCacheOptions const& options,
+                                               PersistentStringCache* pimpl)
+    : cache_path_(cache_path)
+{
+    int num_shards = options.num_shards;
+    if (num_shards < 1)
+    {
+        throw_invalid_argument("invalid num_shards (" + to_string(num_shards) + "): value must be > 0");
+    }
+    if (num_shards > 1 && max_size_in_bytes < num_shards)
+    {
+        throw_invalid_argument("invalid max_size_in_bytes (" + to_string(max_size_in_bytes) +
+                               "): value must be >= num_shards (" + to_string(num_shards) + ")");
+    }
+
+    int existing_shards = count_shards(cache_path);
+    if (existing_shards == 0 && leveldb::Env::Default()->FileExists(cache_path + "/CURRENT"))
+    {
+        existing_shards = 1;  // Existing cache that isn't sharded.
+    }
+    if (existing_shards != 0 && existing_shards != num_shards)
+    {
+        throw_logic_error("existing cache opened with different num_shards (" + to_string(num_shards) +
+                          "), existing num_shards = " + to_string(existing_shards));
+    }
+
+    if (num_shards == 1)
+    {
+        shards_.emplace_back(new PersistentStringCacheImpl(cache_path, max_size_in_bytes, policy, options, pimpl));
+        return;
+    }
+
+    leveldb::Env::Default()->CreateDir(cache_path);  // Failure to create is reported when we open the shards.
+    auto sizes = split(max_size_in_bytes, num_shards);
+    auto memory_sizes = split(max(options.memory_cache_size, int64_t(0)), num_shards);
+    auto block_cache_sizes = split(max(options.block_cache_size, int64_t(0)), num_shards);
+    auto sketch_sizes = split(max(options.admission_sketch_size, int64_t(0)), num_shards);
+    for (int i = 0; i < num_shards; ++i)
+    {
+        PersistentCacheOptions shard_options = options;
+        if (options.memory_cache_size > 0)
+        {
+            shard_options.memory_cache_size = memory_sizes[i];
+        }
+        if (options.block_cache_size > 0)
+        {
+            shard_options.block_cache_size = max(block_cache_sizes[i], int64_t(1));
+        }
+        if (options.admission_sketch_size > 0)
+        {
+            shard_options.admission_sketch_size = max(sketch_sizes[i], int64_t(1));
+        }
+        auto path = shard_path(cache_path, i);
+        shards_.emplace_back(new PersistentStringCacheImpl(path, sizes[i], policy, shard_options, pimpl));
+    }
+}
+
+ShardedStringCacheImpl::ShardedStringCacheImpl(string const& cache_path, PersistentStringCache* pimpl)
+    : cache_path_(cache_path)
+{
+    int num_shards = count_shards(cache_path);
+    if (num_shards == 0)
+    {
+        shards_.emplace_back(new PersistentStringCacheImpl(cache_path, pimpl));  // Throws if DB doesn't exist.
+        return;
+    }
+    for (int i = 0; i < num_shards; ++i)
+    {
+        shards_.emplace_back(new PersistentStringCacheImpl(shard_path(cache_path, i), pimpl));
+    }
+}
+
+ShardedStringCacheImpl::~ShardedStringCacheImpl() = default;
+
+bool ShardedStringCacheImpl::get(string const& key, string& value, string* metadata) const
+{
+    return shard(key).get(key, value, metadata);
+}
+
+bool ShardedStringCacheImpl::get_view(string const& key, PersistentStringCache::View& view) const
+{
+    return shard(key).get_view(key, view);
+}
+
+void ShardedStringCacheImpl::get_many(vector<string> const& keys,
+                                      vector<Optional<string>>& values,
+                                      vector<string>* metadata) const
+{
+    if (shards_.size() == 1)
+    {
+        shards_[0]->get_many(keys, values, metadata);
+        return;
+    }
+
+    // Check the keys before doing anything, so we don't update some shards and then throw.
+    for (auto const& k : keys)
+    {
+        if (k.empty())
+        {
+            throw_invalid_argument("get_many(): key must be non-empty");
+        }
+    }
+
+    // Each shard looks up its keys with a single call. We remember the position
+    // of each key, so we can return the results in the order of the keys.
+    vector<vector<string>> shard_keys(shards_.size());
+    vector<vector<size_t>> shard_indexes(shards_.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        auto n = hash_key(keys[i]) % shards_.size();
+        shard_keys[n].push_back(keys[i]);
+        shard_indexes[n].push_back(i);
+    }
+
+    values.assign(keys.size(), Optional<string>());
+    if (metadata)
+    {
+        metadata->assign(keys.size(), string());
+    }
+    vector<Optional<string>> shard_values;
+    vector<string> shard_metadata;
+    for (size_t n = 0; n < shards_.size(); ++n)
+    {
+        if (shard_keys[n].empty())
+        {
+            continue;
+        }
+        shards_[n]->get_many(shard_keys[n], shard_values, metadata ? &shard_metadata : nullptr);
+        for (size_t i = 0; i < shard_indexes[n].size(); ++i)
+        {
+            values[shard_indexes[n][i]] = std::move(shard_values[i]);
+            if (metadata)
+            {
+                (*metadata)[shard_indexes[n][i]] = move(shard_metadata[i]);
+            }
+        }
+    }
+}
+
+bool ShardedStringCacheImpl::get_metadata(string const& key, string& metadata) const
+{
+    return shard(key).get_metadata(key, metadata);
+}
+
+bool ShardedStringCacheImpl::contains_key(string const& key) const
+{
+    return shard(key).contains_key(key);
+}
+
+int64_t ShardedStringCacheImpl::size() const noexcept
+{
+    int64_t size = 0;
+    for (auto const& s : shards_)
+    {
+        size += s->size();
+    }
+    return size;
+}
+
+int64_t ShardedStringCacheImpl::size_in_bytes() const noexcept
+{
+    int64_t size = 0;
+    for (auto const& s : shards_)
+    {
+        size += s->size_in_bytes();
+    }
+    return size;
+}
+
+int64_t ShardedStringCacheImpl::max_size_in_bytes() const noexcept
+{
+    int64_t size = 0;
+    for (auto const& s : shards_)
+    {
+        size += s->max_size_in_bytes();
+    }
+    return size;
+}
+
+int64_t ShardedStringCacheImpl::disk_size_in_bytes() const
+{
+    int64_t size = 0;
+    for (auto const& s : shards_)
+    {
+        size += s->disk_size_in_bytes();
+    }
+    return size;
+}
+
+CacheDiscardPolicy ShardedStringCacheImpl::discard_policy() const noexcept
+{
+    return shards_[0]->discard_policy();
+}
+
+PersistentCacheStats ShardedStringCacheImpl::stats() const
+{
+    if (shards_.size() == 1)
+    {
+        return shards_[0]->stats();
+    }
+
+    auto merged = make_shared<PersistentStringCacheStats>(*shards_[0]->stats().p_);
+    merged->cache_path_ = cache_path_;
+    for (size_t i = 1; i < shards_.size(); ++i)
+    {
+        merged->merge(*shards_[i]->stats().p_);
+    }
+    return PersistentCacheStats(merged);
+}
+
+bool ShardedStringCacheImpl::put(string const& key,
+                                 char const* value_data,
+                                 int64_t value_size,
+                                 char const* metadata_data,
+                                 int64_t metadata_size,
+                                 chrono::time_point<chrono::system_clock> expiry_time,
+                                 double cost)
+{
+    auto& s = shard(key);
+    bool added = s.put(key, value_data, value_size, metadata_data, metadata_size, expiry_time, cost);
+    s.commit();
+    return added;
+}
+
+bool ShardedStringCacheImpl::put_many(vector<PersistentStringCacheImpl::PutEntry> const& entries,
+                                      chrono::time_point<chrono::system_clock> expiry_time)
+{
+    if (shards_.size() == 1)
+    {
+        bool added = shards_[0]->put_many(entries, expiry_time);
+        shards_[0]->commit();
+        return added;
+    }
+
+    // Check the entries before doing anything, so we don't update some shards and then throw.
+    // Each shard adds its entries with a single call.
+    vector<vector<PersistentStringCacheImpl::PutEntry>> shard_entries(shards_.size());
+    for (auto const& e : entries)
+    {
+        if (e.key->empty())
+        {
+            throw_invalid_argument("put_many(): key must be non-empty");
+        }
+        auto n = hash_key(*e.key) % shards_.size();
+        int64_t size = e.key->size() + e.value->size() + (e.metadata ? e.metadata->size() : 0);
+        if (size > shards_[n]->max_size_in_bytes())
+        {
+            throw_logic_error(string("put_many(): cannot add ") + to_string(size) +
+                              "-byte record to cache with maximum size of " +
+                              to_string(shards_[n]->max_size_in_bytes()));
+        }
+        shard_entries[n].push_back(e);
+    }
+    bool added = true;
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        if (!shard_entries[i].empty())
+        {
+            added = shards_[i]->put_many(shard_entries[i], expiry_time) && added;
+        }
+    }
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        if (!shard_entries[i].empty())
+        {
+            shards_[i]->commit();
+        }
+    }
+    return added;
+}
+
+bool ShardedStringCacheImpl::get_or_put(string const& key,
+                                        string& value,
+                                        string* metadata,
+                                        PersistentStringCache::Loader load_func)
+{
+    auto& s = shard(key);
+    bool found = s.get_or_put(key, value, metadata, load_func);
+    s.commit();  // The value may have been loaded and added.
+    return found;
+}
+
+bool ShardedStringCacheImpl::put_metadata(string const& key, char const* metadata, int64_t metadata_size)
+{
+    auto& s = shard(key);
+    bool updated = s.put_metadata(key, metadata, metadata_size);
+    s.commit();
+    return updated;
+}
+
+bool ShardedStringCacheImpl::take(string const& key, string& value, string* metadata)
+{
+    auto& s = shard(key);
+    bool found = s.take(key, value, metadata);
+    s.commit();
+    return found;
+}
+
+bool ShardedStringCacheImpl::invalidate(string const& key)
+{
+    auto& s = shard(key);
+    bool found = s.invalidate(key);
+    s.commit();
+    return found;
+}
+
+void ShardedStringCacheImpl::invalidate(vector<string> const& keys)
+{
+    if (shards_.size() == 1)
+    {
+        shards_[0]->invalidate(keys);
+        shards_[0]->commit();
+        return;
+    }
+
+    // Each shard removes its keys in a single batch.
+    vector<vector<string>> shard_keys(shards_.size());
+    for (auto const& k : keys)
+    {
+        shard_keys[hash_key(k) % shards_.size()].push_back(k);
+    }
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        if (!shard_keys[i].empty())
+        {
+            shards_[i]->invalidate(shard_keys[i]);
+        }
+    }
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        if (!shard_keys[i].empty())
+        {
+            shards_[i]->commit();
+        }
+    }
+}
+
+void ShardedStringCacheImpl::invalidate()
+{
+    for (auto& s : shards_)
+    {
+        s->invalidate();
+    }
+    for (auto& s : shards_)
+    {
+        s->commit();
+    }
+}
+
+bool ShardedStringCacheImpl::touch(string const& key, chrono::time_point<chrono::system_clock> expiry_time)
+{
+    auto& s = shard(key);
+    bool found = s.touch(key, expiry_time);
+    s.commit();
+    return found;
+}
+
+void ShardedStringCacheImpl::clear_stats() noexcept
+{
+    for (auto& s : shards_)
+    {
+        s->clear_stats();
+    }
+}
+
+void ShardedStringCacheImpl::resize(int64_t size_in_bytes)
+{
+    if (shards_.size() == 1)
+    {
+        shards_[0]->resize(size_in_bytes);
+        return;
+    }
+
+    if (size_in_bytes < int64_t(shards_.size()))
+    {
+        throw_invalid_argument("resize(): invalid size_in_bytes (" + to_string(size_in_bytes) +
+                               "): value must be >= num_shards (" + to_string(shards_.size()) + ")");
+    }
+    auto sizes = split(size_in_bytes, shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        shards_[i]->resize(sizes[i]);
+    }
+}
+
+void ShardedStringCacheImpl::trim_to(int64_t used_size_in_bytes)
+{
+    if (shards_.size() == 1)
+    {
+        shards_[0]->trim_to(used_size_in_bytes);
+        return;
+    }
+
+    if (used_size_in_bytes < 0)
+    {
+        throw_invalid_argument("trim_to(): invalid used_size_in_bytes (" + to_string(used_size_in_bytes) +
+                               "): value must be >= 0");
+    }
+    auto max_size = max_size_in_bytes();
+    if (used_size_in_bytes > max_size)
+    {
+        throw_logic_error(string("trim_to(): invalid used_size_in_bytes (") + to_string(used_size_in_bytes) +
+                          "): value must be <= max_size_in_bytes (" + to_string(max_size) + ")");
+    }
+
+    // Because the shard budgets are split the same way, no shard is trimmed to more than its maximum size.
+    auto sizes = split(used_size_in_bytes, shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        shards_[i]->trim_to(sizes[i]);
+    }
+}
+
+void ShardedStringCacheImpl::compact()
+{
+    for (auto& s : shards_)
+    {
+        s->compact();
+    }
+}
+
+void ShardedStringCacheImpl::flush()
+{
+    for (auto& s : shards_)
+    {
+        s->flush();
+    }
+    for (auto& s : shards_)
+    {
+        s->commit();
+    }
+}
+
+void ShardedStringCacheImpl::set_handler(CacheEvent events, PersistentStringCache::EventCallback cb)
+{
+    for (auto& s : shards_)
+    {
+        s->set_handler(events, cb);
+    }
+}
+
+void ShardedStringCacheImpl::set_batch_handler(CacheEvent events, PersistentStringCache::BatchEventCallback cb)
+{
+    for (auto& s : shards_)
+    {
+        s->set_batch_handler(events, cb);
+    }
+}
+
+PersistentStringCacheImpl& ShardedStringCacheImpl::shard(string const& key) const noexcept
+{
+    if (shards_.size() == 1)
+    {
+        return *shards_[0];
+    }
+    return *shards_[hash_key(key) % shards_.size()];
+}
+
+// Splits size_in_bytes into num_shards parts that differ by at most one byte.
+
+vector<int64_t> ShardedStringCacheImpl::split(int64_t size_in_bytes, int num_shards) noexcept
+{
+    vector<int64_t> sizes(num_shards, size_in_bytes / num_shards);
+    for (int i = 0; i < size_in_bytes % num_shards; ++i)
+    {
+        ++sizes[i];
+    }
+    return sizes;
+}
+
+string ShardedStringCacheImpl::make_message(string const& msg) const
+{
+    return class_name + ": " + msg + " (cache_path: " + cache_path_ + ")";
+}
+
+void ShardedStringCacheImpl::throw_logic_error(string const& msg) const
+{
+    throw logic_error(make_message(msg));
+}
+
+void ShardedStringCacheImpl::throw_invalid_argument(string const& msg) const
+{
+    throw invalid_argument(make_message(msg));
+}
+
+}  // namespace internal
+
+}  // namespace core
@@ -25,6 +25,12 @@ using namespace std;
 namespace core
 {
 
+/// @cond
+
+constexpr unsigned PersistentCacheStats::NUM_LATENCY_BINS;
+
+/// @endcond
+
 PersistentCacheStats::PersistentCacheStats()
     : p_(make_shared<internal::PersistentStringCacheStats>())
     , internal_(false)
@@ -191,6 +197,26 @@ int64_t PersistentCacheStats::lru_evictions() const noexcept
     return p_->lru_evictions_;
 }
 
+int64_t PersistentCacheStats::memory_hits() const noexcept
+{
+    return p_->memory_hits_;
+}
+
+int64_t PersistentCacheStats::memory_misses() const noexcept
+{
+    return p_->memory_misses_;
+}
+
+int64_t PersistentCacheStats::dropped_events() const noexcept
+{
+    return p_->dropped_events_;
+}
+
+int64_t PersistentCacheStats::rejected_puts() const noexcept
+{
+    return p_->rejected_puts_;
+}
+
 chrono::system_clock::time_point PersistentCacheStats::most_recent_hit_time() const noexcept
 {
     return p_->most_recent_hit_time_;
@@ -213,7 +239,7 @@ chrono::system_clock::time_point PersistentCacheStats::longest_miss_run_time() c
 
 PersistentCacheStats::Histogram const& PersistentCacheStats::histogram() const noexcept
 {
-    return p_->hist_;
+    return p_->hist_.values();
 }
 
 PersistentCacheStats::HistogramBounds const& PersistentCacheStats::histogram_bounds() noexcept
@@ -240,4 +266,100 @@ PersistentCacheStats::HistogramBounds const& PersistentCacheStats::histogram_bou
     return bounds;
 }
 
+int64_t PersistentCacheStats::num_operations(Operation op) const noexcept
+{
+    int64_t num = 0;
+    for (unsigned i = 0; i < NUM_LATENCY_BINS; ++i)
+    {
+        num += p_->latencies_.get(op, i);
+    }
+    return num;
+}
+
+PersistentCacheStats::LatencyHistogram PersistentCacheStats::latency_histogram(Operation op) const
+{
+    LatencyHistogram h(NUM_LATENCY_BINS);
+    for (unsigned i = 0; i < NUM_LATENCY_BINS; ++i)
+    {
+        h[i] = p_->latencies_.get(op, i);
+    }
+    return h;
+}
+
+PersistentCacheStats::LatencyHistogramBounds const& PersistentCacheStats::latency_histogram_bounds() noexcept
+{
+    static LatencyHistogramBounds bounds = []()
+    {
+        auto constexpr sub_bins = internal::LatencyHistograms::SUB_BINS;
+
+        LatencyHistogramBounds b;
+        for (unsigned i = 0; i < sub_bins; ++i)
+        {
+            b.push_back({i, i});  // One bin per nanosecond below sub_bins.
+        }
+        for (unsigned i = sub_bins; i < NUM_LATENCY_BINS; ++i)
+        {
+            unsigned shifts = i / sub_bins - 1;
+            int64_t mantissa = sub_bins + i % sub_bins;
+            b.push_back({mantissa << shifts, ((mantissa + 1) << shifts) - 1});
+        }
+        b.back().second = std::numeric_limits<decltype(b[0].second)>::max();
+        return b;
+    }();
+    return bounds;
+}
+
+chrono::nanoseconds PersistentCacheStats::latency_percentile(Operation op, double percentile) const noexcept
+{
+    // Take a snapshot of the bins, so the total agrees with the bins we walk.
+    uint64_t bins[NUM_LATENCY_BINS];
+    uint64_t total = 0;
+    for (unsigned i = 0; i < NUM_LATENCY_BINS; ++i)
+    {
+        bins[i] = p_->latencies_.get(op, i);
+        total += bins[i];
+    }
+    if (total == 0)
+    {
+        return chrono::nanoseconds(0);
+    }
+
+    percentile = max(0.0, min(100.0, percentile));
+    uint64_t rank = ceil(percentile / 100 * total);
+    rank = max(uint64_t(1), min(total, rank));
+
+    auto const& bounds = latency_histogram_bounds();
+    uint64_t seen = 0;
+    unsigned i = 0;
+    for (; i < NUM_LATENCY_BINS - 1; ++i)
+    {
+        seen += bins[i];
+        if (seen >= rank)
+        {
+            return chrono::nanoseconds(bounds[i].second);
+        }
+    }
+    return chrono::nanoseconds(bounds[i].first);
+}
+
+chrono::nanoseconds PersistentCacheStats::latency_p50(Operation op) const noexcept
+{
+    return latency_percentile(op, 50);
+}
+
+chrono::nanoseconds PersistentCacheStats::latency_p90(Operation op) const noexcept
+{
+    return latency_percentile(op, 90);
+}
+
+chrono::nanoseconds PersistentCacheStats::latency_p99(Operation op) const noexcept
+{
+    return latency_percentile(op, 99);
+}
+
+chrono::nanoseconds PersistentCacheStats::latency_p999(Operation op) const noexcept
+{
+    return latency_percentile(op, 99.9);
+}
+
 }  // namespace core
@@ -20,7 +20,7 @@
 
 #include <core/persistent_string_cache.h>
 
-#include <core/internal/persistent_string_cache_impl.h>
+#include <core/internal/sharded_string_cache_impl.h>
 #include <core/persistent_cache_stats.h>
 
 using namespace std;
@@ -31,12 +31,20 @@ namespace core
 PersistentStringCache::PersistentStringCache(string const& cache_path,
                                              int64_t max_size_in_bytes,
                                              CacheDiscardPolicy policy)
-    : p_(new internal::PersistentStringCacheImpl(cache_path, max_size_in_bytes, policy, this))
+    : p_(new internal::ShardedStringCacheImpl(cache_path, max_size_in_bytes, policy, PersistentCacheOptions(), this))
+{
+}
+
+PersistentStringCache::PersistentStringCache(string const& cache_path,
+                                             int64_t max_size_in_bytes,
+                                             CacheDiscardPolicy policy,
+                                             PersistentCacheOptions const& options)
+    : p_(new internal::ShardedStringCacheImpl(cache_path, max_size_in_bytes, policy, options, this))
 {
 }
 
 PersistentStringCache::PersistentStringCache(string const& cache_path)
-    : p_(new internal::PersistentStringCacheImpl(cache_path, this))
+    : p_(new internal::ShardedStringCacheImpl(cache_path, this))
 {
 }
 
@@ -52,6 +60,14 @@ PersistentStringCache::UPtr PersistentStringCache::open(string const& cache_path
     return PersistentStringCache::UPtr(new PersistentStringCache(cache_path, max_size_in_bytes, policy));
 }
 
+PersistentStringCache::UPtr PersistentStringCache::open(string const& cache_path,
+                                                        int64_t max_size_in_bytes,
+                                                        CacheDiscardPolicy policy,
+                                                        PersistentCacheOptions const& options)
+{
+    return PersistentStringCache::UPtr(new PersistentStringCache(cache_path, max_size_in_bytes, policy, options));
+}
+
 PersistentStringCache::UPtr PersistentStringCache::open(string const& cache_path)
 {
     return PersistentStringCache::UPtr(new PersistentStringCache(cache_path));
@@ -60,7 +76,7 @@ PersistentStringCache::UPtr PersistentStringCache::open(string const& cache_path
 Optional<string> PersistentStringCache::get(string const& key) const
 {
     string value;
-    return p_->get(key, value) ? Optional<string>(move(value)) : Optional<string>();
+    return p_->get(key, value, nullptr) ? Optional<string>(move(value)) : Optional<string>();
 }
 
 Optional<PersistentStringCache::Data> PersistentStringCache::get_data(string const& key) const
@@ -70,6 +86,34 @@ Optional<PersistentStringCache::Data> PersistentStringCache::get_data(string con
     return p_->get(key, value, &metadata) ? Optional<Data>(move(Data{move(value), move(metadata)})) : Optional<Data>();
 }
 
+Optional<PersistentStringCache::View> PersistentStringCache::get_view(string const& key) const
+{
+    View view;
+    return p_->get_view(key, view) ? Optional<View>(move(view)) : Optional<View>();
+}
+
+vector<Optional<string>> PersistentStringCache::get_many(vector<string> const& keys) const
+{
+    vector<Optional<string>> values;
+    p_->get_many(keys, values, nullptr);
+    return values;
+}
+
+vector<Optional<PersistentStringCache::Data>> PersistentStringCache::get_data_many(vector<string> const& keys) const
+{
+    vector<Optional<string>> values;
+    vector<string> metadata;
+    p_->get_many(keys, values, &metadata);
+
+    vector<Optional<Data>> data;
+    data.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        data.emplace_back(values[i] ? Optional<Data>(Data{move(*values[i]), move(metadata[i])}) : Optional<Data>());
+    }
+    return data;
+}
+
 Optional<string> PersistentStringCache::get_metadata(string const& key) const
 {
     string metadata;
@@ -113,25 +157,28 @@ PersistentCacheStats PersistentStringCache::stats() const
 
 bool PersistentStringCache::put(string const& key,
                                 string const& value,
-                                chrono::time_point<chrono::system_clock> expiry_time)
+                                chrono::time_point<chrono::system_clock> expiry_time,
+                                double cost)
 {
-    return p_->put(key, value.data(), value.size(), nullptr, 0, expiry_time);
+    return p_->put(key, value.data(), value.size(), nullptr, 0, expiry_time, cost);
 }
 
 bool PersistentStringCache::put(string const& key,
                                 char const* value,
                                 int64_t size,
-                                chrono::time_point<chrono::system_clock> expiry_time)
+                                chrono::time_point<chrono::system_clock> expiry_time,
+                                double cost)
 {
-    return p_->put(key, value, size, nullptr, 0, expiry_time);
+    return p_->put(key, value, size, nullptr, 0, expiry_time, cost);
 }
 
 bool PersistentStringCache::put(string const& key,
                                 string const& value,
                                 string const& metadata,
-                                chrono::time_point<chrono::system_clock> expiry_time)
+                                chrono::time_point<chrono::system_clock> expiry_time,
+                                double cost)
 {
-    return p_->put(key, value.data(), value.size(), metadata.data(), metadata.size(), expiry_time);
+    return p_->put(key, value.data(), value.size(), metadata.data(), metadata.size(), expiry_time, cost);
 }
 
 bool PersistentStringCache::put(string const& key,
@@ -139,16 +186,41 @@ bool PersistentStringCache::put(string const& key,
                                 int64_t value_size,
                                 char const* metadata,
                                 int64_t metadata_size,
-                                chrono::time_point<chrono::system_clock> expiry_time)
+                                chrono::time_point<chrono::system_clock> expiry_time,
+                                double cost)
+{
+    return p_->put(key, value, value_size, metadata, metadata_size, expiry_time, cost);
+}
+
+bool PersistentStringCache::put_many(vector<pair<string, string>> const& entries,
+                                     chrono::time_point<chrono::system_clock> expiry_time)
+{
+    vector<internal::PersistentStringCacheImpl::PutEntry> put_entries;
+    put_entries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        put_entries.push_back({&e.first, &e.second, nullptr});
+    }
+    return p_->put_many(put_entries, expiry_time);
+}
+
+bool PersistentStringCache::put_many(vector<pair<string, Data>> const& entries,
+                                     chrono::time_point<chrono::system_clock> expiry_time)
 {
-    return p_->put(key, value, value_size, metadata, metadata_size, expiry_time);
+    vector<internal::PersistentStringCacheImpl::PutEntry> put_entries;
+    put_entries.reserve(entries.size());
+    for (auto const& e : entries)
+    {
+        put_entries.push_back({&e.first, &e.second.value, &e.second.metadata});
+    }
+    return p_->put_many(put_entries, expiry_time);
 }
 
 Optional<string> PersistentStringCache::get_or_put(
     string const& key, PersistentStringCache::Loader const& load_func)
 {
     string value;
-    bool found = p_->get_or_put(key, value, load_func);
+    bool found = p_->get_or_put(key, value, nullptr, load_func);
     return found ? Optional<string>(move(value)) : Optional<string>();
 }
 
@@ -174,7 +246,7 @@ bool PersistentStringCache::put_metadata(string const& key, char const* metadata
 Optional<string> PersistentStringCache::take(string const& key)
 {
     string value;
-    return p_->take(key, value) ? Optional<string>(move(value)) : Optional<string>();
+    return p_->take(key, value, nullptr) ? Optional<string>(move(value)) : Optional<string>();
 }
 
 Optional<PersistentStringCache::Data> PersistentStringCache::take_data(string const& key)
@@ -229,11 +301,21 @@ void PersistentStringCache::compact()
     p_->compact();
 }
 
+void PersistentStringCache::flush()
+{
+    p_->flush();
+}
+
 void PersistentStringCache::set_handler(CacheEvent events, EventCallback cb)
 {
     p_->set_handler(events, cb);
 }
 
+void PersistentStringCache::set_batch_handler(CacheEvent events, BatchEventCallback cb)
+{
+    p_->set_batch_handler(events, cb);
+}
+
 }  // namespace core
 
 // @endcond
@@ -18,11 +18,18 @@
 
 #include <core/internal/persistent_string_cache_impl.h>
 
+#include <core/internal/int64_encoding.h>
+#include <core/internal/persistent_string_cache_stats.h>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <leveldb/write_batch.h>
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <future>
+#include <limits>
 #include <map>
 #include <thread>
 
@@ -555,6 +562,137 @@ TEST(PersistentStringCacheImpl, get_or_put)
     }
 }
 
+TEST(PersistentStringCacheImpl, get_or_put_concurrent)
+{
+    unlink_db(TEST_DB);
+
+    auto c = PersistentStringCache::open(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_ttl);
+
+    atomic<int> loader_calls(0);
+    atomic<bool> release_loader(false);
+    auto slow_load = [&](string const& key, PersistentStringCache& c)
+    {
+        ++loader_calls;
+        while (!release_loader)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        c.put(key, "slow");
+    };
+
+    // Several concurrent misses on the same key must call the loader only once.
+    vector<thread> threads;
+    vector<Optional<string>> results(4);
+    for (unsigned i = 0; i < results.size(); ++i)
+    {
+        threads.emplace_back([&, i]{ results[i] = c->get_or_put("k", slow_load); });
+    }
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    // The loader doesn't hold the lock, so other operations proceed while it runs.
+    EXPECT_TRUE(c->put("other", "x"));
+    EXPECT_EQ("x", *c->get("other"));
+    EXPECT_FALSE(c->contains_key("k"));
+
+    release_loader = true;
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    EXPECT_EQ(1, loader_calls);
+    for (auto const& r : results)
+    {
+        ASSERT_TRUE(bool(r));
+        EXPECT_EQ("slow", *r);
+    }
+
+    // An exception thrown by the loader is reported to all waiting threads.
+    loader_calls = 0;
+    release_loader = false;
+    auto throwing_load = [&](string const&, PersistentStringCache&)
+    {
+        ++loader_calls;
+        while (!release_loader)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        throw runtime_error("no such key");
+    };
+    threads.clear();
+    vector<string> errors(4);
+    for (unsigned i = 0; i < errors.size(); ++i)
+    {
+        threads.emplace_back([&, i]
+        {
+            try
+            {
+                c->get_or_put("bad", throwing_load);
+            }
+            catch (runtime_error const& e)
+            {
+                errors[i] = e.what();
+            }
+        });
+    }
+    this_thread::sleep_for(chrono::milliseconds(100));
+    release_loader = true;
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    EXPECT_EQ(1, loader_calls);
+    for (auto const& e : errors)
+    {
+        EXPECT_EQ("PersistentStringCache: get_or_put(): load_func exception: no such key (cache_path: " + TEST_DB + ")",
+                  e);
+    }
+    EXPECT_FALSE(c->contains_key("bad"));
+
+    // A new miss after a failed load calls the loader again.
+    auto load = [](string const& key, PersistentStringCache& c)
+    {
+        c.put(key, "good");
+    };
+    EXPECT_EQ("good", *c->get_or_put("bad", load));
+
+    // A loader that recursively asks for the same key would deadlock.
+    auto recursive_load = [](string const& key, PersistentStringCache& c)
+    {
+        c.get_or_put(key, [](string const&, PersistentStringCache&){});
+    };
+    try
+    {
+        c->get_or_put("recursive", recursive_load);
+        FAIL();
+    }
+    catch (runtime_error const& e)
+    {
+        EXPECT_EQ("PersistentStringCache: get_or_put(): load_func exception: PersistentStringCache: "
+                  "get_or_put(): recursive call from load_func for key \"recursive\" (cache_path: " + TEST_DB +
+                  ") (cache_path: " + TEST_DB + ")",
+                  string(e.what()));
+    }
+
+    // A synchronous event handler holds the cache lock, so it can't call get_or_put().
+    string handler_error;
+    c->set_handler(CacheEvent::miss, [&c, &handler_error](string const& key, CacheEvent, PersistentCacheStats const&)
+    {
+        try
+        {
+            c->get_or_put(key + "_nested", [](string const& k, PersistentStringCache& c) { c.put(k, "x"); });
+        }
+        catch (logic_error const& e)
+        {
+            handler_error = e.what();
+        }
+    });
+    EXPECT_FALSE(c->get("missing"));
+    EXPECT_EQ("PersistentStringCache: get_or_put(): cannot be called from a synchronous event handler (cache_path: " +
+              TEST_DB + ")",
+              handler_error);
+    EXPECT_FALSE(c->contains_key("missing_nested"));
+}
+
 TEST(PersistentStringCacheImpl, open)
 {
     {
@@ -1287,11 +1425,15 @@ TEST(PersistentStringCacheImpl, exceptions)
         }
 
         {
-            // Write a version mismatch.
+            // Write a version mismatch, plus rows with the prefixes of older schema versions.
             open_db();
             string val = "0";
             auto s = db->Put(write_options, "YSCHEMA_VERSION", val);
             ASSERT_TRUE(s.ok());
+            s = db->Put(write_options, "Aold", "old");
+            ASSERT_TRUE(s.ok());
+            s = db->Put(write_options, "Eold", "old");
+            ASSERT_TRUE(s.ok());
             db.reset(nullptr);
         }
 
@@ -1302,6 +1444,15 @@ TEST(PersistentStringCacheImpl, exceptions)
             EXPECT_TRUE(c.put("y", "y"));
         }
 
+        {
+            // The rows with the old prefixes are gone, too.
+            open_db();
+            string val;
+            EXPECT_TRUE(db->Get(leveldb::ReadOptions(), "Aold", &val).IsNotFound());
+            EXPECT_TRUE(db->Get(leveldb::ReadOptions(), "Eold", &val).IsNotFound());
+            db.reset(nullptr);
+        }
+
         {
             // Write a version mismatch.
             open_db();
@@ -2107,3 +2258,2136 @@ TEST(PersistentStringCacheImpl, event_handlers)
     EXPECT_EQ(0, er.stats.size());
     EXPECT_EQ(0, er.stats.size_in_bytes());
 }
+
+TEST(PersistentStringCacheImpl, deferred_access_time)
+{
+    unlink_db(TEST_DB);
+
+    PersistentCacheOptions options;
+    options.defer_access_time_updates = true;
+    options.access_time_flush_interval = chrono::hours(1);  // Never flush on a timer.
+    options.max_pending_access_times = 3;
+
+    string val;
+    string b(1023, 'b');
+    {
+        PersistentStringCacheImpl c(TEST_DB, 3 * 1024, CacheDiscardPolicy::lru_only, options);
+
+        c.put("a", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+        c.put("b", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+        c.put("c", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+
+        // Hit on "a" is recorded in memory only, but eviction must still see it.
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ(b, val);
+        EXPECT_EQ(1, c.stats().hits());
+        c.put("d", b);
+        EXPECT_TRUE(c.contains_key("a"));
+        EXPECT_FALSE(c.contains_key("b"));
+        EXPECT_TRUE(c.contains_key("c"));
+        EXPECT_TRUE(c.contains_key("d"));
+
+        // Hits on "c" are written when the cache is closed.
+        this_thread::sleep_for(chrono::milliseconds(5));
+        EXPECT_TRUE(c.get("c", val));
+    }
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 3 * 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(3, c.size());
+
+        c.trim_to(2 * 1024);
+        EXPECT_FALSE(c.contains_key("a"));
+        EXPECT_TRUE(c.contains_key("c"));
+        EXPECT_TRUE(c.contains_key("d"));
+
+        // An update after the hit must not be overwritten by the older access time.
+        this_thread::sleep_for(chrono::milliseconds(5));
+        EXPECT_TRUE(c.get("c", val));
+        this_thread::sleep_for(chrono::milliseconds(5));
+        EXPECT_TRUE(c.touch("d"));
+        EXPECT_TRUE(c.take("c", val));
+        c.put("e", b);
+        c.trim_to(1024);
+        EXPECT_FALSE(c.contains_key("d"));
+        EXPECT_TRUE(c.contains_key("e"));
+        EXPECT_EQ(1, c.size());
+    }
+
+    {
+        // Bad options.
+        PersistentCacheOptions bad;
+        bad.access_time_flush_interval = chrono::milliseconds(-1);
+        try
+        {
+            PersistentStringCacheImpl c(TEST_DB, 3 * 1024, CacheDiscardPolicy::lru_only, bad);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: invalid access_time_flush_interval (-1): value must be >= 0 "
+                      "(cache_path: " + TEST_DB + ")",
+                      e.what());
+        }
+
+        bad = PersistentCacheOptions();
+        bad.max_pending_access_times = 0;
+        try
+        {
+            PersistentStringCacheImpl c(TEST_DB, 3 * 1024, CacheDiscardPolicy::lru_only, bad);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: invalid max_pending_access_times (0): value must be > 0 "
+                      "(cache_path: " + TEST_DB + ")",
+                      e.what());
+        }
+    }
+}
+
+TEST(PersistentStringCacheImpl, upgrade_from_version_3)
+{
+    unlink_db(TEST_DB);
+
+    {
+        // Create a cache with the version 3 schema, with times and sizes in decimal.
+        unique_ptr<leveldb::DB> db;
+        leveldb::Options options;
+        options.create_if_missing = true;
+        leveldb::DB* p;
+        auto s = leveldb::DB::Open(options, TEST_DB, &p);
+        ASSERT_TRUE(s.ok());
+        db.reset(p);
+
+        leveldb::WriteBatch batch;
+        batch.Put("YSCHEMA_VERSION", "3");
+        batch.Put("YMAX_SIZE", "1024");
+        batch.Put("YPOLICY", to_string(static_cast<int>(CacheDiscardPolicy::lru_ttl)));
+        batch.Put("!DIRTY", "1");
+
+        batch.Put("Aa", "value");
+        batch.Put("Ba", "100 4000000000000 6");
+        batch.Put("D0000000000100 a", "6");
+        batch.Put("E4000000000000 a", "6");
+
+        batch.Put("Abb", "xyz");
+        batch.Put("Bbb", "200 0 6");
+        batch.Put("Cbb", "m");
+        batch.Put("D0000000000200 bb", "6");
+
+        leveldb::WriteOptions write_options;
+        s = db->Write(write_options, &batch);
+        ASSERT_TRUE(s.ok());
+    }
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_ttl);
+        EXPECT_EQ(2, c.size());
+        EXPECT_EQ(12, c.size_in_bytes());
+
+        string val;
+        string metadata;
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ("value", val);
+        EXPECT_TRUE(c.get("bb", val, &metadata));
+        EXPECT_EQ("xyz", val);
+        EXPECT_EQ("m", metadata);
+        EXPECT_TRUE(c.touch("bb", chrono::system_clock::now() + chrono::hours(1)));
+
+        // "a" has the older access time, so it must be evicted first.
+        c.trim_to(6);
+        EXPECT_EQ(1, c.size());
+        EXPECT_FALSE(c.contains_key("a"));
+        EXPECT_TRUE(c.contains_key("bb"));
+        c.trim_to(0);
+        EXPECT_EQ(0, c.size());
+        EXPECT_EQ(0, c.size_in_bytes());
+    }
+}
+
+TEST(PersistentStringCacheImpl, upgrade_from_version_4)
+{
+    unlink_db(TEST_DB);
+
+    auto open_db = []
+    {
+        leveldb::Options options;
+        options.create_if_missing = true;
+        leveldb::DB* p;
+        auto s = leveldb::DB::Open(options, TEST_DB, &p);
+        EXPECT_TRUE(s.ok());
+        return unique_ptr<leveldb::DB>(p);
+    };
+
+    {
+        // Create a cache with the version 4 schema, with separate rows for value, data, and metadata.
+        auto db = open_db();
+
+        auto data = [](int64_t atime, int64_t etime, int64_t size)
+        {
+            return encode_int64(atime) + encode_int64(etime) + encode_int64(size);
+        };
+
+        leveldb::WriteBatch batch;
+        batch.Put("YSCHEMA_VERSION", "4");
+        batch.Put("YMAX_SIZE", "1024");
+        batch.Put("YPOLICY", to_string(static_cast<int>(CacheDiscardPolicy::lru_ttl)));
+        batch.Put("!DIRTY", "1");
+
+        batch.Put("Aa", "value");
+        batch.Put("Ba", data(100, 4000000000000, 6));
+        batch.Put("D" + encode_int64(100) + "a", encode_int64(6));
+        batch.Put("E" + encode_int64(4000000000000) + "a", encode_int64(6));
+
+        batch.Put("Abb", "xyz");
+        batch.Put("Bbb", data(200, 0, 6));
+        batch.Put("Cbb", "m");
+        batch.Put("D" + encode_int64(200) + "bb", encode_int64(6));
+
+        batch.Put("Accc", "");
+        batch.Put("Bccc", data(300, 0, 3));
+        batch.Put("Cccc", "");
+        batch.Put("D" + encode_int64(300) + "ccc", encode_int64(3));
+
+        leveldb::WriteOptions write_options;
+        auto s = db->Write(write_options, &batch);
+        ASSERT_TRUE(s.ok());
+    }
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_ttl);
+        EXPECT_EQ(3, c.size());
+        EXPECT_EQ(15, c.size_in_bytes());
+
+        string val;
+        string metadata;
+        EXPECT_TRUE(c.get("a", val, &metadata));
+        EXPECT_EQ("value", val);
+        EXPECT_EQ("", metadata);
+        EXPECT_FALSE(c.get_metadata("a", metadata));
+        EXPECT_TRUE(c.get("bb", val, &metadata));
+        EXPECT_EQ("xyz", val);
+        EXPECT_EQ("m", metadata);
+        EXPECT_TRUE(c.get_metadata("ccc", metadata));  // Empty metadata is distinct from no metadata.
+        EXPECT_EQ("", metadata);
+    }
+
+    {
+        // Only the Entries table and the indexes remain.
+        auto db = open_db();
+        unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        map<char, int> rows;
+        for (it->SeekToFirst(); it->Valid(); it->Next())
+        {
+            ++rows[it->key()[0]];
+        }
+        EXPECT_EQ(0, rows['A']);
+        EXPECT_EQ(0, rows['B']);
+        EXPECT_EQ(0, rows['C']);
+        EXPECT_EQ(0, rows['D']);
+        EXPECT_EQ(0, rows['E']);
+        EXPECT_EQ(3, rows['G']);
+        EXPECT_EQ(3, rows['H']);
+        EXPECT_EQ(1, rows['I']);
+
+        string version;
+        db->Get(leveldb::ReadOptions(), "YSCHEMA_VERSION", &version);
+        EXPECT_EQ("8", version);
+    }
+}
+
+TEST(PersistentStringCacheImpl, upgrade_from_version_5)
+{
+    unlink_db(TEST_DB);
+
+    auto open_db = []
+    {
+        leveldb::Options options;
+        options.create_if_missing = true;
+        leveldb::DB* p;
+        auto s = leveldb::DB::Open(options, TEST_DB, &p);
+        EXPECT_TRUE(s.ok());
+        return unique_ptr<leveldb::DB>(p);
+    };
+
+    int64_t const etime = 4000000000000;
+
+    {
+        // Create a cache with the version 5 schema, whose index rows hold only the size.
+        auto db = open_db();
+
+        auto record = [](int64_t atime, int64_t etime, int64_t size, string const& value)
+        {
+            return encode_int64(atime) + encode_int64(etime) + encode_int64(size) + encode_int64(-1) + value;
+        };
+
+        leveldb::WriteBatch batch;
+        batch.Put("YSCHEMA_VERSION", "5");
+        batch.Put("YMAX_SIZE", "1024");
+        batch.Put("YPOLICY", to_string(static_cast<int>(CacheDiscardPolicy::lru_ttl)));
+        batch.Put("!DIRTY", "1");
+
+        batch.Put("Aa", record(100, etime, 6, "value"));
+        batch.Put("D" + encode_int64(100) + "a", encode_int64(6));
+        batch.Put("E" + encode_int64(etime) + "a", encode_int64(6));
+
+        batch.Put("Abb", record(200, 0, 5, "xyz"));
+        batch.Put("D" + encode_int64(200) + "bb", encode_int64(5));
+
+        leveldb::WriteOptions write_options;
+        auto s = db->Write(write_options, &batch);
+        ASSERT_TRUE(s.ok());
+    }
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_ttl);
+        EXPECT_EQ(2, c.size());
+        EXPECT_EQ(11, c.size_in_bytes());
+    }
+
+    {
+        // The index rows now hold both the size and the other time of the entry,
+        // and the version 6 upgrade moved them to generation 0.
+        auto db = open_db();
+        string const gen = encode_int64(0);
+        string v;
+        ASSERT_TRUE(db->Get(leveldb::ReadOptions(), "H" + gen + encode_int64(100) + "a", &v).ok());
+        EXPECT_EQ(encode_int64(6) + encode_int64(etime), v);
+        ASSERT_TRUE(db->Get(leveldb::ReadOptions(), "I" + gen + encode_int64(etime) + "a", &v).ok());
+        EXPECT_EQ(encode_int64(6) + encode_int64(100), v);
+        ASSERT_TRUE(db->Get(leveldb::ReadOptions(), "H" + gen + encode_int64(200) + "bb", &v).ok());
+        EXPECT_EQ(encode_int64(5) + encode_int64(0), v);
+        EXPECT_TRUE(db->Get(leveldb::ReadOptions(), "Aa", &v).IsNotFound());
+        EXPECT_TRUE(db->Get(leveldb::ReadOptions(), "D" + encode_int64(100) + "a", &v).IsNotFound());
+
+        string version;
+        db->Get(leveldb::ReadOptions(), "YSCHEMA_VERSION", &version);
+        EXPECT_EQ("8", version);
+    }
+
+    {
+        // Eviction removes all rows of the entries.
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_ttl);
+        c.trim_to(0);
+        EXPECT_EQ(0, c.size());
+    }
+
+    {
+        auto db = open_db();
+        unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        map<char, int> rows;
+        for (it->SeekToFirst(); it->Valid(); it->Next())
+        {
+            ++rows[it->key()[0]];
+        }
+        EXPECT_EQ(0, rows['G']);
+        EXPECT_EQ(0, rows['H']);
+        EXPECT_EQ(0, rows['I']);
+    }
+}
+
+TEST(PersistentStringCacheImpl, upgrade_from_version_7)
+{
+    unlink_db(TEST_DB);
+
+    auto open_db = []
+    {
+        leveldb::Options options;
+        options.create_if_missing = true;
+        leveldb::DB* p;
+        auto s = leveldb::DB::Open(options, TEST_DB, &p);
+        EXPECT_TRUE(s.ok());
+        return unique_ptr<leveldb::DB>(p);
+    };
+
+    string const gen = encode_int64(0);
+
+    // Returns the size field of the data tuple in the record of key.
+    auto size_field = [&](leveldb::DB& db, string const& key)
+    {
+        string record;
+        EXPECT_TRUE(db.Get(leveldb::ReadOptions(), "G" + gen + key, &record).ok());
+        return decode_int64(record.data() + 2 * INT64_ENCODED_SIZE);
+    };
+
+    {
+        // Create a segmented_lru cache with the version 7 schema, whose records don't say
+        // which segment an entry is in. "a" is protected, and "bb" is in probation.
+        auto db = open_db();
+
+        auto record = [](int64_t atime, int64_t size, string const& value)
+        {
+            return encode_int64(atime) + encode_int64(0) + encode_int64(size) + encode_int64(-1) + value;
+        };
+
+        leveldb::WriteBatch batch;
+        batch.Put("YSCHEMA_VERSION", "7");
+        batch.Put("YMAX_SIZE", "1024");
+        batch.Put("YPOLICY", to_string(static_cast<int>(CacheDiscardPolicy::segmented_lru)));
+        batch.Put("YGENERATION", "0");
+        batch.Put("!DIRTY", "1");
+
+        batch.Put("G" + gen + "a", record(100, 6, "value"));
+        batch.Put("J" + gen + encode_int64(100) + "a", encode_int64(6) + encode_int64(0));
+
+        batch.Put("G" + gen + "bb", record(200, 5, "xyz"));
+        batch.Put("H" + gen + encode_int64(200) + "bb", encode_int64(5) + encode_int64(0));
+
+        leveldb::WriteOptions write_options;
+        auto s = db->Write(write_options, &batch);
+        ASSERT_TRUE(s.ok());
+    }
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::segmented_lru);
+        EXPECT_EQ(2, c.size());
+        EXPECT_EQ(11, c.size_in_bytes());
+    }
+
+    {
+        // The record of the protected entry now holds the one's complement of its size.
+        auto db = open_db();
+        EXPECT_EQ(~int64_t(6), size_field(*db, "a"));
+        EXPECT_EQ(5, size_field(*db, "bb"));
+
+        string version;
+        db->Get(leveldb::ReadOptions(), "YSCHEMA_VERSION", &version);
+        EXPECT_EQ("8", version);
+    }
+
+    auto count_rows = [&]
+    {
+        auto db = open_db();
+        unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        map<char, int> rows;
+        for (it->SeekToFirst(); it->Valid(); it->Next())
+        {
+            ++rows[it->key()[0]];
+        }
+        return rows;
+    };
+
+    {
+        // Hits on either entry find its index row from the record alone.
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::segmented_lru);
+        string v;
+        EXPECT_TRUE(c.get("a", v));
+        EXPECT_TRUE(c.get("bb", v));
+    }
+
+    {
+        auto rows = count_rows();
+        EXPECT_EQ(2, rows['G']);
+        EXPECT_EQ(0, rows['H']);
+        EXPECT_EQ(2, rows['J']);
+    }
+
+    {
+        // Eviction from the protected segment removes all rows of the entries.
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::segmented_lru);
+        c.trim_to(0);
+        EXPECT_EQ(0, c.size());
+        EXPECT_EQ(0, c.size_in_bytes());
+    }
+
+    {
+        auto rows = count_rows();
+        EXPECT_EQ(0, rows['G']);
+        EXPECT_EQ(0, rows['H']);
+        EXPECT_EQ(0, rows['J']);
+    }
+}
+
+TEST(PersistentStringCacheImpl, db_options)
+{
+    unlink_db(TEST_DB);
+
+    PersistentCacheOptions options;
+    options.bloom_filter_bits_per_key = 16;
+    options.block_size = 8 * 1024;
+    options.compression = false;
+    options.block_cache_size = 1024 * 1024;
+    options.write_buffer_size = 1024 * 1024;
+    options.max_open_files = 100;
+    options.paranoid_checks = true;
+
+    string val;
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, options);
+        c.put("a", "b");
+        EXPECT_FALSE(c.get("x", val));
+    }
+
+    // The settings that determine the on-disk format are recorded.
+    auto read_settings = []
+    {
+        leveldb::Options db_options;
+        leveldb::DB* p;
+        auto s = leveldb::DB::Open(db_options, TEST_DB, &p);
+        EXPECT_TRUE(s.ok());
+        unique_ptr<leveldb::DB> db(p);
+        map<string, string> settings;
+        for (string key : {"YBLOOM_BITS_PER_KEY", "YBLOCK_SIZE", "YCOMPRESSION"})
+        {
+            string value;
+            db->Get(leveldb::ReadOptions(), key, &value);
+            settings[key] = value;
+        }
+        return settings;
+    };
+    auto settings = read_settings();
+    EXPECT_EQ("16", settings["YBLOOM_BITS_PER_KEY"]);
+    EXPECT_EQ("8192", settings["YBLOCK_SIZE"]);
+    EXPECT_EQ("0", settings["YCOMPRESSION"]);
+
+    {
+        // Opening without options uses the recorded settings.
+        PersistentStringCacheImpl c(TEST_DB);
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ("b", val);
+    }
+    settings = read_settings();
+    EXPECT_EQ("16", settings["YBLOOM_BITS_PER_KEY"]);
+
+    {
+        // Opening with a size replaces the recorded settings.
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only);
+        EXPECT_TRUE(c.get("a", val));
+    }
+    settings = read_settings();
+    EXPECT_EQ("10", settings["YBLOOM_BITS_PER_KEY"]);
+    EXPECT_EQ("4096", settings["YBLOCK_SIZE"]);
+    EXPECT_EQ("1", settings["YCOMPRESSION"]);
+
+    // Bad options.
+    auto check_bad = [](PersistentCacheOptions const& bad, string const& msg)
+    {
+        try
+        {
+            PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, bad);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: " + msg + " (cache_path: " + TEST_DB + ")", e.what());
+        }
+    };
+    PersistentCacheOptions bad;
+    bad.bloom_filter_bits_per_key = -1;
+    check_bad(bad, "invalid bloom_filter_bits_per_key (-1): value must be >= 0");
+    bad = PersistentCacheOptions();
+    bad.block_size = 0;
+    check_bad(bad, "invalid block_size (0): value must be > 0");
+    bad = PersistentCacheOptions();
+    bad.block_cache_size = -1;
+    check_bad(bad, "invalid block_cache_size (-1): value must be >= 0");
+    bad = PersistentCacheOptions();
+    bad.write_buffer_size = 0;
+    check_bad(bad, "invalid write_buffer_size (0): value must be > 0");
+    bad = PersistentCacheOptions();
+    bad.max_open_files = 0;
+    check_bad(bad, "invalid max_open_files (0): value must be > 0");
+}
+
+TEST(PersistentStringCacheImpl, memory_tier)
+{
+    unlink_db(TEST_DB);
+
+    PersistentCacheOptions options;
+    options.memory_cache_size = 2 * 1024;
+    options.access_time_flush_interval = chrono::hours(1);  // Never flush on a timer.
+
+    string val;
+    string md;
+    string b(1000, 'b');
+    {
+        PersistentStringCacheImpl c(TEST_DB, 3 * 1024, CacheDiscardPolicy::lru_ttl, options);
+
+        c.put("a", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+        c.put("b", b.data(), b.size(), "x", 1);
+        this_thread::sleep_for(chrono::milliseconds(5));
+        c.put("c", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+
+        // First read goes to the DB and adds the entry to memory, second read is served from memory.
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ(b, val);
+        auto s = c.stats();
+        EXPECT_EQ(2, s.hits());
+        EXPECT_EQ(1, s.memory_hits());
+        EXPECT_EQ(1, s.memory_misses());
+
+        // Metadata is held in memory too.
+        EXPECT_TRUE(c.get("b", val, &md));
+        EXPECT_TRUE(c.get("b", val, &md));
+        EXPECT_EQ("x", md);
+        EXPECT_EQ(2, c.stats().memory_hits());
+
+        // Memory holds only two entries, so reading "c" drops "a" from memory.
+        EXPECT_TRUE(c.get("c", val));
+        EXPECT_TRUE(c.get("a", val));
+        s = c.stats();
+        EXPECT_EQ(2, s.memory_hits());
+        EXPECT_EQ(4, s.memory_misses());
+
+        // Updates are visible.
+        c.put("a", "new a");
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ("new a", val);
+        EXPECT_EQ(3, c.stats().memory_hits());
+        c.put_metadata("a", "y", 1);
+        EXPECT_TRUE(c.get("a", val, &md));
+        EXPECT_EQ("y", md);
+
+        // Removals are visible.
+        EXPECT_TRUE(c.invalidate("a"));
+        EXPECT_FALSE(c.get("a", val));
+        EXPECT_FALSE(c.contains_key("a"));
+        EXPECT_TRUE(c.get("c", val));
+        EXPECT_TRUE(c.take("c", val));
+        EXPECT_FALSE(c.get("c", val));
+
+        // Expiry is visible.
+        c.put("e", "e", chrono::system_clock::now() + chrono::milliseconds(500));
+        EXPECT_TRUE(c.get("e", val));
+        EXPECT_TRUE(c.get("e", val));
+        EXPECT_TRUE(c.touch("e", chrono::system_clock::now() + chrono::milliseconds(50)));
+        this_thread::sleep_for(chrono::milliseconds(100));
+        EXPECT_FALSE(c.contains_key("e"));
+        EXPECT_FALSE(c.get("e", val));
+
+        c.invalidate();
+        EXPECT_FALSE(c.get("b", val));
+        EXPECT_EQ(0, c.stats().memory_hits());
+    }
+
+    {
+        // Hits served from memory still count for LRU eviction.
+        PersistentStringCacheImpl c(TEST_DB, 3 * 1024, CacheDiscardPolicy::lru_ttl, options);
+
+        c.put("a", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+        c.put("b", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+        EXPECT_TRUE(c.get("a", val));
+        this_thread::sleep_for(chrono::milliseconds(5));
+        c.put("c", b);
+        this_thread::sleep_for(chrono::milliseconds(5));
+        EXPECT_TRUE(c.get("a", val));  // From memory
+        EXPECT_EQ(1, c.stats().memory_hits());
+        c.put("d", b);
+        EXPECT_TRUE(c.contains_key("a"));
+        EXPECT_FALSE(c.contains_key("b"));
+
+        // Evicted entries are dropped from memory.
+        c.put("e", b);
+        c.put("f", b);
+        EXPECT_FALSE(c.contains_key("a"));
+        EXPECT_FALSE(c.get("a", val));
+    }
+
+    {
+        // Bad option.
+        PersistentCacheOptions bad;
+        bad.memory_cache_size = -1;
+        try
+        {
+            PersistentStringCacheImpl c(TEST_DB, 3 * 1024, CacheDiscardPolicy::lru_ttl, bad);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: invalid memory_cache_size (-1): value must be >= 0 "
+                      "(cache_path: " + TEST_DB + ")",
+                      e.what());
+        }
+    }
+}
+
+TEST(PersistentStringCacheImpl, expiry_reaper)
+{
+    unlink_db(TEST_DB);
+
+    {
+        PersistentCacheOptions options;
+        options.expiry_reap_interval = chrono::milliseconds(10);
+        options.expiry_reap_batch_size = 2;
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_ttl, options);
+
+        atomic<int> num_evictions(0);
+        c.set_handler(CacheEvent::evict_ttl, [&](string const&, CacheEvent, PersistentCacheStats const&)
+                      {
+                          ++num_evictions;
+                      });
+
+        auto expiry = chrono::system_clock::now() + chrono::milliseconds(50);
+        for (int i = 0; i < 5; ++i)
+        {
+            c.put(to_string(i), "x", expiry);
+        }
+        c.put("no expiry", "x");
+        c.put("later", "x", chrono::system_clock::now() + chrono::hours(1));
+        EXPECT_EQ(7, c.size());
+
+        // The expired entries disappear without any further calls on the cache.
+        for (int i = 0; i < 200 && c.size() != 2; ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        EXPECT_EQ(2, c.size());
+        EXPECT_EQ(string("no expiry").size() + string("later").size() + 2, c.size_in_bytes());
+        EXPECT_EQ(5, c.stats().ttl_evictions());
+        EXPECT_EQ(5, num_evictions);
+        EXPECT_TRUE(c.contains_key("later"));
+    }
+
+    {
+        // The background thread isn't used with lru_only, and stops when the cache is closed.
+        PersistentCacheOptions options;
+        options.expiry_reap_interval = chrono::milliseconds(1);
+        PersistentStringCacheImpl c(TEST_DB + "2", 1024, CacheDiscardPolicy::lru_only, options);
+        c.put("a", "b");
+        EXPECT_EQ(1, c.size());
+    }
+
+    {
+        // Bad options.
+        auto check_bad = [](PersistentCacheOptions const& bad, string const& msg)
+        {
+            try
+            {
+                PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_ttl, bad);
+                FAIL();
+            }
+            catch (invalid_argument const& e)
+            {
+                EXPECT_EQ("PersistentStringCache: " + msg + " (cache_path: " + TEST_DB + ")", e.what());
+            }
+        };
+        PersistentCacheOptions bad;
+        bad.expiry_reap_interval = chrono::milliseconds(-1);
+        check_bad(bad, "invalid expiry_reap_interval (-1): value must be >= 0");
+        bad = PersistentCacheOptions();
+        bad.expiry_reap_batch_size = 0;
+        check_bad(bad, "invalid expiry_reap_batch_size (0): value must be > 0");
+    }
+}
+
+TEST(PersistentStringCacheImpl, watermark_eviction)
+{
+    unlink_db(TEST_DB);
+
+    {
+        PersistentCacheOptions options;
+        options.eviction_high_watermark = 0.8;
+        options.eviction_low_watermark = 0.5;
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, options);
+
+        atomic<int> num_evictions(0);
+        c.set_handler(CacheEvent::evict_lru, [&](string const&, CacheEvent, PersistentCacheStats const&)
+                      {
+                          ++num_evictions;
+                      });
+
+        // 100-byte entries. Up to the high watermark, nothing is evicted.
+        string const val(99, 'x');
+        for (int i = 0; i < 8; ++i)
+        {
+            c.put(to_string(i), val);
+        }
+        this_thread::sleep_for(chrono::milliseconds(20));
+        EXPECT_EQ(8, c.size());
+        EXPECT_EQ(0, num_evictions);
+
+        // Going above the high watermark trims the cache to the low watermark in the background.
+        c.put("8", val);
+        for (int i = 0; i < 200 && c.size_in_bytes() > 500; ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        EXPECT_EQ(5, c.size());
+        EXPECT_EQ(4, num_evictions);
+        EXPECT_EQ(4, c.stats().lru_evictions());
+        EXPECT_FALSE(c.contains_key("0"));
+        EXPECT_FALSE(c.contains_key("3"));
+        EXPECT_TRUE(c.contains_key("4"));
+        EXPECT_TRUE(c.contains_key("8"));
+
+        // An entry that doesn't fit into the remaining space makes room for itself, as usual.
+        EXPECT_TRUE(c.put("big", string(597, 'y')));
+        EXPECT_LE(c.size_in_bytes(), 1000);
+    }
+
+    {
+        // Bad options.
+        auto check_bad = [](PersistentCacheOptions const& bad, string const& msg)
+        {
+            try
+            {
+                PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, bad);
+                FAIL();
+            }
+            catch (invalid_argument const& e)
+            {
+                EXPECT_EQ("PersistentStringCache: " + msg + " (cache_path: " + TEST_DB + ")", e.what());
+            }
+        };
+        PersistentCacheOptions bad;
+        bad.eviction_high_watermark = 0;
+        check_bad(bad, "invalid eviction_high_watermark (0.000000): value must be > 0 and <= 1");
+        bad.eviction_high_watermark = 1.5;
+        check_bad(bad, "invalid eviction_high_watermark (1.500000): value must be > 0 and <= 1");
+        bad = PersistentCacheOptions();
+        bad.eviction_high_watermark = 0.5;
+        bad.eviction_low_watermark = 0.6;
+        check_bad(bad, "invalid eviction_low_watermark (0.600000): value must be > 0 and <= eviction_high_watermark");
+    }
+}
+
+TEST(PersistentStringCacheImpl, background_invalidate)
+{
+    unlink_db(TEST_DB);
+
+    // Returns the number of rows in the Entries table and the Atime and Etime indexes.
+    auto count_entry_rows = []
+    {
+        leveldb::Options options;
+        leveldb::DB* p;
+        auto s = leveldb::DB::Open(options, TEST_DB, &p);
+        EXPECT_TRUE(s.ok());
+        unique_ptr<leveldb::DB> db(p);
+        unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        int rows = 0;
+        for (it->Seek("G"); it->Valid() && it->key().compare("J") < 0; it->Next())
+        {
+            ++rows;
+        }
+        return rows;
+    };
+
+    int const num_entries = 2500;  // More than one batch
+
+    {
+        PersistentCacheOptions options;
+        options.background_invalidate = true;
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_ttl, options);
+
+        atomic<int> num_invalidated(0);
+        c.set_handler(CacheEvent::invalidate, [&](string const&, CacheEvent, PersistentCacheStats const&)
+                      {
+                          ++num_invalidated;
+                      });
+
+        auto expiry = chrono::system_clock::now() + chrono::hours(1);
+        for (int i = 0; i < num_entries; ++i)
+        {
+            c.put(to_string(i), "x", expiry);
+        }
+        EXPECT_EQ(num_entries, c.size());
+
+        // The old entries are gone right away.
+        c.invalidate();
+        EXPECT_EQ(0, c.size());
+        EXPECT_EQ(0, c.size_in_bytes());
+        string val;
+        EXPECT_FALSE(c.get("0", val));
+        EXPECT_FALSE(c.contains_key("1"));
+
+        // New entries don't mix with the old generation.
+        c.put("0", "new");
+        EXPECT_TRUE(c.get("0", val));
+        EXPECT_EQ("new", val);
+        EXPECT_EQ(1, c.size());
+
+        // The background thread calls the handler for each old entry.
+        for (int i = 0; i < 500 && num_invalidated != num_entries; ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        EXPECT_EQ(num_entries, num_invalidated);
+        EXPECT_EQ(1, c.size());
+
+        // A second invalidate() while there is nothing left to drop.
+        c.invalidate();
+        EXPECT_EQ(0, c.size());
+        EXPECT_FALSE(c.get("0", val));
+    }
+
+    {
+        // Rows that are left over when the cache is closed are deleted once it is re-opened.
+        // Without background_invalidate, this happens before the constructor returns.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.background_invalidate = true;
+        {
+            PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, options);
+            for (int i = 0; i < num_entries; ++i)
+            {
+                c.put(to_string(i), "x");
+            }
+            c.invalidate();
+            c.put("a", "b");
+        }
+        {
+            PersistentStringCacheImpl c(TEST_DB);
+            EXPECT_EQ(1, c.size());
+            string val;
+            EXPECT_TRUE(c.get("a", val));
+            EXPECT_FALSE(c.get("0", val));
+        }
+        EXPECT_EQ(2, count_entry_rows());  // Entry and Atime index row for "a"
+    }
+
+    {
+        // Without background_invalidate, invalidate() deletes the entries before it returns.
+        {
+            PersistentStringCacheImpl c(TEST_DB);
+            for (int i = 0; i < num_entries; ++i)
+            {
+                c.put(to_string(i), "x");
+            }
+            c.invalidate();
+            EXPECT_EQ(0, c.size());
+        }
+        EXPECT_EQ(0, count_entry_rows());
+    }
+}
+
+TEST(PersistentStringCacheImpl, stats_checkpoint)
+{
+    unlink_db(TEST_DB);
+
+    auto open_db = []
+    {
+        leveldb::Options options;
+        leveldb::DB* p;
+        auto s = leveldb::DB::Open(options, TEST_DB, &p);
+        EXPECT_TRUE(s.ok());
+        return unique_ptr<leveldb::DB>(p);
+    };
+
+    auto count_rows = [](leveldb::DB* db, char prefix)
+    {
+        int rows = 0;
+        unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        for (it->Seek(string(1, prefix)); it->Valid() && it->key()[0] == prefix; it->Next())
+        {
+            ++rows;
+        }
+        return rows;
+    };
+
+    {
+        PersistentCacheOptions options;
+        options.stats_checkpoint_interval = 3;
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_only, options);
+        c.put("a", "1234");
+        c.put("b", "12345678");
+        c.put("c", "1");
+        c.invalidate("b");
+        c.put("a", "12");
+    }
+
+    {
+        // Simulate a crash after a write that is recorded only in the journal:
+        // "a" was replaced with a larger value, and "d" was added.
+        auto db = open_db();
+        string checkpoint;
+        ASSERT_TRUE(db->Get(leveldb::ReadOptions(), "XCHECKPOINT", &checkpoint).ok());
+        EXPECT_EQ(0, count_rows(db.get(), 'W'));  // The clean shutdown wrote a new checkpoint.
+        int64_t seq = decode_int64(checkpoint.data());
+
+        leveldb::WriteBatch batch;
+        batch.Put("!DIRTY", "1");
+        batch.Put("W" + encode_int64(seq + 1), encode_int64(-3) + encode_int64(10) + encode_int64(2));
+        ASSERT_TRUE(db->Write(leveldb::WriteOptions(), &batch).ok());
+    }
+
+    {
+        PersistentStringCacheImpl c(TEST_DB);
+        EXPECT_EQ(3, c.size());
+        EXPECT_EQ(14, c.size_in_bytes());
+        auto hist = c.stats().histogram();
+        EXPECT_EQ(2, hist[0]);
+        EXPECT_EQ(1, hist[1]);
+    }
+
+    {
+        auto db = open_db();
+        EXPECT_EQ(0, count_rows(db.get(), 'W'));  // Opening the cache started a new journal.
+    }
+
+    {
+        // Without journaling, a dirty open scans the entries.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.stats_checkpoint_interval = 0;
+        {
+            PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_only, options);
+            c.put("a", "1234");
+            c.put("b", "1");
+        }
+        {
+            auto db = open_db();
+            string checkpoint;
+            EXPECT_TRUE(db->Get(leveldb::ReadOptions(), "XCHECKPOINT", &checkpoint).IsNotFound());
+            ASSERT_TRUE(db->Put(leveldb::WriteOptions(), "!DIRTY", "1").ok());
+        }
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(2, c.size());
+        EXPECT_EQ(7, c.size_in_bytes());
+    }
+
+    {
+        PersistentCacheOptions bad;
+        bad.stats_checkpoint_interval = -1;
+        try
+        {
+            PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_only, bad);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: invalid stats_checkpoint_interval (-1): value must be >= 0 "
+                      "(cache_path: " + TEST_DB + ")",
+                      e.what());
+        }
+    }
+}
+
+TEST(PersistentStringCacheImpl, async_events)
+{
+    unlink_db(TEST_DB);
+
+    {
+        PersistentCacheOptions options;
+        options.async_events = true;
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, options);
+
+        // Handlers run on the dispatch thread, in the order of the events.
+        mutex m;
+        vector<string> keys;
+        vector<CacheEvent> events;
+        thread::id handler_thread;
+        c.set_handler(CacheEvent::put | CacheEvent::get, [&](string const& key, CacheEvent ev, PersistentCacheStats const&)
+                      {
+                          lock_guard<mutex> lock(m);
+                          keys.push_back(key);
+                          events.push_back(ev);
+                          handler_thread = this_thread::get_id();
+                      });
+        mutex bm;
+        PersistentStringCache::EventBatch batched;
+        int64_t last_size = 0;
+        c.set_batch_handler(CacheEvent::put | CacheEvent::invalidate,
+                            [&](PersistentStringCache::EventBatch const& batch, PersistentCacheStats const& stats)
+                            {
+                                lock_guard<mutex> lock(bm);
+                                batched.insert(batched.end(), batch.begin(), batch.end());
+                                last_size = stats.size();
+                            });
+
+        c.put("a", "1");
+        c.put("b", "2");
+        string value;
+        c.get("a", value);
+        c.invalidate("b");
+
+        auto delivered = [&]
+        {
+            lock_guard<mutex> lock(bm);
+            return batched.size() == 3;
+        };
+        for (int i = 0; i < 500 && !delivered(); ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        {
+            lock_guard<mutex> lock(m);
+            EXPECT_EQ((vector<string>{"a", "b", "a"}), keys);
+            EXPECT_EQ((vector<CacheEvent>{CacheEvent::put, CacheEvent::put, CacheEvent::get}), events);
+            EXPECT_NE(this_thread::get_id(), handler_thread);
+        }
+        {
+            lock_guard<mutex> lock(bm);
+            ASSERT_EQ(3u, batched.size());
+            EXPECT_EQ(make_pair(string("a"), CacheEvent::put), batched[0]);
+            EXPECT_EQ(make_pair(string("b"), CacheEvent::put), batched[1]);
+            EXPECT_EQ(make_pair(string("b"), CacheEvent::invalidate), batched[2]);
+            EXPECT_EQ(1, last_size);  // Stats as of delivery.
+        }
+
+        // A handler that blocks doesn't block the cache.
+        promise<void> release;
+        shared_future<void> released(release.get_future());
+        atomic<int> num_calls(0);
+        c.set_batch_handler(CacheEvent::put, nullptr);
+        c.set_handler(CacheEvent::put, [&](string const&, CacheEvent, PersistentCacheStats const&)
+                      {
+                          ++num_calls;
+                          released.wait();
+                      });
+        c.put("c", "3");
+        for (int i = 0; i < 500 && num_calls == 0; ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        for (int i = 0; i < 10; ++i)
+        {
+            c.put("d", "4");
+        }
+        EXPECT_EQ(1, num_calls);
+        release.set_value();
+        EXPECT_EQ(0, c.stats().dropped_events());
+    }  // Queued events are delivered before the cache is closed.
+
+    {
+        // If the handler doesn't keep up, events are dropped once the queue is full.
+        PersistentCacheOptions options;
+        options.async_events = true;
+        options.event_queue_size = 3;  // Rounded up to 4.
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, options);
+
+        promise<void> release;
+        shared_future<void> released(release.get_future());
+        atomic<int> num_calls(0);
+        c.set_handler(CacheEvent::put, [&](string const&, CacheEvent, PersistentCacheStats const&)
+                      {
+                          if (++num_calls == 1)
+                          {
+                              released.wait();
+                          }
+                      });
+        c.put("a", "1");
+        for (int i = 0; i < 500 && num_calls == 0; ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        for (int i = 0; i < 6; ++i)
+        {
+            c.put(to_string(i), "x");
+        }
+        EXPECT_EQ(2, c.stats().dropped_events());
+
+        // Events without a handler are neither queued nor dropped.
+        string value;
+        c.get("a", value);
+        EXPECT_EQ(2, c.stats().dropped_events());
+
+        release.set_value();
+        for (int i = 0; i < 500 && num_calls != 5; ++i)
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        EXPECT_EQ(5, num_calls);
+
+        c.clear_stats();
+        EXPECT_EQ(0, c.stats().dropped_events());
+    }
+
+    {
+        // Without async_events, the batch handler is called for each event.
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only);
+        vector<size_t> sizes;
+        c.set_batch_handler(CacheEvent::put, [&](PersistentStringCache::EventBatch const& batch,
+                                                 PersistentCacheStats const& stats)
+                            {
+                                sizes.push_back(batch.size());
+                                EXPECT_EQ("a", batch[0].first);
+                                EXPECT_EQ(1, stats.size());  // Stats as of the event.
+                            });
+        c.put("a", "1");
+        string value;
+        c.get("a", value);
+        EXPECT_EQ(vector<size_t>{1}, sizes);
+    }
+
+    {
+        // Bad arguments.
+        PersistentCacheOptions bad;
+        bad.event_queue_size = 0;
+        try
+        {
+            PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, bad);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_STREQ(("PersistentStringCache: invalid event_queue_size (0): value must be > 0 (cache_path: " +
+                          TEST_DB + ")").c_str(),
+                         e.what());
+        }
+
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only);
+        try
+        {
+            c.set_batch_handler(CacheEvent(0), nullptr);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_STREQ(("PersistentStringCache: set_batch_handler(): invalid events (0): value must be in the "
+                          "range [1..127] (cache_path: " + TEST_DB + ")").c_str(),
+                         e.what());
+        }
+    }
+}
+
+TEST(PersistentStringCacheImpl, lock_free_stats)
+{
+    unlink_db(TEST_DB);
+
+    PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only);
+
+    // The put handler runs while the put holds the cache lock. Reading the stats must not wait for it.
+    promise<void> entered;
+    promise<void> release;
+    shared_future<void> released(release.get_future());
+    c.set_handler(CacheEvent::put, [&](string const&, CacheEvent, PersistentCacheStats const&)
+                  {
+                      entered.set_value();
+                      released.wait();
+                  });
+    thread t([&]
+             {
+                 c.put("a", "12345");
+             });
+    entered.get_future().wait();
+
+    EXPECT_EQ(1, c.size());
+    EXPECT_EQ(6, c.size_in_bytes());
+    EXPECT_EQ(1024 * 1024, c.max_size_in_bytes());
+    auto s = c.stats();
+    EXPECT_EQ(1, s.size());
+    EXPECT_EQ(6, s.size_in_bytes());
+    EXPECT_EQ(1u, s.histogram()[0]);
+
+    release.set_value();
+    t.join();
+
+    // The snapshot doesn't change with the cache.
+    c.set_handler(CacheEvent::put, nullptr);
+    c.put("bb", "123456789");
+    EXPECT_EQ(1, s.size());
+    EXPECT_EQ(1u, s.histogram()[0]);
+    EXPECT_EQ(0u, s.histogram()[1]);
+    s = c.stats();
+    EXPECT_EQ(2, s.size());
+    EXPECT_EQ(1u, s.histogram()[1]);
+}
+
+TEST(PersistentStringCacheImpl, latency_stats)
+{
+    typedef PersistentCacheStats::Operation Op;
+
+    // Bin boundaries.
+    auto const& bounds = PersistentCacheStats::latency_histogram_bounds();
+    ASSERT_EQ(PersistentCacheStats::NUM_LATENCY_BINS, bounds.size());
+    EXPECT_EQ(make_pair(int64_t(0), int64_t(0)), bounds[0]);
+    EXPECT_EQ(make_pair(int64_t(7), int64_t(7)), bounds[7]);
+    EXPECT_EQ(make_pair(int64_t(8), int64_t(8)), bounds[8]);
+    EXPECT_EQ(make_pair(int64_t(16), int64_t(17)), bounds[16]);
+    EXPECT_EQ(make_pair(int64_t(30), int64_t(31)), bounds[23]);
+    EXPECT_EQ(numeric_limits<int64_t>::max(), bounds.back().second);
+    for (unsigned i = 1; i < bounds.size(); ++i)
+    {
+        EXPECT_EQ(bounds[i - 1].second + 1, bounds[i].first);
+    }
+    for (auto ns : {int64_t(0), int64_t(7), int64_t(8), int64_t(100), int64_t(12345678), int64_t(1) << 39})
+    {
+        auto bin = LatencyHistograms::bin_of(ns);
+        EXPECT_LE(bounds[bin].first, ns);
+        EXPECT_GE(bounds[bin].second, ns);
+    }
+    EXPECT_EQ(PersistentCacheStats::NUM_LATENCY_BINS - 1, LatencyHistograms::bin_of(int64_t(1) << 40));
+    EXPECT_EQ(PersistentCacheStats::NUM_LATENCY_BINS - 1, LatencyHistograms::bin_of(numeric_limits<int64_t>::max()));
+
+    unlink_db(TEST_DB);
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 100, CacheDiscardPolicy::lru_only);
+
+        auto s = c.stats();
+        for (unsigned op = 0; op < unsigned(Op::END_); ++op)
+        {
+            EXPECT_EQ(0, s.num_operations(Op(op)));
+            EXPECT_EQ(chrono::nanoseconds(0), s.latency_p50(Op(op)));
+        }
+
+        string value;
+        for (int i = 0; i < 20; ++i)
+        {
+            c.put(to_string(i), string(10, 'x'));  // Later puts evict.
+            c.get(to_string(i), value);
+        }
+        c.get("no_such_key", value);
+        c.take("19", value);
+        c.invalidate("18");
+        c.invalidate({"17", "16"});
+        c.touch("15");
+        c.compact();
+
+        s = c.stats();
+        EXPECT_EQ(20, s.num_operations(Op::put));
+        EXPECT_EQ(21, s.num_operations(Op::get));
+        EXPECT_EQ(1, s.num_operations(Op::take));
+        EXPECT_EQ(2, s.num_operations(Op::invalidate));
+        EXPECT_EQ(1, s.num_operations(Op::touch));
+        EXPECT_EQ(1, s.num_operations(Op::compaction));
+        EXPECT_LT(0, s.num_operations(Op::eviction));
+
+        auto h = s.latency_histogram(Op::get);
+        ASSERT_EQ(PersistentCacheStats::NUM_LATENCY_BINS, h.size());
+        uint64_t sum = 0;
+        for (auto n : h)
+        {
+            sum += n;
+        }
+        EXPECT_EQ(21u, sum);
+
+        EXPECT_LT(chrono::nanoseconds(0), s.latency_p50(Op::get));
+        EXPECT_LE(s.latency_p50(Op::get), s.latency_p90(Op::get));
+        EXPECT_LE(s.latency_p90(Op::get), s.latency_p99(Op::get));
+        EXPECT_LE(s.latency_p99(Op::get), s.latency_p999(Op::get));
+        EXPECT_EQ(s.latency_p999(Op::get), s.latency_percentile(Op::get, 100));
+        EXPECT_EQ(s.latency_percentile(Op::get, 100), s.latency_percentile(Op::get, 1000));
+        EXPECT_EQ(s.latency_percentile(Op::get, 0), s.latency_percentile(Op::get, -1));
+
+        // With a single operation, every percentile is in the same bin.
+        EXPECT_EQ(s.latency_p50(Op::compaction), s.latency_p999(Op::compaction));
+    }
+
+    {
+        // Latencies are persistent.
+        PersistentStringCacheImpl c(TEST_DB);
+        auto s = c.stats();
+        EXPECT_EQ(20, s.num_operations(Op::put));
+        EXPECT_EQ(21, s.num_operations(Op::get));
+        EXPECT_EQ(1, s.num_operations(Op::compaction));
+
+        c.clear_stats();
+        s = c.stats();
+        for (unsigned op = 0; op < unsigned(Op::END_); ++op)
+        {
+            EXPECT_EQ(0, s.num_operations(Op(op)));
+        }
+    }
+}
+
+TEST(PersistentStringCacheImpl, segmented_lru)
+{
+    string const value(96, 'x');  // With a key of four or five bytes, each entry takes about 100 bytes.
+
+    // Reads the key and adds it on a miss. Returns true for a hit.
+    auto access = [&](PersistentStringCacheImpl& c, string const& key)
+    {
+        string v;
+        if (c.get(key, v))
+        {
+            return true;
+        }
+        c.put(key, value);
+        return false;
+    };
+
+    // Replays a trace in which a working set of 50 entries is read repeatedly, followed by
+    // a single pass over 1000 other keys that are never read again. Returns the number of hits
+    // for a final pass over the working set.
+    auto replay = [&](PersistentStringCacheImpl& c)
+    {
+        for (int round = 0; round < 3; ++round)
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                access(c, "hot" + to_string(i));
+            }
+        }
+        for (int i = 0; i < 1000; ++i)
+        {
+            access(c, "scan" + to_string(i));
+        }
+        int hits = 0;
+        for (int i = 0; i < 50; ++i)
+        {
+            hits += access(c, "hot" + to_string(i));
+        }
+        return hits;
+    };
+
+    // The cache has room for about 100 entries, so the scan flushes the working set out of an LRU cache.
+    {
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 100 * 100, CacheDiscardPolicy::lru_only);
+        EXPECT_EQ(0, replay(c));
+    }
+
+    // With segmented LRU, the scan displaces only entries in probation.
+    {
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 100 * 100, CacheDiscardPolicy::segmented_lru);
+        EXPECT_EQ(50, replay(c));
+        EXPECT_LE(c.size_in_bytes(), 100 * 100);
+        EXPECT_LT(0, c.stats().lru_evictions());
+    }
+
+    {
+        // The working set is still protected after re-opening the cache.
+        PersistentStringCacheImpl c(TEST_DB, 100 * 100, CacheDiscardPolicy::segmented_lru);
+        for (int i = 0; i < 1000; ++i)
+        {
+            access(c, "scan2_" + to_string(i));
+        }
+        int hits = 0;
+        for (int i = 0; i < 50; ++i)
+        {
+            hits += access(c, "hot" + to_string(i));
+        }
+        EXPECT_EQ(50, hits);
+
+        // Once probation is empty, entries are evicted from the protected segment.
+        string const big(100 * 100 - 10, 'y');
+        c.put("big", big);
+        EXPECT_EQ(1, c.size());
+        string v;
+        EXPECT_TRUE(c.get("big", v));
+
+        c.invalidate();
+        EXPECT_EQ(0, c.size());
+        EXPECT_EQ(50, replay(c));
+    }
+
+    {
+        // If the protected segment is smaller than the working set, the least recently
+        // used entries of the working set are moved back to probation, where the scan evicts them.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.protected_fraction = 0.1;
+        PersistentStringCacheImpl c(TEST_DB, 100 * 100, CacheDiscardPolicy::segmented_lru, options);
+        auto hits = replay(c);
+        EXPECT_LT(0, hits);
+        EXPECT_GE(10, hits);
+    }
+
+    {
+        // Hits served from memory and deferred access time updates also promote entries.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.memory_cache_size = 1000;
+        options.defer_access_time_updates = true;
+        PersistentStringCacheImpl c(TEST_DB, 100 * 100, CacheDiscardPolicy::segmented_lru, options);
+        EXPECT_EQ(50, replay(c));
+    }
+
+    unlink_db(TEST_DB);
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::segmented_lru);
+
+        // No expiry times with segmented_lru.
+        try
+        {
+            c.put("a", "x", chrono::system_clock::time_point(chrono::milliseconds(1)));
+            FAIL();
+        }
+        catch (logic_error const& e)
+        {
+            EXPECT_STREQ(("PersistentStringCache: put(): policy is segmented_lru, but expiry_time (1) is not infinite "
+                          "(cache_path: " +
+                          TEST_DB + ")").c_str(),
+                         e.what());
+        }
+    }
+
+    try
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::lru_only);
+        FAIL();
+    }
+    catch (logic_error const& e)
+    {
+        EXPECT_EQ(
+            "PersistentStringCache: existing cache opened with different policy (lru_only), "
+            "existing policy = segmented_lru (cache_path: " +
+            TEST_DB + ")",
+            e.what());
+    }
+
+    try
+    {
+        PersistentCacheOptions bad;
+        bad.protected_fraction = 0;
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::segmented_lru, bad);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_STREQ(("PersistentStringCache: invalid protected_fraction (0.000000): value must be > 0 and <= 1 "
+                      "(cache_path: " +
+                      TEST_DB + ")").c_str(),
+                     e.what());
+    }
+}
+
+TEST(PersistentStringCacheImpl, admission_filter)
+{
+    {
+        FrequencySketch sketch(10);
+        EXPECT_EQ(16, sketch.width());
+        EXPECT_EQ(0u, sketch.estimate("a"));
+        for (int i = 0; i < 20; ++i)
+        {
+            sketch.increment("a");
+        }
+        EXPECT_EQ(FrequencySketch::MAX_COUNT, sketch.estimate("a"));
+
+        FrequencySketch copy(16);
+        EXPECT_TRUE(copy.deserialize(sketch.serialize()));
+        EXPECT_EQ(FrequencySketch::MAX_COUNT, copy.estimate("a"));
+        FrequencySketch other_width(32);
+        EXPECT_FALSE(other_width.deserialize(sketch.serialize()));
+        EXPECT_EQ(0u, other_width.estimate("a"));
+
+        // After ten increments per counter in a row, the counters are halved.
+        for (int i = 0; i < 200; ++i)
+        {
+            sketch.increment("k" + to_string(i));
+        }
+        EXPECT_GT(FrequencySketch::MAX_COUNT, sketch.estimate("a"));
+        EXPECT_LE(FrequencySketch::MAX_COUNT / 2, sketch.estimate("a"));
+    }
+
+    string const value(95, 'x');  // Room for ten entries in the cache.
+    string v;
+
+    unlink_db(TEST_DB);
+
+    PersistentCacheOptions options;
+    options.admission_filter = true;
+    options.admission_sketch_size = 1024;
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, options);
+        for (int i = 0; i < 10; ++i)
+        {
+            EXPECT_TRUE(c.put("hot" + to_string(i), value));
+            for (int j = 0; j < 3; ++j)
+            {
+                EXPECT_TRUE(c.get("hot" + to_string(i), v));
+            }
+        }
+        EXPECT_EQ(10, c.size());
+
+        // A key that wasn't accessed before loses against the entries it would evict.
+        EXPECT_FALSE(c.put("cold", value));
+        EXPECT_EQ(1, c.stats().rejected_puts());
+        EXPECT_FALSE(c.get("cold", v));
+        for (int i = 0; i < 10; ++i)
+        {
+            EXPECT_TRUE(c.get("hot" + to_string(i), v));
+        }
+
+        // A key that is requested often enough gets in.
+        for (int i = 0; i < 10; ++i)
+        {
+            EXPECT_FALSE(c.get("popular", v));
+        }
+        EXPECT_TRUE(c.put("popular", value));
+        EXPECT_TRUE(c.get("popular", v));
+        EXPECT_EQ(10, c.size());
+        EXPECT_EQ(1, c.stats().rejected_puts());
+
+        // Updates are not filtered.
+        EXPECT_TRUE(c.put("popular", value));
+        EXPECT_EQ(1, c.stats().rejected_puts());
+    }
+
+    {
+        // The frequencies survive a restart.
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, options);
+        EXPECT_FALSE(c.put("cold2", value));
+        EXPECT_EQ(2, c.stats().rejected_puts());
+        c.clear_stats();
+        EXPECT_EQ(0, c.stats().rejected_puts());
+    }
+
+    {
+        // The sketch is also saved in the background, so the frequencies survive a crash. We simulate
+        // the crash by copying the files of the open cache, which still has its dirty flag set.
+        namespace fs = boost::filesystem;
+        string const crash_db = TEST_DIR "/crash_db";
+        fs::remove_all(crash_db);
+        fs::create_directory(crash_db);
+        unlink_db(TEST_DB);
+
+        PersistentCacheOptions o = options;
+        o.admission_sketch_save_interval = chrono::milliseconds(10);
+        {
+            PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, o);
+            for (int i = 0; i < 10; ++i)
+            {
+                EXPECT_TRUE(c.put("hot" + to_string(i), value));
+                EXPECT_TRUE(c.get("hot" + to_string(i), v));
+            }
+            this_thread::sleep_for(chrono::milliseconds(200));
+            for (fs::directory_iterator end, it(TEST_DB); it != end; ++it)
+            {
+                fs::copy_file(it->path(), crash_db + "/" + it->path().filename().string());
+            }
+        }
+
+        {
+            PersistentStringCacheImpl c(crash_db, 1000, CacheDiscardPolicy::lru_only, o);
+            EXPECT_EQ(10, c.size());
+            EXPECT_FALSE(c.put("cold", value));
+            EXPECT_EQ(1, c.stats().rejected_puts());
+        }
+        fs::remove_all(crash_db);
+    }
+
+    {
+        // Without the filter, every put is admitted.
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only);
+        for (int i = 0; i < 10; ++i)
+        {
+            EXPECT_TRUE(c.put("hot" + to_string(i), value));
+            EXPECT_TRUE(c.get("hot" + to_string(i), v));
+        }
+        EXPECT_TRUE(c.put("cold", value));
+        EXPECT_EQ(0, c.stats().rejected_puts());
+    }
+
+    try
+    {
+        PersistentCacheOptions bad;
+        bad.admission_sketch_size = 0;
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, bad);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_STREQ(("PersistentStringCache: invalid admission_sketch_size (0): value must be > 0 (cache_path: " +
+                      TEST_DB + ")").c_str(),
+                     e.what());
+    }
+
+    try
+    {
+        PersistentCacheOptions bad;
+        bad.admission_sketch_save_interval = chrono::milliseconds(-1);
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, bad);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_STREQ(("PersistentStringCache: invalid admission_sketch_save_interval (-1): value must be >= 0 "
+                      "(cache_path: " + TEST_DB + ")").c_str(),
+                     e.what());
+    }
+}
+
+TEST(PersistentStringCacheImpl, gdsf)
+{
+    string const small(96, 's');  // With a key of four or five bytes, a small entry takes about 100 bytes.
+    string const large(1995, 'l');  // A large entry takes about 2000 bytes.
+
+    auto put = [](PersistentStringCacheImpl& c, string const& key, string const& value, double cost)
+    {
+        return c.put(key, value.data(), value.size(), nullptr, 0, chrono::system_clock::time_point(), cost);
+    };
+
+    // Adds ten small entries that are expensive to re-create, followed by a stream of large entries that
+    // are cheap to re-create. Returns the number of small entries that are still in the cache.
+    auto replay = [&](PersistentStringCacheImpl& c)
+    {
+        for (int i = 0; i < 10; ++i)
+        {
+            put(c, "s" + to_string(i), small, 100);
+        }
+        for (int i = 0; i < 100; ++i)
+        {
+            put(c, "l" + to_string(i), large, 1);
+        }
+        int64_t count = 0;
+        for (int i = 0; i < 10; ++i)
+        {
+            count += c.contains_key("s" + to_string(i));
+        }
+        return count;
+    };
+
+    // The cache has room for about five large entries, so the large entries flush the small ones
+    // out of an LRU cache.
+    {
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 10000, CacheDiscardPolicy::lru_only);
+        EXPECT_EQ(0, replay(c));
+    }
+
+    // With gdsf, the small entries have a much higher priority than the large ones.
+    {
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 10000, CacheDiscardPolicy::gdsf);
+        EXPECT_EQ(10, replay(c));
+        EXPECT_LE(c.size_in_bytes(), 10000);
+        EXPECT_LT(0, c.stats().lru_evictions());
+        EXPECT_EQ(CacheDiscardPolicy::gdsf, c.discard_policy());
+        EXPECT_EQ(CacheDiscardPolicy::gdsf, c.stats().policy());
+    }
+
+    {
+        // The weights survive re-opening the cache.
+        PersistentStringCacheImpl c(TEST_DB, 10000, CacheDiscardPolicy::gdsf);
+        for (int i = 100; i < 200; ++i)
+        {
+            put(c, "l" + to_string(i), large, 1);
+        }
+        for (int i = 0; i < 10; ++i)
+        {
+            EXPECT_TRUE(c.contains_key("s" + to_string(i)));
+        }
+    }
+
+    {
+        // With equal cost and size, the entry that is accessed more often wins.
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 10000, CacheDiscardPolicy::gdsf);
+        string v;
+        put(c, "l_hot", large, 1);
+        for (int i = 0; i < 3; ++i)
+        {
+            EXPECT_TRUE(c.get("l_hot", v));
+        }
+        put(c, "l_cold", large, 1);
+        for (int i = 0; i < 4; ++i)
+        {
+            put(c, "l" + to_string(i), large, 1);
+        }
+        EXPECT_TRUE(c.contains_key("l_hot"));
+        EXPECT_FALSE(c.contains_key("l_cold"));
+
+        // put_metadata() and touch() keep the entry in the cache.
+        EXPECT_TRUE(c.put_metadata("l_hot", "meta"));
+        EXPECT_TRUE(c.touch("l_hot"));
+        EXPECT_TRUE(c.get("l_hot", v, nullptr));
+        EXPECT_EQ(large, v);
+    }
+
+    {
+        // Eviction advances the clock, so an expensive entry that is never accessed again ages out eventually.
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 10000, CacheDiscardPolicy::gdsf);
+        put(c, "s0", small, 1);
+        int i = 0;
+        while (c.contains_key("s0") && i < 1000)
+        {
+            put(c, "l" + to_string(i++), large, 1);
+        }
+        EXPECT_FALSE(c.contains_key("s0"));
+        EXPECT_LT(5, i);  // The small entry outlives several large ones.
+    }
+
+    {
+        // Hits served from memory and deferred access time updates also count.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.memory_cache_size = 10000;
+        options.defer_access_time_updates = true;
+        PersistentStringCacheImpl c(TEST_DB, 10000, CacheDiscardPolicy::gdsf, options);
+        EXPECT_EQ(10, replay(c));
+
+        string v;
+        put(c, "l_hot", large, 1);
+        EXPECT_TRUE(c.get("l_hot", v));
+        put(c, "l_cold", large, 1);
+        for (int i = 0; i < 4; ++i)
+        {
+            put(c, "x" + to_string(i), large, 1);
+        }
+        EXPECT_TRUE(c.contains_key("l_hot"));
+        EXPECT_FALSE(c.contains_key("l_cold"));
+    }
+
+    unlink_db(TEST_DB);
+
+    {
+        PersistentStringCacheImpl c(TEST_DB, 1024, CacheDiscardPolicy::gdsf);
+
+        // No expiry times with gdsf.
+        try
+        {
+            c.put("a", "x", chrono::system_clock::time_point(chrono::milliseconds(1)));
+            FAIL();
+        }
+        catch (logic_error const& e)
+        {
+            EXPECT_STREQ(("PersistentStringCache: put(): policy is gdsf, but expiry_time (1) is not infinite "
+                          "(cache_path: " +
+                          TEST_DB + ")").c_str(),
+                         e.what());
+        }
+
+        try
+        {
+            put(c, "a", "x", 0);
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_STREQ(("PersistentStringCache: put(): invalid cost (0.000000): value must be > 0 and finite "
+                          "(cache_path: " +
+                          TEST_DB + ")").c_str(),
+                         e.what());
+        }
+        EXPECT_THROW(put(c, "a", "x", numeric_limits<double>::infinity()), invalid_argument);
+        EXPECT_THROW(put(c, "a", "x", numeric_limits<double>::quiet_NaN()), invalid_argument);
+        EXPECT_EQ(0, c.size());
+    }
+}
+
+TEST(PersistentStringCacheImpl, durability)
+{
+    typedef PersistentCacheStats::Operation Op;
+
+    {
+        // Without durability, commit() doesn't sync.
+        unlink_db(TEST_DB);
+        PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only);
+        EXPECT_TRUE(c.put("a", "1"));
+        c.commit();
+        EXPECT_EQ(0, c.stats().num_operations(Op::sync));
+    }
+
+    {
+        // With sync durability, each commit() syncs.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.durability = CacheDurability::sync;
+        PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only, options);
+        EXPECT_TRUE(c.put("a", "1"));
+        c.commit();
+        EXPECT_EQ(1, c.stats().num_operations(Op::sync));
+        EXPECT_TRUE(c.invalidate("a"));
+        c.commit();
+        EXPECT_EQ(2, c.stats().num_operations(Op::sync));
+
+        // Concurrent commits share syncs.
+        int const num_threads = 8;
+        int const num_puts = 50;
+        vector<thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+        {
+            threads.emplace_back([&c, t]
+            {
+                for (int i = 0; i < num_puts; ++i)
+                {
+                    c.put(to_string(t) + "_" + to_string(i), "x");
+                    c.commit();
+                }
+            });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        EXPECT_EQ(num_threads * num_puts, c.size());
+        auto syncs = c.stats().num_operations(Op::sync);
+        EXPECT_LT(2, syncs);
+        EXPECT_GT(2 + num_threads * num_puts, syncs);  // Fewer syncs than commits.
+    }
+
+    {
+        // With a small write buffer, leveldb switches logs many times. The logs it closes are synced, too,
+        // so the entries written to them are still there.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.durability = CacheDurability::sync;
+        options.write_buffer_size = 64 * 1024;
+        string const value(1000, 'x');
+        {
+            PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, options);
+            for (int i = 0; i < 500; ++i)
+            {
+                EXPECT_TRUE(c.put(to_string(i), value));
+                c.commit();
+            }
+        }
+        PersistentStringCacheImpl c(TEST_DB, 1024 * 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(500, c.size());
+        string v;
+        EXPECT_TRUE(c.get("0", v));
+    }
+
+    {
+        // With periodic durability, the background thread syncs.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.durability = CacheDurability::periodic;
+        options.sync_interval = chrono::milliseconds(10);
+        PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only, options);
+        EXPECT_TRUE(c.put("a", "1"));
+        c.commit();  // No-op for periodic.
+        auto start = chrono::steady_clock::now();
+        while (c.stats().num_operations(Op::sync) < 2 && chrono::steady_clock::now() - start < chrono::seconds(10))
+        {
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+        EXPECT_LE(2, c.stats().num_operations(Op::sync));
+    }
+
+    {
+        // The cache syncs when it is closed.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.durability = CacheDurability::periodic;
+        options.sync_interval = chrono::hours(1);
+        {
+            PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only, options);
+            EXPECT_TRUE(c.put("a", "1"));
+            EXPECT_EQ(0, c.stats().num_operations(Op::sync));
+        }
+        PersistentStringCacheImpl c(TEST_DB);
+        EXPECT_TRUE(c.contains_key("a"));
+    }
+
+    try
+    {
+        PersistentCacheOptions bad;
+        bad.durability = CacheDurability::periodic;
+        bad.sync_interval = chrono::milliseconds(0);
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, bad);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_STREQ(("PersistentStringCache: invalid sync_interval (0): value must be > 0 (cache_path: " +
+                      TEST_DB + ")").c_str(),
+                     e.what());
+    }
+}
+
+TEST(PersistentStringCacheImpl, write_behind)
+{
+    {
+        // Staged entries are visible, but are written only by flush().
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.write_behind = true;
+        options.write_behind_interval = chrono::hours(1);
+        PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only, options);
+
+        int puts = 0;
+        c.set_handler(CacheEvent::put, [&puts](string const&, CacheEvent, PersistentCacheStats const&) { ++puts; });
+
+        EXPECT_TRUE(c.put("a", "1"));
+        string md = "m";
+        EXPECT_TRUE(c.put("b", "2", &md));
+        EXPECT_TRUE(c.put("a", "3"));
+        EXPECT_EQ(0, c.size());
+        EXPECT_EQ(0, puts);
+
+        string val;
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ("3", val);
+        string metadata;
+        EXPECT_FALSE(c.get_metadata("a", metadata));
+        EXPECT_TRUE(c.get_metadata("b", metadata));
+        EXPECT_EQ("m", metadata);
+        EXPECT_TRUE(c.contains_key("b"));
+        EXPECT_FALSE(c.contains_key("c"));
+        PersistentStringCache::View view;
+        EXPECT_TRUE(c.get_view("b", view));
+        EXPECT_EQ("2", string(view.data(), view.size()));
+
+        c.flush();
+        EXPECT_EQ(2, c.size());
+        EXPECT_EQ(2, puts);
+        EXPECT_EQ("2", string(view.data(), view.size()));  // View still refers to the staged data.
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ("3", val);
+
+        // A staged entry supersedes the entry on disk.
+        EXPECT_TRUE(c.put("a", "4"));
+        EXPECT_TRUE(c.get("a", val));
+        EXPECT_EQ("4", val);
+
+        // take() writes the staged entry first.
+        EXPECT_TRUE(c.take("a", val));
+        EXPECT_EQ("4", val);
+        EXPECT_FALSE(c.contains_key("a"));
+        EXPECT_EQ(1, c.size());
+
+        // invalidate() discards staged entries.
+        EXPECT_TRUE(c.put("c", "5"));
+        EXPECT_TRUE(c.invalidate("c"));
+        EXPECT_FALSE(c.invalidate("c"));
+        EXPECT_TRUE(c.put("b", "6"));
+        EXPECT_TRUE(c.invalidate("b"));
+        EXPECT_FALSE(c.contains_key("b"));
+        EXPECT_TRUE(c.put("d", "7"));
+        c.invalidate();
+        c.flush();
+        EXPECT_EQ(0, c.size());
+
+        // put_many() writes the staged entries first, so its entries win.
+        EXPECT_TRUE(c.put("e", "8"));
+        string e = "e";
+        string nine = "9";
+        EXPECT_TRUE(c.put_many({{&e, &nine, nullptr}}, chrono::system_clock::time_point()));
+        EXPECT_EQ(1, c.size());
+        EXPECT_TRUE(c.get("e", val));
+        EXPECT_EQ("9", val);
+    }
+
+    {
+        // Staged entries are written once they reach write_behind_max_bytes.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.write_behind = true;
+        options.write_behind_interval = chrono::hours(1);
+        options.write_behind_max_bytes = 10;
+        PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only, options);
+        EXPECT_TRUE(c.put("a", "1234"));
+        EXPECT_EQ(0, c.size());
+        EXPECT_TRUE(c.put("b", "5678"));
+        EXPECT_EQ(2, c.size());
+    }
+
+    {
+        // If the cache is smaller than write_behind_max_bytes, staged entries are written once they fill the cache.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.write_behind = true;
+        options.write_behind_interval = chrono::hours(1);
+        PersistentStringCacheImpl c(TEST_DB, 20, CacheDiscardPolicy::lru_only, options);
+        EXPECT_TRUE(c.put("a", "123456789"));
+        EXPECT_EQ(0, c.size());
+        EXPECT_TRUE(c.put("b", "123456789"));
+        EXPECT_EQ(2, c.size());
+        EXPECT_EQ(20, c.size_in_bytes());
+    }
+
+    {
+        // Staged entries count towards the eviction watermarks.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.write_behind = true;
+        options.write_behind_interval = chrono::hours(1);
+        options.eviction_high_watermark = 0.5;
+        options.eviction_low_watermark = 0.25;
+        PersistentStringCacheImpl c(TEST_DB, 100, CacheDiscardPolicy::lru_only, options);
+        for (int i = 0; i < 4; ++i)
+        {
+            EXPECT_TRUE(c.put(to_string(i), "123456789"));
+        }
+        c.flush();
+        EXPECT_EQ(4, c.size());
+        EXPECT_TRUE(c.put("a", "123456789"));
+        EXPECT_TRUE(c.put("b", "123456789"));
+        auto start = chrono::steady_clock::now();
+        while (c.size() != 0 && chrono::steady_clock::now() - start < chrono::seconds(10))
+        {
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+        EXPECT_EQ(0, c.size());
+        c.flush();
+        EXPECT_EQ(2, c.size());
+    }
+
+    {
+        // The background thread writes the staged entries.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.write_behind = true;
+        options.write_behind_interval = chrono::milliseconds(10);
+        PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only, options);
+        EXPECT_TRUE(c.put("a", "1"));
+        auto start = chrono::steady_clock::now();
+        while (c.size() == 0 && chrono::steady_clock::now() - start < chrono::seconds(10))
+        {
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+        EXPECT_EQ(1, c.size());
+    }
+
+    {
+        // Closing the cache writes the staged entries.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.write_behind = true;
+        options.write_behind_interval = chrono::hours(1);
+        {
+            PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_only, options);
+            EXPECT_TRUE(c.put("a", "1"));
+            EXPECT_EQ(0, c.size());
+        }
+        PersistentStringCacheImpl c(TEST_DB);
+        EXPECT_EQ(1, c.size());
+        EXPECT_TRUE(c.contains_key("a"));
+    }
+
+    {
+        // Staged entries that expire are not written.
+        unlink_db(TEST_DB);
+        PersistentCacheOptions options;
+        options.write_behind = true;
+        options.write_behind_interval = chrono::hours(1);
+        PersistentStringCacheImpl c(TEST_DB, 100000, CacheDiscardPolicy::lru_ttl, options);
+        EXPECT_TRUE(c.put("a", "1"));
+        EXPECT_TRUE(c.put("b", "2", chrono::system_clock::now() + chrono::milliseconds(50)));
+        this_thread::sleep_for(chrono::milliseconds(100));
+        string val;
+        EXPECT_FALSE(c.get("b", val));
+        EXPECT_FALSE(c.contains_key("b"));
+        c.flush();
+        EXPECT_EQ(1, c.size());
+        EXPECT_FALSE(c.contains_key("b"));
+
+        // The entry that an expired staged entry replaces is removed, too.
+        EXPECT_TRUE(c.put("c", "3"));
+        c.flush();
+        EXPECT_EQ(2, c.size());
+        EXPECT_TRUE(c.put("c", "4", chrono::system_clock::now() + chrono::milliseconds(50)));
+        this_thread::sleep_for(chrono::milliseconds(100));
+        c.flush();
+        EXPECT_FALSE(c.get("c", val));
+        EXPECT_FALSE(c.contains_key("c"));
+        EXPECT_EQ(1, c.size());
+    }
+
+    try
+    {
+        PersistentCacheOptions bad;
+        bad.write_behind = true;
+        bad.write_behind_interval = chrono::milliseconds(0);
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, bad);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_STREQ(("PersistentStringCache: invalid write_behind_interval (0): value must be > 0 (cache_path: " +
+                      TEST_DB + ")").c_str(),
+                     e.what());
+    }
+
+    try
+    {
+        PersistentCacheOptions bad;
+        bad.write_behind = true;
+        bad.write_behind_max_bytes = 0;
+        PersistentStringCacheImpl c(TEST_DB, 1000, CacheDiscardPolicy::lru_only, bad);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_STREQ(("PersistentStringCache: invalid write_behind_max_bytes (0): value must be > 0 (cache_path: " +
+                      TEST_DB + ")").c_str(),
+                     e.what());
+    }
+}
@@ -84,6 +84,42 @@ char CacheCodec<char>::decode(string const& s)
 
 }  // namespace core
 
+// Type with a buffer codec that counts how often it is called.
+
+struct Point
+{
+    int x;
+    int y;
+};
+
+int num_encode_to = 0;
+int num_decode_from = 0;
+
+namespace core
+{
+
+template <>
+struct CacheCodec<Point>
+{
+    static void encode_to(Point const& p, string& buf)
+    {
+        ++num_encode_to;
+        buf += to_string(p.x) + "," + to_string(p.y);
+    }
+
+    static Point decode_from(char const* data, size_t size)
+    {
+        ++num_decode_from;
+        string s(data, size);
+        auto pos = s.find(',');
+        return Point{stoi(s.substr(0, pos)), stoi(s.substr(pos + 1))};
+    }
+};
+
+}  // namespace core
+
+static_assert(internal::HasBufferCodec<Point>::value, "Point must have a buffer codec");
+
 TEST(PersistentCache, IDCCache)
 {
     unlink_db(test_db);
@@ -105,6 +141,14 @@ TEST(PersistentCache, IDCCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = IDCCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = IDCCache::open(test_db);
 
@@ -150,11 +194,29 @@ TEST(PersistentCache, IDCCache)
         EXPECT_EQ('\0', data->metadata);
 
         EXPECT_TRUE(c->put(2, 3, '4'));
+        auto values = c->get_many({2, 42});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(3, *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({42, 2});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(3, data_many[1]->value);
+        EXPECT_EQ('4', data_many[1]->metadata);
         data = c->take_data(2);
         EXPECT_TRUE(bool(data));
         EXPECT_EQ(3, data->value);
         EXPECT_EQ('4', data->metadata);
 
+        EXPECT_TRUE(c->put_many({{5, 6}, {7, 8}}));
+        EXPECT_EQ(6, *c->get(5));
+        EXPECT_EQ(8, *c->get(7));
+        EXPECT_TRUE(c->put_many({{5, IDCCache::Data{9, '1'}}}));
+        data = c->take_data(5);
+        EXPECT_EQ(9, data->value);
+        EXPECT_EQ('1', data->metadata);
+        EXPECT_TRUE(c->invalidate(7));
+
         EXPECT_TRUE(c->put(1, 2, '3'));
         EXPECT_TRUE(c->put_metadata(1, '3'));
         data = c->take_data(1);
@@ -271,6 +333,14 @@ TEST(PersistentCache, SDCCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = SDCCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = SDCCache::open(test_db);
 
@@ -316,11 +386,29 @@ TEST(PersistentCache, SDCCache)
         EXPECT_EQ('\0', data->metadata);
 
         EXPECT_TRUE(c->put("2", 3, '4'));
+        auto values = c->get_many({"2", "42"});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(3, *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({"42", "2"});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(3, data_many[1]->value);
+        EXPECT_EQ('4', data_many[1]->metadata);
         data = c->take_data("2");
         EXPECT_TRUE(bool(data));
         EXPECT_EQ(3, data->value);
         EXPECT_EQ('4', data->metadata);
 
+        EXPECT_TRUE(c->put_many({{"5", 6}, {"7", 8}}));
+        EXPECT_EQ(6, *c->get("5"));
+        EXPECT_EQ(8, *c->get("7"));
+        EXPECT_TRUE(c->put_many({{"5", SDCCache::Data{9, '1'}}}));
+        data = c->take_data("5");
+        EXPECT_EQ(9, data->value);
+        EXPECT_EQ('1', data->metadata);
+        EXPECT_TRUE(c->invalidate("7"));
+
         EXPECT_TRUE(c->put("1", 2, '3'));
         EXPECT_TRUE(c->put_metadata("1", '3'));
         data = c->take_data("1");
@@ -416,6 +504,14 @@ TEST(PersistentCache, ISCCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = ISCCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = ISCCache::open(test_db);
 
@@ -461,11 +557,29 @@ TEST(PersistentCache, ISCCache)
         EXPECT_EQ('\0', data->metadata);
 
         EXPECT_TRUE(c->put(2, string("3"), '4'));
+        auto values = c->get_many({2, 42});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(string("3"), *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({42, 2});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(string("3"), data_many[1]->value);
+        EXPECT_EQ('4', data_many[1]->metadata);
         data = c->take_data(2);
         EXPECT_TRUE(bool(data));
         EXPECT_EQ("3", data->value);
         EXPECT_EQ('4', data->metadata);
 
+        EXPECT_TRUE(c->put_many({{5, string("6")}, {7, string("8")}}));
+        EXPECT_EQ(string("6"), *c->get(5));
+        EXPECT_EQ(string("8"), *c->get(7));
+        EXPECT_TRUE(c->put_many({{5, ISCCache::Data{string("9"), '1'}}}));
+        data = c->take_data(5);
+        EXPECT_EQ(string("9"), data->value);
+        EXPECT_EQ('1', data->metadata);
+        EXPECT_TRUE(c->invalidate(7));
+
         EXPECT_TRUE(c->put(1, string("2"), '3'));
         EXPECT_TRUE(c->put_metadata(1, '3'));
         data = c->take_data(1);
@@ -575,6 +689,14 @@ TEST(PersistentCache, IDSCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = IDSCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = IDSCache::open(test_db);
 
@@ -620,11 +742,29 @@ TEST(PersistentCache, IDSCache)
         EXPECT_EQ("\0", data->metadata);
 
         EXPECT_TRUE(c->put(2, 3, "4"));
+        auto values = c->get_many({2, 42});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(3, *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({42, 2});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(3, data_many[1]->value);
+        EXPECT_EQ("4", data_many[1]->metadata);
         data = c->take_data(2);
         EXPECT_TRUE(bool(data));
         EXPECT_EQ(3, data->value);
         EXPECT_EQ("4", data->metadata);
 
+        EXPECT_TRUE(c->put_many({{5, 6}, {7, 8}}));
+        EXPECT_EQ(6, *c->get(5));
+        EXPECT_EQ(8, *c->get(7));
+        EXPECT_TRUE(c->put_many({{5, IDSCache::Data{9, "1"}}}));
+        data = c->take_data(5);
+        EXPECT_EQ(9, data->value);
+        EXPECT_EQ("1", data->metadata);
+        EXPECT_TRUE(c->invalidate(7));
+
         EXPECT_TRUE(c->put(1, 2, "3"));
         EXPECT_TRUE(c->put_metadata(1, "3"));
         data = c->take_data(1);
@@ -734,6 +874,14 @@ TEST(PersistentCache, SSCCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = SSCCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = SSCCache::open(test_db);
 
@@ -779,11 +927,29 @@ TEST(PersistentCache, SSCCache)
         EXPECT_EQ('\0', data->metadata);
 
         EXPECT_TRUE(c->put("2", string("3"), '4'));
+        auto values = c->get_many({"2", "42"});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(string("3"), *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({"42", "2"});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(string("3"), data_many[1]->value);
+        EXPECT_EQ('4', data_many[1]->metadata);
         data = c->take_data("2");
         EXPECT_TRUE(bool(data));
         EXPECT_EQ("3", data->value);
         EXPECT_EQ('4', data->metadata);
 
+        EXPECT_TRUE(c->put_many({{"5", string("6")}, {"7", string("8")}}));
+        EXPECT_EQ(string("6"), *c->get("5"));
+        EXPECT_EQ(string("8"), *c->get("7"));
+        EXPECT_TRUE(c->put_many({{"5", SSCCache::Data{string("9"), '1'}}}));
+        data = c->take_data("5");
+        EXPECT_EQ(string("9"), data->value);
+        EXPECT_EQ('1', data->metadata);
+        EXPECT_TRUE(c->invalidate("7"));
+
         EXPECT_TRUE(c->put("1", string("2"), '3'));
         EXPECT_TRUE(c->put_metadata("1", '3'));
         data = c->take_data("1");
@@ -893,6 +1059,14 @@ TEST(PersistentCache, SDSCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = SDSCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = SDSCache::open(test_db);
 
@@ -938,11 +1112,29 @@ TEST(PersistentCache, SDSCache)
         EXPECT_EQ("", data->metadata);
 
         EXPECT_TRUE(c->put("2", 3, "4"));
+        auto values = c->get_many({"2", "42"});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(3, *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({"42", "2"});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(3, data_many[1]->value);
+        EXPECT_EQ("4", data_many[1]->metadata);
         data = c->take_data("2");
         EXPECT_TRUE(bool(data));
         EXPECT_EQ(3, data->value);
         EXPECT_EQ("4", data->metadata);
 
+        EXPECT_TRUE(c->put_many({{"5", 6}, {"7", 8}}));
+        EXPECT_EQ(6, *c->get("5"));
+        EXPECT_EQ(8, *c->get("7"));
+        EXPECT_TRUE(c->put_many({{"5", SDSCache::Data{9, "1"}}}));
+        data = c->take_data("5");
+        EXPECT_EQ(9, data->value);
+        EXPECT_EQ("1", data->metadata);
+        EXPECT_TRUE(c->invalidate("7"));
+
         EXPECT_TRUE(c->put("1", 2, "3"));
         EXPECT_TRUE(c->put_metadata("1", "3"));
         data = c->take_data("1");
@@ -1052,6 +1244,14 @@ TEST(PersistentCache, ISSCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = ISSCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = ISSCache::open(test_db);
 
@@ -1097,11 +1297,29 @@ TEST(PersistentCache, ISSCache)
         EXPECT_EQ("\0", data->metadata);
 
         EXPECT_TRUE(c->put(2, string("3"), "4"));
+        auto values = c->get_many({2, 42});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(string("3"), *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({42, 2});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(string("3"), data_many[1]->value);
+        EXPECT_EQ("4", data_many[1]->metadata);
         data = c->take_data(2);
         EXPECT_TRUE(bool(data));
         EXPECT_EQ("3", data->value);
         EXPECT_EQ("4", data->metadata);
 
+        EXPECT_TRUE(c->put_many({{5, string("6")}, {7, string("8")}}));
+        EXPECT_EQ(string("6"), *c->get(5));
+        EXPECT_EQ(string("8"), *c->get(7));
+        EXPECT_TRUE(c->put_many({{5, ISSCache::Data{string("9"), "1"}}}));
+        data = c->take_data(5);
+        EXPECT_EQ(string("9"), data->value);
+        EXPECT_EQ("1", data->metadata);
+        EXPECT_TRUE(c->invalidate(7));
+
         EXPECT_TRUE(c->put(1, string("2"), "3"));
         EXPECT_TRUE(c->put_metadata(1, "3"));
         data = c->take_data(1);
@@ -1218,6 +1436,14 @@ TEST(PersistentCache, SSSCache)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = SSSCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     {
         auto c = SSSCache::open(test_db);
 
@@ -1263,11 +1489,29 @@ TEST(PersistentCache, SSSCache)
         EXPECT_EQ("", data->metadata);
 
         EXPECT_TRUE(c->put("2", string("3"), "4"));
+        auto values = c->get_many({"2", "42"});
+        ASSERT_EQ(2u, values.size());
+        EXPECT_EQ(string("3"), *values[0]);
+        EXPECT_FALSE(values[1]);
+        auto data_many = c->get_data_many({"42", "2"});
+        ASSERT_EQ(2u, data_many.size());
+        EXPECT_FALSE(data_many[0]);
+        EXPECT_EQ(string("3"), data_many[1]->value);
+        EXPECT_EQ("4", data_many[1]->metadata);
         data = c->take_data("2");
         EXPECT_TRUE(bool(data));
         EXPECT_EQ("3", data->value);
         EXPECT_EQ("4", data->metadata);
 
+        EXPECT_TRUE(c->put_many({{"5", string("6")}, {"7", string("8")}}));
+        EXPECT_EQ(string("6"), *c->get("5"));
+        EXPECT_EQ(string("8"), *c->get("7"));
+        EXPECT_TRUE(c->put_many({{"5", SSSCache::Data{string("9"), "1"}}}));
+        data = c->take_data("5");
+        EXPECT_EQ(string("9"), data->value);
+        EXPECT_EQ("1", data->metadata);
+        EXPECT_TRUE(c->invalidate("7"));
+
         EXPECT_TRUE(c->put("1", string("2"), "3"));
         EXPECT_TRUE(c->put_metadata("1", "3"));
         data = c->take_data("1");
@@ -1360,3 +1604,223 @@ TEST(PersistentCache, SSSCache)
         EXPECT_EQ(mbuf, data->metadata);
     }
 }
+
+TEST(PersistentCache, BufferCodec)
+{
+    typedef PersistentCache<Point, Point, Point> PPPCache;
+    typedef PersistentCache<string, Point, string> SPSCache;
+
+    unlink_db(test_db);
+
+    {
+        auto c = PPPCache::open(test_db, 1024 * 1024, CacheDiscardPolicy::lru_only);
+
+        num_encode_to = 0;
+        num_decode_from = 0;
+        EXPECT_TRUE(c->put(Point{1, 2}, Point{3, 4}, Point{5, 6}));
+        EXPECT_EQ(3, num_encode_to);
+
+        auto v = c->get(Point{1, 2});
+        ASSERT_TRUE(bool(v));
+        EXPECT_EQ(3, v->x);
+        EXPECT_EQ(4, v->y);
+        EXPECT_EQ(4, num_encode_to);
+        EXPECT_EQ(1, num_decode_from);
+
+        auto d = c->get_data(Point{1, 2});
+        ASSERT_TRUE(bool(d));
+        EXPECT_EQ(3, d->value.x);
+        EXPECT_EQ(6, d->metadata.y);
+
+        EXPECT_FALSE(bool(c->get(Point{0, 0})));
+        EXPECT_FALSE(bool(c->get_data(Point{0, 0})));
+
+        // Nested calls from an event handler get their own buffers.
+        vector<int> keys;
+        c->set_handler(CacheEvent::put, [&](Point const& key, CacheEvent, PersistentCacheStats const&)
+                       {
+                           keys.push_back(key.x);
+                           if (key.x == 7)
+                           {
+                               c->put(Point{8, 8}, Point{9, 9});
+                           }
+                       });
+        EXPECT_TRUE(c->put(Point{7, 7}, Point{10, 11}));
+        EXPECT_EQ((vector<int>{7, 8}), keys);
+        EXPECT_EQ(10, c->get(Point{7, 7})->x);
+        EXPECT_EQ(9, c->get(Point{8, 8})->x);
+
+        auto many = c->get_many({Point{1, 2}, Point{0, 0}, Point{8, 8}});
+        ASSERT_EQ(3u, many.size());
+        EXPECT_EQ(3, many[0]->x);
+        EXPECT_FALSE(bool(many[1]));
+        EXPECT_EQ(9, many[2]->x);
+
+        auto t = c->take(Point{8, 8});
+        ASSERT_TRUE(bool(t));
+        EXPECT_EQ(9, t->y);
+        EXPECT_FALSE(c->contains_key(Point{8, 8}));
+    }
+
+    unlink_db(test_db);
+
+    {
+        auto c = SPSCache::open(test_db, 1024 * 1024, CacheDiscardPolicy::lru_only);
+
+        EXPECT_TRUE(c->put("a", Point{1, 2}, "meta"));
+        EXPECT_EQ(2, c->get("a")->y);
+        auto d = c->get_data("a");
+        ASSERT_TRUE(bool(d));
+        EXPECT_EQ(1, d->value.x);
+        EXPECT_EQ("meta", d->metadata);
+
+        EXPECT_TRUE(c->put("b", Point{3, 4}));
+        d = c->get_data("b");
+        ASSERT_TRUE(bool(d));
+        EXPECT_EQ("", d->metadata);
+    }
+}
+
+// Type without a custom codec that uses the built-in codec.
+
+struct Pod
+{
+    int64_t id;
+    int32_t score;
+    int16_t tag;
+    int16_t flags;
+};
+
+// Types whose encoding could differ for equal values have no built-in codec.
+
+struct Padded
+{
+    int64_t id;
+    char tag;
+};
+
+struct WithDouble
+{
+    double x;
+    double y;
+};
+
+enum class Color : int16_t
+{
+    red = -1,
+    green = 0,
+    blue = 1
+};
+
+static_assert(internal::HasOrderedCodec<int64_t>::value, "int64_t must have a built-in codec");
+static_assert(internal::HasRawCodec<double>::value, "double must have a built-in codec");
+static_assert(!internal::HasRawCodec<Padded>::value, "types with padding must not have a built-in codec");
+static_assert(!internal::HasRawCodec<WithDouble>::value, "structs with doubles must not have a built-in codec");
+static_assert(!internal::HasRawCodec<int*>::value, "pointers must not have a built-in codec");
+static_assert(!internal::HasRawCodec<string>::value, "string must not have a built-in codec");
+
+TEST(CacheCodec, builtin)
+{
+    // Round trips for various types.
+    EXPECT_EQ(-5, internal::Codec<int8_t>::decode(internal::Codec<int8_t>::encode(-5)));
+    EXPECT_EQ(60000, internal::Codec<uint16_t>::decode(internal::Codec<uint16_t>::encode(60000)));
+    EXPECT_EQ(INT64_MIN, internal::Codec<int64_t>::decode(internal::Codec<int64_t>::encode(INT64_MIN)));
+    EXPECT_EQ(UINT64_MAX, internal::Codec<uint64_t>::decode(internal::Codec<uint64_t>::encode(UINT64_MAX)));
+    EXPECT_TRUE(internal::Codec<bool>::decode(internal::Codec<bool>::encode(true)));
+    EXPECT_EQ(Color::red, internal::Codec<Color>::decode(internal::Codec<Color>::encode(Color::red)));
+    EXPECT_EQ(2.5f, internal::Codec<float>::decode(internal::Codec<float>::encode(2.5f)));
+    EXPECT_EQ(8u, internal::Codec<int64_t>::encode(1).size());
+    EXPECT_EQ(sizeof(Pod), internal::Codec<Pod>::encode(Pod{1, 2, 'x', 0}).size());
+
+    // A specialization takes priority over the built-in codec (see the specializations for int and double above).
+    EXPECT_EQ("42", internal::Codec<int>::encode(42));
+    EXPECT_EQ(2.5, internal::Codec<double>::decode("2.5"));
+
+    // Integer encodings sort in the same order as the values.
+    vector<int64_t> const ints{INT64_MIN, -1000, -1, 0, 1, 255, 256, 1000, INT64_MAX};
+    for (size_t i = 1; i < ints.size(); ++i)
+    {
+        EXPECT_LT(internal::Codec<int64_t>::encode(ints[i - 1]), internal::Codec<int64_t>::encode(ints[i]));
+    }
+    EXPECT_LT(internal::Codec<int8_t>::encode(-1), internal::Codec<int8_t>::encode(0));
+    EXPECT_LT(internal::Codec<uint32_t>::encode(255), internal::Codec<uint32_t>::encode(256));
+    EXPECT_LT(internal::Codec<Color>::encode(Color::red), internal::Codec<Color>::encode(Color::blue));
+    EXPECT_EQ(string("\x80\x01", 2), internal::Codec<int16_t>::encode(1));
+
+    // Empty input decodes to a value-initialized value.
+    EXPECT_EQ(0, internal::Codec<int16_t>::decode(""));
+    EXPECT_EQ(0, internal::Codec<Pod>::decode("").score);
+
+    try
+    {
+        internal::Codec<uint32_t>::decode("abc");
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_STREQ("CacheCodec: cannot decode 3 bytes into a value of size 4", e.what());
+    }
+    EXPECT_THROW(internal::Codec<Pod>::decode("x"), invalid_argument);
+
+    typedef PersistentCache<int64_t, Pod, Color> IPCCache;
+
+    unlink_db(test_db);
+    auto c = IPCCache::open(test_db, 1024 * 1024, CacheDiscardPolicy::lru_only);
+
+    EXPECT_TRUE(c->put(-1, Pod{-1, 5, 'a', 0}, Color::blue));
+    EXPECT_TRUE(c->put(42, Pod{42, 15, 'b', 0}));
+    auto d = c->get_data(-1);
+    ASSERT_TRUE(bool(d));
+    EXPECT_EQ(-1, d->value.id);
+    EXPECT_EQ(5, d->value.score);
+    EXPECT_EQ('a', d->value.tag);
+    EXPECT_EQ(Color::blue, d->metadata);
+    d = c->get_data(42);
+    ASSERT_TRUE(bool(d));
+    EXPECT_EQ(15, d->value.score);
+    EXPECT_EQ(Color::green, d->metadata);  // No metadata decodes to the value-initialized enumerator.
+    EXPECT_FALSE(bool(c->get(7)));
+}
+
+TEST(PersistentCache, batch_handler)
+{
+    typedef PersistentCache<int64_t, string> ISCache;
+    typedef PersistentCache<string, string> SSCache;
+
+    unlink_db(test_db);
+
+    {
+        auto c = ISCache::open(test_db, 1024 * 1024, CacheDiscardPolicy::lru_only);
+
+        ISCache::EventBatch events;
+        c->set_batch_handler(CacheEvent::put | CacheEvent::invalidate,
+                             [&](ISCache::EventBatch const& batch, PersistentCacheStats const&)
+                             {
+                                 events.insert(events.end(), batch.begin(), batch.end());
+                             });
+        c->put(-7, "x");
+        c->invalidate(-7);
+        ASSERT_EQ(2u, events.size());
+        EXPECT_EQ(make_pair(int64_t(-7), CacheEvent::put), events[0]);
+        EXPECT_EQ(make_pair(int64_t(-7), CacheEvent::invalidate), events[1]);
+
+        c->set_batch_handler(CacheEvent::put, nullptr);
+        c->put(1, "x");
+        EXPECT_EQ(2u, events.size());
+    }
+
+    unlink_db(test_db);
+
+    {
+        auto c = SSCache::open(test_db, 1024 * 1024, CacheDiscardPolicy::lru_only);
+
+        SSCache::EventBatch events;
+        c->set_batch_handler(CacheEvent::put, [&](SSCache::EventBatch const& batch, PersistentCacheStats const&)
+                             {
+                                 events.insert(events.end(), batch.begin(), batch.end());
+                             });
+        c->put("a", "x");
+        ASSERT_EQ(1u, events.size());
+        EXPECT_EQ("a", events[0].first);
+    }
+}
@@ -64,6 +64,14 @@ TEST(PersistentStringCache, basic)
         EXPECT_EQ(2048, c->max_size_in_bytes());
     }
 
+    {
+        // Constructor with options.
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = true;
+        auto c = PersistentStringCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        EXPECT_EQ(1024, c->max_size_in_bytes());
+    }
+
     // Tests below are cursory, simply calling each method once.
     // Note: get_or_put() is tested by PersistentStringCacheImpl_test.cpp.
     {
@@ -138,6 +146,8 @@ TEST(PersistentStringCache, stats)
         EXPECT_EQ(0, s.longest_miss_run());
         EXPECT_EQ(0, s.ttl_evictions());
         EXPECT_EQ(0, s.lru_evictions());
+        EXPECT_EQ(0, s.memory_hits());
+        EXPECT_EQ(0, s.memory_misses());
         EXPECT_EQ(chrono::system_clock::time_point(), s.most_recent_hit_time());
         EXPECT_EQ(chrono::system_clock::time_point(), s.most_recent_miss_time());
         EXPECT_EQ(chrono::system_clock::time_point(), s.longest_hit_run_time());
@@ -487,3 +497,457 @@ TEST(PersistentStringCache, stats)
         EXPECT_EQ(4, s.lru_evictions());
     }
 }
+
+TEST(PersistentStringCache, sharded)
+{
+    unlink_db(test_db);
+
+    PersistentCacheOptions options;
+    options.num_shards = 4;
+
+    {
+        auto c = PersistentStringCache::open(test_db, 4002, CacheDiscardPolicy::lru_ttl, options);
+        EXPECT_EQ(4002, c->max_size_in_bytes());
+        EXPECT_EQ(CacheDiscardPolicy::lru_ttl, c->discard_policy());
+
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_TRUE(c->put(to_string(i), string(i % 10 + 1, 'v')));
+        }
+        EXPECT_EQ(100, c->size());
+        for (int i = 0; i < 100; ++i)
+        {
+            auto val = c->get(to_string(i));
+            ASSERT_TRUE(bool(val));
+            EXPECT_EQ(string(i % 10 + 1, 'v'), *val);
+        }
+        EXPECT_FALSE(c->get("no such key"));
+
+        auto s = c->stats();
+        EXPECT_EQ(test_db, s.cache_path());
+        EXPECT_EQ(CacheDiscardPolicy::lru_ttl, s.policy());
+        EXPECT_EQ(100, s.size());
+        EXPECT_EQ(c->size_in_bytes(), s.size_in_bytes());
+        EXPECT_EQ(4002, s.max_size_in_bytes());
+        EXPECT_EQ(100, s.hits());
+        EXPECT_EQ(1, s.misses());
+        EXPECT_EQ(0, s.hits_since_last_miss());
+        EXPECT_EQ(1, s.misses_since_last_hit());
+        int64_t entries = 0;
+        for (auto count : s.histogram())
+        {
+            entries += count;
+        }
+        EXPECT_EQ(100, entries);
+
+        c->invalidate({"0", "1", "2", "3", "4", "5"});
+        EXPECT_EQ(94, c->size());
+        EXPECT_FALSE(c->contains_key("3"));
+        EXPECT_TRUE(c->contains_key("6"));
+
+        c->trim_to(100);
+        EXPECT_LE(c->size_in_bytes(), 100);
+        c->resize(2000);
+        EXPECT_EQ(2000, c->max_size_in_bytes());
+        c->clear_stats();
+        EXPECT_EQ(0, c->stats().hits());
+    }
+
+    {
+        // Reopen without options and check that all shards are found.
+        auto c = PersistentStringCache::open(test_db);
+        EXPECT_EQ(2000, c->max_size_in_bytes());
+        auto size = c->size();
+        EXPECT_GT(size, 0);
+        for (int i = 6; i < 100; ++i)
+        {
+            if (c->contains_key(to_string(i)))
+            {
+                --size;
+            }
+        }
+        EXPECT_EQ(0, size);
+
+        c->invalidate();
+        EXPECT_EQ(0, c->size());
+        EXPECT_EQ(0, c->size_in_bytes());
+    }
+
+    try
+    {
+        PersistentStringCache::open(test_db, 2000, CacheDiscardPolicy::lru_ttl);
+        FAIL();
+    }
+    catch (logic_error const& e)
+    {
+        EXPECT_EQ("PersistentStringCache: existing cache opened with different num_shards (1), "
+                  "existing num_shards = 4 (cache_path: " + test_db + ")",
+                  string(e.what()));
+    }
+
+    try
+    {
+        // Existing cache that isn't sharded.
+        PersistentStringCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only);
+        PersistentStringCache::open(test_db + "3", 1024, CacheDiscardPolicy::lru_only, options);
+        FAIL();
+    }
+    catch (logic_error const& e)
+    {
+        EXPECT_EQ("PersistentStringCache: existing cache opened with different num_shards (4), "
+                  "existing num_shards = 1 (cache_path: " + test_db + "3)",
+                  string(e.what()));
+    }
+
+    try
+    {
+        options.num_shards = 0;
+        PersistentStringCache::open(test_db + "4", 1000, CacheDiscardPolicy::lru_ttl, options);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_EQ("PersistentStringCache: invalid num_shards (0): value must be > 0 (cache_path: " + test_db + "4)",
+                  string(e.what()));
+    }
+
+    try
+    {
+        options.num_shards = 8;
+        PersistentStringCache::open(test_db + "4", 7, CacheDiscardPolicy::lru_ttl, options);
+        FAIL();
+    }
+    catch (invalid_argument const& e)
+    {
+        EXPECT_EQ("PersistentStringCache: invalid max_size_in_bytes (7): value must be >= num_shards (8) "
+                  "(cache_path: " + test_db + "4)",
+                  string(e.what()));
+    }
+}
+
+TEST(PersistentStringCache, get_many)
+{
+    for (int num_shards : {1, 3})
+    {
+        unlink_db(test_db);
+
+        PersistentCacheOptions options;
+        options.num_shards = num_shards;
+        auto c = PersistentStringCache::open(test_db, 10000, CacheDiscardPolicy::lru_only, options);
+
+        for (int i = 0; i < 20; ++i)
+        {
+            EXPECT_TRUE(c->put(to_string(i), "v" + to_string(i), "m" + to_string(i)));
+        }
+        EXPECT_TRUE(c->put("no metadata", "x"));
+        this_thread::sleep_for(chrono::milliseconds(2));  // Make sure the hits have a later access time.
+
+        auto values = c->get_many({"5", "no such key", "0", "19", "5", "no metadata"});
+        ASSERT_EQ(6u, values.size());
+        EXPECT_EQ("v5", *values[0]);
+        EXPECT_FALSE(values[1]);
+        EXPECT_EQ("v0", *values[2]);
+        EXPECT_EQ("v19", *values[3]);
+        EXPECT_EQ("v5", *values[4]);
+        EXPECT_EQ("x", *values[5]);
+
+        auto s = c->stats();
+        EXPECT_EQ(5, s.hits());
+        EXPECT_EQ(1, s.misses());
+
+        auto data = c->get_data_many({"no metadata", "7", "nothing"});
+        ASSERT_EQ(3u, data.size());
+        EXPECT_EQ("x", data[0]->value);
+        EXPECT_EQ("", data[0]->metadata);
+        EXPECT_EQ("v7", data[1]->value);
+        EXPECT_EQ("m7", data[1]->metadata);
+        EXPECT_FALSE(data[2]);
+
+        if (num_shards == 1)
+        {
+            // The hits update the access time, so the least recently used entry is one that was not read.
+            c->trim_to(c->size_in_bytes() - 1);
+            EXPECT_EQ(20, c->size());
+            EXPECT_TRUE(c->contains_key("0"));
+            EXPECT_FALSE(c->contains_key("1"));
+        }
+
+        EXPECT_TRUE(c->get_many({}).empty());
+
+        try
+        {
+            c->get_many({"1", ""});
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: get_many(): key must be non-empty (cache_path: " + test_db + ")",
+                      string(e.what()));
+        }
+    }
+}
+
+TEST(PersistentStringCache, put_many)
+{
+    for (int num_shards : {1, 3})
+    {
+        unlink_db(test_db);
+
+        PersistentCacheOptions options;
+        options.num_shards = num_shards;
+        auto c = PersistentStringCache::open(test_db, 10000, CacheDiscardPolicy::lru_only, options);
+
+        int num_puts = 0;
+        c->set_handler(CacheEvent::put, [&](string const&, CacheEvent, PersistentCacheStats const&)
+                       {
+                           ++num_puts;
+                       });
+
+        vector<pair<string, string>> entries;
+        int64_t size = 0;
+        for (int i = 0; i < 20; ++i)
+        {
+            entries.emplace_back(to_string(i), "v" + to_string(i));
+            size += entries.back().first.size() + entries.back().second.size();
+        }
+        entries.emplace_back("5", "new");  // The last entry for a key wins.
+        size += 1;
+        EXPECT_TRUE(c->put_many(entries));
+        EXPECT_EQ(21, num_puts);
+        EXPECT_EQ(20, c->size());
+        EXPECT_EQ(size, c->size_in_bytes());
+        EXPECT_EQ("new", *c->get("5"));
+        EXPECT_EQ("v19", *c->get("19"));
+        EXPECT_FALSE(c->get_metadata("0"));
+
+        // Replace some entries and add metadata.
+        vector<pair<string, PersistentStringCache::Data>> data_entries{{"0", {"x", "m"}}, {"new key", {"y", ""}}};
+        EXPECT_TRUE(c->put_many(data_entries));
+        EXPECT_EQ(23, num_puts);
+        EXPECT_EQ(21, c->size());
+        EXPECT_EQ(size - 2 + 2 + 8, c->size_in_bytes());
+        auto data = c->get_data("0");
+        EXPECT_EQ("x", data->value);
+        EXPECT_EQ("m", data->metadata);
+        data = c->get_data("new key");
+        EXPECT_EQ("y", data->value);
+        EXPECT_EQ("", data->metadata);
+
+        EXPECT_TRUE(c->put_many(vector<pair<string, string>>()));
+        EXPECT_EQ(23, num_puts);
+
+        try
+        {
+            c->put_many({{"1", "a"}, {"", "b"}});
+            FAIL();
+        }
+        catch (invalid_argument const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: put_many(): key must be non-empty (cache_path: " + test_db + ")",
+                      string(e.what()));
+        }
+        EXPECT_EQ("v1", *c->get("1"));  // Nothing was written.
+        EXPECT_EQ(23, num_puts);
+    }
+
+    {
+        unlink_db(test_db);
+
+        auto c = PersistentStringCache::open(test_db, 100, CacheDiscardPolicy::lru_only);
+
+        vector<string> evicted;
+        c->set_handler(CacheEvent::evict_lru, [&](string const& key, CacheEvent, PersistentCacheStats const&)
+                       {
+                           evicted.push_back(key);
+                       });
+
+        EXPECT_TRUE(c->put("z", string(9, 'z')));
+        EXPECT_TRUE(c->put("a", string(9, 'a')));
+
+        // Six 20-byte entries don't fit, so the first one is discarded, together with
+        // the existing entry for the same key. Making room for the remaining ones
+        // evicts the other existing entry.
+        vector<pair<string, string>> entries;
+        for (char k = 'a'; k <= 'f'; ++k)
+        {
+            entries.emplace_back(string(1, k), string(19, k));
+        }
+        EXPECT_TRUE(c->put_many(entries));
+        EXPECT_EQ(5, c->size());
+        EXPECT_EQ(100, c->size_in_bytes());
+        EXPECT_FALSE(c->contains_key("a"));
+        EXPECT_FALSE(c->contains_key("z"));
+        EXPECT_EQ(string(19, 'f'), *c->get("f"));
+        EXPECT_EQ(2, c->stats().lru_evictions());
+        EXPECT_EQ((vector<string>{"z", "a"}), evicted);
+
+        try
+        {
+            c->put_many({{"x", string(100, 'x')}});
+            FAIL();
+        }
+        catch (logic_error const& e)
+        {
+            EXPECT_EQ("PersistentStringCache: put_many(): cannot add 101-byte record to cache with maximum size of 100 "
+                      "(cache_path: " + test_db + ")",
+                      string(e.what()));
+        }
+
+        try
+        {
+            c->put_many({{"x", "y"}}, chrono::system_clock::now() + chrono::seconds(10));
+            FAIL();
+        }
+        catch (logic_error const& e)
+        {
+            string msg = e.what();
+            EXPECT_EQ(0u, msg.find("PersistentStringCache: put_many(): policy is lru_only, but expiry_time ("));
+        }
+    }
+}
+
+TEST(PersistentStringCache, get_view)
+{
+    // Views from the database, with and without deferred access time updates, and from the in-memory tier.
+    for (int variant = 0; variant < 3; ++variant)
+    {
+        unlink_db(test_db);
+
+        PersistentCacheOptions options;
+        options.defer_access_time_updates = variant == 1;
+        options.memory_cache_size = variant == 2 ? 50000 : 0;
+        options.num_shards = 2;
+        {
+            auto c = PersistentStringCache::open(test_db, 100000, CacheDiscardPolicy::lru_only, options);
+
+            string const big(5000, 'b');
+            EXPECT_TRUE(c->put("big", big, "meta"));
+            EXPECT_TRUE(c->put("small", "s"));
+
+            auto v = c->get_view("big");
+            ASSERT_TRUE(v);
+            EXPECT_EQ(big, string(v->data(), v->size()));
+            EXPECT_EQ("meta", string(v->metadata_data(), v->metadata_size()));
+
+            auto s = c->get_view("small");
+            ASSERT_TRUE(s);
+            EXPECT_EQ("s", string(s->data(), s->size()));
+            EXPECT_EQ(0, s->metadata_size());
+
+            EXPECT_FALSE(c->get_view("no such key"));
+            EXPECT_EQ(2, c->stats().hits());
+            EXPECT_EQ(1, c->stats().misses());
+
+            // The view doesn't change when the entry is updated or removed.
+            auto v2 = c->get_view("big");  // Served from memory for the in-memory tier.
+            ASSERT_TRUE(v2);
+            EXPECT_TRUE(c->put("big", "new value"));
+            EXPECT_TRUE(c->invalidate("small"));
+            EXPECT_EQ(big, string(v->data(), v->size()));
+            EXPECT_EQ(big, string(v2->data(), v2->size()));
+            EXPECT_EQ("meta", string(v2->metadata_data(), v2->metadata_size()));
+            EXPECT_EQ("s", string(s->data(), s->size()));
+
+            auto v3 = c->get_view("big");
+            ASSERT_TRUE(v3);
+            EXPECT_EQ("new value", string(v3->data(), v3->size()));
+            EXPECT_FALSE(c->get_view("small"));
+
+            // A copy of a view shares the data.
+            auto copy = *v3;
+            v3 = Optional<PersistentStringCache::View>();
+            EXPECT_EQ("new value", string(copy.data(), copy.size()));
+
+            try
+            {
+                c->get_view("");
+                FAIL();
+            }
+            catch (invalid_argument const& e)
+            {
+                string msg = e.what();
+                EXPECT_EQ(0u, msg.find("PersistentStringCache: get_view(): key must be non-empty (cache_path: "));
+            }
+        }
+    }
+
+    PersistentStringCache::View empty;
+    EXPECT_EQ(nullptr, empty.data());
+    EXPECT_EQ(0, empty.size());
+}
+
+TEST(PersistentStringCache, put_with_cost)
+{
+    unlink_db(test_db);
+
+    PersistentCacheOptions options;
+    options.num_shards = 2;
+    auto c = PersistentStringCache::open(test_db, 20000, CacheDiscardPolicy::gdsf, options);
+
+    // Small, expensive entries survive a stream of large, cheap ones.
+    chrono::system_clock::time_point const never;
+    EXPECT_TRUE(c->put("expensive", "value", never, 1000.0));
+    EXPECT_TRUE(c->put("expensive_meta", "value", "meta", never, 1000.0));
+    string const large(2000, 'l');
+    for (int i = 0; i < 50; ++i)
+    {
+        EXPECT_TRUE(c->put("cheap" + to_string(i), large));
+    }
+    EXPECT_EQ("value", *c->get("expensive"));
+    auto data = c->get_data("expensive_meta");
+    ASSERT_TRUE(data);
+    EXPECT_EQ("value", data->value);
+    EXPECT_EQ("meta", data->metadata);
+    EXPECT_LT(0, c->stats().lru_evictions());
+
+    EXPECT_THROW(c->put("x", "value", never, -1.0), invalid_argument);
+}
+
+TEST(PersistentStringCache, durability)
+{
+    typedef PersistentCacheStats::Operation Op;
+
+    unlink_db(test_db);
+
+    PersistentCacheOptions options;
+    options.durability = CacheDurability::sync;
+    options.num_shards = 2;
+    auto c = PersistentStringCache::open(test_db, 100000, CacheDiscardPolicy::lru_only, options);
+
+    // Each modifying operation syncs the shard it modified before it returns.
+    EXPECT_TRUE(c->put("a", "1"));
+    EXPECT_EQ(1, c->stats().num_operations(Op::sync));
+    EXPECT_TRUE(c->put_metadata("a", "meta"));
+    EXPECT_TRUE(c->touch("a"));
+    EXPECT_TRUE(c->take("a"));
+    EXPECT_EQ(4, c->stats().num_operations(Op::sync));
+
+    // Reads don't sync.
+    EXPECT_FALSE(c->get("a"));
+    EXPECT_EQ(4, c->stats().num_operations(Op::sync));
+}
+
+TEST(PersistentStringCache, write_behind)
+{
+    unlink_db(test_db);
+
+    PersistentCacheOptions options;
+    options.write_behind = true;
+    options.write_behind_interval = chrono::hours(1);
+    options.num_shards = 2;
+    auto c = PersistentStringCache::open(test_db, 100000, CacheDiscardPolicy::lru_only, options);
+
+    EXPECT_TRUE(c->put("a", "1"));
+    EXPECT_TRUE(c->put("b", "2"));
+    EXPECT_EQ(0, c->size());
+    EXPECT_EQ("1", *c->get("a"));
+
+    // get_or_put() returns the value that the loader staged.
+    auto loader = [](string const& key, PersistentStringCache& cache) { cache.put(key, "loaded"); };
+    EXPECT_EQ("loaded", *c->get_or_put("c", loader));
+
+    c->flush();
+    EXPECT_EQ(3, c->size());
+    EXPECT_EQ("2", *c->get("b"));
+    EXPECT_EQ("loaded", *c->get("c"));
+}
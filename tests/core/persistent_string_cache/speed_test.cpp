@@ -16,14 +16,19 @@
  * Authored by: Michi Henning <michi.henning@canonical.com>
  */
 
+#include <core/internal/int64_encoding.h>
+#include <core/persistent_cache.h>
 #include <core/persistent_string_cache.h>
 
 #include <boost/filesystem.hpp>
 #include <gtest/gtest.h>
 
 #include <chrono>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <random>
+#include <sstream>
 #include <thread>
 
 using namespace std;
@@ -140,6 +145,11 @@ TEST(PersistentStringCache, basic)
 
     static Optional<string> val;
 
+    // Fill the cache in chunks, so each chunk is evicted for and written in one go.
+    size_t const chunk_size = 100;
+    vector<pair<string, string>> chunk;
+    chunk.reserve(chunk_size);
+
     auto start = chrono::system_clock::now();
     for (int i = 0; i < num_records; ++i)
     {
@@ -149,7 +159,12 @@ TEST(PersistentStringCache, basic)
         s.clear();
         s.str("");
         string const& val = random_string(random_size(value_size, stddev, 0, max_cache_size));
-        c->put(key, val);
+        chunk.emplace_back(move(key), val);
+        if (chunk.size() == chunk_size || i == num_records - 1)
+        {
+            c->put_many(chunk);
+            chunk.clear();
+        }
     }
     auto now = chrono::system_clock::now();
     double secs = chrono::duration_cast<chrono::milliseconds>(now - start).count() / 1000.0;
@@ -210,3 +225,233 @@ TEST(PersistentStringCache, basic)
 
     unlink_db(test_db);  // Reclaim disk space
 }
+
+// Measures throughput with several threads accessing the cache concurrently, once for a cache
+// with a single shard and once for a sharded cache. Each thread uses its own random engine
+// because the helper functions above are not thread-safe.
+
+TEST(PersistentStringCache, threads)
+{
+    double const kB = 1024.0;
+    double const MB = kB * 1024;
+
+    // Adjustable parameters
+
+    int64_t const max_cache_size = 50 * MB;
+    int const value_size = 4 * kB;
+    double const hit_rate = 0.8;
+    int const iterations = 20000;  // Per thread
+    int const keylen = 60;
+    int const num_shards = 16;
+
+    // End adjustable parameters
+
+    int64_t const num_records = max_cache_size / (keylen + value_size);
+    int const max_key = ((1 - hit_rate) + 1) * num_records - 1;
+    int const max_threads = max(4u, thread::hardware_concurrency());
+    string const value(value_size, 'v');
+
+    auto key_of = [keylen](int i)
+    {
+        ostringstream s;
+        s << setfill('0') << setw(keylen) << i;
+        return s.str();
+    };
+
+    cout.setf(ios::fixed, ios::floatfield);
+    cout.precision(0);
+
+    for (int shards : {1, num_shards})
+    {
+        unlink_db(test_db);
+        PersistentCacheOptions options;
+        options.num_shards = shards;
+        auto c = PersistentStringCache::open(test_db, max_cache_size, CacheDiscardPolicy::lru_only, options);
+        for (int i = 0; i < num_records; ++i)
+        {
+            c->put(key_of(i), value);
+        }
+
+        cout << "Shards: " << shards << endl;
+        double single_thread_rate = 0;
+        for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+        {
+            auto worker = [&](int seed)
+            {
+                mt19937 engine(seed);
+                uniform_int_distribution<int> dist(0, max_key);
+                for (int i = 0; i < iterations; ++i)
+                {
+                    string key = key_of(dist(engine));
+                    if (!c->get(key))
+                    {
+                        c->put(key, value);
+                    }
+                }
+            };
+
+            auto start = chrono::steady_clock::now();
+            vector<thread> threads;
+            for (int t = 0; t < num_threads; ++t)
+            {
+                threads.emplace_back(worker, t);
+            }
+            for (auto& t : threads)
+            {
+                t.join();
+            }
+            double secs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() /
+                          1000000.0;
+            double rate = num_threads * iterations / secs;
+            if (num_threads == 1)
+            {
+                single_thread_rate = rate;
+            }
+            cout << "    Threads: " << setw(3) << num_threads << "  ops/sec: " << setw(9) << rate
+                 << "  scaling: " << setprecision(2) << rate / single_thread_rate << setprecision(0) << endl;
+        }
+    }
+
+    unlink_db(test_db);  // Reclaim disk space
+}
+
+// Compares the cost of the encoding used by version 3 of the schema (decimal strings
+// written with string streams) with the binary encoding. Each iteration performs the encoding
+// and decoding work that a cache hit does: decode the data tuple, then encode the new
+// data tuple, the new Atime index key, and the size.
+
+TEST(PersistentStringCache, encoding)
+{
+    using namespace core::internal;
+
+    int const iterations = 1000000;
+    string const key(60, 'k');
+    int64_t const atime = 1500000000000;
+    int64_t const etime = 1600000000000;
+    int64_t const size = 20 * 1024;
+
+    cout.setf(ios::fixed, ios::floatfield);
+    cout.precision(1);
+
+    int64_t sum = 0;  // Prevents the optimizer from discarding the work.
+
+    string v3_data;
+    {
+        ostringstream os;
+        os << atime << " " << etime << " " << size;
+        v3_data = os.str();
+    }
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        int64_t at, et, sz;
+        istringstream is(v3_data);
+        is >> at >> et >> sz;
+
+        ostringstream data;
+        data << at + i << " " << et << " " << sz;
+        ostringstream index;
+        index << "D" << setfill('0') << setw(13) << at + i << " " << key;
+        string size_val = to_string(sz);
+        sum += data.str().size() + index.str().size() + size_val.size();
+    }
+    auto v3_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+    string const data = encode_int64(atime) + encode_int64(etime) + encode_int64(size);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        int64_t at = decode_int64(data.data());
+        int64_t et = decode_int64(data.data() + INT64_ENCODED_SIZE);
+        int64_t sz = decode_int64(data.data() + 2 * INT64_ENCODED_SIZE);
+
+        string new_data;
+        new_data.reserve(3 * INT64_ENCODED_SIZE);
+        append_int64(new_data, at + i);
+        append_int64(new_data, et);
+        append_int64(new_data, sz);
+        string index;
+        index.reserve(1 + INT64_ENCODED_SIZE + key.size());
+        index.append("D");
+        append_int64(index, at + i);
+        index.append(key);
+        string size_val = encode_int64(sz);
+        sum += new_data.size() + index.size() + size_val.size();
+    }
+    auto v4_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+    cout << "Encoding cost per cache hit (" << iterations << " iterations):" << endl;
+    cout << "Decimal (v3):   " << double(v3_ns) / iterations << " ns" << endl;
+    cout << "Binary (v4):    " << double(v4_ns) / iterations << " ns" << endl;
+    cout << "Speedup:        " << double(v3_ns) / v4_ns << "x" << endl;
+    EXPECT_GT(sum, 0);
+}
+
+// Compares the cost of a typed cache that uses the built-in codecs with that of a string cache
+// for which the caller encodes keys and values by hand. The typed cache should be within a few percent.
+
+struct Sample
+{
+    int64_t id;
+    int64_t values[8];
+};
+
+TEST(PersistentStringCache, typed)
+{
+    int const num_records = 20000;
+    int const iterations = 5;
+
+    cout.setf(ios::fixed, ios::floatfield);
+    cout.precision(1);
+
+    Sample sample{0, {1, 2, 3, 4, 5, 6, 7, 8}};
+    int64_t sum = 0;  // Prevents the optimizer from discarding the work.
+
+    unlink_db(test_db);
+    auto sc = PersistentStringCache::open(test_db, 100 * 1024 * 1024, CacheDiscardPolicy::lru_only);
+    auto start = chrono::steady_clock::now();
+    for (int n = 0; n < iterations; ++n)
+    {
+        for (int64_t i = 0; i < num_records; ++i)
+        {
+            sample.id = i;
+            sc->put(internal::encode_int64(i), reinterpret_cast<char const*>(&sample), sizeof(sample));
+        }
+        for (int64_t i = 0; i < num_records; ++i)
+        {
+            auto v = sc->get(internal::encode_int64(i));
+            Sample s;
+            memcpy(&s, v->data(), sizeof(s));
+            sum += s.id;
+        }
+    }
+    auto string_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    sc.reset();
+
+    unlink_db(test_db);
+    auto tc = PersistentCache<int64_t, Sample>::open(test_db, 100 * 1024 * 1024, CacheDiscardPolicy::lru_only);
+    start = chrono::steady_clock::now();
+    for (int n = 0; n < iterations; ++n)
+    {
+        for (int64_t i = 0; i < num_records; ++i)
+        {
+            sample.id = i;
+            tc->put(i, sample);
+        }
+        for (int64_t i = 0; i < num_records; ++i)
+        {
+            sum += tc->get(i)->id;
+        }
+    }
+    auto typed_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    tc.reset();
+
+    int const ops = 2 * num_records * iterations;
+    cout << "Cost per operation (" << ops << " operations):" << endl;
+    cout << "String cache:   " << double(string_ns) / ops << " ns" << endl;
+    cout << "Typed cache:    " << double(typed_ns) / ops << " ns" << endl;
+    cout << "Overhead:       " << (double(typed_ns) / string_ns - 1) * 100 << "%" << endl;
+    EXPECT_GT(sum, 0);
+
+    unlink_db(test_db);
+}